@@ -5,6 +5,7 @@
 #include "audio_codec.h"
 #include "mqtt_protocol.h"
 #include "websocket_protocol.h"
+#include "audio_packet_pool.h"
 #include "assets/lang_config.h"
 #include "mcp_server.h"
 #include "assets.h"
@@ -213,16 +214,19 @@ void Application::ShowActivationCode(const std::string& code, const std::string&
         digit_sound{'9', Lang::Sounds::OGG_9}
     }};
 
-    // This sentence uses 9KB of SRAM, so we need to wait for it to finish
-    Alert(Lang::Strings::ACTIVATION, message.c_str(), "link", Lang::Sounds::OGG_ACTIVATION);
-
+    // The prompt and the digits are queued as one playlist, so the main loop is never blocked by them
+    std::vector<std::string_view> playlist;
+    playlist.push_back(Lang::Sounds::OGG_ACTIVATION);
     for (const auto& digit : code) {
         auto it = std::find_if(digit_sounds.begin(), digit_sounds.end(),
             [digit](const digit_sound& ds) { return ds.digit == digit; });
         if (it != digit_sounds.end()) {
-            audio_service_.PlaySound(it->sound);
+            playlist.push_back(it->sound);
         }
     }
+
+    Alert(Lang::Strings::ACTIVATION, message.c_str(), "link");
+    audio_service_.PlaySounds(playlist, kSoundPolicyReplace);
 }
 
 void Application::Alert(const char* status, const char* message, const char* emotion, const std::string_view& sound) {
@@ -265,6 +269,7 @@ void Application::ToggleChatState() {
     }
 
     if (device_state_ == kDeviceStateIdle) {
+        audio_service_.MarkListeningRequest();
         Schedule([this]() {
             if (!protocol_->IsAudioChannelOpened()) {
                 SetDeviceState(kDeviceStateConnecting);
@@ -302,6 +307,7 @@ void Application::StartListening() {
     }
     
     if (device_state_ == kDeviceStateIdle) {
+        audio_service_.MarkListeningRequest();
         Schedule([this]() {
             if (!protocol_->IsAudioChannelOpened()) {
                 SetDeviceState(kDeviceStateConnecting);
@@ -313,6 +319,7 @@ void Application::StartListening() {
             SetListeningMode(kListeningModeManualStop);
         });
     } else if (device_state_ == kDeviceStateSpeaking) {
+        audio_service_.MarkListeningRequest();
         Schedule([this]() {
             AbortSpeaking(kAbortReasonNone);
             SetListeningMode(kListeningModeManualStop);
@@ -370,6 +377,14 @@ void Application::Start() {
     callbacks.on_vad_change = [this](bool speaking) {
         xEventGroupSetBits(event_group_, MAIN_EVENT_VAD_CHANGE);
     };
+    callbacks.on_end_of_utterance = [this]() {
+        xEventGroupSetBits(event_group_, MAIN_EVENT_END_OF_UTTERANCE);
+    };
+    callbacks.on_local_command = [this](const std::string& tool, const std::string& arguments) {
+        Schedule([this, tool, arguments]() {
+            OnLocalCommand(tool, arguments);
+        });
+    };
     audio_service_.SetCallbacks(callbacks);
 
     // Start the main event loop task with priority 3
@@ -424,109 +439,39 @@ void Application::Start() {
             audio_service_.PushPacketToDecodeQueue(std::move(packet));
         }
     });
-    protocol_->OnAudioChannelOpened([this, codec, &board]() {
+    protocol_->OnAudioChannelOpened([this, &board]() {
         board.SetPowerSaveMode(false);
+        protocol_->ResetLinkActivity();
+        audio_service_.SetInputKeepWarm(true);
+    });
+    protocol_->OnAudioParamsNegotiated([this, codec]() {
+        audio_service_.SetAudioFormats(protocol_->uplink_format(), protocol_->downlink_format());
+        auto& link = protocol_->link_estimator();
+        audio_service_.SetUplinkBitrate(link.opus_bitrate(), link.fec_loss_percent());
         if (protocol_->server_sample_rate() != codec->output_sample_rate()) {
-            ESP_LOGW(TAG, "Server sample rate %d does not match device output sample rate %d, resampling may cause distortion",
+            ESP_LOGI(TAG, "Server sample rate %d differs from device output sample rate %d, decoding at the device rate when supported",
                 protocol_->server_sample_rate(), codec->output_sample_rate());
         }
     });
     protocol_->OnAudioChannelClosed([this, &board]() {
         board.SetPowerSaveMode(true);
+        audio_service_.SetInputKeepWarm(false);
+        // Until the next hello the uplink format is unknown, audio captured ahead of it is held as PCM anyway
+        audio_service_.SetAudioFormats(kAudioFormatOpus, kAudioFormatOpus);
+        // Give the recycled downlink packets back to the heap between conversations
+        AudioPacketPool::GetInstance().Clear();
+        auto session_ms = protocol_->link_session_ms();
+        auto active_ms = protocol_->link_active_ms();
+        ESP_LOGI(TAG, "Conversation lasted %lld ms, link active %lld ms (%d%%)", session_ms, active_ms,
+            session_ms > 0 ? (int)(active_ms * 100 / session_ms) : 0);
         Schedule([this]() {
             auto display = Board::GetInstance().GetDisplay();
             display->SetChatMessage("system", "");
             SetDeviceState(kDeviceStateIdle);
         });
     });
-    protocol_->OnIncomingJson([this, display](const cJSON* root) {
-        // Parse JSON data
-        auto type = cJSON_GetObjectItem(root, "type");
-        if (strcmp(type->valuestring, "tts") == 0) {
-            auto state = cJSON_GetObjectItem(root, "state");
-            if (strcmp(state->valuestring, "start") == 0) {
-                Schedule([this]() {
-                    aborted_ = false;
-                    if (device_state_ == kDeviceStateIdle || device_state_ == kDeviceStateListening) {
-                        SetDeviceState(kDeviceStateSpeaking);
-                    }
-                });
-            } else if (strcmp(state->valuestring, "stop") == 0) {
-                Schedule([this]() {
-                    if (device_state_ == kDeviceStateSpeaking) {
-                        if (listening_mode_ == kListeningModeManualStop) {
-                            SetDeviceState(kDeviceStateIdle);
-                        } else {
-                            SetDeviceState(kDeviceStateListening);
-                        }
-                    }
-                });
-            } else if (strcmp(state->valuestring, "sentence_start") == 0) {
-                auto text = cJSON_GetObjectItem(root, "text");
-                if (cJSON_IsString(text)) {
-                    ESP_LOGI(TAG, "<< %s", text->valuestring);
-                    Schedule([this, display, message = std::string(text->valuestring)]() {
-                        display->SetChatMessage("assistant", message.c_str());
-                    });
-                }
-            }
-        } else if (strcmp(type->valuestring, "stt") == 0) {
-            auto text = cJSON_GetObjectItem(root, "text");
-            if (cJSON_IsString(text)) {
-                ESP_LOGI(TAG, ">> %s", text->valuestring);
-                Schedule([this, display, message = std::string(text->valuestring)]() {
-                    display->SetChatMessage("user", message.c_str());
-                });
-            }
-        } else if (strcmp(type->valuestring, "llm") == 0) {
-            auto emotion = cJSON_GetObjectItem(root, "emotion");
-            if (cJSON_IsString(emotion)) {
-                Schedule([this, display, emotion_str = std::string(emotion->valuestring)]() {
-                    display->SetEmotion(emotion_str.c_str());
-                });
-            }
-        } else if (strcmp(type->valuestring, "mcp") == 0) {
-            auto payload = cJSON_GetObjectItem(root, "payload");
-            if (cJSON_IsObject(payload)) {
-                McpServer::GetInstance().ParseMessage(payload);
-            }
-        } else if (strcmp(type->valuestring, "system") == 0) {
-            auto command = cJSON_GetObjectItem(root, "command");
-            if (cJSON_IsString(command)) {
-                ESP_LOGI(TAG, "System command: %s", command->valuestring);
-                if (strcmp(command->valuestring, "reboot") == 0) {
-                    // Do a reboot if user requests a OTA update
-                    Schedule([this]() {
-                        Reboot();
-                    });
-                } else {
-                    ESP_LOGW(TAG, "Unknown system command: %s", command->valuestring);
-                }
-            }
-        } else if (strcmp(type->valuestring, "alert") == 0) {
-            auto status = cJSON_GetObjectItem(root, "status");
-            auto message = cJSON_GetObjectItem(root, "message");
-            auto emotion = cJSON_GetObjectItem(root, "emotion");
-            if (cJSON_IsString(status) && cJSON_IsString(message) && cJSON_IsString(emotion)) {
-                Alert(status->valuestring, message->valuestring, emotion->valuestring, Lang::Sounds::OGG_VIBRATION);
-            } else {
-                ESP_LOGW(TAG, "Alert command requires status, message and emotion");
-            }
-#if CONFIG_RECEIVE_CUSTOM_MESSAGE
-        } else if (strcmp(type->valuestring, "custom") == 0) {
-            auto payload = cJSON_GetObjectItem(root, "payload");
-            ESP_LOGI(TAG, "Received custom message: %s", cJSON_PrintUnformatted(root));
-            if (cJSON_IsObject(payload)) {
-                Schedule([this, display, payload_str = std::string(cJSON_PrintUnformatted(payload))]() {
-                    display->SetChatMessage("system", payload_str.c_str());
-                });
-            } else {
-                ESP_LOGW(TAG, "Invalid custom message format: missing payload");
-            }
-#endif
-        } else {
-            ESP_LOGW(TAG, "Unknown message type: %s", type->valuestring);
-        }
+    protocol_->OnIncomingJson([this](const JsonMessage& message) {
+        OnIncomingJson(message);
     });
     bool protocol_started = protocol_->Start();
 
@@ -543,6 +488,152 @@ void Application::Start() {
     }
 }
 
+// Runs on the network task, with the message text still in the receive buffer
+void Application::OnIncomingJson(const JsonMessage& message) {
+    typedef void (Application::*Handler)(const JsonMessage& message);
+    static constexpr struct {
+        uint32_t hash;
+        const char* type;
+        Handler handler;
+    } routes[] = {
+        {JsonMessage::Hash("tts"), "tts", &Application::HandleTtsMessage},
+        {JsonMessage::Hash("stt"), "stt", &Application::HandleSttMessage},
+        {JsonMessage::Hash("llm"), "llm", &Application::HandleLlmMessage},
+        {JsonMessage::Hash("mcp"), "mcp", &Application::HandleMcpMessage},
+        {JsonMessage::Hash("system"), "system", &Application::HandleSystemMessage},
+        {JsonMessage::Hash("alert"), "alert", &Application::HandleAlertMessage},
+#if CONFIG_RECEIVE_CUSTOM_MESSAGE
+        {JsonMessage::Hash("custom"), "custom", &Application::HandleCustomMessage},
+#endif
+    };
+
+    auto type = message.Get("type");
+    auto hash = JsonMessage::Hash(type.data, type.size);
+    for (auto& route : routes) {
+        if (route.hash == hash && strlen(route.type) == type.size && memcmp(route.type, type.data, type.size) == 0) {
+            (this->*route.handler)(message);
+            return;
+        }
+    }
+    ESP_LOGW(TAG, "Unknown message type: %.*s", (int)type.size, type.data);
+}
+
+void Application::HandleTtsMessage(const JsonMessage& message) {
+    if (message.Equals("state", "start")) {
+        // A new reply keeps the speaking state, forget the previous stop
+        audio_service_.OnPlaybackDrained(nullptr);
+        Schedule([this]() {
+            aborted_ = false;
+            if (device_state_ == kDeviceStateIdle || device_state_ == kDeviceStateListening) {
+                SetDeviceState(kDeviceStateSpeaking);
+            }
+        });
+    } else if (message.Equals("state", "stop")) {
+        auto leave_speaking = [this]() {
+            Schedule([this]() {
+                if (device_state_ == kDeviceStateSpeaking) {
+                    if (listening_mode_ == kListeningModeManualStop) {
+                        SetDeviceState(kDeviceStateIdle);
+                    } else {
+                        SetDeviceState(kDeviceStateListening);
+                    }
+                }
+            });
+        };
+        if (aborted_) {
+            // The user interrupted, the rest of the reply is dropped anyway
+            leave_speaking();
+        } else {
+            // Leave speaking when the last sample of the reply has been played
+            audio_service_.OnPlaybackDrained(leave_speaking);
+        }
+    } else if (message.Equals("state", "sentence_start")) {
+        std::string text;
+        if (message.GetString("text", text)) {
+            ESP_LOGI(TAG, "<< %s", text.c_str());
+            Schedule([text = std::move(text)]() {
+                Board::GetInstance().GetDisplay()->SetChatMessage("assistant", text.c_str());
+            });
+        }
+    }
+}
+
+void Application::HandleSttMessage(const JsonMessage& message) {
+    std::string text;
+    if (!message.GetString("text", text)) {
+        return;
+    }
+    ESP_LOGI(TAG, ">> %s", text.c_str());
+    int64_t local_stop_us = local_stop_pending_us_.exchange(0);
+    if (local_stop_us > 0) {
+        ESP_LOGI(TAG, "Server endpoint arrived %lld ms after the local listen stop",
+            (long long)((esp_timer_get_time() - local_stop_us) / 1000));
+    }
+    Schedule([text = std::move(text)]() {
+        Board::GetInstance().GetDisplay()->SetChatMessage("user", text.c_str());
+    });
+}
+
+void Application::HandleLlmMessage(const JsonMessage& message) {
+    std::string emotion;
+    if (message.GetString("emotion", emotion)) {
+        Schedule([emotion = std::move(emotion)]() {
+            Board::GetInstance().GetDisplay()->SetEmotion(emotion.c_str());
+        });
+    }
+}
+
+void Application::HandleMcpMessage(const JsonMessage& message) {
+    // JSON-RPC is walked as a tree, only the payload is parsed into one
+    auto payload = message.Get("payload");
+    if (payload.type != kJsonObject) {
+        return;
+    }
+    auto root = cJSON_ParseWithLength(payload.data, payload.size);
+    if (root != nullptr) {
+        McpServer::GetInstance().ParseMessage(root);
+        cJSON_Delete(root);
+    }
+}
+
+void Application::HandleSystemMessage(const JsonMessage& message) {
+    std::string command;
+    if (!message.GetString("command", command)) {
+        return;
+    }
+    ESP_LOGI(TAG, "System command: %s", command.c_str());
+    if (command == "reboot") {
+        // Do a reboot if user requests a OTA update
+        Schedule([this]() {
+            Reboot();
+        });
+    } else {
+        ESP_LOGW(TAG, "Unknown system command: %s", command.c_str());
+    }
+}
+
+void Application::HandleAlertMessage(const JsonMessage& message) {
+    std::string status, text, emotion;
+    if (message.GetString("status", status) && message.GetString("message", text) && message.GetString("emotion", emotion)) {
+        Alert(status.c_str(), text.c_str(), emotion.c_str(), Lang::Sounds::OGG_VIBRATION);
+    } else {
+        ESP_LOGW(TAG, "Alert command requires status, message and emotion");
+    }
+}
+
+void Application::HandleCustomMessage(const JsonMessage& message) {
+    // The payload is shown as it came, no need to parse it
+    auto payload = message.Get("payload");
+    if (payload.type != kJsonObject) {
+        ESP_LOGW(TAG, "Invalid custom message format: missing payload");
+        return;
+    }
+    ESP_LOGI(TAG, "Received custom message: %.*s", (int)payload.size, payload.data);
+    Schedule([payload_str = std::string(payload.data, payload.size)]() {
+        Board::GetInstance().GetDisplay()->SetChatMessage("system", payload_str.c_str());
+    });
+}
+
 // Add a async task to MainLoop
 void Application::Schedule(std::function<void()> callback) {
     {
@@ -562,6 +653,7 @@ void Application::MainEventLoop() {
             MAIN_EVENT_WAKE_WORD_DETECTED |
             MAIN_EVENT_VAD_CHANGE |
             MAIN_EVENT_CLOCK_TICK |
+            MAIN_EVENT_END_OF_UTTERANCE |
             MAIN_EVENT_ERROR, pdTRUE, pdFALSE, portMAX_DELAY);
 
         if (bits & MAIN_EVENT_ERROR) {
@@ -570,11 +662,20 @@ void Application::MainEventLoop() {
         }
 
         if (bits & MAIN_EVENT_SEND_AUDIO) {
+            // More than one packet waiting means the link or this loop fell behind the encoder
+            size_t backlog = 0;
+            bool dropped = false;
             while (auto packet = audio_service_.PopPacketFromSendQueue()) {
+                backlog++;
                 if (protocol_ && !protocol_->SendAudio(std::move(packet))) {
+                    audio_service_.GetFlightRecorder().Record(kFlightEventSendDrop);
+                    dropped = true;
                     break;
                 }
             }
+            if (protocol_ && backlog > 0) {
+                protocol_->link_estimator().RecordSendBacklog(backlog, dropped);
+            }
         }
 
         if (bits & MAIN_EVENT_WAKE_WORD_DETECTED) {
@@ -588,6 +689,10 @@ void Application::MainEventLoop() {
             }
         }
 
+        if (bits & MAIN_EVENT_END_OF_UTTERANCE) {
+            OnEndOfUtterance();
+        }
+
         if (bits & MAIN_EVENT_SCHEDULE) {
             std::unique_lock<std::mutex> lock(mutex_);
             auto tasks = std::move(main_tasks_);
@@ -601,7 +706,21 @@ void Application::MainEventLoop() {
             clock_ticks_++;
             auto display = Board::GetInstance().GetDisplay();
             display->UpdateStatusBar();
+
+            if (protocol_ && protocol_->IsAudioChannelOpened()) {
+                auto& link = protocol_->link_estimator();
+                link.Update();
+                audio_service_.SetUplinkBitrate(link.opus_bitrate(), link.fec_loss_percent());
+            }
         
+#if CONFIG_USE_CLIENT_ENDPOINTING
+            if (reply_wait_started_us_ != 0 && esp_timer_get_time() - reply_wait_started_us_ >
+                    CONFIG_ENDPOINT_REPLY_TIMEOUT_SECONDS * 1000000LL) {
+                ESP_LOGW(TAG, "No reply within %d s of the local listen stop", CONFIG_ENDPOINT_REPLY_TIMEOUT_SECONDS);
+                SetDeviceState(kDeviceStateIdle);
+            }
+#endif
+
             // Print the debug info every 10 seconds
             if (clock_ticks_ % 10 == 0) {
                 // SystemInfo::PrintTaskCpuUsage(pdMS_TO_TICKS(1000));
@@ -618,6 +737,7 @@ void Application::OnWakeWordDetected() {
     }
 
     if (device_state_ == kDeviceStateIdle) {
+        audio_service_.MarkListeningRequest();
         audio_service_.EncodeWakeWord();
 
         if (!protocol_->IsAudioChannelOpened()) {
@@ -650,6 +770,34 @@ void Application::OnWakeWordDetected() {
     }
 }
 
+void Application::OnLocalCommand(const std::string& tool, const std::string& arguments) {
+    // Recognized device controls are handled here and never reach the server
+    if (device_state_ != kDeviceStateIdle) {
+        return;
+    }
+    ESP_LOGI(TAG, "Local command: %s %s", tool.c_str(), arguments.c_str());
+    if (McpServer::GetInstance().CallToolLocally(tool, arguments)) {
+        audio_service_.PlaySound(Lang::Sounds::OGG_POPUP);
+    } else {
+        audio_service_.PlaySound(Lang::Sounds::OGG_EXCLAMATION);
+    }
+}
+
+void Application::OnEndOfUtterance() {
+    // Only auto-stop mode hands endpointing to the device, the other modes stop explicitly
+    if (device_state_ != kDeviceStateListening || listening_mode_ != kListeningModeAutoStop || !protocol_ ||
+        reply_wait_started_us_ != 0) {
+        return;
+    }
+
+    // Stay in listening with the microphone off until the reply starts, idle would resume a paused
+    // stream and wake word detection between the question and the answer
+    protocol_->SendStopListening();
+    audio_service_.EnableVoiceProcessing(false);
+    local_stop_pending_us_ = esp_timer_get_time();
+    reply_wait_started_us_ = esp_timer_get_time();
+}
+
 void Application::AbortSpeaking(AbortReason reason) {
     ESP_LOGI(TAG, "Abort speaking");
     aborted_ = true;
@@ -669,13 +817,18 @@ void Application::SetDeviceState(DeviceState state) {
     }
     
     clock_ticks_ = 0;
+    reply_wait_started_us_ = 0;
     auto previous_state = device_state_;
     device_state_ = state;
     ESP_LOGI(TAG, "STATE: %s", STATE_STRINGS[device_state_]);
+    audio_service_.GetFlightRecorder().Record(kFlightEventDeviceState, previous_state, state);
 
     // Send the state change event
     DeviceStateEventManager::GetInstance().PostStateChangeEvent(previous_state, state);
 
+    // A URL stream only plays while nobody is talking to the device
+    url_player_.SetPaused(state != kDeviceStateIdle);
+
     auto& board = Board::GetInstance();
     auto display = board.GetDisplay();
     auto led = board.GetLed();
@@ -692,6 +845,8 @@ void Application::SetDeviceState(DeviceState state) {
             display->SetStatus(Lang::Strings::CONNECTING);
             display->SetEmotion("neutral");
             display->SetChatMessage("system", "");
+            // Connecting always leads to listening, so start capturing while the channel opens
+            audio_service_.PrepareVoiceProcessing(true);
             break;
         case kDeviceStateListening:
             display->SetStatus(Lang::Strings::LISTENING);
@@ -703,6 +858,11 @@ void Application::SetDeviceState(DeviceState state) {
                 protocol_->SendStartListening(listening_mode_);
                 audio_service_.EnableVoiceProcessing(true);
                 audio_service_.EnableWakeWordDetection(false);
+            } else if (previous_state == kDeviceStateConnecting) {
+                // The capture started while connecting, its audio follows the listen message
+                protocol_->SendStartListening(listening_mode_);
+                audio_service_.EnableWakeWordDetection(false);
+                audio_service_.ReleaseUplink();
             }
             break;
         case kDeviceStateSpeaking:
@@ -808,6 +968,13 @@ void Application::WakeWordInvoke(const std::string& wake_word) {
     }
 }
 
+cJSON* Application::GetLinkStatusJson() {
+    if (protocol_ == nullptr) {
+        return cJSON_CreateObject();
+    }
+    return protocol_->link_estimator().GetStatusJson();
+}
+
 bool Application::CanEnterSleepMode() {
     if (device_state_ != kDeviceStateIdle) {
         return false;
@@ -817,7 +984,7 @@ bool Application::CanEnterSleepMode() {
         return false;
     }
 
-    if (!audio_service_.IsIdle()) {
+    if (!audio_service_.IsIdle() || url_player_.IsActive()) {
         return false;
     }
 
@@ -10,10 +10,12 @@
 #include <mutex>
 #include <deque>
 #include <memory>
+#include <atomic>
 
 #include "protocol.h"
 #include "ota.h"
 #include "audio_service.h"
+#include "ogg_stream_player.h"
 #include "device_state_event.h"
 
 
@@ -24,6 +26,7 @@
 #define MAIN_EVENT_ERROR (1 << 4)
 #define MAIN_EVENT_CHECK_NEW_VERSION_DONE (1 << 5)
 #define MAIN_EVENT_CLOCK_TICK (1 << 6)
+#define MAIN_EVENT_END_OF_UTTERANCE (1 << 7)
 
 
 enum AecMode {
@@ -63,6 +66,9 @@ public:
     AecMode GetAecMode() const { return aec_mode_; }
     void PlaySound(const std::string_view& sound);
     AudioService& GetAudioService() { return audio_service_; }
+    OggStreamPlayer& GetUrlPlayer() { return url_player_; }
+    // Returns a new cJSON object with the link estimate of the audio channel, the caller takes ownership
+    cJSON* GetLinkStatusJson();
 
 private:
     Application();
@@ -78,14 +84,30 @@ private:
     AecMode aec_mode_ = kAecOff;
     std::string last_error_message_;
     AudioService audio_service_;
+    OggStreamPlayer url_player_{audio_service_};
 
     bool has_server_time_ = false;
     bool aborted_ = false;
     int clock_ticks_ = 0;
+    // esp_timer time of a local listen stop still waiting for the stt result, 0 when none is pending.
+    // Set on the main task, taken on the network task that delivers the stt message.
+    std::atomic<int64_t> local_stop_pending_us_ = 0;
+    // esp_timer time of a local listen stop while the device waits in listening for the reply, 0 when not waiting
+    int64_t reply_wait_started_us_ = 0;
     TaskHandle_t check_new_version_task_handle_ = nullptr;
     TaskHandle_t main_event_loop_task_handle_ = nullptr;
 
     void OnWakeWordDetected();
+    void OnEndOfUtterance();
+    void OnLocalCommand(const std::string& tool, const std::string& arguments);
+    void OnIncomingJson(const JsonMessage& message);
+    void HandleTtsMessage(const JsonMessage& message);
+    void HandleSttMessage(const JsonMessage& message);
+    void HandleLlmMessage(const JsonMessage& message);
+    void HandleMcpMessage(const JsonMessage& message);
+    void HandleSystemMessage(const JsonMessage& message);
+    void HandleAlertMessage(const JsonMessage& message);
+    void HandleCustomMessage(const JsonMessage& message);
     void CheckNewVersion(Ota& ota);
     void CheckAssetsVersion();
     void ShowActivationCode(const std::string& code, const std::string& message);
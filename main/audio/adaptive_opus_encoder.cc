@@ -0,0 +1,79 @@
+#include "adaptive_opus_encoder.h"
+
+#include <esp_log.h>
+
+#define TAG "AdaptiveOpusEncoder"
+
+AdaptiveOpusEncoder::AdaptiveOpusEncoder(int sample_rate, int channels, int duration_ms) {
+    frame_size_ = sample_rate / 1000 * channels * duration_ms;
+    int error;
+    encoder_ = opus_encoder_create(sample_rate, channels, OPUS_APPLICATION_VOIP, &error);
+    if (encoder_ == nullptr) {
+        ESP_LOGE(TAG, "Failed to create audio encoder, error code: %d", error);
+        return;
+    }
+    opus_encoder_ctl(encoder_, OPUS_SET_DTX(0));
+    in_buffer_.reserve(frame_size_);
+}
+
+AdaptiveOpusEncoder::~AdaptiveOpusEncoder() {
+    if (encoder_ != nullptr) {
+        opus_encoder_destroy(encoder_);
+    }
+}
+
+void AdaptiveOpusEncoder::SetComplexity(int complexity) {
+    if (encoder_ != nullptr) {
+        opus_encoder_ctl(encoder_, OPUS_SET_COMPLEXITY(complexity));
+    }
+}
+
+void AdaptiveOpusEncoder::SetBitrate(int bitrate) {
+    if (encoder_ == nullptr || bitrate == bitrate_) {
+        return;
+    }
+    bitrate_ = bitrate;
+    opus_encoder_ctl(encoder_, OPUS_SET_BITRATE(bitrate));
+}
+
+void AdaptiveOpusEncoder::SetFec(int loss_percent) {
+    if (encoder_ == nullptr || loss_percent == fec_loss_percent_) {
+        return;
+    }
+    fec_loss_percent_ = loss_percent;
+    opus_encoder_ctl(encoder_, OPUS_SET_INBAND_FEC(loss_percent > 0 ? 1 : 0));
+    opus_encoder_ctl(encoder_, OPUS_SET_PACKET_LOSS_PERC(loss_percent));
+}
+
+bool AdaptiveOpusEncoder::Encode(std::vector<int16_t>&& pcm, std::vector<uint8_t>& opus) {
+    if (encoder_ == nullptr) {
+        return false;
+    }
+    if (in_buffer_.empty() && (int)pcm.size() == frame_size_) {
+        // The usual case, one frame in and no copy
+        in_buffer_ = std::move(pcm);
+    } else {
+        in_buffer_.insert(in_buffer_.end(), pcm.begin(), pcm.end());
+    }
+    if ((int)in_buffer_.size() < frame_size_) {
+        return false;
+    }
+
+    opus.resize(ADAPTIVE_OPUS_MAX_PACKET_SIZE);
+    int ret = opus_encode(encoder_, in_buffer_.data(), frame_size_, opus.data(), opus.size());
+    in_buffer_.erase(in_buffer_.begin(), in_buffer_.begin() + frame_size_);
+    if (ret < 0) {
+        ESP_LOGE(TAG, "Failed to encode audio, error code: %d", ret);
+        opus.clear();
+        return false;
+    }
+    opus.resize(ret);
+    return true;
+}
+
+void AdaptiveOpusEncoder::ResetState() {
+    if (encoder_ != nullptr) {
+        opus_encoder_ctl(encoder_, OPUS_RESET_STATE);
+    }
+    in_buffer_.clear();
+}
@@ -0,0 +1,38 @@
+#ifndef ADAPTIVE_OPUS_ENCODER_H
+#define ADAPTIVE_OPUS_ENCODER_H
+
+#include <cstdint>
+#include <vector>
+#include <opus.h>
+
+/*
+ * The uplink Opus encoder. It works like OpusEncoderWrapper (PCM is collected until a whole frame is
+ * there) and also lets the link estimator change the bitrate and in-band FEC between frames, which
+ * the wrapper does not expose. Both take effect on the next frame without resetting the encoder.
+ */
+#define ADAPTIVE_OPUS_MAX_PACKET_SIZE 1500
+
+class AdaptiveOpusEncoder {
+public:
+    AdaptiveOpusEncoder(int sample_rate, int channels, int duration_ms);
+    ~AdaptiveOpusEncoder();
+
+    void SetComplexity(int complexity);
+    void SetBitrate(int bitrate);
+    // 0 turns in-band FEC off, otherwise the packet loss in percent the encoder protects against
+    void SetFec(int loss_percent);
+    bool Encode(std::vector<int16_t>&& pcm, std::vector<uint8_t>& opus);
+    void ResetState();
+
+    int bitrate() const { return bitrate_; }
+    int fec_loss_percent() const { return fec_loss_percent_; }
+
+private:
+    OpusEncoder* encoder_ = nullptr;
+    int frame_size_;
+    int bitrate_ = OPUS_AUTO;
+    int fec_loss_percent_ = 0;
+    std::vector<int16_t> in_buffer_;
+};
+
+#endif
@@ -0,0 +1,207 @@
+#include "afe_service.h"
+#include "processors/afe_audio_processor.h"
+
+#include <esp_log.h>
+#include <esp_timer.h>
+#include <esp_heap_caps.h>
+#include <esp_nsn_models.h>
+#include <string>
+
+#define AFE_SERVICE_RUNNING 0x01
+
+#define TAG "AfeService"
+
+AfeService::AfeService() {
+    event_group_ = xEventGroupCreate();
+}
+
+AfeService::~AfeService() {
+    if (afe_data_ != nullptr) {
+        afe_iface_->destroy(afe_data_);
+    }
+    vEventGroupDelete(event_group_);
+}
+
+bool AfeService::Initialize(AudioCodec* codec, srmodel_list_t* models_list) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (initialized_) {
+        return afe_data_ != nullptr;
+    }
+    initialized_ = true;
+
+    int ref_num = codec->input_reference() ? 1 : 0;
+    std::string input_format;
+    for (int i = 0; i < codec->input_channels() - ref_num; i++) {
+        input_format.push_back('M');
+    }
+    for (int i = 0; i < ref_num; i++) {
+        input_format.push_back('R');
+    }
+
+    srmodel_list_t* models = models_list != nullptr ? models_list : esp_srmodel_init("model");
+    char* ns_model_name = esp_srmodel_filter(models, ESP_NSNET_PREFIX, NULL);
+    char* vad_model_name = esp_srmodel_filter(models, ESP_VADN_PREFIX, NULL);
+
+    // SR type is the only one with WakeNet, the communication stages are added on top of it.
+    // The uplink so differs from the separate VC pipeline of AfeAudioProcessor, see USE_SHARED_AFE
+    afe_config_t* afe_config = afe_config_init(input_format.c_str(), models, AFE_TYPE_SR, AFE_MODE_HIGH_PERF);
+    afe_config->aec_init = codec->input_reference();
+#ifdef CONFIG_USE_DEVICE_AEC
+    afe_config->aec_mode = AEC_MODE_VOIP_HIGH_PERF;
+    afe_config->vad_init = false;
+#else
+    afe_config->aec_mode = AEC_MODE_SR_HIGH_PERF;
+    afe_config->vad_init = true;
+#endif
+    afe_config->vad_mode = VAD_MODE_0;
+    afe_config->vad_min_noise_ms = AFE_VAD_MIN_NOISE_MS;
+    if (vad_model_name != nullptr) {
+        afe_config->vad_model_name = vad_model_name;
+    }
+    if (ns_model_name != nullptr) {
+        afe_config->ns_init = true;
+        afe_config->ns_model_name = ns_model_name;
+        afe_config->afe_ns_mode = AFE_NS_MODE_NET;
+        ns_available_ = true;
+    } else {
+        afe_config->ns_init = false;
+    }
+#if CONFIG_USE_AUDIO_COMPUTE_GOVERNOR
+    afe_config->agc_init = true;
+    agc_available_ = true;
+#else
+    afe_config->agc_init = false;
+#endif
+    afe_config->afe_perferred_core = 1;
+    afe_config->afe_perferred_priority = 1;
+    afe_config->memory_alloc_mode = AFE_MEMORY_ALLOC_MORE_PSRAM;
+
+    size_t psram_before = heap_caps_get_free_size(MALLOC_CAP_SPIRAM);
+    size_t internal_before = heap_caps_get_free_size(MALLOC_CAP_INTERNAL);
+    afe_iface_ = esp_afe_handle_from_config(afe_config);
+    afe_data_ = afe_iface_->create_from_config(afe_config);
+    if (afe_data_ == nullptr) {
+        ESP_LOGE(TAG, "Failed to create the AFE instance");
+        return false;
+    }
+    size_t psram_after = heap_caps_get_free_size(MALLOC_CAP_SPIRAM);
+    size_t internal_after = heap_caps_get_free_size(MALLOC_CAP_INTERNAL);
+    psram_bytes_ = psram_before > psram_after ? psram_before - psram_after : 0;
+    internal_bytes_ = internal_before > internal_after ? internal_before - internal_after : 0;
+    // The size of this instance only, the saving shows in the free PSRAM AudioService logs once both users are set up
+    ESP_LOGI(TAG, "Shared AFE takes %u bytes of PSRAM and %u bytes of internal RAM",
+        psram_bytes_, internal_bytes_);
+
+    // Every stage starts disabled until a mode asks for it
+    afe_iface_->disable_wakenet(afe_data_);
+    if (ns_available_) {
+        afe_iface_->disable_ns(afe_data_);
+    }
+    if (agc_available_) {
+        afe_iface_->disable_agc(afe_data_);
+    }
+
+    xTaskCreate([](void* arg) {
+        auto this_ = (AfeService*)arg;
+        this_->AfeFetchTask();
+        vTaskDelete(NULL);
+    }, "afe_fetch", 4096, this, 3, NULL);
+    return true;
+}
+
+void AfeService::SetHandler(AfeMode mode, AfeResultHandler handler) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (mode == kAfeModeWakeWord) {
+        wake_word_handler_ = handler;
+    } else {
+        communication_handler_ = handler;
+    }
+}
+
+void AfeService::EnableMode(AfeMode mode, bool enable) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (afe_data_ == nullptr || IsModeEnabled(mode) == enable) {
+        return;
+    }
+
+    auto start_time = esp_timer_get_time();
+    int modes = enable ? (modes_ | mode) : (modes_ & ~mode);
+    if (mode == kAfeModeWakeWord) {
+        if (enable) {
+            afe_iface_->enable_wakenet(afe_data_);
+        } else {
+            afe_iface_->disable_wakenet(afe_data_);
+        }
+    } else if (!enable) {
+        // The audio processor switches NS and AGC on for its compute tier when it starts
+        if (ns_available_) {
+            afe_iface_->disable_ns(afe_data_);
+        }
+        if (agc_available_) {
+            afe_iface_->disable_agc(afe_data_);
+        }
+    }
+    if (modes == 0) {
+        xEventGroupClearBits(event_group_, AFE_SERVICE_RUNNING);
+        afe_iface_->reset_buffer(afe_data_);
+    }
+    modes_ = modes;
+    if (modes != 0) {
+        xEventGroupSetBits(event_group_, AFE_SERVICE_RUNNING);
+    }
+
+    last_switch_us_ = esp_timer_get_time() - start_time;
+    if (last_switch_us_ > max_switch_us_) {
+        max_switch_us_ = last_switch_us_;
+    }
+    mode_switches_++;
+    ESP_LOGI(TAG, "%s %s mode in %lld us", enable ? "Enter" : "Leave",
+        mode == kAfeModeWakeWord ? "wake word" : "communication", last_switch_us_);
+}
+
+void AfeService::Feed(AfeMode mode, const int16_t* data) {
+    // Both clients receive the same frames, only one of them may feed
+    int modes = modes_;
+    if (afe_data_ == nullptr || (modes & mode) == 0) {
+        return;
+    }
+    if (mode == kAfeModeWakeWord && (modes & kAfeModeCommunication)) {
+        return;
+    }
+    afe_iface_->feed(afe_data_, data);
+}
+
+void AfeService::AfeFetchTask() {
+    ESP_LOGI(TAG, "AFE fetch task started, feed size: %d fetch size: %d",
+        afe_iface_->get_feed_chunksize(afe_data_), afe_iface_->get_fetch_chunksize(afe_data_));
+
+    while (true) {
+        xEventGroupWaitBits(event_group_, AFE_SERVICE_RUNNING, pdFALSE, pdTRUE, portMAX_DELAY);
+
+        auto res = afe_iface_->fetch_with_delay(afe_data_, portMAX_DELAY);
+        if (res == nullptr || res->ret_value == ESP_FAIL) {
+            continue;
+        }
+
+        int modes = modes_;
+        if ((modes & kAfeModeWakeWord) && wake_word_handler_) {
+            wake_word_handler_(res);
+        }
+        if ((modes & kAfeModeCommunication) && communication_handler_) {
+            communication_handler_(res);
+        }
+    }
+}
+
+cJSON* AfeService::GetStatusJson() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto root = cJSON_CreateObject();
+    cJSON_AddBoolToObject(root, "wake_word", IsModeEnabled(kAfeModeWakeWord));
+    cJSON_AddBoolToObject(root, "communication", IsModeEnabled(kAfeModeCommunication));
+    cJSON_AddNumberToObject(root, "psram_bytes", psram_bytes_);
+    cJSON_AddNumberToObject(root, "internal_bytes", internal_bytes_);
+    cJSON_AddNumberToObject(root, "mode_switches", mode_switches_);
+    cJSON_AddNumberToObject(root, "last_switch_us", last_switch_us_);
+    cJSON_AddNumberToObject(root, "max_switch_us", max_switch_us_);
+    return root;
+}
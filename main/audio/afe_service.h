@@ -0,0 +1,79 @@
+#ifndef AFE_SERVICE_H
+#define AFE_SERVICE_H
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <freertos/event_groups.h>
+
+#include <esp_afe_sr_models.h>
+#include <model_path.h>
+#include <cJSON.h>
+
+#include <functional>
+#include <mutex>
+#include <vector>
+
+#include "audio_codec.h"
+
+/*
+ * One AFE instance shared by the AFE wake word and the AFE audio processor.
+ * Wake word mode runs WakeNet, communication mode runs NS / AGC / VAD, both share the AEC and the buffers,
+ * and switching only enables or disables stages instead of holding a second pipeline in PSRAM.
+ * While both modes are active the communication client feeds the instance, the other feed is ignored.
+ */
+enum AfeMode {
+    kAfeModeWakeWord = 0x01,
+    kAfeModeCommunication = 0x02,
+};
+
+typedef std::function<void(afe_fetch_result_t* result)> AfeResultHandler;
+
+class AfeService {
+public:
+    static AfeService& GetInstance() {
+        static AfeService instance;
+        return instance;
+    }
+    // Delete copy constructor and assignment operator
+    AfeService(const AfeService&) = delete;
+    AfeService& operator=(const AfeService&) = delete;
+
+    // Creates the instance on the first call, later calls only return the result of the first one
+    bool Initialize(AudioCodec* codec, srmodel_list_t* models_list);
+    void SetHandler(AfeMode mode, AfeResultHandler handler);
+    void EnableMode(AfeMode mode, bool enable);
+    bool IsModeEnabled(AfeMode mode) const { return (modes_ & mode) != 0; }
+    void Feed(AfeMode mode, const int16_t* data);
+
+    esp_afe_sr_iface_t* iface() const { return afe_iface_; }
+    esp_afe_sr_data_t* data() const { return afe_data_; }
+    bool ns_available() const { return ns_available_; }
+    bool agc_available() const { return agc_available_; }
+    // Returns a new cJSON object with the memory and mode switch figures
+    cJSON* GetStatusJson();
+
+private:
+    AfeService();
+    ~AfeService();
+
+    std::mutex mutex_;
+    EventGroupHandle_t event_group_ = nullptr;
+    esp_afe_sr_iface_t* afe_iface_ = nullptr;
+    esp_afe_sr_data_t* afe_data_ = nullptr;
+    AfeResultHandler wake_word_handler_;
+    AfeResultHandler communication_handler_;
+    bool initialized_ = false;
+    bool ns_available_ = false;
+    bool agc_available_ = false;
+    volatile int modes_ = 0;
+
+    size_t psram_bytes_ = 0;
+    size_t internal_bytes_ = 0;
+    uint32_t mode_switches_ = 0;
+    int64_t last_switch_us_ = 0;
+    int64_t max_switch_us_ = 0;
+
+    void AfeFetchTask();
+};
+
+#endif
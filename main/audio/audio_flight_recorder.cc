@@ -0,0 +1,227 @@
+#include "audio_flight_recorder.h"
+
+#include <esp_log.h>
+#include <esp_timer.h>
+#include <esp_heap_caps.h>
+#include <mbedtls/base64.h>
+#include <algorithm>
+#include <cstring>
+#include <string>
+
+#define TAG "FlightRecorder"
+
+static const char* const FLIGHT_EVENT_NAMES[] = {
+    "encode_queue",
+    "send_queue",
+    "decode_queue",
+    "playback",
+    "decode_drop",
+    "send_drop",
+    "underrun",
+    "vad",
+    "wake_word",
+    "device_state",
+    "trigger",
+};
+
+static const char* const FLIGHT_TRIGGER_NAMES[] = {
+    "none",
+    "decode_overflow",
+    "underrun",
+    "manual",
+};
+
+AudioFlightRecorder::AudioFlightRecorder() {
+}
+
+AudioFlightRecorder::~AudioFlightRecorder() {
+    if (events_ != nullptr) {
+        heap_caps_free(events_);
+    }
+    if (audio_slots_ != nullptr) {
+        heap_caps_free(audio_slots_);
+    }
+}
+
+bool AudioFlightRecorder::Initialize(size_t max_events, size_t audio_bytes) {
+    events_ = (FlightEvent*)heap_caps_calloc(max_events, sizeof(FlightEvent), MALLOC_CAP_SPIRAM);
+    if (events_ == nullptr) {
+        ESP_LOGE(TAG, "Failed to allocate %u events", max_events);
+        return false;
+    }
+    max_events_ = max_events;
+
+    size_t slots = audio_bytes / sizeof(FlightAudioSlot);
+    if (slots > 0) {
+        audio_slots_ = (FlightAudioSlot*)heap_caps_calloc(slots, sizeof(FlightAudioSlot), MALLOC_CAP_SPIRAM);
+        if (audio_slots_ == nullptr) {
+            ESP_LOGW(TAG, "Failed to allocate %u audio slots, recording events only", slots);
+        } else {
+            max_audio_slots_ = slots;
+        }
+    }
+    ESP_LOGI(TAG, "Armed with %u events and %u audio packets", max_events_, max_audio_slots_);
+    return true;
+}
+
+void AudioFlightRecorder::Append(FlightEventType type, uint32_t a, uint32_t b) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (frozen_) {
+        return;
+    }
+
+    auto& event = events_[event_head_];
+    event.time_us = esp_timer_get_time();
+    event.type = type;
+    event.a = (uint16_t)std::min<uint32_t>(a, UINT16_MAX);
+    event.b = b;
+    event_head_ = (event_head_ + 1) % max_events_;
+    if (event_count_ < max_events_) {
+        event_count_++;
+    } else {
+        overwritten_events_++;
+    }
+
+    // Keep recording a little after the trigger to capture how the pipeline recovered
+    if (trigger_ != kFlightTriggerNone && --post_trigger_events_ <= 0) {
+        frozen_ = true;
+        ESP_LOGW(TAG, "Frozen after %s", FLIGHT_TRIGGER_NAMES[trigger_]);
+    }
+}
+
+void AudioFlightRecorder::AppendAudio(FlightAudioDirection direction, const uint8_t* data, size_t size) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (frozen_) {
+        return;
+    }
+
+    auto& slot = audio_slots_[audio_head_];
+    slot.time_us = esp_timer_get_time();
+    slot.direction = direction;
+    slot.size = (uint16_t)std::min<size_t>(size, FLIGHT_RECORDER_AUDIO_SLOT_BYTES);
+    slot.truncated = size > FLIGHT_RECORDER_AUDIO_SLOT_BYTES;
+    memcpy(slot.data, data, slot.size);
+    audio_head_ = (audio_head_ + 1) % max_audio_slots_;
+    if (audio_count_ < max_audio_slots_) {
+        audio_count_++;
+    }
+}
+
+void AudioFlightRecorder::Trigger(FlightTrigger reason) {
+    if (events_ == nullptr) {
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (frozen_ || trigger_ != kFlightTriggerNone) {
+            return;
+        }
+        trigger_ = reason;
+        trigger_time_us_ = esp_timer_get_time();
+        // A manual trigger freezes right away, the others wait to capture the recovery
+        post_trigger_events_ = reason == kFlightTriggerManual ? 1 : FLIGHT_RECORDER_POST_TRIGGER_EVENTS;
+    }
+    ESP_LOGW(TAG, "Triggered by %s", FLIGHT_TRIGGER_NAMES[reason]);
+    Append(kFlightEventTrigger, reason, 0);
+}
+
+void AudioFlightRecorder::Rearm() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    event_count_ = 0;
+    event_head_ = 0;
+    overwritten_events_ = 0;
+    audio_count_ = 0;
+    audio_head_ = 0;
+    trigger_ = kFlightTriggerNone;
+    trigger_time_us_ = 0;
+    frozen_ = false;
+}
+
+cJSON* AudioFlightRecorder::GetSnapshotJson(size_t max_events, bool include_audio) {
+    /* Copy the newest entries under the lock, the recording tasks must not wait for the JSON */
+    std::vector<FlightEvent> events;
+    std::vector<FlightAudioSlot> audio_slots;
+    bool enabled, frozen, has_audio;
+    FlightTrigger trigger;
+    int64_t trigger_time_us;
+    uint32_t overwritten_events;
+    size_t recorded_events;
+    int64_t now;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        now = esp_timer_get_time();
+        enabled = events_ != nullptr;
+        has_audio = audio_slots_ != nullptr;
+        frozen = frozen_;
+        trigger = trigger_;
+        trigger_time_us = trigger_time_us_;
+        overwritten_events = overwritten_events_;
+        recorded_events = event_count_;
+
+        size_t count = std::min({max_events, event_count_, (size_t)FLIGHT_RECORDER_SNAPSHOT_MAX_EVENTS});
+        events.reserve(count);
+        for (size_t i = event_count_ - count; i < event_count_; i++) {
+            events.push_back(events_[(event_head_ + max_events_ - event_count_ + i) % max_events_]);
+        }
+
+        if (include_audio && audio_slots_ != nullptr) {
+            size_t audio_bytes = 0;
+            size_t first = audio_count_;
+            while (first > 0) {
+                auto& slot = audio_slots_[(audio_head_ + max_audio_slots_ - audio_count_ + first - 1) % max_audio_slots_];
+                if (audio_bytes + slot.size > FLIGHT_RECORDER_SNAPSHOT_AUDIO_BYTES) {
+                    break;
+                }
+                audio_bytes += slot.size;
+                first--;
+            }
+            audio_slots.reserve(audio_count_ - first);
+            for (size_t i = first; i < audio_count_; i++) {
+                audio_slots.push_back(audio_slots_[(audio_head_ + max_audio_slots_ - audio_count_ + i) % max_audio_slots_]);
+            }
+        }
+    }
+
+    auto json = cJSON_CreateObject();
+    cJSON_AddBoolToObject(json, "enabled", enabled);
+    cJSON_AddBoolToObject(json, "frozen", frozen);
+    cJSON_AddStringToObject(json, "trigger", FLIGHT_TRIGGER_NAMES[trigger]);
+    // All times are in milliseconds relative to the snapshot, negative values are in the past
+    if (trigger != kFlightTriggerNone) {
+        cJSON_AddNumberToObject(json, "trigger_time_ms", (double)(trigger_time_us - now) / 1000);
+    }
+    cJSON_AddNumberToObject(json, "overwritten_events", overwritten_events);
+    cJSON_AddNumberToObject(json, "recorded_events", recorded_events);
+
+    auto events_json = cJSON_CreateArray();
+    for (auto& event : events) {
+        auto item = cJSON_CreateArray();
+        cJSON_AddItemToArray(item, cJSON_CreateNumber((double)(event.time_us - now) / 1000));
+        cJSON_AddItemToArray(item, cJSON_CreateString(FLIGHT_EVENT_NAMES[event.type]));
+        cJSON_AddItemToArray(item, cJSON_CreateNumber(event.a));
+        cJSON_AddItemToArray(item, cJSON_CreateNumber(event.b));
+        cJSON_AddItemToArray(events_json, item);
+    }
+    cJSON_AddItemToObject(json, "events", events_json);
+
+    if (include_audio && has_audio) {
+        auto audio = cJSON_CreateArray();
+        std::string base64;
+        for (auto& slot : audio_slots) {
+            size_t dlen = 0, olen = 0;
+            mbedtls_base64_encode(nullptr, 0, &dlen, slot.data, slot.size);
+            base64.resize(dlen);
+            mbedtls_base64_encode((unsigned char*)base64.data(), base64.size(), &olen, slot.data, slot.size);
+            base64.resize(olen);
+
+            auto item = cJSON_CreateObject();
+            cJSON_AddNumberToObject(item, "time_ms", (double)(slot.time_us - now) / 1000);
+            cJSON_AddStringToObject(item, "direction", slot.direction == kFlightAudioUplink ? "up" : "down");
+            cJSON_AddBoolToObject(item, "truncated", slot.truncated);
+            cJSON_AddStringToObject(item, "opus", base64.c_str());
+            cJSON_AddItemToArray(audio, item);
+        }
+        cJSON_AddItemToObject(json, "audio", audio);
+    }
+    return json;
+}
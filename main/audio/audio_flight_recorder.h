@@ -0,0 +1,113 @@
+#ifndef AUDIO_FLIGHT_RECORDER_H
+#define AUDIO_FLIGHT_RECORDER_H
+
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+#include <cJSON.h>
+
+/*
+ * The flight recorder keeps the most recent audio pipeline events in a PSRAM ring buffer.
+ * When a trigger fires (decode queue overflow, speaker underrun, ...) it keeps recording
+ * for a short while and then freezes, so the snapshot shows what led to the glitch.
+ */
+#define FLIGHT_RECORDER_POST_TRIGGER_EVENTS 64
+#define FLIGHT_RECORDER_AUDIO_SLOT_BYTES 240
+// A snapshot is sent back as one MCP reply, these keep it around 16 KB of JSON
+#define FLIGHT_RECORDER_SNAPSHOT_MAX_EVENTS 256
+#define FLIGHT_RECORDER_SNAPSHOT_AUDIO_BYTES 4096
+
+enum FlightEventType : uint16_t {
+    kFlightEventEncodeQueue,    // a: encode queue depth
+    kFlightEventSendQueue,      // a: send queue depth, b: packet timestamp
+    kFlightEventDecodeQueue,    // a: decode queue depth, b: packet timestamp
+    kFlightEventPlayback,       // a: playback queue depth, b: decode queue depth
+    kFlightEventDecodeDrop,     // a: decode queue depth
+    kFlightEventSendDrop,       // the protocol failed to send a packet
+    kFlightEventUnderrun,       // a: gap in ms, b: decode queue depth
+    kFlightEventVad,            // a: 1 when speech starts, 0 when it stops
+    kFlightEventWakeWord,
+    kFlightEventDeviceState,    // a: previous state, b: new state
+    kFlightEventTrigger,        // a: trigger reason
+};
+
+enum FlightTrigger : uint16_t {
+    kFlightTriggerNone,
+    kFlightTriggerDecodeOverflow,
+    kFlightTriggerUnderrun,
+    kFlightTriggerManual,
+};
+
+enum FlightAudioDirection : uint8_t {
+    kFlightAudioUplink,
+    kFlightAudioDownlink,
+};
+
+struct FlightEvent {
+    int64_t time_us;
+    FlightEventType type;
+    uint16_t a;
+    uint32_t b;
+};
+
+struct FlightAudioSlot {
+    int64_t time_us;
+    FlightAudioDirection direction;
+    uint8_t truncated;
+    uint16_t size;
+    uint8_t data[FLIGHT_RECORDER_AUDIO_SLOT_BYTES];
+};
+
+class AudioFlightRecorder {
+public:
+    AudioFlightRecorder();
+    ~AudioFlightRecorder();
+
+    // Allocates the ring buffers in PSRAM, the recorder stays disabled if this is never called
+    bool Initialize(size_t max_events, size_t audio_bytes);
+
+    inline void Record(FlightEventType type, uint32_t a = 0, uint32_t b = 0) {
+        if (events_ != nullptr && !frozen_) {
+            Append(type, a, b);
+        }
+    }
+    inline void RecordAudio(FlightAudioDirection direction, const uint8_t* data, size_t size) {
+        if (audio_slots_ != nullptr && !frozen_) {
+            AppendAudio(direction, data, size);
+        }
+    }
+
+    void Trigger(FlightTrigger reason);
+    void Rearm();
+    bool enabled() const { return events_ != nullptr; }
+    bool frozen() const { return frozen_; }
+
+    // Returns a new cJSON object with the last max_events events (at most FLIGHT_RECORDER_SNAPSHOT_MAX_EVENTS)
+    // and the newest audio packets that fit FLIGHT_RECORDER_SNAPSHOT_AUDIO_BYTES, the caller takes ownership
+    cJSON* GetSnapshotJson(size_t max_events, bool include_audio);
+
+private:
+    std::mutex mutex_;
+    FlightEvent* events_ = nullptr;
+    size_t max_events_ = 0;
+    size_t event_count_ = 0;
+    size_t event_head_ = 0;
+    uint32_t overwritten_events_ = 0;
+
+    FlightAudioSlot* audio_slots_ = nullptr;
+    size_t max_audio_slots_ = 0;
+    size_t audio_count_ = 0;
+    size_t audio_head_ = 0;
+
+    volatile bool frozen_ = false;
+    FlightTrigger trigger_ = kFlightTriggerNone;
+    int64_t trigger_time_us_ = 0;
+    int post_trigger_events_ = 0;
+
+    void Append(FlightEventType type, uint32_t a, uint32_t b);
+    void AppendAudio(FlightAudioDirection direction, const uint8_t* data, size_t size);
+};
+
+#endif
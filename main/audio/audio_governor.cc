@@ -0,0 +1,116 @@
+#include "audio_governor.h"
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <esp_heap_caps.h>
+#include <esp_log.h>
+#include <cstring>
+#include <cstdlib>
+
+#define TAG "AudioGovernor"
+
+AudioGovernor::AudioGovernor() {
+}
+
+int AudioGovernor::MeasureCpuBusyPercent() {
+    UBaseType_t task_count = uxTaskGetNumberOfTasks() + 5;
+    TaskStatus_t* tasks = (TaskStatus_t*)malloc(sizeof(TaskStatus_t) * task_count);
+    if (tasks == nullptr) {
+        return cpu_busy_percent_;
+    }
+
+    configRUN_TIME_COUNTER_TYPE total_time = 0;
+    task_count = uxTaskGetSystemState(tasks, task_count, &total_time);
+    uint64_t idle_time = 0;
+    for (UBaseType_t i = 0; i < task_count; i++) {
+        if (strncmp(tasks[i].pcTaskName, "IDLE", 4) == 0) {
+            idle_time += tasks[i].ulRunTimeCounter;
+        }
+    }
+    free(tasks);
+
+    // The run time counters wrap around, so only trust a positive window
+    uint64_t total = (uint64_t)total_time * CONFIG_FREERTOS_NUMBER_OF_CORES;
+    int busy = cpu_busy_percent_;
+    if (last_total_time_ != 0 && total > last_total_time_ && idle_time >= last_idle_time_) {
+        uint64_t idle_delta = idle_time - last_idle_time_;
+        uint64_t total_delta = total - last_total_time_;
+        busy = 100 - (int)(idle_delta * 100 / total_delta);
+        if (busy < 0) {
+            busy = 0;
+        }
+    }
+    last_idle_time_ = idle_time;
+    last_total_time_ = total;
+    return busy;
+}
+
+AudioComputeTier AudioGovernor::Update(const AudioPipelineLoad& load) {
+    int cpu_busy = MeasureCpuBusyPercent();
+    size_t free_heap = heap_caps_get_free_size(MALLOC_CAP_INTERNAL);
+    cpu_busy_percent_ = cpu_busy;
+    free_internal_heap_ = free_heap;
+
+    // The encoder is behind when its input queue is full or the uplink keeps growing
+    bool encoder_behind = load.encode_queue_max > 0 && load.encode_queue >= load.encode_queue_max;
+    bool uplink_backlog = load.send_queue_max > 0 && load.send_queue > load.send_queue_max / 2;
+    // The decoder is behind when packets keep waiting but the speaker has nothing to play
+    if (load.decode_queue > 0 && load.playback_queue == 0) {
+        decoder_behind_samples_++;
+    } else {
+        decoder_behind_samples_ = 0;
+    }
+    bool decoder_behind = decoder_behind_samples_ >= AUDIO_GOVERNOR_DECODER_BEHIND_SAMPLES;
+
+    bool pressure = cpu_busy >= AUDIO_GOVERNOR_CPU_HIGH_PERCENT ||
+        free_heap < AUDIO_GOVERNOR_HEAP_LOW_BYTES ||
+        encoder_behind || uplink_backlog || decoder_behind;
+    bool headroom = cpu_busy < AUDIO_GOVERNOR_CPU_LOW_PERCENT &&
+        free_heap > AUDIO_GOVERNOR_HEAP_HIGH_BYTES &&
+        load.encode_queue == 0 && load.send_queue <= 2;
+
+    AudioComputeTier tier = tier_;
+    if (pressure) {
+        headroom_samples_ = 0;
+        if (++pressure_samples_ >= AUDIO_GOVERNOR_STEP_DOWN_SAMPLES && tier > kAudioComputeTierLow) {
+            tier_ = (AudioComputeTier)(tier - 1);
+            pressure_samples_ = 0;
+            ESP_LOGW(TAG, "Step down to %s (cpu %d%%, heap %u, encode %u, send %u, decode %u)", tier_name(),
+                cpu_busy, free_heap, load.encode_queue, load.send_queue, load.decode_queue);
+        }
+    } else if (headroom) {
+        pressure_samples_ = 0;
+        if (++headroom_samples_ >= AUDIO_GOVERNOR_STEP_UP_SAMPLES && tier < kAudioComputeTierHigh) {
+            tier_ = (AudioComputeTier)(tier + 1);
+            headroom_samples_ = 0;
+            ESP_LOGI(TAG, "Step up to %s (cpu %d%%, heap %u)", tier_name(), cpu_busy, free_heap);
+        }
+    } else {
+        pressure_samples_ = 0;
+        headroom_samples_ = 0;
+    }
+    return tier_;
+}
+
+int AudioGovernor::opus_complexity() const {
+    switch (tier_.load()) {
+    case kAudioComputeTierLow:
+    case kAudioComputeTierMedium:
+        return 0;
+    case kAudioComputeTierHigh:
+        return 5;
+    }
+    return 0;
+}
+
+const char* AudioGovernor::tier_name() const {
+    switch (tier_.load()) {
+    case kAudioComputeTierLow:
+        return "low";
+    case kAudioComputeTierMedium:
+        return "medium";
+    case kAudioComputeTierHigh:
+        return "high";
+    }
+    return "unknown";
+}
@@ -0,0 +1,59 @@
+#ifndef AUDIO_GOVERNOR_H
+#define AUDIO_GOVERNOR_H
+
+#include <cstddef>
+#include <cstdint>
+#include <atomic>
+
+#include "audio_processor.h"
+
+/*
+ * The governor is sampled about once per second by the AudioService.
+ * It steps the compute tier down quickly under pressure and up slowly when there is headroom,
+ * so the pipeline does not oscillate between tiers.
+ * Update runs on the timer task, the getters may be called from any task.
+ */
+#define AUDIO_GOVERNOR_STEP_DOWN_SAMPLES 2
+#define AUDIO_GOVERNOR_STEP_UP_SAMPLES 10
+#define AUDIO_GOVERNOR_CPU_HIGH_PERCENT 85
+#define AUDIO_GOVERNOR_CPU_LOW_PERCENT 60
+#define AUDIO_GOVERNOR_HEAP_LOW_BYTES (24 * 1024)
+#define AUDIO_GOVERNOR_HEAP_HIGH_BYTES (48 * 1024)
+// A burst of speech starts with packets queued and nothing played yet, only a decoder that stays behind counts
+#define AUDIO_GOVERNOR_DECODER_BEHIND_SAMPLES 2
+
+struct AudioPipelineLoad {
+    size_t encode_queue = 0;
+    size_t encode_queue_max = 0;
+    size_t send_queue = 0;
+    size_t send_queue_max = 0;
+    size_t decode_queue = 0;
+    size_t playback_queue = 0;
+};
+
+class AudioGovernor {
+public:
+    AudioGovernor();
+
+    AudioComputeTier Update(const AudioPipelineLoad& load);
+
+    inline AudioComputeTier tier() const { return tier_; }
+    inline int cpu_busy_percent() const { return cpu_busy_percent_; }
+    inline size_t free_internal_heap() const { return free_internal_heap_; }
+    int opus_complexity() const;
+    const char* tier_name() const;
+
+private:
+    std::atomic<AudioComputeTier> tier_ = kAudioComputeTierMedium;
+    int pressure_samples_ = 0;
+    int headroom_samples_ = 0;
+    int decoder_behind_samples_ = 0;
+    std::atomic<int> cpu_busy_percent_ = 0;
+    std::atomic<size_t> free_internal_heap_ = 0;
+    uint64_t last_idle_time_ = 0;
+    uint64_t last_total_time_ = 0;
+
+    int MeasureCpuBusyPercent();
+};
+
+#endif
@@ -0,0 +1,199 @@
+#include "audio_input_fanout.h"
+
+#include <esp_log.h>
+#include <algorithm>
+#include <chrono>
+
+#define TAG "AudioInputFanout"
+
+AudioInputFanout::AudioInputFanout() {
+}
+
+AudioInputFanout::~AudioInputFanout() {
+}
+
+AudioInputFanout::Consumer* AudioInputFanout::FindConsumer(int id) {
+    for (auto& consumer : consumers_) {
+        if (consumer->id == id) {
+            return consumer.get();
+        }
+    }
+    return nullptr;
+}
+
+AudioInputFanout::Consumer* AudioInputFanout::CreateConsumer(const char* name, const AudioInputFormat& format) {
+    auto consumer = std::make_shared<Consumer>();
+    consumer->id = next_id_++;
+    consumer->name = name;
+    consumer->format = format;
+    if (format.sample_rate != AUDIO_FANOUT_CAPTURE_SAMPLE_RATE) {
+        // Rate conversion is only done on the mic channel
+        consumer->format.with_reference = false;
+        consumer->resampler = std::make_unique<OpusResampler>();
+        consumer->resampler->Configure(AUDIO_FANOUT_CAPTURE_SAMPLE_RATE, format.sample_rate);
+    }
+    ESP_LOGI(TAG, "Add consumer %s: %d Hz, %s, %d samples", name, consumer->format.sample_rate,
+        consumer->format.with_reference ? "mic + reference" : "mic", consumer->format.frame_samples);
+    consumers_.push_back(std::move(consumer));
+    return consumers_.back().get();
+}
+
+int AudioInputFanout::AddConsumer(const char* name, const AudioInputFormat& format, AudioFrameHandler handler) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto consumer = CreateConsumer(name, format);
+    consumer->handler = handler;
+    return consumer->id;
+}
+
+int AudioInputFanout::AddQueueConsumer(const char* name, const AudioInputFormat& format, size_t max_frames, AudioBackpressurePolicy policy) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto consumer = CreateConsumer(name, format);
+    consumer->queued = true;
+    consumer->max_frames = max_frames;
+    consumer->policy = policy;
+    return consumer->id;
+}
+
+void AudioInputFanout::RemoveConsumer(int id) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = std::find_if(consumers_.begin(), consumers_.end(),
+        [id](const std::shared_ptr<Consumer>& consumer) { return consumer->id == id; });
+    if (it != consumers_.end()) {
+        ESP_LOGI(TAG, "Remove consumer %s, dropped %lu frames", (*it)->name, (*it)->dropped_frames);
+        (*it)->generation++;
+        consumers_.erase(it);
+    }
+    frame_cv_.notify_all();
+}
+
+void AudioInputFanout::EnableConsumer(int id, bool enable) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto consumer = FindConsumer(id);
+    if (consumer == nullptr || consumer->enabled == enable) {
+        return;
+    }
+    consumer->enabled = enable;
+    // Never deliver audio captured before the consumer was disabled, Deliver checks the generation
+    // before each handler call, so only a call that has already started can still run
+    consumer->generation++;
+    consumer->pending.clear();
+    consumer->frames.clear();
+}
+
+void AudioInputFanout::SetFrameSamples(int id, int frame_samples) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto consumer = FindConsumer(id);
+    if (consumer != nullptr && consumer->format.frame_samples != frame_samples) {
+        consumer->format.frame_samples = frame_samples;
+        consumer->pending.clear();
+    }
+}
+
+bool AudioInputFanout::ReadFrame(int id, std::vector<int16_t>& frame, int timeout_ms) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    auto ready = [this, id]() {
+        auto consumer = FindConsumer(id);
+        return consumer == nullptr || !consumer->frames.empty();
+    };
+    if (!frame_cv_.wait_for(lock, std::chrono::milliseconds(timeout_ms), ready)) {
+        return false;
+    }
+    auto consumer = FindConsumer(id);
+    if (consumer == nullptr) {
+        return false;
+    }
+    frame = std::move(consumer->frames.front());
+    consumer->frames.pop_front();
+    return true;
+}
+
+bool AudioInputFanout::HasQueueConsumers() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return std::any_of(consumers_.begin(), consumers_.end(),
+        [](const std::shared_ptr<Consumer>& consumer) { return consumer->queued && consumer->enabled; });
+}
+
+void AudioInputFanout::Convert(Consumer& consumer, const std::vector<int16_t>& capture, int channels) {
+    auto& pending = consumer.pending;
+    size_t samples = capture.size() / channels;
+    if (consumer.format.with_reference && channels == 2) {
+        pending.insert(pending.end(), capture.begin(), capture.end());
+    } else if (consumer.resampler) {
+        auto& mic = consumer.mic;
+        mic.resize(samples);
+        for (size_t i = 0; i < samples; i++) {
+            mic[i] = capture[i * channels];
+        }
+        size_t offset = pending.size();
+        pending.resize(offset + consumer.resampler->GetOutputSamples(samples));
+        consumer.resampler->Process(mic.data(), mic.size(), pending.data() + offset);
+    } else if (channels == 1) {
+        pending.insert(pending.end(), capture.begin(), capture.end());
+    } else {
+        size_t offset = pending.size();
+        pending.resize(offset + samples);
+        for (size_t i = 0; i < samples; i++) {
+            pending[offset + i] = capture[i * channels];
+        }
+    }
+}
+
+void AudioInputFanout::Deliver(const std::vector<int16_t>& capture, int channels) {
+    ready_consumers_.clear();
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        bool queued_frames = false;
+        for (auto& consumer : consumers_) {
+            if (!consumer->enabled || consumer->format.frame_samples <= 0) {
+                continue;
+            }
+            Convert(*consumer, capture, channels);
+
+            int frame_channels = (consumer->format.with_reference && channels == 2) ? 2 : 1;
+            size_t frame_size = consumer->format.frame_samples * frame_channels;
+            size_t offset = 0;
+            consumer->ready_count = 0;
+            while (consumer->pending.size() - offset >= frame_size) {
+                auto frame_begin = consumer->pending.begin() + offset;
+                offset += frame_size;
+                if (!consumer->queued) {
+                    /* A handler that kept the previous frame took its buffer, otherwise the capacity is reused */
+                    if (consumer->ready_frames.size() <= consumer->ready_count) {
+                        consumer->ready_frames.emplace_back();
+                    }
+                    consumer->ready_frames[consumer->ready_count++].assign(frame_begin, frame_begin + frame_size);
+                    continue;
+                }
+                if (consumer->frames.size() >= consumer->max_frames) {
+                    consumer->dropped_frames++;
+                    if (consumer->policy == kAudioBackpressureDropNewest) {
+                        continue;
+                    }
+                    consumer->frames.pop_front();
+                }
+                consumer->frames.emplace_back(frame_begin, frame_begin + frame_size);
+                queued_frames = true;
+            }
+            consumer->pending.erase(consumer->pending.begin(), consumer->pending.begin() + offset);
+            if (consumer->ready_count > 0) {
+                consumer->ready_generation = consumer->generation;
+                ready_consumers_.push_back(consumer);
+            }
+        }
+        if (queued_frames) {
+            frame_cv_.notify_all();
+        }
+    }
+
+    /* Push consumers run without the lock, so they may enable or disable consumers. A consumer
+       disabled or removed since its frames were gathered gets none of them. */
+    for (auto& consumer : ready_consumers_) {
+        for (size_t i = 0; i < consumer->ready_count; i++) {
+            if (consumer->generation != consumer->ready_generation) {
+                break;
+            }
+            consumer->handler(consumer->ready_frames[i]);
+        }
+    }
+    ready_consumers_.clear();
+}
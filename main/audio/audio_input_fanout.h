@@ -0,0 +1,90 @@
+#ifndef AUDIO_INPUT_FANOUT_H
+#define AUDIO_INPUT_FANOUT_H
+
+#include <atomic>
+#include <memory>
+#include <vector>
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+
+#include <opus_resampler.h>
+
+/*
+ * The microphone is captured once by the AudioInputTask and each captured frame is fanned out
+ * to every enabled consumer. A consumer gets its own sample rate, channel layout and frame size,
+ * and is either called on the capture task (push) or reads frames from its own bounded queue (pull).
+ */
+#define AUDIO_FANOUT_CAPTURE_SAMPLE_RATE 16000
+
+enum AudioBackpressurePolicy {
+    kAudioBackpressureDropOldest,   // a slow reader loses the oldest queued frames
+    kAudioBackpressureDropNewest,   // a slow reader keeps its queue and misses the new frames
+};
+
+struct AudioInputFormat {
+    int sample_rate = AUDIO_FANOUT_CAPTURE_SAMPLE_RATE;
+    // Interleave the reference channel after the mic channel, like the AFE expects
+    bool with_reference = false;
+    // Samples per channel in each delivered frame
+    int frame_samples = 0;
+};
+
+// Push consumers may take ownership of the frame by moving it
+typedef std::function<void(std::vector<int16_t>& frame)> AudioFrameHandler;
+
+class AudioInputFanout {
+public:
+    AudioInputFanout();
+    ~AudioInputFanout();
+
+    int AddConsumer(const char* name, const AudioInputFormat& format, AudioFrameHandler handler);
+    int AddQueueConsumer(const char* name, const AudioInputFormat& format, size_t max_frames, AudioBackpressurePolicy policy);
+    void RemoveConsumer(int id);
+    void EnableConsumer(int id, bool enable);
+    void SetFrameSamples(int id, int frame_samples);
+    // Blocks until the next frame of a pull consumer is available, returns false on timeout or removal
+    bool ReadFrame(int id, std::vector<int16_t>& frame, int timeout_ms);
+    bool HasQueueConsumers();
+
+    // Called by the capture task with a frame at the capture rate, channels are interleaved mic / reference
+    void Deliver(const std::vector<int16_t>& capture, int channels);
+
+private:
+    struct Consumer {
+        int id;
+        const char* name;
+        AudioInputFormat format;
+        AudioFrameHandler handler;
+        bool enabled = true;
+        // Bumped when the consumer is enabled, disabled or removed, frames gathered before are dropped
+        std::atomic<uint32_t> generation = 0;
+        uint32_t ready_generation = 0;
+        std::vector<int16_t> pending;
+        std::unique_ptr<OpusResampler> resampler;
+        // Buffers reused on every capture, only the capture task touches them
+        std::vector<int16_t> mic;
+        std::vector<std::vector<int16_t>> ready_frames;
+        size_t ready_count = 0;
+        // Pull consumers only
+        bool queued = false;
+        size_t max_frames = 0;
+        AudioBackpressurePolicy policy = kAudioBackpressureDropOldest;
+        std::deque<std::vector<int16_t>> frames;
+        uint32_t dropped_frames = 0;
+    };
+
+    std::mutex mutex_;
+    std::condition_variable frame_cv_;
+    // Shared so a push consumer removed while its handler runs stays valid until the handler returns
+    std::vector<std::shared_ptr<Consumer>> consumers_;
+    std::vector<std::shared_ptr<Consumer>> ready_consumers_;
+    int next_id_ = 1;
+
+    Consumer* FindConsumer(int id);
+    Consumer* CreateConsumer(const char* name, const AudioInputFormat& format);
+    void Convert(Consumer& consumer, const std::vector<int16_t>& capture, int channels);
+};
+
+#endif
@@ -8,6 +8,16 @@
 #include <model_path.h>
 #include "audio_codec.h"
 
+/*
+ * Compute tiers selected by the AudioGovernor.
+ * Low trades quality for CPU, High spends spare headroom on quality.
+ */
+enum AudioComputeTier {
+    kAudioComputeTierLow,
+    kAudioComputeTierMedium,
+    kAudioComputeTierHigh,
+};
+
 class AudioProcessor {
 public:
     virtual ~AudioProcessor() = default;
@@ -21,6 +31,10 @@ public:
     virtual void OnVadStateChange(std::function<void(bool speaking)> callback) = 0;
     virtual size_t GetFeedSize() = 0;
     virtual void EnableDeviceAec(bool enable) = 0;
+    // Called from the task that feeds the processor, or before Start
+    virtual void SetComputeTier(AudioComputeTier tier) = 0;
+    // Silence the VAD waits for before it reports the end of speech, every speech run includes it
+    virtual int GetVadHangoverMs() = 0;
 };
 
 #endif
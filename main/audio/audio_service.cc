@@ -1,9 +1,16 @@
 #include "audio_service.h"
 #include <esp_log.h>
+#include <esp_app_desc.h>
+#include <esp_heap_caps.h>
 #include <cstring>
+#include <algorithm>
+
+#include "ogg_opus_demuxer.h"
+#include "audio_packet_pool.h"
 
 #if CONFIG_USE_AUDIO_PROCESSOR
 #include "processors/afe_audio_processor.h"
+#include "afe_service.h"
 #else
 #include "processors/no_audio_processor.h"
 #endif
@@ -17,6 +24,13 @@
 
 #define TAG "AudioService"
 
+/* Bitrates of a 16 kHz mono speech stream, Opus is the typical VBR rate at complexity 0 */
+static const AudioFormatProfile AUDIO_FORMAT_PROFILES[] = {
+    {kAudioFormatOpus, 24000},
+    {kAudioFormatAdpcm, 64000},
+    {kAudioFormatPcm, 256000},
+};
+
 
 AudioService::AudioService() {
     event_group_ = xEventGroupCreate();
@@ -35,8 +49,17 @@ void AudioService::Initialize(AudioCodec* codec) {
 
     /* Setup the audio codec */
     opus_decoder_ = std::make_unique<OpusDecoderWrapper>(codec->output_sample_rate(), 1, OPUS_FRAME_DURATION_MS);
-    opus_encoder_ = std::make_unique<OpusEncoderWrapper>(16000, 1, OPUS_FRAME_DURATION_MS);
-    opus_encoder_->SetComplexity(0);
+    opus_encoder_ = std::make_unique<AdaptiveOpusEncoder>(16000, 1, OPUS_FRAME_DURATION_MS);
+    opus_complexity_ = governor_.opus_complexity();
+    opus_encoder_->SetComplexity(opus_complexity_);
+
+#if CONFIG_USE_AUDIO_FLIGHT_RECORDER
+    flight_recorder_.Initialize(CONFIG_AUDIO_FLIGHT_RECORDER_EVENTS, CONFIG_AUDIO_FLIGHT_RECORDER_AUDIO_KB * 1024);
+#endif
+
+#if CONFIG_USE_DOWNLINK_BURST_BUFFER
+    downlink_buffer_.Initialize(CONFIG_DOWNLINK_BURST_BUFFER_KB * 1024);
+#endif
 
     if (codec->input_sample_rate() != 16000) {
         input_resampler_.Configure(codec->input_sample_rate(), 16000);
@@ -49,12 +72,44 @@ void AudioService::Initialize(AudioCodec* codec) {
     audio_processor_ = std::make_unique<NoAudioProcessor>();
 #endif
 
+    /* Every feature that listens to the mic is a consumer of the single capture in AudioInputTask */
+    bool with_reference = codec_->input_channels() == 2;
+    wake_word_consumer_ = input_fanout_.AddConsumer("wake_word", {16000, with_reference, 0},
+        [this](std::vector<int16_t>& frame) {
+            wake_word_->Feed(frame);
+        });
+    audio_processor_consumer_ = input_fanout_.AddConsumer("audio_processor", {16000, with_reference, 0},
+        [this](std::vector<int16_t>& frame) {
+            ApplyPendingComputeTier();
+            audio_processor_->Feed(std::move(frame));
+        });
+    audio_testing_consumer_ = input_fanout_.AddConsumer("audio_testing", {16000, false, OPUS_FRAME_DURATION_MS * 16000 / 1000},
+        [this](std::vector<int16_t>& frame) {
+            if (audio_testing_queue_.size() >= AUDIO_TESTING_MAX_DURATION_MS / OPUS_FRAME_DURATION_MS) {
+                ESP_LOGW(TAG, "Audio testing queue is full, stopping audio testing");
+                EnableAudioTesting(false);
+                return;
+            }
+            PushTaskToEncodeQueue(kAudioTaskTypeEncodeToTestingQueue, std::move(frame));
+        });
+    input_fanout_.EnableConsumer(wake_word_consumer_, false);
+    input_fanout_.EnableConsumer(audio_processor_consumer_, false);
+    input_fanout_.EnableConsumer(audio_testing_consumer_, false);
+
     audio_processor_->OnOutput([this](std::vector<int16_t>&& data) {
+        int64_t request_us = listen_request_us_.exchange(0);
+        if (request_us > 0) {
+            listen_latency_ms_ = (esp_timer_get_time() - request_us) / 1000;
+            ESP_LOGI(TAG, "First captured frame %d ms after the listening request (%s input)",
+                listen_latency_ms_, listen_input_warm_ ? "warm" : "cold");
+        }
         PushTaskToEncodeQueue(kAudioTaskTypeEncodeToSendQueue, std::move(data));
     });
 
     audio_processor_->OnVadStateChange([this](bool speaking) {
         voice_detected_ = speaking;
+        flight_recorder_.Record(kFlightEventVad, speaking);
+        UpdateEndpointing(speaking);
         if (callbacks_.on_vad_change) {
             callbacks_.on_vad_change(speaking);
         }
@@ -71,13 +126,65 @@ void AudioService::Initialize(AudioCodec* codec) {
         .skip_unhandled_events = true,
     };
     esp_timer_create(&audio_power_timer_args, &audio_power_timer_);
+
+    esp_timer_create_args_t playback_drain_timer_args = {
+        .callback = [](void* arg) {
+            AudioService* audio_service = (AudioService*)arg;
+            audio_service->OnPlaybackDrainTimer();
+        },
+        .arg = this,
+        .dispatch_method = ESP_TIMER_TASK,
+        .name = "playback_drain_timer",
+        .skip_unhandled_events = true,
+    };
+    esp_timer_create(&playback_drain_timer_args, &playback_drain_timer_);
+
+#if CONFIG_USE_CLIENT_ENDPOINTING
+    esp_timer_create_args_t end_of_utterance_timer_args = {
+        .callback = [](void* arg) {
+            AudioService* audio_service = (AudioService*)arg;
+            ESP_LOGI(TAG, "End of utterance detected");
+            if (audio_service->callbacks_.on_end_of_utterance) {
+                audio_service->callbacks_.on_end_of_utterance();
+            }
+        },
+        .arg = this,
+        .dispatch_method = ESP_TIMER_TASK,
+        .name = "end_of_utterance_timer",
+        .skip_unhandled_events = true,
+    };
+    esp_timer_create(&end_of_utterance_timer_args, &end_of_utterance_timer_);
+    endpointer_.Configure(CONFIG_ENDPOINT_MIN_SPEECH_MS, CONFIG_ENDPOINT_TRAILING_SILENCE_MS,
+        audio_processor_->GetVadHangoverMs());
+#endif
+
+#if CONFIG_USE_AUDIO_COMPUTE_GOVERNOR
+    esp_timer_create_args_t audio_governor_timer_args = {
+        .callback = [](void* arg) {
+            AudioService* audio_service = (AudioService*)arg;
+            audio_service->UpdateComputeTier();
+        },
+        .arg = this,
+        .dispatch_method = ESP_TIMER_TASK,
+        .name = "audio_governor_timer",
+        .skip_unhandled_events = true,
+    };
+    esp_timer_create(&audio_governor_timer_args, &audio_governor_timer_);
+#endif
 }
 
 void AudioService::Start() {
     service_stopped_ = false;
-    xEventGroupClearBits(event_group_, AS_EVENT_AUDIO_TESTING_RUNNING | AS_EVENT_WAKE_WORD_RUNNING | AS_EVENT_AUDIO_PROCESSOR_RUNNING);
+    xEventGroupClearBits(event_group_, AS_EVENT_AUDIO_TESTING_RUNNING | AS_EVENT_WAKE_WORD_RUNNING |
+        AS_EVENT_AUDIO_PROCESSOR_RUNNING | AS_EVENT_INPUT_CONSUMERS_RUNNING);
+    if (input_fanout_.HasQueueConsumers()) {
+        xEventGroupSetBits(event_group_, AS_EVENT_INPUT_CONSUMERS_RUNNING);
+    }
 
     esp_timer_start_periodic(audio_power_timer_, 1000000);
+    if (audio_governor_timer_ != nullptr) {
+        esp_timer_start_periodic(audio_governor_timer_, AUDIO_GOVERNOR_INTERVAL_MS * 1000);
+    }
 
 #if CONFIG_USE_AUDIO_PROCESSOR
     /* Start the audio input task */
@@ -109,6 +216,13 @@ void AudioService::Start() {
     }, "audio_output", 2048, this, 4, &audio_output_task_handle_);
 #endif
 
+    /* Start the sound task, it feeds the decode queue on behalf of PlaySound callers */
+    xTaskCreate([](void* arg) {
+        AudioService* audio_service = (AudioService*)arg;
+        audio_service->AudioSoundTask();
+        vTaskDelete(NULL);
+    }, "audio_sound", 2048 + 1024, this, 3, &audio_sound_task_handle_);
+
     /* Start the opus codec task */
     xTaskCreate([](void* arg) {
         AudioService* audio_service = (AudioService*)arg;
@@ -119,14 +233,22 @@ void AudioService::Start() {
 
 void AudioService::Stop() {
     esp_timer_stop(audio_power_timer_);
+    if (audio_governor_timer_ != nullptr) {
+        esp_timer_stop(audio_governor_timer_);
+    }
     service_stopped_ = true;
     xEventGroupSetBits(event_group_, AS_EVENT_AUDIO_TESTING_RUNNING |
         AS_EVENT_WAKE_WORD_RUNNING |
-        AS_EVENT_AUDIO_PROCESSOR_RUNNING);
+        AS_EVENT_AUDIO_PROCESSOR_RUNNING |
+        AS_EVENT_INPUT_CONSUMERS_RUNNING);
+
+    CancelAllSounds();
 
     std::lock_guard<std::mutex> lock(audio_queue_mutex_);
     audio_encode_queue_.clear();
-    audio_decode_queue_.clear();
+    audio_held_queue_.clear();
+    ReleaseDecodeQueue();
+    downlink_buffer_.Clear();
     audio_playback_queue_.clear();
     audio_testing_queue_.clear();
     audio_queue_cv_.notify_all();
@@ -137,6 +259,7 @@ bool AudioService::ReadAudioData(std::vector<int16_t>& data, int sample_rate, in
         esp_timer_stop(audio_power_timer_);
         esp_timer_start_periodic(audio_power_timer_, AUDIO_POWER_CHECK_INTERVAL_MS * 1000);
         codec_->EnableInput(true);
+        input_settle_samples_ = AUDIO_INPUT_SETTLE_MS * sample_rate / 1000;
     }
 
     if (codec_->input_sample_rate() != sample_rate) {
@@ -153,8 +276,11 @@ bool AudioService::ReadAudioData(std::vector<int16_t>& data, int sample_rate, in
             }
             auto resampled_mic = std::vector<int16_t>(input_resampler_.GetOutputSamples(mic_channel.size()));
             auto resampled_reference = std::vector<int16_t>(reference_resampler_.GetOutputSamples(reference_channel.size()));
+            auto start_time = esp_timer_get_time();
             input_resampler_.Process(mic_channel.data(), mic_channel.size(), resampled_mic.data());
             reference_resampler_.Process(reference_channel.data(), reference_channel.size(), resampled_reference.data());
+            performance_statistics_.input_resample.Record(esp_timer_get_time() - start_time,
+                (int64_t)samples * 1000000 / sample_rate);
             data.resize(resampled_mic.size() + resampled_reference.size());
             for (size_t i = 0, j = 0; i < resampled_mic.size(); ++i, j += 2) {
                 data[j] = resampled_mic[i];
@@ -162,7 +288,10 @@ bool AudioService::ReadAudioData(std::vector<int16_t>& data, int sample_rate, in
             }
         } else {
             auto resampled = std::vector<int16_t>(input_resampler_.GetOutputSamples(data.size()));
+            auto start_time = esp_timer_get_time();
             input_resampler_.Process(data.data(), data.size(), resampled.data());
+            performance_statistics_.input_resample.Record(esp_timer_get_time() - start_time,
+                (int64_t)samples * 1000000 / sample_rate);
             data = std::move(resampled);
         }
     } else {
@@ -189,74 +318,35 @@ bool AudioService::ReadAudioData(std::vector<int16_t>& data, int sample_rate, in
 
 void AudioService::AudioInputTask() {
     while (true) {
-        EventBits_t bits = xEventGroupWaitBits(event_group_, AS_EVENT_AUDIO_TESTING_RUNNING |
-            AS_EVENT_WAKE_WORD_RUNNING | AS_EVENT_AUDIO_PROCESSOR_RUNNING,
+        xEventGroupWaitBits(event_group_, AS_EVENT_AUDIO_TESTING_RUNNING |
+            AS_EVENT_WAKE_WORD_RUNNING | AS_EVENT_AUDIO_PROCESSOR_RUNNING | AS_EVENT_INPUT_CONSUMERS_RUNNING,
             pdFALSE, pdFALSE, portMAX_DELAY);
 
         if (service_stopped_) {
             break;
         }
-        if (audio_input_need_warmup_) {
-            audio_input_need_warmup_ = false;
-            vTaskDelay(pdMS_TO_TICKS(120));
-            continue;
-        }
-
-        /* Used for audio testing in NetworkConfiguring mode by clicking the BOOT button */
-        if (bits & AS_EVENT_AUDIO_TESTING_RUNNING) {
-            if (audio_testing_queue_.size() >= AUDIO_TESTING_MAX_DURATION_MS / OPUS_FRAME_DURATION_MS) {
-                ESP_LOGW(TAG, "Audio testing queue is full, stopping audio testing");
-                EnableAudioTesting(false);
-                continue;
-            }
-            std::vector<int16_t> data;
-            int samples = OPUS_FRAME_DURATION_MS * 16000 / 1000;
-            if (ReadAudioData(data, 16000, samples)) {
-                // If input channels is 2, we need to fetch the left channel data
-                if (codec_->input_channels() == 2) {
-                    auto mono_data = std::vector<int16_t>(data.size() / 2);
-                    for (size_t i = 0, j = 0; i < mono_data.size(); ++i, j += 2) {
-                        mono_data[i] = data[j];
-                    }
-                    data = std::move(mono_data);
-                }
-                PushTaskToEncodeQueue(kAudioTaskTypeEncodeToTestingQueue, std::move(data));
-                continue;
-            }
-        }
 
-        /* Feed the wake word */
-        if (bits & AS_EVENT_WAKE_WORD_RUNNING) {
-            std::vector<int16_t> data;
-            int samples = wake_word_->GetFeedSize();
-            if (samples > 0) {
-                if (ReadAudioData(data, 16000, samples)) {
-                    wake_word_->Feed(data);
-                    continue;
-                }
-            }
+        /* Capture once and fan the frame out to every enabled consumer */
+        std::vector<int16_t> data;
+        if (!ReadAudioData(data, 16000, AUDIO_INPUT_CAPTURE_FRAME_MS * 16000 / 1000)) {
+            vTaskDelay(pdMS_TO_TICKS(10));
+            continue;
         }
-
-        /* Feed the audio processor */
-        if (bits & AS_EVENT_AUDIO_PROCESSOR_RUNNING) {
-            std::vector<int16_t> data;
-            int samples = audio_processor_->GetFeedSize();
-            if (samples > 0) {
-                if (ReadAudioData(data, 16000, samples)) {
-                    audio_processor_->Feed(std::move(data));
-                    continue;
-                }
-            }
+        if (input_settle_samples_ > 0) {
+            /* The codec was just powered up, keep reading but drop the samples while it settles */
+            input_settle_samples_ -= (int)(data.size() / codec_->input_channels());
+            continue;
         }
-
-        ESP_LOGE(TAG, "Should not be here, bits: %lx", bits);
-        break;
+        input_fanout_.Deliver(data, codec_->input_channels());
     }
 
     ESP_LOGW(TAG, "Audio input task stopped");
 }
 
 void AudioService::AudioOutputTask() {
+    int64_t last_write_done_us = 0;
+    // When OutputData returns at most the DMA ring is still pending
+    const int64_t dma_us = (int64_t)AUDIO_CODEC_DMA_DESC_NUM * AUDIO_CODEC_DMA_FRAME_NUM * 1000000 / codec_->output_sample_rate();
     while (true) {
         std::unique_lock<std::mutex> lock(audio_queue_mutex_);
         audio_queue_cv_.wait(lock, [this]() { return !audio_playback_queue_.empty() || service_stopped_; });
@@ -266,38 +356,71 @@ void AudioService::AudioOutputTask() {
 
         auto task = std::move(audio_playback_queue_.front());
         audio_playback_queue_.pop_front();
+        size_t playback_depth = audio_playback_queue_.size();
+        size_t decode_depth = audio_decode_queue_.size();
+        playback_writing_ = true;
+        writing_sound_ = task->sound;
         audio_queue_cv_.notify_all();
         lock.unlock();
 
+        flight_recorder_.Record(kFlightEventPlayback, playback_depth, decode_depth);
+        if (flight_recorder_.enabled() && last_write_done_us > 0) {
+            // Anything later than the DMA ring left the speaker dry
+            int64_t gap_us = esp_timer_get_time() - last_write_done_us - dma_us;
+            if (gap_us > 0 && gap_us < AUDIO_UNDERRUN_MAX_GAP_MS * 1000) {
+                flight_recorder_.Record(kFlightEventUnderrun, gap_us / 1000, decode_depth);
+                // Packets were waiting, so the decoder fell behind instead of the network
+                if (decode_depth > 0) {
+                    flight_recorder_.Trigger(kFlightTriggerUnderrun);
+                }
+            }
+        }
+
         if (!codec_->output_enabled()) {
             esp_timer_stop(audio_power_timer_);
             esp_timer_start_periodic(audio_power_timer_, AUDIO_POWER_CHECK_INTERVAL_MS * 1000);
             codec_->EnableOutput(true);
         }
+        int64_t write_start_us = esp_timer_get_time();
         codec_->OutputData(task->pcm);
+        last_write_done_us = esp_timer_get_time();
+
+        /*
+         * The DMA ring now holds what was left in it plus the new samples, minus what played during the write,
+         * and never more than its size. The last sample leaves the DAC once that backlog has played.
+         */
+        int64_t backlog_us = std::max<int64_t>(0, dma_drained_at_us_ - write_start_us) +
+            (int64_t)task->pcm.size() * 1000000 / codec_->output_sample_rate() - (last_write_done_us - write_start_us);
+        dma_drained_at_us_ = last_write_done_us + std::clamp<int64_t>(backlog_us, 0, dma_us);
 
         /* Update the last output time */
         last_output_time_ = std::chrono::steady_clock::now();
         debug_statistics_.playback_count++;
 
+        lock.lock();
+        playback_writing_ = false;
+        writing_sound_ = 0;
 #if CONFIG_USE_SERVER_AEC
         /* Record the timestamp for server AEC */
         if (task->timestamp > 0) {
-            lock.lock();
             timestamp_queue_.push_back(task->timestamp);
         }
 #endif
+        lock.unlock();
+        CheckPlaybackDrained();
     }
 
     ESP_LOGW(TAG, "Audio output task stopped");
 }
 
 void AudioService::OpusCodecTask() {
+    int applied_complexity = opus_complexity_;
     while (true) {
         std::unique_lock<std::mutex> lock(audio_queue_mutex_);
         audio_queue_cv_.wait(lock, [this]() {
             return service_stopped_ ||
-                (!audio_encode_queue_.empty() && audio_send_queue_.size() < MAX_SEND_PACKETS_IN_QUEUE) ||
+                (!audio_encode_queue_.empty() && (audio_send_queue_.size() < MAX_SEND_PACKETS_IN_QUEUE || uplink_held_)) ||
+                (!uplink_held_ && !audio_held_queue_.empty() && audio_send_queue_.size() < MAX_SEND_PACKETS_IN_QUEUE) ||
                 (!audio_decode_queue_.empty() && audio_playback_queue_.size() < MAX_PLAYBACK_TASKS_IN_QUEUE);
         });
         if (service_stopped_) {
@@ -308,52 +431,138 @@ void AudioService::OpusCodecTask() {
         if (!audio_decode_queue_.empty() && audio_playback_queue_.size() < MAX_PLAYBACK_TASKS_IN_QUEUE) {
             auto packet = std::move(audio_decode_queue_.front());
             audio_decode_queue_.pop_front();
+            if (!downlink_buffer_.empty()) {
+                auto buffered = downlink_buffer_.Pop();
+                flight_recorder_.Record(kFlightEventDecodeQueue, audio_decode_queue_.size() + 1, buffered->timestamp);
+                audio_decode_queue_.push_back(std::move(buffered));
+            }
+            playback_decoding_ = true;
+            decoding_sound_ = packet->sound;
+            uint32_t generation = downlink_generation_;
             audio_queue_cv_.notify_all();
             lock.unlock();
 
             auto task = std::make_unique<AudioTask>();
             task->type = kAudioTaskTypeDecodeToPlaybackQueue;
             task->timestamp = packet->timestamp;
+            task->sound = packet->sound;
+
+            auto format = packet->format;
+            int decoded_sample_rate = packet->sample_rate;
+            bool decoded = false;
+            auto start_time = esp_timer_get_time();
+            if (format == kAudioFormatOpus) {
+                SetDecodeSampleRate(packet->sample_rate, packet->frame_duration);
+                start_time = esp_timer_get_time();
+                decoded = opus_decoder_->Decode(std::move(packet->payload), task->pcm);
+                decoded_sample_rate = opus_decoder_->sample_rate();
+            } else {
+                decoded = DecodeUncompressed(*packet, task->pcm);
+            }
+            AudioPacketPool::GetInstance().Release(std::move(packet));
+            if (decoded) {
+                auto decoded_time = esp_timer_get_time();
+                int64_t audio_duration_us = (int64_t)task->pcm.size() * 1000000 / decoded_sample_rate;
+                if (format == kAudioFormatOpus) {
+                    performance_statistics_.opus_decode.Record(decoded_time - start_time, audio_duration_us);
+                } else if (format == kAudioFormatAdpcm) {
+                    performance_statistics_.adpcm_decode.Record(decoded_time - start_time, audio_duration_us);
+                }
 
-            SetDecodeSampleRate(packet->sample_rate, packet->frame_duration);
-            if (opus_decoder_->Decode(std::move(packet->payload), task->pcm)) {
                 // Resample if the sample rate is different
-                if (opus_decoder_->sample_rate() != codec_->output_sample_rate()) {
+                if (decoded_sample_rate != codec_->output_sample_rate()) {
+                    if (output_resampler_rate_ != decoded_sample_rate) {
+                        ESP_LOGI(TAG, "Resampling audio from %d to %d", decoded_sample_rate, codec_->output_sample_rate());
+                        output_resampler_.Configure(decoded_sample_rate, codec_->output_sample_rate());
+                        output_resampler_rate_ = decoded_sample_rate;
+                    }
                     int target_size = output_resampler_.GetOutputSamples(task->pcm.size());
                     std::vector<int16_t> resampled(target_size);
                     output_resampler_.Process(task->pcm.data(), task->pcm.size(), resampled.data());
                     task->pcm = std::move(resampled);
+                    performance_statistics_.output_resample.Record(esp_timer_get_time() - decoded_time, audio_duration_us);
                 }
 
                 lock.lock();
-                audio_playback_queue_.push_back(std::move(task));
+                /* A reset or a sound cancelled while the frame was decoded drops the frame */
+                if (generation == downlink_generation_ && (task->sound == 0 || !cancel_playing_sound_)) {
+                    audio_playback_queue_.push_back(std::move(task));
+                }
+                playback_decoding_ = false;
+                decoding_sound_ = 0;
                 audio_queue_cv_.notify_all();
             } else {
                 ESP_LOGE(TAG, "Failed to decode audio");
                 lock.lock();
+                playback_decoding_ = false;
+                decoding_sound_ = 0;
+                lock.unlock();
+                CheckPlaybackDrained();
+                lock.lock();
             }
             debug_statistics_.decode_count++;
         }
         
-        /* Encode the audio to send queue */
-        if (!audio_encode_queue_.empty() && audio_send_queue_.size() < MAX_SEND_PACKETS_IN_QUEUE) {
-            auto task = std::move(audio_encode_queue_.front());
+        /* Held audio stays PCM in a ring, the capture never stalls on a slow connection */
+        while (uplink_held_ && !audio_encode_queue_.empty() &&
+            audio_encode_queue_.front()->type == kAudioTaskTypeEncodeToSendQueue) {
+            if (audio_held_queue_.size() >= MAX_HELD_ENCODE_TASKS_IN_QUEUE) {
+                audio_held_queue_.pop_front();
+                flight_recorder_.Record(kFlightEventSendDrop, audio_held_queue_.size());
+            }
+            audio_held_queue_.push_back(std::move(audio_encode_queue_.front()));
             audio_encode_queue_.pop_front();
             audio_queue_cv_.notify_all();
+        }
+
+        /* Encode the audio to send queue, the released audio goes first */
+        auto source = !uplink_held_ && !audio_held_queue_.empty() ? &audio_held_queue_ : &audio_encode_queue_;
+        if (!source->empty() && (audio_send_queue_.size() < MAX_SEND_PACKETS_IN_QUEUE || uplink_held_)) {
+            auto task = std::move(source->front());
+            source->pop_front();
+            audio_queue_cv_.notify_all();
             lock.unlock();
 
             auto packet = std::make_unique<AudioStreamPacket>();
             packet->frame_duration = OPUS_FRAME_DURATION_MS;
             packet->sample_rate = 16000;
             packet->timestamp = task->timestamp;
-            if (!opus_encoder_->Encode(std::move(task->pcm), packet->payload)) {
-                ESP_LOGE(TAG, "Failed to encode audio");
-                continue;
+            /* The testing queue is played back locally, so it always uses Opus */
+            packet->format = task->type == kAudioTaskTypeEncodeToSendQueue ? uplink_format_.load() : kAudioFormatOpus;
+            /* Outgoing packets keep room for the protocol header, so it is written in place when sending */
+            packet->headroom = task->type == kAudioTaskTypeEncodeToSendQueue ? AUDIO_PACKET_HEADROOM : 0;
+            auto start_time = esp_timer_get_time();
+            if (packet->format != kAudioFormatOpus) {
+                EncodeUncompressed(packet->format, task->pcm, *packet);
+                if (packet->format == kAudioFormatAdpcm) {
+                    performance_statistics_.adpcm_encode.Record(esp_timer_get_time() - start_time, OPUS_FRAME_DURATION_MS * 1000);
+                }
+            } else {
+                /* Apply the complexity chosen by the governor between frames */
+                int complexity = opus_complexity_;
+                if (complexity != applied_complexity) {
+                    opus_encoder_->SetComplexity(complexity);
+                    applied_complexity = complexity;
+                }
+                /* The encoder skips the settings that did not change */
+                opus_encoder_->SetBitrate(opus_bitrate_);
+                opus_encoder_->SetFec(opus_fec_loss_percent_);
+                start_time = esp_timer_get_time();
+                if (!opus_encoder_->Encode(std::move(task->pcm), opus_buffer_)) {
+                    ESP_LOGE(TAG, "Failed to encode audio");
+                    continue;
+                }
+                /* The packet gets the exact size, the encoder buffer is reused for every frame */
+                packet->payload.resize(packet->headroom + opus_buffer_.size());
+                memcpy(packet->data(), opus_buffer_.data(), opus_buffer_.size());
+                performance_statistics_.opus_encode.Record(esp_timer_get_time() - start_time, OPUS_FRAME_DURATION_MS * 1000);
             }
 
             if (task->type == kAudioTaskTypeEncodeToSendQueue) {
+                flight_recorder_.RecordAudio(kFlightAudioUplink, packet->data(), packet->size());
                 {
                     std::lock_guard<std::mutex> lock(audio_queue_mutex_);
+                    flight_recorder_.Record(kFlightEventSendQueue, audio_send_queue_.size() + 1, packet->timestamp);
                     audio_send_queue_.push_back(std::move(packet));
                 }
                 if (callbacks_.on_send_queue_available) {
@@ -371,19 +580,77 @@ void AudioService::OpusCodecTask() {
     ESP_LOGW(TAG, "Opus codec task stopped");
 }
 
+static bool IsOpusNativeSampleRate(int sample_rate) {
+    return sample_rate == 8000 || sample_rate == 12000 || sample_rate == 16000 ||
+        sample_rate == 24000 || sample_rate == 48000;
+}
+
 void AudioService::SetDecodeSampleRate(int sample_rate, int frame_duration) {
-    if (opus_decoder_->sample_rate() == sample_rate && opus_decoder_->duration_ms() == frame_duration) {
+    // Opus can decode any stream at 8/12/16/24/48 kHz regardless of the encoder rate,
+    // so decode straight at the codec output rate and skip the resampler whenever possible
+    int decode_sample_rate = sample_rate;
+    if (IsOpusNativeSampleRate(codec_->output_sample_rate())) {
+        decode_sample_rate = codec_->output_sample_rate();
+    }
+    if (opus_decoder_->sample_rate() == decode_sample_rate && opus_decoder_->duration_ms() == frame_duration) {
         return;
     }
 
     opus_decoder_.reset();
-    opus_decoder_ = std::make_unique<OpusDecoderWrapper>(sample_rate, 1, frame_duration);
+    opus_decoder_ = std::make_unique<OpusDecoderWrapper>(decode_sample_rate, 1, frame_duration);
+
+    if (sample_rate != decode_sample_rate) {
+        ESP_LOGI(TAG, "Decoding %d Hz stream at %d Hz, resampler bypassed", sample_rate, decode_sample_rate);
+    }
+}
 
-    auto codec = Board::GetInstance().GetAudioCodec();
-    if (opus_decoder_->sample_rate() != codec->output_sample_rate()) {
-        ESP_LOGI(TAG, "Resampling audio from %d to %d", opus_decoder_->sample_rate(), codec->output_sample_rate());
-        output_resampler_.Configure(opus_decoder_->sample_rate(), codec->output_sample_rate());
+void AudioService::SetAudioFormats(AudioFormat uplink, AudioFormat downlink) {
+    uplink_format_ = uplink;
+    downlink_format_ = downlink;
+    uplink_adpcm_state_ = ImaAdpcmState();
+}
+
+void AudioService::SetUplinkBitrate(int bitrate, int fec_loss_percent) {
+    opus_bitrate_ = bitrate;
+    opus_fec_loss_percent_ = fec_loss_percent;
+}
+
+bool AudioService::EncodeUncompressed(AudioFormat format, const std::vector<int16_t>& pcm, AudioStreamPacket& packet) {
+    if (format == kAudioFormatPcm) {
+        packet.payload.resize(packet.headroom + pcm.size() * sizeof(int16_t));
+        memcpy(packet.data(), pcm.data(), packet.size());
+        return true;
+    }
+    if (format == kAudioFormatAdpcm) {
+        // Every packet carries the encoder state, so a lost packet does not corrupt the next ones
+        packet.payload.resize(packet.headroom + AUDIO_ADPCM_HEADER_SIZE + ImaAdpcm::EncodedSize(pcm.size()));
+        auto payload = packet.data();
+        payload[0] = uplink_adpcm_state_.predictor & 0xFF;
+        payload[1] = (uplink_adpcm_state_.predictor >> 8) & 0xFF;
+        payload[2] = uplink_adpcm_state_.step_index;
+        payload[3] = 0;
+        ImaAdpcm::Encode(uplink_adpcm_state_, pcm.data(), pcm.size(), payload + AUDIO_ADPCM_HEADER_SIZE);
+        return true;
     }
+    return false;
+}
+
+bool AudioService::DecodeUncompressed(const AudioStreamPacket& packet, std::vector<int16_t>& pcm) {
+    auto& payload = packet.payload;
+    if (packet.format == kAudioFormatPcm) {
+        pcm.resize(payload.size() / sizeof(int16_t));
+        memcpy(pcm.data(), payload.data(), pcm.size() * sizeof(int16_t));
+        return true;
+    }
+    if (packet.format == kAudioFormatAdpcm && payload.size() > AUDIO_ADPCM_HEADER_SIZE) {
+        ImaAdpcmState state;
+        state.predictor = (int16_t)(payload[0] | (payload[1] << 8));
+        state.step_index = payload[2] > 88 ? 88 : payload[2];
+        pcm.resize((payload.size() - AUDIO_ADPCM_HEADER_SIZE) * 2);
+        ImaAdpcm::Decode(state, payload.data() + AUDIO_ADPCM_HEADER_SIZE, pcm.size(), pcm.data());
+        return true;
+    }
+    return false;
 }
 
 void AudioService::PushTaskToEncodeQueue(AudioTaskType type, std::vector<int16_t>&& pcm) {
@@ -406,26 +673,69 @@ void AudioService::PushTaskToEncodeQueue(AudioTaskType type, std::vector<int16_t
 
     audio_queue_cv_.wait(lock, [this]() { return audio_encode_queue_.size() < MAX_ENCODE_TASKS_IN_QUEUE; });
     audio_encode_queue_.push_back(std::move(task));
+    flight_recorder_.Record(kFlightEventEncodeQueue, audio_encode_queue_.size());
     audio_queue_cv_.notify_all();
 }
 
-bool AudioService::PushPacketToDecodeQueue(std::unique_ptr<AudioStreamPacket> packet, bool wait) {
+uint32_t AudioService::GetDownlinkGeneration() {
+    std::lock_guard<std::mutex> lock(audio_queue_mutex_);
+    return downlink_generation_;
+}
+
+bool AudioService::PushPacketToDecodeQueue(std::unique_ptr<AudioStreamPacket> packet, bool wait, uint32_t generation) {
     std::unique_lock<std::mutex> lock(audio_queue_mutex_);
-    if (audio_decode_queue_.size() >= MAX_DECODE_PACKETS_IN_QUEUE) {
-        if (wait) {
-            audio_queue_cv_.wait(lock, [this]() { return audio_decode_queue_.size() < MAX_DECODE_PACKETS_IN_QUEUE; });
+    /* Once packets spill into the burst buffer the following ones queue behind them */
+    if (!wait && downlink_buffer_.enabled() &&
+        (audio_decode_queue_.size() >= MAX_DECODE_PACKETS_IN_QUEUE || !downlink_buffer_.empty())) {
+        bool pushed = downlink_buffer_.Push(*packet);
+        if (!pushed) {
+            flight_recorder_.Record(kFlightEventDecodeDrop, audio_decode_queue_.size());
+            flight_recorder_.Trigger(kFlightTriggerDecodeOverflow);
         } else {
+            flight_recorder_.RecordAudio(kFlightAudioDownlink, packet->payload.data(), packet->payload.size());
+        }
+        AudioPacketPool::GetInstance().Release(std::move(packet));
+        return pushed;
+    }
+    if (wait) {
+        /* Queue behind the packets in the burst buffer, and give up when the sound, the stream or the service stops */
+        bool sound = packet->sound != 0;
+        auto cancelled = [this, sound, generation]() {
+            return (sound && cancel_playing_sound_) || (generation != 0 && generation != downlink_generation_) ||
+                service_stopped_;
+        };
+        audio_queue_cv_.wait(lock, [this, &cancelled]() {
+            return (audio_decode_queue_.size() < MAX_DECODE_PACKETS_IN_QUEUE && downlink_buffer_.empty()) || cancelled();
+        });
+        if (cancelled()) {
+            AudioPacketPool::GetInstance().Release(std::move(packet));
             return false;
         }
+    } else if (audio_decode_queue_.size() >= MAX_DECODE_PACKETS_IN_QUEUE) {
+        flight_recorder_.Record(kFlightEventDecodeDrop, audio_decode_queue_.size());
+        flight_recorder_.Trigger(kFlightTriggerDecodeOverflow);
+        AudioPacketPool::GetInstance().Release(std::move(packet));
+        return false;
     }
+    flight_recorder_.RecordAudio(kFlightAudioDownlink, packet->payload.data(), packet->payload.size());
+    flight_recorder_.Record(kFlightEventDecodeQueue, audio_decode_queue_.size() + 1, packet->timestamp);
     audio_decode_queue_.push_back(std::move(packet));
     audio_queue_cv_.notify_all();
     return true;
 }
 
+/* Called with audio_queue_mutex_ held, the dropped packets go back to the pool like decoded ones */
+void AudioService::ReleaseDecodeQueue() {
+    auto& pool = AudioPacketPool::GetInstance();
+    for (auto& packet : audio_decode_queue_) {
+        pool.Release(std::move(packet));
+    }
+    audio_decode_queue_.clear();
+}
+
 std::unique_ptr<AudioStreamPacket> AudioService::PopPacketFromSendQueue() {
     std::lock_guard<std::mutex> lock(audio_queue_mutex_);
-    if (audio_send_queue_.empty()) {
+    if (audio_send_queue_.empty() || uplink_held_) {
         return nullptr;
     }
     auto packet = std::move(audio_send_queue_.front());
@@ -465,42 +775,136 @@ void AudioService::EnableWakeWordDetection(bool enable) {
                 return;
             }
             wake_word_initialized_ = true;
+            RecordAfeMemory();
         }
         wake_word_->Start();
+        input_fanout_.SetFrameSamples(wake_word_consumer_, wake_word_->GetFeedSize());
+        input_fanout_.EnableConsumer(wake_word_consumer_, true);
         xEventGroupSetBits(event_group_, AS_EVENT_WAKE_WORD_RUNNING);
     } else {
+        input_fanout_.EnableConsumer(wake_word_consumer_, false);
         wake_word_->Stop();
         xEventGroupClearBits(event_group_, AS_EVENT_WAKE_WORD_RUNNING);
     }
 }
 
+void AudioService::InitializeAudioProcessor() {
+    if (audio_processor_initialized_) {
+        return;
+    }
+    audio_processor_->Initialize(codec_, OPUS_FRAME_DURATION_MS, models_list_);
+    audio_processor_initialized_ = true;
+    RecordAfeMemory();
+}
+
+void AudioService::RecordAfeMemory() {
+    /* Taken once the wake word and the audio processor both hold their AFE, builds with and without
+       USE_SHARED_AFE are compared by this figure */
+    if (afe_psram_free_ != 0 || !audio_processor_initialized_ || (wake_word_ && !wake_word_initialized_)) {
+        return;
+    }
+    afe_psram_free_ = heap_caps_get_free_size(MALLOC_CAP_SPIRAM);
+#if CONFIG_USE_SHARED_AFE
+    ESP_LOGI(TAG, "Free PSRAM with wake word and audio processor set up: %u bytes, shared AFE", afe_psram_free_);
+#else
+    ESP_LOGI(TAG, "Free PSRAM with wake word and audio processor set up: %u bytes, separate AFE", afe_psram_free_);
+#endif
+}
+
+void AudioService::MarkListeningRequest() {
+    listen_request_us_ = esp_timer_get_time();
+    listen_input_warm_ = codec_->input_enabled();
+}
+
+void AudioService::SetInputKeepWarm(bool keep_warm) {
+    input_keep_warm_ = keep_warm;
+}
+
+void AudioService::PrepareVoiceProcessing(bool capture_ahead) {
+    /* Creating the AFE takes a while, do it while the audio channel is still connecting */
+    InitializeAudioProcessor();
+    if (!capture_ahead || IsAudioProcessorRunning()) {
+        return;
+    }
+
+    /* Capture right away, the audio is held as PCM until ReleaseUplink. A sound that is playing,
+       like the wake word popup or an alert, plays to its end, and wake word detection stops first
+       like it does when listening starts. */
+    EnableWakeWordDetection(false);
+    {
+        std::lock_guard<std::mutex> lock(audio_queue_mutex_);
+        audio_send_queue_.clear();
+        audio_held_queue_.clear();
+        uplink_held_ = true;
+    }
+    StartVoiceProcessing();
+}
+
+void AudioService::ReleaseUplink() {
+    {
+        std::lock_guard<std::mutex> lock(audio_queue_mutex_);
+        if (!uplink_held_) {
+            return;
+        }
+        /* The channel is open and SetAudioFormats was called, the codec task encodes the held audio now */
+        uplink_held_ = false;
+        ESP_LOGI(TAG, "Release %u frames captured ahead as %s", audio_held_queue_.size(),
+            Protocol::GetAudioFormatName(uplink_format_));
+        audio_queue_cv_.notify_all();
+    }
+}
+
 void AudioService::EnableVoiceProcessing(bool enable) {
     ESP_LOGD(TAG, "%s voice processing", enable ? "Enabling" : "Disabling");
     if (enable) {
-        if (!audio_processor_initialized_) {
-            audio_processor_->Initialize(codec_, OPUS_FRAME_DURATION_MS, models_list_);
-            audio_processor_initialized_ = true;
-        }
+        InitializeAudioProcessor();
 
         /* We should make sure no audio is playing */
         ResetDecoder();
-        audio_input_need_warmup_ = true;
-        audio_processor_->Start();
-        xEventGroupSetBits(event_group_, AS_EVENT_AUDIO_PROCESSOR_RUNNING);
+        StartVoiceProcessing();
     } else {
+        if (end_of_utterance_timer_ != nullptr) {
+            esp_timer_stop(end_of_utterance_timer_);
+        }
+        input_fanout_.EnableConsumer(audio_processor_consumer_, false);
         audio_processor_->Stop();
         xEventGroupClearBits(event_group_, AS_EVENT_AUDIO_PROCESSOR_RUNNING);
+        listen_request_us_ = 0;
+
+        /* Audio captured ahead of a listening turn that never started is not sent */
+        std::lock_guard<std::mutex> lock(audio_queue_mutex_);
+        if (uplink_held_) {
+            uplink_held_ = false;
+            audio_send_queue_.clear();
+            audio_queue_cv_.notify_all();
+        }
+        audio_held_queue_.clear();
     }
 }
 
+void AudioService::StartVoiceProcessing() {
+    if (listen_request_us_ == 0) {
+        MarkListeningRequest();
+    }
+    endpointer_.Reset();
+    /* The input task is not feeding the processor yet, a tier chosen while idle is applied here */
+    ApplyPendingComputeTier();
+    audio_processor_->Start();
+    input_fanout_.SetFrameSamples(audio_processor_consumer_, audio_processor_->GetFeedSize());
+    input_fanout_.EnableConsumer(audio_processor_consumer_, true);
+    xEventGroupSetBits(event_group_, AS_EVENT_AUDIO_PROCESSOR_RUNNING);
+}
+
 void AudioService::EnableAudioTesting(bool enable) {
     ESP_LOGI(TAG, "%s audio testing", enable ? "Enabling" : "Disabling");
+    input_fanout_.EnableConsumer(audio_testing_consumer_, enable);
     if (enable) {
         xEventGroupSetBits(event_group_, AS_EVENT_AUDIO_TESTING_RUNNING);
     } else {
         xEventGroupClearBits(event_group_, AS_EVENT_AUDIO_TESTING_RUNNING);
         /* Copy audio_testing_queue_ to audio_decode_queue_ */
         std::lock_guard<std::mutex> lock(audio_queue_mutex_);
+        ReleaseDecodeQueue();
         audio_decode_queue_ = std::move(audio_testing_queue_);
         audio_queue_cv_.notify_all();
     }
@@ -508,137 +912,280 @@ void AudioService::EnableAudioTesting(bool enable) {
 
 void AudioService::EnableDeviceAec(bool enable) {
     ESP_LOGI(TAG, "%s device AEC", enable ? "Enabling" : "Disabling");
-    if (!audio_processor_initialized_) {
-        audio_processor_->Initialize(codec_, OPUS_FRAME_DURATION_MS, models_list_);
-        audio_processor_initialized_ = true;
-    }
+    InitializeAudioProcessor();
 
     audio_processor_->EnableDeviceAec(enable);
 }
 
+int AudioService::AddInputConsumer(const char* name, const AudioInputFormat& format, size_t max_frames, AudioBackpressurePolicy policy) {
+    int id = input_fanout_.AddQueueConsumer(name, format, max_frames, policy);
+    xEventGroupSetBits(event_group_, AS_EVENT_INPUT_CONSUMERS_RUNNING);
+    return id;
+}
+
+void AudioService::RemoveInputConsumer(int id) {
+    input_fanout_.RemoveConsumer(id);
+    if (!input_fanout_.HasQueueConsumers()) {
+        xEventGroupClearBits(event_group_, AS_EVENT_INPUT_CONSUMERS_RUNNING);
+    }
+}
+
+bool AudioService::ReadInputFrame(int id, std::vector<int16_t>& frame, int timeout_ms) {
+    return input_fanout_.ReadFrame(id, frame, timeout_ms);
+}
+
 void AudioService::SetCallbacks(AudioServiceCallbacks& callbacks) {
     callbacks_ = callbacks;
 }
 
-void AudioService::PlaySound(const std::string_view& ogg) {
-    if (!codec_->output_enabled()) {
-        esp_timer_stop(audio_power_timer_);
-        esp_timer_start_periodic(audio_power_timer_, AUDIO_POWER_CHECK_INTERVAL_MS * 1000);
-        codec_->EnableOutput(true);
+SoundHandle AudioService::PlaySound(const std::string_view& sound, SoundPolicy policy) {
+    return PlaySounds({sound}, policy);
+}
+
+SoundHandle AudioService::PlaySounds(const std::vector<std::string_view>& playlist, SoundPolicy policy) {
+    std::lock_guard<std::mutex> lock(sound_mutex_);
+    if (policy == kSoundPolicyInterrupt || policy == kSoundPolicyReplace) {
+        sound_queue_.clear();
+    }
+    if (policy == kSoundPolicyInterrupt && playing_sound_ != 0) {
+        cancel_playing_sound_ = true;
+        NotifySoundCancelled();
     }
 
-    const uint8_t* buf = reinterpret_cast<const uint8_t*>(ogg.data());
-    size_t size = ogg.size();
-    size_t offset = 0;
+    auto handle = next_sound_handle_++;
+    if (next_sound_handle_ == 0) {
+        next_sound_handle_ = 1;
+    }
+    sound_queue_.push_back(SoundRequest{handle, playlist});
+    sound_cv_.notify_all();
+    return handle;
+}
 
-    auto find_page = [&](size_t start)->size_t {
-        for (size_t i = start; i + 4 <= size; ++i) {
-            if (buf[i] == 'O' && buf[i+1] == 'g' && buf[i+2] == 'g' && buf[i+3] == 'S') return i;
+void AudioService::CancelSound(SoundHandle handle) {
+    std::lock_guard<std::mutex> lock(sound_mutex_);
+    if (playing_sound_ == handle) {
+        cancel_playing_sound_ = true;
+    } else {
+        auto it = std::find_if(sound_queue_.begin(), sound_queue_.end(),
+            [handle](const SoundRequest& request) { return request.handle == handle; });
+        if (it != sound_queue_.end()) {
+            sound_queue_.erase(it);
         }
-        return static_cast<size_t>(-1);
-    };
+    }
+    sound_cv_.notify_all();
+    NotifySoundCancelled();
+}
 
-    bool seen_head = false;
-    bool seen_tags = false;
-    int sample_rate = 16000; // 默认值
+void AudioService::CancelAllSounds() {
+    std::lock_guard<std::mutex> lock(sound_mutex_);
+    sound_queue_.clear();
+    if (playing_sound_ != 0) {
+        cancel_playing_sound_ = true;
+    }
+    sound_cv_.notify_all();
+    NotifySoundCancelled();
+}
 
+bool AudioService::IsSoundPending(SoundHandle handle) {
+    std::lock_guard<std::mutex> lock(sound_mutex_);
+    if (playing_sound_ == handle) {
+        return true;
+    }
+    return std::any_of(sound_queue_.begin(), sound_queue_.end(),
+        [handle](const SoundRequest& request) { return request.handle == handle; });
+}
+
+bool AudioService::WaitForSound(SoundHandle handle, int timeout_ms) {
+    std::unique_lock<std::mutex> lock(sound_mutex_);
+    auto finished = [this, handle]() {
+        return playing_sound_ != handle && std::none_of(sound_queue_.begin(), sound_queue_.end(),
+            [handle](const SoundRequest& request) { return request.handle == handle; });
+    };
+    if (timeout_ms < 0) {
+        sound_cv_.wait(lock, finished);
+        return true;
+    }
+    return sound_cv_.wait_for(lock, std::chrono::milliseconds(timeout_ms), finished);
+}
+
+void AudioService::AudioSoundTask() {
     while (true) {
-        size_t pos = find_page(offset);
-        if (pos == static_cast<size_t>(-1)) break;
-        offset = pos;
-        if (offset + 27 > size) break;
-
-        const uint8_t* page = buf + offset;
-        uint8_t page_segments = page[26];
-        size_t seg_table_off = offset + 27;
-        if (seg_table_off + page_segments > size) break;
-
-        size_t body_size = 0;
-        for (size_t i = 0; i < page_segments; ++i) body_size += page[27 + i];
-
-        size_t body_off = seg_table_off + page_segments;
-        if (body_off + body_size > size) break;
-
-        // Parse packets using lacing
-        size_t cur = body_off;
-        size_t seg_idx = 0;
-        while (seg_idx < page_segments) {
-            size_t pkt_len = 0;
-            size_t pkt_start = cur;
-            bool continued = false;
-            do {
-                uint8_t l = page[27 + seg_idx++];
-                pkt_len += l;
-                cur += l;
-                continued = (l == 255);
-            } while (continued && seg_idx < page_segments);
-
-            if (pkt_len == 0) continue;
-            const uint8_t* pkt_ptr = buf + pkt_start;
-
-            if (!seen_head) {
-                // 解析OpusHead包
-                if (pkt_len >= 19 && std::memcmp(pkt_ptr, "OpusHead", 8) == 0) {
-                    seen_head = true;
-                    
-                    // OpusHead结构：[0-7] "OpusHead", [8] version, [9] channel_count, [10-11] pre_skip
-                    // [12-15] input_sample_rate, [16-17] output_gain, [18] mapping_family
-                    if (pkt_len >= 12) {
-                        uint8_t version = pkt_ptr[8];
-                        uint8_t channel_count = pkt_ptr[9];
-                        
-                        if (pkt_len >= 16) {
-                            // 读取输入采样率 (little-endian)
-                            sample_rate = pkt_ptr[12] | (pkt_ptr[13] << 8) | 
-                                        (pkt_ptr[14] << 16) | (pkt_ptr[15] << 24);
-                            ESP_LOGI(TAG, "OpusHead: version=%d, channels=%d, sample_rate=%d", 
-                                   version, channel_count, sample_rate);
-                        }
-                    }
-                }
-                continue;
+        std::unique_lock<std::mutex> lock(sound_mutex_);
+        sound_cv_.wait(lock, [this]() { return !sound_queue_.empty() || service_stopped_; });
+        if (service_stopped_) {
+            playing_sound_ = 0;
+            sound_queue_.clear();
+            sound_cv_.notify_all();
+            break;
+        }
+
+        auto request = std::move(sound_queue_.front());
+        sound_queue_.pop_front();
+        playing_sound_ = request.handle;
+        cancel_playing_sound_ = false;
+        lock.unlock();
+
+        if (!codec_->output_enabled()) {
+            esp_timer_stop(audio_power_timer_);
+            esp_timer_start_periodic(audio_power_timer_, AUDIO_POWER_CHECK_INTERVAL_MS * 1000);
+            codec_->EnableOutput(true);
+        }
+
+        for (auto& sound : request.playlist) {
+            if (!PlayOggSound(sound, request.handle)) {
+                break;
             }
-            if (!seen_tags) {
-                // Expect OpusTags in second packet
-                if (pkt_len >= 8 && std::memcmp(pkt_ptr, "OpusTags", 8) == 0) {
-                    seen_tags = true;
+        }
+
+        /*
+         * The sound is finished once its frames have left the decoder and the speaker.
+         * A cancelled sound drops its queued frames, other audio in the queues is left alone.
+         */
+        {
+            std::unique_lock<std::mutex> queue_lock(audio_queue_mutex_);
+            while (!service_stopped_) {
+                if (cancel_playing_sound_) {
+                    DropSoundFrames(request.handle);
                 }
-                continue;
+                if (!HasSoundFrames(request.handle)) {
+                    break;
+                }
+                audio_queue_cv_.wait(queue_lock);
             }
-
-            // Audio packet (Opus)
-            auto packet = std::make_unique<AudioStreamPacket>();
-            packet->sample_rate = sample_rate;
-            packet->frame_duration = 60;
-            packet->payload.resize(pkt_len);
-            std::memcpy(packet->payload.data(), pkt_ptr, pkt_len);
-            PushPacketToDecodeQueue(std::move(packet), true);
         }
 
-        offset = body_off + body_size;
+        lock.lock();
+        playing_sound_ = 0;
+        sound_cv_.notify_all();
+    }
+
+    ESP_LOGW(TAG, "Audio sound task stopped");
+}
+
+bool AudioService::PlayOggSound(const std::string_view& ogg, SoundHandle handle) {
+    OggOpusDemuxer demuxer;
+    return demuxer.Feed(reinterpret_cast<const uint8_t*>(ogg.data()), ogg.size(),
+        [this, handle](std::unique_ptr<AudioStreamPacket> packet) {
+            packet->sound = handle;
+            return PushPacketToDecodeQueue(std::move(packet), true);
+        });
+}
+
+/* Wakes the sound task and a blocked push, under the queue lock so the wakeup cannot be missed */
+void AudioService::NotifySoundCancelled() {
+    std::lock_guard<std::mutex> lock(audio_queue_mutex_);
+    audio_queue_cv_.notify_all();
+}
+
+/* Called with audio_queue_mutex_ held */
+bool AudioService::HasSoundFrames(SoundHandle handle) const {
+    if (decoding_sound_ == handle || writing_sound_ == handle) {
+        return true;
+    }
+    return std::any_of(audio_decode_queue_.begin(), audio_decode_queue_.end(),
+            [handle](const std::unique_ptr<AudioStreamPacket>& packet) { return packet->sound == handle; }) ||
+        std::any_of(audio_playback_queue_.begin(), audio_playback_queue_.end(),
+            [handle](const std::unique_ptr<AudioTask>& task) { return task->sound == handle; });
+}
+
+/* Called with audio_queue_mutex_ held */
+void AudioService::DropSoundFrames(SoundHandle handle) {
+    auto decode_end = std::remove_if(audio_decode_queue_.begin(), audio_decode_queue_.end(),
+        [handle](const std::unique_ptr<AudioStreamPacket>& packet) { return packet->sound == handle; });
+    auto playback_end = std::remove_if(audio_playback_queue_.begin(), audio_playback_queue_.end(),
+        [handle](const std::unique_ptr<AudioTask>& task) { return task->sound == handle; });
+    if (decode_end != audio_decode_queue_.end() || playback_end != audio_playback_queue_.end()) {
+        audio_decode_queue_.erase(decode_end, audio_decode_queue_.end());
+        audio_playback_queue_.erase(playback_end, audio_playback_queue_.end());
+        audio_queue_cv_.notify_all();
     }
 }
 
 bool AudioService::IsIdle() {
+    {
+        std::lock_guard<std::mutex> sound_lock(sound_mutex_);
+        if (playing_sound_ != 0 || !sound_queue_.empty()) {
+            return false;
+        }
+    }
     std::lock_guard<std::mutex> lock(audio_queue_mutex_);
-    return audio_encode_queue_.empty() && audio_decode_queue_.empty() && audio_playback_queue_.empty() && audio_testing_queue_.empty();
+    return audio_encode_queue_.empty() && audio_decode_queue_.empty() && downlink_buffer_.empty() &&
+        audio_playback_queue_.empty() && audio_testing_queue_.empty();
 }
 
 void AudioService::ResetDecoder() {
-    std::lock_guard<std::mutex> lock(audio_queue_mutex_);
-    opus_decoder_->ResetState();
-    timestamp_queue_.clear();
-    audio_decode_queue_.clear();
-    audio_playback_queue_.clear();
-    audio_testing_queue_.clear();
-    audio_queue_cv_.notify_all();
+    /* Whatever was about to play is dropped, a sound would otherwise keep feeding the new stream */
+    CancelAllSounds();
+    {
+        std::lock_guard<std::mutex> lock(audio_queue_mutex_);
+        if (++downlink_generation_ == 0) {
+            downlink_generation_ = 1;
+        }
+        opus_decoder_->ResetState();
+        timestamp_queue_.clear();
+        ReleaseDecodeQueue();
+        downlink_buffer_.Clear();
+        audio_playback_queue_.clear();
+        audio_testing_queue_.clear();
+        audio_queue_cv_.notify_all();
+    }
+    CheckPlaybackDrained();
+}
+
+void AudioService::OnPlaybackDrained(std::function<void()> callback) {
+    {
+        std::lock_guard<std::mutex> lock(audio_queue_mutex_);
+        playback_drained_callback_ = callback;
+        playback_drain_requested_us_ = esp_timer_get_time();
+    }
+    if (callback) {
+        CheckPlaybackDrained();
+    } else {
+        esp_timer_stop(playback_drain_timer_);
+    }
+}
+
+bool AudioService::IsPlaybackPipelineEmpty() const {
+    return audio_decode_queue_.empty() && downlink_buffer_.empty() && !playback_decoding_ &&
+        audio_playback_queue_.empty() && !playback_writing_;
+}
+
+void AudioService::CheckPlaybackDrained() {
+    int64_t remaining_us;
+    {
+        std::lock_guard<std::mutex> lock(audio_queue_mutex_);
+        if (!playback_drained_callback_ || !IsPlaybackPipelineEmpty()) {
+            return;
+        }
+        remaining_us = dma_drained_at_us_ - esp_timer_get_time();
+    }
+    /* Nothing is queued any more, wait for the DMA ring to play out */
+    esp_timer_stop(playback_drain_timer_);
+    esp_timer_start_once(playback_drain_timer_, std::max<int64_t>(remaining_us, 0) + 1);
+}
+
+void AudioService::OnPlaybackDrainTimer() {
+    std::function<void()> callback;
+    int64_t waited_us;
+    {
+        std::lock_guard<std::mutex> lock(audio_queue_mutex_);
+        // New audio arrived meanwhile, the output task checks again after its next write
+        if (!playback_drained_callback_ || !IsPlaybackPipelineEmpty() || dma_drained_at_us_ > esp_timer_get_time()) {
+            return;
+        }
+        callback = std::move(playback_drained_callback_);
+        playback_drained_callback_ = nullptr;
+        waited_us = esp_timer_get_time() - playback_drain_requested_us_;
+    }
+    ESP_LOGI(TAG, "Playback drained %lld ms after it was requested", waited_us / 1000);
+    callback();
 }
 
 void AudioService::CheckAndUpdateAudioPowerState() {
     auto now = std::chrono::steady_clock::now();
     auto input_elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(now - last_input_time_).count();
     auto output_elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(now - last_output_time_).count();
-    if (input_elapsed > AUDIO_POWER_TIMEOUT_MS && codec_->input_enabled()) {
+    if (input_elapsed > AUDIO_POWER_TIMEOUT_MS && codec_->input_enabled() && !input_keep_warm_) {
         codec_->EnableInput(false);
     }
     if (output_elapsed > AUDIO_POWER_TIMEOUT_MS && codec_->output_enabled()) {
@@ -670,11 +1217,23 @@ void AudioService::SetModelsList(srmodel_list_t* models_list) {
 
     if (wake_word_) {
         wake_word_->OnWakeWordDetected([this](const std::string& wake_word) {
+            flight_recorder_.Record(kFlightEventWakeWord);
             if (callbacks_.on_wake_word_detected) {
                 callbacks_.on_wake_word_detected(wake_word);
             }
         });
     }
+
+#if CONFIG_IDF_TARGET_ESP32S3 || CONFIG_IDF_TARGET_ESP32P4
+    auto custom_wake_word = dynamic_cast<CustomWakeWord*>(wake_word_.get());
+    if (custom_wake_word != nullptr) {
+        custom_wake_word->OnLocalCommand([this](const std::string& tool, const std::string& arguments) {
+            if (callbacks_.on_local_command) {
+                callbacks_.on_local_command(tool, arguments);
+            }
+        });
+    }
+#endif
 }
 
 bool AudioService::IsAfeWakeWord() {
@@ -684,3 +1243,135 @@ bool AudioService::IsAfeWakeWord() {
     return false;
 #endif
 }
+
+void AudioService::UpdateComputeTier() {
+    AudioPipelineLoad load;
+    {
+        std::lock_guard<std::mutex> lock(audio_queue_mutex_);
+        load.encode_queue = audio_encode_queue_.size();
+        load.encode_queue_max = MAX_ENCODE_TASKS_IN_QUEUE;
+        load.send_queue = audio_send_queue_.size();
+        load.send_queue_max = MAX_SEND_PACKETS_IN_QUEUE;
+        load.decode_queue = audio_decode_queue_.size();
+        load.playback_queue = audio_playback_queue_.size();
+    }
+
+    auto previous_tier = governor_.tier();
+    auto tier = governor_.Update(load);
+    if (tier == previous_tier) {
+        return;
+    }
+
+    opus_complexity_ = governor_.opus_complexity();
+    /* The AFE must not be reconfigured from the timer task while the input task feeds it */
+    pending_compute_tier_ = tier;
+}
+
+void AudioService::ApplyPendingComputeTier() {
+    int tier = pending_compute_tier_.exchange(-1);
+    if (tier >= 0 && audio_processor_) {
+        audio_processor_->SetComputeTier((AudioComputeTier)tier);
+    }
+}
+
+cJSON* AudioService::GetStatusJson() {
+    auto root = cJSON_CreateObject();
+    cJSON_AddStringToObject(root, "compute_tier", governor_.tier_name());
+    cJSON_AddNumberToObject(root, "opus_complexity", opus_complexity_);
+    cJSON_AddNumberToObject(root, "opus_bitrate", opus_bitrate_);
+    cJSON_AddNumberToObject(root, "opus_fec_loss", opus_fec_loss_percent_);
+    cJSON_AddNumberToObject(root, "cpu_busy", governor_.cpu_busy_percent());
+    cJSON_AddStringToObject(root, "uplink_format", Protocol::GetAudioFormatName(uplink_format_));
+    cJSON_AddStringToObject(root, "downlink_format", Protocol::GetAudioFormatName(downlink_format_));
+    auto formats = cJSON_CreateArray();
+    for (auto& profile : AUDIO_FORMAT_PROFILES) {
+        // The CPU side of the profile is measured, 0 until the format has been used
+        auto& encode = profile.format == kAudioFormatOpus ? performance_statistics_.opus_encode : performance_statistics_.adpcm_encode;
+        auto item = cJSON_CreateObject();
+        cJSON_AddStringToObject(item, "format", Protocol::GetAudioFormatName(profile.format));
+        cJSON_AddNumberToObject(item, "bitrate", profile.bitrate);
+        cJSON_AddNumberToObject(item, "encode_rtf", profile.format == kAudioFormatPcm || encode.audio_us == 0 ?
+            0 : (double)encode.busy_us / encode.audio_us);
+        cJSON_AddItemToArray(formats, item);
+    }
+    cJSON_AddItemToObject(root, "formats", formats);
+    cJSON_AddBoolToObject(root, "input_warm", codec_->input_enabled());
+    cJSON_AddNumberToObject(root, "listen_latency_ms", listen_latency_ms_);
+    if (downlink_buffer_.enabled()) {
+        std::lock_guard<std::mutex> lock(audio_queue_mutex_);
+        auto buffer = cJSON_CreateObject();
+        cJSON_AddNumberToObject(buffer, "capacity_bytes", downlink_buffer_.capacity());
+        cJSON_AddNumberToObject(buffer, "used_bytes", downlink_buffer_.used_bytes());
+        cJSON_AddNumberToObject(buffer, "peak_bytes", downlink_buffer_.peak_bytes());
+        cJSON_AddNumberToObject(buffer, "buffered_ms", downlink_buffer_.buffered_ms());
+        cJSON_AddItemToObject(root, "downlink_buffer", buffer);
+    }
+    cJSON_AddItemToObject(root, "packet_pool", AudioPacketPool::GetInstance().GetStatusJson());
+    if (afe_psram_free_ != 0) {
+        cJSON_AddNumberToObject(root, "afe_psram_free_bytes", afe_psram_free_);
+    }
+#if CONFIG_USE_SHARED_AFE
+    cJSON_AddItemToObject(root, "afe", AfeService::GetInstance().GetStatusJson());
+#endif
+    return root;
+}
+
+static cJSON* CreateKernelJson(const AudioKernelStatistics& stats) {
+    uint32_t frames = stats.frames;
+    int64_t busy_us = stats.busy_us;
+    int64_t audio_us = stats.audio_us;
+    auto root = cJSON_CreateObject();
+    cJSON_AddNumberToObject(root, "frames", frames);
+    cJSON_AddNumberToObject(root, "ns_per_frame", frames > 0 ? (double)busy_us * 1000 / frames : 0);
+    cJSON_AddNumberToObject(root, "max_us", stats.max_us);
+    cJSON_AddNumberToObject(root, "rtf", audio_us > 0 ? (double)busy_us / audio_us : 0);
+    return root;
+}
+
+cJSON* AudioService::GetPerformanceJson() {
+    auto root = cJSON_CreateObject();
+    cJSON_AddStringToObject(root, "version", esp_app_get_description()->version);
+    cJSON_AddStringToObject(root, "board", BOARD_NAME);
+    cJSON_AddNumberToObject(root, "input_sample_rate", codec_->input_sample_rate());
+    cJSON_AddNumberToObject(root, "output_sample_rate", codec_->output_sample_rate());
+    cJSON_AddNumberToObject(root, "opus_complexity", opus_complexity_);
+    auto kernels = cJSON_CreateObject();
+    cJSON_AddItemToObject(kernels, "opus_encode", CreateKernelJson(performance_statistics_.opus_encode));
+    cJSON_AddItemToObject(kernels, "opus_decode", CreateKernelJson(performance_statistics_.opus_decode));
+    cJSON_AddItemToObject(kernels, "input_resample", CreateKernelJson(performance_statistics_.input_resample));
+    cJSON_AddItemToObject(kernels, "output_resample", CreateKernelJson(performance_statistics_.output_resample));
+    cJSON_AddItemToObject(kernels, "adpcm_encode", CreateKernelJson(performance_statistics_.adpcm_encode));
+    cJSON_AddItemToObject(kernels, "adpcm_decode", CreateKernelJson(performance_statistics_.adpcm_decode));
+    cJSON_AddItemToObject(root, "kernels", kernels);
+    // The pipeline internals stay out of the device status the assistant sees
+    cJSON_AddItemToObject(root, "pipeline", GetStatusJson());
+    return root;
+}
+
+void AudioService::ResetPerformanceStatistics() {
+    performance_statistics_.Reset();
+}
+
+/*
+ * Endpointing on the VAD edges, the rule is in UtteranceEndpointer: once the user has spoken for
+ * CONFIG_ENDPOINT_MIN_SPEECH_MS in total, a silence edge arms a one-shot timer of
+ * CONFIG_ENDPOINT_TRAILING_SILENCE_MS. Speech before it fires cancels the timer, otherwise the end
+ * of utterance callback is raised.
+ */
+void AudioService::UpdateEndpointing(bool speaking) {
+    if (end_of_utterance_timer_ == nullptr) {
+        return;
+    }
+
+    switch (endpointer_.OnVadChange(speaking, esp_timer_get_time())) {
+    case UtteranceEndpointer::kActionCancelTimer:
+        esp_timer_stop(end_of_utterance_timer_);
+        break;
+    case UtteranceEndpointer::kActionArmTimer:
+        esp_timer_stop(end_of_utterance_timer_);
+        esp_timer_start_once(end_of_utterance_timer_, endpointer_.trailing_silence_ms() * 1000);
+        break;
+    default:
+        break;
+    }
+}
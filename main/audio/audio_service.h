@@ -6,12 +6,15 @@
 #include <condition_variable>
 #include <chrono>
 #include <mutex>
+#include <atomic>
+#include <string_view>
 
 #include <freertos/FreeRTOS.h>
 #include <freertos/task.h>
 #include <freertos/event_groups.h>
 #include <esp_timer.h>
 #include <model_path.h>
+#include <cJSON.h>
 
 #include <opus_encoder.h>
 #include <opus_decoder.h>
@@ -19,6 +22,13 @@
 
 #include "audio_codec.h"
 #include "audio_processor.h"
+#include "audio_governor.h"
+#include "adaptive_opus_encoder.h"
+#include "audio_flight_recorder.h"
+#include "audio_input_fanout.h"
+#include "downlink_buffer.h"
+#include "utterance_endpointer.h"
+#include "ima_adpcm.h"
 #include "processors/audio_debugger.h"
 #include "wake_word.h"
 #include "protocol.h"
@@ -40,23 +50,33 @@
 #define MAX_PLAYBACK_TASKS_IN_QUEUE 2
 #define MAX_DECODE_PACKETS_IN_QUEUE (2400 / OPUS_FRAME_DURATION_MS)
 #define MAX_SEND_PACKETS_IN_QUEUE (2400 / OPUS_FRAME_DURATION_MS)
+// Audio captured while the channel connects is held as PCM, 32 KB per second, so only the last 1.2 s is kept
+#define MAX_HELD_ENCODE_TASKS_IN_QUEUE (1200 / OPUS_FRAME_DURATION_MS)
 #define AUDIO_TESTING_MAX_DURATION_MS 10000
 #define MAX_TIMESTAMPS_IN_QUEUE 3
 
 #define AUDIO_POWER_TIMEOUT_MS 15000
 #define AUDIO_POWER_CHECK_INTERVAL_MS 1000
+#define AUDIO_GOVERNOR_INTERVAL_MS 1000
+#define AUDIO_UNDERRUN_MAX_GAP_MS 1000
+#define AUDIO_INPUT_CAPTURE_FRAME_MS 10
+#define AUDIO_INPUT_SETTLE_MS 120
+#define AUDIO_ADPCM_HEADER_SIZE 4
 
 
 #define AS_EVENT_AUDIO_TESTING_RUNNING      (1 << 0)
 #define AS_EVENT_WAKE_WORD_RUNNING          (1 << 1)
 #define AS_EVENT_AUDIO_PROCESSOR_RUNNING    (1 << 2)
 #define AS_EVENT_PLAYBACK_NOT_EMPTY         (1 << 3)
+#define AS_EVENT_INPUT_CONSUMERS_RUNNING    (1 << 4)
 
 struct AudioServiceCallbacks {
     std::function<void(void)> on_send_queue_available;
     std::function<void(const std::string&)> on_wake_word_detected;
     std::function<void(bool)> on_vad_change;
     std::function<void(void)> on_audio_testing_queue_full;
+    std::function<void(void)> on_end_of_utterance;
+    std::function<void(const std::string& tool, const std::string& arguments)> on_local_command;
 };
 
 
@@ -66,10 +86,31 @@ enum AudioTaskType {
     kAudioTaskTypeDecodeToPlaybackQueue,
 };
 
+/*
+ * How a new sound is scheduled relative to the sounds already queued:
+ * Enqueue plays it after them, Interrupt stops the current sound and drops the queue,
+ * Replace lets the current sound finish but drops the pending ones.
+ */
+enum SoundPolicy {
+    kSoundPolicyEnqueue,
+    kSoundPolicyInterrupt,
+    kSoundPolicyReplace,
+};
+
+/* Identifies a queued sound or playlist, 0 is never a valid handle */
+typedef uint32_t SoundHandle;
+
+struct SoundRequest {
+    SoundHandle handle;
+    // Sounds are embedded assets, the data must stay valid until played
+    std::vector<std::string_view> playlist;
+};
+
 struct AudioTask {
     AudioTaskType type;
     std::vector<int16_t> pcm;
     uint32_t timestamp;
+    SoundHandle sound = 0;
 };
 
 struct DebugStatistics {
@@ -79,6 +120,54 @@ struct DebugStatistics {
     uint32_t playback_count = 0;
 };
 
+/* Time spent in one DSP kernel compared to the duration of audio it processed */
+struct AudioKernelStatistics {
+    /* Each kernel is recorded by one task, the reader and Reset may run on any task */
+    std::atomic<uint32_t> frames = 0;
+    std::atomic<int64_t> busy_us = 0;
+    std::atomic<int64_t> audio_us = 0;
+    std::atomic<int64_t> max_us = 0;
+
+    void Record(int64_t elapsed_us, int64_t audio_duration_us) {
+        frames++;
+        busy_us += elapsed_us;
+        audio_us += audio_duration_us;
+        if (elapsed_us > max_us) {
+            max_us = elapsed_us;
+        }
+    }
+
+    void Reset() {
+        frames = 0;
+        busy_us = 0;
+        audio_us = 0;
+        max_us = 0;
+    }
+};
+
+struct PerformanceStatistics {
+    AudioKernelStatistics opus_encode;
+    AudioKernelStatistics opus_decode;
+    AudioKernelStatistics input_resample;
+    AudioKernelStatistics output_resample;
+    AudioKernelStatistics adpcm_encode;
+    AudioKernelStatistics adpcm_decode;
+
+    void Reset() {
+        opus_encode.Reset();
+        opus_decode.Reset();
+        input_resample.Reset();
+        output_resample.Reset();
+        adpcm_encode.Reset();
+        adpcm_decode.Reset();
+    }
+};
+
+struct AudioFormatProfile {
+    AudioFormat format;
+    int bitrate;
+};
+
 class AudioService {
 public:
     AudioService();
@@ -100,15 +189,47 @@ public:
     void EnableVoiceProcessing(bool enable);
     void EnableAudioTesting(bool enable);
     void EnableDeviceAec(bool enable);
+    // Initializes the processor early, with capture_ahead it also starts capturing and holds
+    // the captured audio as PCM until ReleaseUplink
+    void PrepareVoiceProcessing(bool capture_ahead);
+    void ReleaseUplink();
+    // Keeps the codec input powered between turns
+    void SetInputKeepWarm(bool keep_warm);
+    // Starts the latency measurement up to the first frame in the send path
+    void MarkListeningRequest();
 
     void SetCallbacks(AudioServiceCallbacks& callbacks);
 
-    bool PushPacketToDecodeQueue(std::unique_ptr<AudioStreamPacket> packet, bool wait = false);
+    // With a generation from GetDownlinkGeneration, a push that waits is dropped once ResetDecoder runs
+    bool PushPacketToDecodeQueue(std::unique_ptr<AudioStreamPacket> packet, bool wait = false, uint32_t generation = 0);
+    uint32_t GetDownlinkGeneration();
     std::unique_ptr<AudioStreamPacket> PopPacketFromSendQueue();
-    void PlaySound(const std::string_view& sound);
-    bool ReadAudioData(std::vector<int16_t>& data, int sample_rate, int samples);
+    SoundHandle PlaySound(const std::string_view& sound, SoundPolicy policy = kSoundPolicyEnqueue);
+    SoundHandle PlaySounds(const std::vector<std::string_view>& playlist, SoundPolicy policy = kSoundPolicyEnqueue);
+    void CancelSound(SoundHandle handle);
+    void CancelAllSounds();
+    bool IsSoundPending(SoundHandle handle);
+    bool WaitForSound(SoundHandle handle, int timeout_ms = -1);
+    // Other features read the mic through their own consumer instead of reading the codec directly
+    int AddInputConsumer(const char* name, const AudioInputFormat& format, size_t max_frames,
+        AudioBackpressurePolicy policy = kAudioBackpressureDropOldest);
+    void RemoveInputConsumer(int id);
+    bool ReadInputFrame(int id, std::vector<int16_t>& frame, int timeout_ms);
     void ResetDecoder();
+    // Calls back once from the timer task when every sample queued so far has left the DAC,
+    // a later call replaces the callback and nullptr cancels it
+    void OnPlaybackDrained(std::function<void()> callback);
+    // Formats negotiated for the current audio channel, sounds are always Opus
+    void SetAudioFormats(AudioFormat uplink, AudioFormat downlink);
+    // Chosen by the link estimator, applied to the uplink Opus encoder before its next frame
+    void SetUplinkBitrate(int bitrate, int fec_loss_percent);
     void SetModelsList(srmodel_list_t* models_list);
+    // Returns a new cJSON object describing the audio pipeline, the caller takes ownership
+    cJSON* GetStatusJson();
+    // Returns a new cJSON object with ns/frame and real-time factor of each DSP kernel
+    cJSON* GetPerformanceJson();
+    void ResetPerformanceStatistics();
+    AudioFlightRecorder& GetFlightRecorder() { return flight_recorder_; }
 
 private:
     AudioCodec* codec_ = nullptr;
@@ -116,12 +237,29 @@ private:
     std::unique_ptr<AudioProcessor> audio_processor_;
     std::unique_ptr<WakeWord> wake_word_;
     std::unique_ptr<AudioDebugger> audio_debugger_;
-    std::unique_ptr<OpusEncoderWrapper> opus_encoder_;
+    std::unique_ptr<AdaptiveOpusEncoder> opus_encoder_;
     std::unique_ptr<OpusDecoderWrapper> opus_decoder_;
+    std::vector<uint8_t> opus_buffer_;
     OpusResampler input_resampler_;
     OpusResampler reference_resampler_;
     OpusResampler output_resampler_;
     DebugStatistics debug_statistics_;
+    PerformanceStatistics performance_statistics_;
+    AudioGovernor governor_;
+    AudioFlightRecorder flight_recorder_;
+    AudioInputFanout input_fanout_;
+    int wake_word_consumer_ = 0;
+    int audio_processor_consumer_ = 0;
+    int audio_testing_consumer_ = 0;
+    std::atomic<int> opus_complexity_ = 0;
+    // A tier chosen on the timer task, applied to the audio processor between two feeds
+    std::atomic<int> pending_compute_tier_ = -1;
+    std::atomic<int> opus_bitrate_ = OPUS_AUTO;
+    std::atomic<int> opus_fec_loss_percent_ = 0;
+    std::atomic<AudioFormat> uplink_format_ = kAudioFormatOpus;
+    AudioFormat downlink_format_ = kAudioFormatOpus;
+    ImaAdpcmState uplink_adpcm_state_;
+    int output_resampler_rate_ = 0;
     srmodel_list_t* models_list_ = nullptr;
 
     EventGroupHandle_t event_group_;
@@ -130,32 +268,87 @@ private:
     TaskHandle_t audio_input_task_handle_ = nullptr;
     TaskHandle_t audio_output_task_handle_ = nullptr;
     TaskHandle_t opus_codec_task_handle_ = nullptr;
+    TaskHandle_t audio_sound_task_handle_ = nullptr;
     std::mutex audio_queue_mutex_;
     std::condition_variable audio_queue_cv_;
     std::deque<std::unique_ptr<AudioStreamPacket>> audio_decode_queue_;
+    // Overflow of the decode queue when the server bursts, kept in PSRAM
+    DownlinkBuffer downlink_buffer_;
     std::deque<std::unique_ptr<AudioStreamPacket>> audio_send_queue_;
     std::deque<std::unique_ptr<AudioStreamPacket>> audio_testing_queue_;
     std::deque<std::unique_ptr<AudioTask>> audio_encode_queue_;
+    // Captured ahead of the listen message, encoded on ReleaseUplink once the uplink format is known
+    std::deque<std::unique_ptr<AudioTask>> audio_held_queue_;
     std::deque<std::unique_ptr<AudioTask>> audio_playback_queue_;
     // For server AEC
     std::deque<uint32_t> timestamp_queue_;
 
+    // Sound playback, the sound task feeds the decode queue so callers never block
+    std::mutex sound_mutex_;
+    std::condition_variable sound_cv_;
+    std::deque<SoundRequest> sound_queue_;
+    SoundHandle next_sound_handle_ = 1;
+    SoundHandle playing_sound_ = 0;
+    std::atomic<bool> cancel_playing_sound_ = false;
+
     bool wake_word_initialized_ = false;
     bool audio_processor_initialized_ = false;
+    // Free PSRAM once both AFE users are set up, 0 until then
+    size_t afe_psram_free_ = 0;
     bool voice_detected_ = false;
     bool service_stopped_ = true;
-    bool audio_input_need_warmup_ = false;
+    bool input_keep_warm_ = false;
+    int input_settle_samples_ = 0;
+    std::atomic<bool> uplink_held_ = false;
+    std::atomic<int64_t> listen_request_us_ = 0;
+    bool listen_input_warm_ = false;
+    int listen_latency_ms_ = -1;
 
     esp_timer_handle_t audio_power_timer_ = nullptr;
+    esp_timer_handle_t audio_governor_timer_ = nullptr;
+    esp_timer_handle_t end_of_utterance_timer_ = nullptr;
+    UtteranceEndpointer endpointer_;
     std::chrono::steady_clock::time_point last_input_time_;
     std::chrono::steady_clock::time_point last_output_time_;
 
+    // Playback drain tracking, the flags and the callback are guarded by audio_queue_mutex_
+    esp_timer_handle_t playback_drain_timer_ = nullptr;
+    std::function<void()> playback_drained_callback_;
+    int64_t playback_drain_requested_us_ = 0;
+    bool playback_decoding_ = false;
+    // The sounds whose frame is being decoded or written, so a sound is not finished while they are
+    SoundHandle decoding_sound_ = 0;
+    // Bumped by ResetDecoder, a push or a decoded frame from before the reset is dropped. 0 is never used
+    uint32_t downlink_generation_ = 1;
+    SoundHandle writing_sound_ = 0;
+    bool playback_writing_ = false;
+    std::atomic<int64_t> dma_drained_at_us_ = 0;
+
     void AudioInputTask();
+    bool ReadAudioData(std::vector<int16_t>& data, int sample_rate, int samples);
     void AudioOutputTask();
     void OpusCodecTask();
+    void AudioSoundTask();
+    bool PlayOggSound(const std::string_view& ogg, SoundHandle handle);
+    bool HasSoundFrames(SoundHandle handle) const;
+    void DropSoundFrames(SoundHandle handle);
+    void NotifySoundCancelled();
     void PushTaskToEncodeQueue(AudioTaskType type, std::vector<int16_t>&& pcm);
     void SetDecodeSampleRate(int sample_rate, int frame_duration);
+    bool EncodeUncompressed(AudioFormat format, const std::vector<int16_t>& pcm, AudioStreamPacket& packet);
+    bool DecodeUncompressed(const AudioStreamPacket& packet, std::vector<int16_t>& pcm);
     void CheckAndUpdateAudioPowerState();
+    bool IsPlaybackPipelineEmpty() const;
+    void CheckPlaybackDrained();
+    void OnPlaybackDrainTimer();
+    void UpdateComputeTier();
+    void ApplyPendingComputeTier();
+    void ReleaseDecodeQueue();
+    void InitializeAudioProcessor();
+    void RecordAfeMemory();
+    // Starts the processor and its input without touching what is playing
+    void StartVoiceProcessing();
+    void UpdateEndpointing(bool speaking);
 };
 
 #endif
\ No newline at end of file
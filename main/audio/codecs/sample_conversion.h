@@ -0,0 +1,40 @@
+#ifndef SAMPLE_CONVERSION_H
+#define SAMPLE_CONVERSION_H
+
+#include <cstdint>
+
+/*
+ * The per-sample loops of the I2S codecs, kept free of driver calls so they also build on a host.
+ */
+
+// 32-bit I2S microphone words to 16-bit PCM, the samples sit in the upper bits of the word
+inline void ConvertI2s32ToPcm16(const int32_t* src, int16_t* dest, int samples) {
+    for (int i = 0; i < samples; i++) {
+        int32_t value = src[i] >> 12;
+        dest[i] = (value > INT16_MAX) ? INT16_MAX : (value < -INT16_MAX) ? -INT16_MAX : (int16_t)value;
+    }
+}
+
+// 16-bit PCM to 32-bit I2S speaker words, volume_factor is 0-65536
+inline void ScalePcm16ToI2s32(const int16_t* src, int32_t* dest, int samples, int32_t volume_factor) {
+    for (int i = 0; i < samples; i++) {
+        int64_t temp = int64_t(src[i]) * volume_factor; // 使用 int64_t 进行乘法运算
+        if (temp > INT32_MAX) {
+            dest[i] = INT32_MAX;
+        } else if (temp < INT32_MIN) {
+            dest[i] = INT32_MIN;
+        } else {
+            dest[i] = static_cast<int32_t>(temp);
+        }
+    }
+}
+
+// Integer gain on 16-bit PCM in place, saturating
+inline void ApplyPcm16Gain(int16_t* data, int samples, int gain_factor) {
+    for (int i = 0; i < samples; i++) {
+        int32_t amplified = data[i] * gain_factor;
+        data[i] = (amplified > INT16_MAX) ? INT16_MAX : (amplified < -INT16_MAX) ? -INT16_MAX : (int16_t)amplified;
+    }
+}
+
+#endif
@@ -0,0 +1,110 @@
+#include "downlink_buffer.h"
+#include "audio_packet_pool.h"
+
+#include <esp_log.h>
+#include <esp_heap_caps.h>
+#include <cstring>
+
+#define TAG "DownlinkBuffer"
+
+DownlinkBuffer::DownlinkBuffer() {
+}
+
+DownlinkBuffer::~DownlinkBuffer() {
+    if (buffer_ != nullptr) {
+        heap_caps_free(buffer_);
+    }
+}
+
+bool DownlinkBuffer::Initialize(size_t capacity) {
+    buffer_ = (uint8_t*)heap_caps_malloc(capacity, MALLOC_CAP_SPIRAM);
+    if (buffer_ == nullptr) {
+        ESP_LOGE(TAG, "Failed to allocate %u bytes of PSRAM", capacity);
+        return false;
+    }
+    capacity_ = capacity;
+    ESP_LOGI(TAG, "Downlink burst buffer: %u bytes", capacity);
+    return true;
+}
+
+bool DownlinkBuffer::Push(const AudioStreamPacket& packet) {
+    if (buffer_ == nullptr || packet.payload.size() > UINT16_MAX) {
+        return false;
+    }
+    size_t size = sizeof(PacketHeader) + packet.payload.size();
+    // A packet that does not fit before the end of the ring starts over at 0, the end is skipped
+    bool wrap = tail_ + size > capacity_;
+    size_t skip = wrap ? capacity_ - tail_ : 0;
+    if (used_ + skip + size > capacity_) {
+        return false;
+    }
+    if (wrap) {
+        if (skip >= sizeof(PacketHeader)) {
+            PacketHeader marker = {};
+            marker.wrap = 1;
+            memcpy(buffer_ + tail_, &marker, sizeof(marker));
+        }
+        tail_ = 0;
+        used_ += skip;
+    }
+
+    PacketHeader header = {};
+    header.timestamp = packet.timestamp;
+    header.sample_rate = packet.sample_rate;
+    header.frame_duration = packet.frame_duration;
+    header.payload_size = packet.payload.size();
+    header.format = packet.format;
+    memcpy(buffer_ + tail_, &header, sizeof(header));
+    memcpy(buffer_ + tail_ + sizeof(header), packet.payload.data(), packet.payload.size());
+    tail_ += size;
+    used_ += size;
+    packets_++;
+    buffered_ms_ += packet.frame_duration;
+    if (used_ > peak_) {
+        peak_ = used_;
+    }
+    return true;
+}
+
+std::unique_ptr<AudioStreamPacket> DownlinkBuffer::Pop() {
+    if (packets_ == 0) {
+        return nullptr;
+    }
+
+    PacketHeader header;
+    size_t end_space = capacity_ - head_;
+    if (end_space >= sizeof(PacketHeader)) {
+        memcpy(&header, buffer_ + head_, sizeof(header));
+    }
+    if (end_space < sizeof(PacketHeader) || header.wrap) {
+        used_ -= end_space;
+        head_ = 0;
+        memcpy(&header, buffer_, sizeof(header));
+    }
+
+    auto packet = AudioPacketPool::GetInstance().Acquire(header.payload_size);
+    packet->timestamp = header.timestamp;
+    packet->sample_rate = header.sample_rate;
+    packet->frame_duration = header.frame_duration;
+    packet->format = (AudioFormat)header.format;
+    auto payload = buffer_ + head_ + sizeof(header);
+    packet->payload.assign(payload, payload + header.payload_size);
+
+    size_t size = sizeof(header) + header.payload_size;
+    head_ += size;
+    used_ -= size;
+    packets_--;
+    buffered_ms_ -= header.frame_duration;
+    if (packets_ == 0) {
+        Clear();
+    }
+    return packet;
+}
+
+void DownlinkBuffer::Clear() {
+    head_ = 0;
+    tail_ = 0;
+    used_ = 0;
+    packets_ = 0;
+    buffered_ms_ = 0;
+}
@@ -0,0 +1,55 @@
+#ifndef DOWNLINK_BUFFER_H
+#define DOWNLINK_BUFFER_H
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+#include "protocol.h"
+
+/*
+ * Compressed downlink packets kept in one PSRAM ring, behind the decode queue.
+ * The server may send a long reply faster than real time, the ring absorbs it and the radio goes idle
+ * while the reply keeps playing. Each packet is stored as a small header followed by its payload,
+ * a packet never wraps around the end of the ring.
+ */
+class DownlinkBuffer {
+public:
+    DownlinkBuffer();
+    ~DownlinkBuffer();
+
+    bool Initialize(size_t capacity);
+    bool enabled() const { return buffer_ != nullptr; }
+    // Copies the packet into the ring, returns false when it does not fit
+    bool Push(const AudioStreamPacket& packet);
+    std::unique_ptr<AudioStreamPacket> Pop();
+    void Clear();
+
+    bool empty() const { return packets_ == 0; }
+    size_t capacity() const { return capacity_; }
+    size_t used_bytes() const { return used_; }
+    size_t peak_bytes() const { return peak_; }
+    int buffered_ms() const { return buffered_ms_; }
+
+private:
+    struct PacketHeader {
+        uint32_t timestamp;
+        uint32_t sample_rate;
+        uint16_t frame_duration;
+        uint16_t payload_size;
+        uint8_t format;
+        uint8_t wrap;       // Marks the unused end of the ring, the next packet starts at offset 0
+        uint16_t reserved;
+    };
+
+    uint8_t* buffer_ = nullptr;
+    size_t capacity_ = 0;
+    size_t head_ = 0;
+    size_t tail_ = 0;
+    size_t used_ = 0;
+    size_t peak_ = 0;
+    size_t packets_ = 0;
+    int buffered_ms_ = 0;
+};
+
+#endif
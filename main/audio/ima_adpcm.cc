@@ -0,0 +1,89 @@
+#include "ima_adpcm.h"
+
+static const int8_t kIndexTable[16] = {
+    -1, -1, -1, -1, 2, 4, 6, 8,
+    -1, -1, -1, -1, 2, 4, 6, 8,
+};
+
+static const int16_t kStepTable[89] = {
+    7, 8, 9, 10, 11, 12, 13, 14, 16, 17,
+    19, 21, 23, 25, 28, 31, 34, 37, 41, 45,
+    50, 55, 60, 66, 73, 80, 88, 97, 107, 118,
+    130, 143, 157, 173, 190, 209, 230, 253, 279, 307,
+    337, 371, 408, 449, 494, 544, 598, 658, 724, 796,
+    876, 963, 1060, 1166, 1282, 1411, 1552, 1707, 1878, 2066,
+    2272, 2499, 2749, 3024, 3327, 3660, 4026, 4428, 4871, 5358,
+    5894, 6484, 7132, 7845, 8630, 9493, 10442, 11487, 12635, 13899,
+    15289, 16818, 18500, 20350, 22385, 24623, 27086, 29794, 32767,
+};
+
+static inline int ClampStepIndex(int index) {
+    return index < 0 ? 0 : (index > 88 ? 88 : index);
+}
+
+static inline int16_t ClampSample(int value) {
+    return value < -32768 ? -32768 : (value > 32767 ? 32767 : value);
+}
+
+uint8_t ImaAdpcm::EncodeSample(ImaAdpcmState& state, int16_t sample) {
+    int step = kStepTable[state.step_index];
+    int diff = sample - state.predictor;
+    uint8_t code = 0;
+    if (diff < 0) {
+        code = 8;
+        diff = -diff;
+    }
+
+    // Same arithmetic as the decoder so both sides track the same predictor
+    int delta = step >> 3;
+    if (diff >= step) {
+        code |= 4;
+        diff -= step;
+        delta += step;
+    }
+    step >>= 1;
+    if (diff >= step) {
+        code |= 2;
+        diff -= step;
+        delta += step;
+    }
+    step >>= 1;
+    if (diff >= step) {
+        code |= 1;
+        delta += step;
+    }
+
+    state.predictor = ClampSample((code & 8) ? state.predictor - delta : state.predictor + delta);
+    state.step_index = ClampStepIndex(state.step_index + kIndexTable[code]);
+    return code;
+}
+
+int16_t ImaAdpcm::DecodeSample(ImaAdpcmState& state, uint8_t code) {
+    int step = kStepTable[state.step_index];
+    int delta = step >> 3;
+    if (code & 4) delta += step;
+    if (code & 2) delta += step >> 1;
+    if (code & 1) delta += step >> 2;
+
+    state.predictor = ClampSample((code & 8) ? state.predictor - delta : state.predictor + delta);
+    state.step_index = ClampStepIndex(state.step_index + kIndexTable[code]);
+    return state.predictor;
+}
+
+void ImaAdpcm::Encode(ImaAdpcmState& state, const int16_t* pcm, size_t samples, uint8_t* adpcm) {
+    for (size_t i = 0; i + 1 < samples; i += 2) {
+        uint8_t low = EncodeSample(state, pcm[i]);
+        uint8_t high = EncodeSample(state, pcm[i + 1]);
+        adpcm[i / 2] = low | (high << 4);
+    }
+    if (samples & 1) {
+        adpcm[samples / 2] = EncodeSample(state, pcm[samples - 1]);
+    }
+}
+
+void ImaAdpcm::Decode(ImaAdpcmState& state, const uint8_t* adpcm, size_t samples, int16_t* pcm) {
+    for (size_t i = 0; i < samples; i++) {
+        uint8_t byte = adpcm[i / 2];
+        pcm[i] = DecodeSample(state, (i & 1) ? (byte >> 4) : (byte & 0x0F));
+    }
+}
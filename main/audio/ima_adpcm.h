@@ -0,0 +1,31 @@
+#ifndef IMA_ADPCM_H
+#define IMA_ADPCM_H
+
+#include <cstddef>
+#include <cstdint>
+
+/*
+ * IMA-ADPCM, 4 bits per sample, two samples per byte with the first sample in the low nibble.
+ * It costs a few dozen cycles per sample, so it can run continuously next to the wake word model
+ * on single-core chips where an Opus encoder would not fit.
+ */
+struct ImaAdpcmState {
+    int16_t predictor = 0;
+    int8_t step_index = 0;
+};
+
+class ImaAdpcm {
+public:
+    static size_t EncodedSize(size_t samples) { return (samples + 1) / 2; }
+
+    // Encodes samples into EncodedSize(samples) bytes and advances the state
+    static void Encode(ImaAdpcmState& state, const int16_t* pcm, size_t samples, uint8_t* adpcm);
+    // Decodes samples from the bytes produced by Encode, starting from the same state
+    static void Decode(ImaAdpcmState& state, const uint8_t* adpcm, size_t samples, int16_t* pcm);
+
+private:
+    static uint8_t EncodeSample(ImaAdpcmState& state, int16_t sample);
+    static int16_t DecodeSample(ImaAdpcmState& state, uint8_t code);
+};
+
+#endif
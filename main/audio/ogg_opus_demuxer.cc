@@ -0,0 +1,241 @@
+#include "ogg_opus_demuxer.h"
+
+#include <esp_log.h>
+#include <algorithm>
+#include <cstring>
+
+#define TAG "OggOpusDemuxer"
+
+#define OGG_HEADER_TYPE_CONTINUED 0x01
+#define OGG_HEADER_TYPE_BOS 0x02
+
+static const int kSilkFrameUs[4] = { 10000, 20000, 40000, 60000 };
+
+OggOpusDemuxer::OggOpusDemuxer() {
+}
+
+void OggOpusDemuxer::Reset() {
+    Resync();
+    seen_head_ = false;
+    seen_tags_ = false;
+    sample_rate_ = 48000;
+    channels_ = 1;
+    lost_syncs_ = 0;
+}
+
+void OggOpusDemuxer::Resync() {
+    state_ = kStateSync;
+    page_fill_ = 0;
+    packet_.clear();
+    packet_dropped_ = false;
+}
+
+void OggOpusDemuxer::LoseSync() {
+    lost_syncs_++;
+    ESP_LOGW(TAG, "Lost sync, searching for the next page");
+    // The bytes taken as header after its first one may already hold the next page, search them first
+    size_t skipped = page_fill_ > 1 ? 1 + FindCapturePattern(page_ + 1, page_fill_ - 1) : page_fill_;
+    size_t kept = page_fill_ - skipped;
+    Resync();
+    if (kept > 0) {
+        memmove(page_, page_ + skipped, kept);
+        page_fill_ = kept;
+        state_ = kStateHeader;
+    }
+}
+
+size_t OggOpusDemuxer::FindCapturePattern(const uint8_t* data, size_t size) {
+    const uint8_t* end = data + size;
+    const uint8_t* p = data;
+    while ((p = (const uint8_t*)memchr(p, 'O', end - p)) != nullptr) {
+        // A pattern cut by the end of the chunk is completed and checked in the header state
+        size_t length = std::min<size_t>(end - p, 4);
+        if (memcmp(p, "OggS", length) == 0) {
+            return p - data;
+        }
+        p++;
+    }
+    return size;
+}
+
+void OggOpusDemuxer::StartPage() {
+    uint8_t header_type = page_[5];
+    if (header_type & OGG_HEADER_TYPE_BOS) {
+        // A chained stream starts over with its own OpusHead and OpusTags
+        seen_head_ = false;
+        seen_tags_ = false;
+    }
+    if (header_type & OGG_HEADER_TYPE_CONTINUED) {
+        // Without the beginning of the packet its continuation is useless
+        if (packet_.empty()) {
+            packet_dropped_ = true;
+        }
+    } else if (!packet_.empty() || packet_dropped_) {
+        packet_.clear();
+        packet_dropped_ = false;
+    }
+    segment_index_ = 0;
+    segment_remaining_ = segment_count_ > 0 ? page_[OGG_PAGE_HEADER_SIZE] : 0;
+    state_ = kStateBody;
+}
+
+bool OggOpusDemuxer::Feed(const uint8_t* data, size_t size, const OggOpusPacketHandler& handler) {
+    while (true) {
+        switch (state_) {
+        case kStateSync: {
+            size_t skipped = FindCapturePattern(data, size);
+            data += skipped;
+            size -= skipped;
+            if (size == 0) {
+                return true;
+            }
+            page_fill_ = 0;
+            state_ = kStateHeader;
+            break;
+        }
+        case kStateHeader: {
+            size_t length = std::min(OGG_PAGE_HEADER_SIZE - page_fill_, size);
+            memcpy(page_ + page_fill_, data, length);
+            page_fill_ += length;
+            data += length;
+            size -= length;
+            if (memcmp(page_, "OggS", std::min<size_t>(page_fill_, 4)) != 0) {
+                LoseSync();
+                break;
+            }
+            if (page_fill_ < OGG_PAGE_HEADER_SIZE) {
+                return true;
+            }
+            if (page_[4] != 0) {
+                LoseSync();
+                break;
+            }
+            segment_count_ = page_[26];
+            state_ = kStateSegments;
+            break;
+        }
+        case kStateSegments: {
+            size_t total = OGG_PAGE_HEADER_SIZE + segment_count_;
+            size_t length = std::min(total - page_fill_, size);
+            memcpy(page_ + page_fill_, data, length);
+            page_fill_ += length;
+            data += length;
+            size -= length;
+            if (page_fill_ < total) {
+                return true;
+            }
+            StartPage();
+            break;
+        }
+        case kStateBody: {
+            while (segment_index_ < segment_count_) {
+                size_t length = std::min(segment_remaining_, size);
+                if (length > 0) {
+                    if (!packet_dropped_ && packet_.size() + length <= OGG_MAX_PACKET_SIZE) {
+                        packet_.insert(packet_.end(), data, data + length);
+                    } else {
+                        packet_dropped_ = true;
+                    }
+                    data += length;
+                    size -= length;
+                    segment_remaining_ -= length;
+                }
+                if (segment_remaining_ > 0) {
+                    return true;
+                }
+
+                // A lacing value below 255 ends the packet
+                uint8_t lacing = page_[OGG_PAGE_HEADER_SIZE + segment_index_];
+                segment_index_++;
+                if (segment_index_ < segment_count_) {
+                    segment_remaining_ = page_[OGG_PAGE_HEADER_SIZE + segment_index_];
+                }
+                if (lacing < 255 && !EmitPacket(handler)) {
+                    return false;
+                }
+            }
+            // In sync the next page starts right here
+            page_fill_ = 0;
+            state_ = kStateHeader;
+            if (size == 0) {
+                return true;
+            }
+            break;
+        }
+        }
+    }
+}
+
+bool OggOpusDemuxer::EmitPacket(const OggOpusPacketHandler& handler) {
+    if (packet_dropped_ || packet_.empty()) {
+        packet_.clear();
+        packet_dropped_ = false;
+        return true;
+    }
+
+    if (!seen_head_) {
+        // OpusHead: [0-7] "OpusHead", [8] version, [9] channel count, [10-11] pre-skip, [12-15] input sample rate
+        if (packet_.size() >= 19 && memcmp(packet_.data(), "OpusHead", 8) == 0) {
+            seen_head_ = true;
+            channels_ = packet_[9];
+            int input_sample_rate = packet_[12] | (packet_[13] << 8) | (packet_[14] << 16) | (packet_[15] << 24);
+            // Other rates are informational only, Opus itself always runs at one of these
+            bool native = input_sample_rate == 8000 || input_sample_rate == 12000 || input_sample_rate == 16000 ||
+                input_sample_rate == 24000 || input_sample_rate == 48000;
+            sample_rate_ = native ? input_sample_rate : 48000;
+            ESP_LOGI(TAG, "OpusHead: version=%d, channels=%d, sample_rate=%d", packet_[8], channels_, input_sample_rate);
+        }
+        packet_.clear();
+        return true;
+    }
+    if (!seen_tags_) {
+        // Expect OpusTags in second packet
+        if (packet_.size() >= 8 && memcmp(packet_.data(), "OpusTags", 8) == 0) {
+            seen_tags_ = true;
+        }
+        packet_.clear();
+        return true;
+    }
+
+    auto packet = std::make_unique<AudioStreamPacket>();
+    packet->sample_rate = sample_rate_;
+    // The decoder is sized for the longest packet, longer than 60 ms only happens with 80-120 ms packets
+    packet->frame_duration = GetPacketDurationUs(packet_.data(), packet_.size()) > 60000 ? 120 : 60;
+    packet->payload = std::move(packet_);
+    packet_.clear();
+    return handler(std::move(packet));
+}
+
+int OggOpusDemuxer::GetPacketDurationUs(const uint8_t* packet, size_t size) {
+    if (size < 1) {
+        return 0;
+    }
+    // TOC byte: configurations 0-11 are SILK, 12-15 hybrid, 16-31 CELT
+    int config = packet[0] >> 3;
+    int frame_us;
+    if (config < 12) {
+        frame_us = kSilkFrameUs[config & 3];
+    } else if (config < 16) {
+        frame_us = (config & 1) ? 20000 : 10000;
+    } else {
+        frame_us = 2500 << (config & 3);
+    }
+
+    int frames;
+    switch (packet[0] & 3) {
+    case 0:
+        frames = 1;
+        break;
+    case 1:
+    case 2:
+        frames = 2;
+        break;
+    default:
+        if (size < 2) {
+            return 0;
+        }
+        frames = packet[1] & 0x3F;
+        break;
+    }
+    return frames * frame_us;
+}
@@ -0,0 +1,69 @@
+#ifndef OGG_OPUS_DEMUXER_H
+#define OGG_OPUS_DEMUXER_H
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+#include <functional>
+
+#include "protocol.h"
+
+/*
+ * Incremental Ogg demuxer for Opus streams, fed with chunks of any size.
+ * While in sync the next page is expected right after the previous one, the capture pattern is only
+ * searched (with memchr) at the start, after a corrupt page or after Resync. Packets spanning several
+ * segments or pages are reassembled in a buffer bounded by OGG_MAX_PACKET_SIZE, longer ones are dropped.
+ */
+#define OGG_PAGE_HEADER_SIZE 27
+#define OGG_MAX_PACKET_SIZE 8192
+
+// Returns false to stop the demuxer, Feed then returns false too
+typedef std::function<bool(std::unique_ptr<AudioStreamPacket> packet)> OggOpusPacketHandler;
+
+class OggOpusDemuxer {
+public:
+    OggOpusDemuxer();
+
+    void Reset();
+    // Drops the partial page and packet and searches for the next page, used after a reconnect
+    void Resync();
+    bool Feed(const uint8_t* data, size_t size, const OggOpusPacketHandler& handler);
+
+    int sample_rate() const { return sample_rate_; }
+    int channels() const { return channels_; }
+    uint32_t lost_syncs() const { return lost_syncs_; }
+
+    // Duration of an Opus packet from its TOC byte, 0 if the packet is malformed
+    static int GetPacketDurationUs(const uint8_t* packet, size_t size);
+
+private:
+    enum State {
+        kStateSync,
+        kStateHeader,
+        kStateSegments,
+        kStateBody,
+    };
+
+    State state_ = kStateSync;
+    uint8_t page_[OGG_PAGE_HEADER_SIZE + 255];
+    size_t page_fill_ = 0;
+    int segment_count_ = 0;
+    int segment_index_ = 0;
+    size_t segment_remaining_ = 0;
+    std::vector<uint8_t> packet_;
+    bool packet_dropped_ = false;
+
+    bool seen_head_ = false;
+    bool seen_tags_ = false;
+    int sample_rate_ = 48000;
+    int channels_ = 1;
+    uint32_t lost_syncs_ = 0;
+
+    size_t FindCapturePattern(const uint8_t* data, size_t size);
+    void LoseSync();
+    void StartPage();
+    bool EmitPacket(const OggOpusPacketHandler& handler);
+};
+
+#endif
@@ -0,0 +1,312 @@
+#include "ogg_stream_player.h"
+
+#include <esp_log.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <algorithm>
+
+#include "audio_service.h"
+#include "ogg_opus_demuxer.h"
+#include "board.h"
+
+#define TAG "OggStreamPlayer"
+
+static const char* const STATE_STRINGS[] = {
+    "stopped",
+    "buffering",
+    "playing",
+};
+
+OggStreamPlayer::OggStreamPlayer(AudioService& audio_service) : audio_service_(audio_service) {
+}
+
+void OggStreamPlayer::StartTasks() {
+    // Created on the first URL, devices that never stream keep the stack memory
+    tasks_started_ = true;
+    xTaskCreate([](void* arg) {
+        auto this_ = (OggStreamPlayer*)arg;
+        this_->DownloadTask();
+        vTaskDelete(NULL);
+    }, "ogg_download", 4096 * 2, this, 3, NULL);
+    xTaskCreate([](void* arg) {
+        auto this_ = (OggStreamPlayer*)arg;
+        this_->FeederTask();
+        vTaskDelete(NULL);
+    }, "ogg_feeder", 3072, this, 4, NULL);
+}
+
+// Called with mutex_ held, returns true if stream audio may be left in the decode queue
+bool OggStreamPlayer::ClearStream() {
+    bool playing = state_ == kOggStreamPlaying && !paused_;
+    generation_++;
+    queue_.clear();
+    queued_bytes_ = 0;
+    queued_us_ = 0;
+    eof_ = false;
+    state_ = kOggStreamStopped;
+    cv_.notify_all();
+    return playing;
+}
+
+void OggStreamPlayer::Play(const std::string& url) {
+    bool flush;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (!tasks_started_) {
+            StartTasks();
+        }
+        flush = ClearStream();
+        url_ = url;
+        download_pending_ = true;
+        state_ = kOggStreamBuffering;
+        position_us_ = 0;
+        bytes_received_ = 0;
+        stalls_ = 0;
+        reconnects_ = 0;
+        lost_syncs_ = 0;
+        cv_.notify_all();
+    }
+    ESP_LOGI(TAG, "Play %s", url.c_str());
+    if (flush) {
+        audio_service_.ResetDecoder();
+    }
+}
+
+void OggStreamPlayer::Stop() {
+    bool flush;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (state_ == kOggStreamStopped && !download_pending_) {
+            return;
+        }
+        flush = ClearStream();
+        download_pending_ = false;
+    }
+    ESP_LOGI(TAG, "Stopped");
+    if (flush) {
+        audio_service_.ResetDecoder();
+    }
+}
+
+void OggStreamPlayer::SetPaused(bool paused) {
+    bool flush = false;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (paused_ == paused) {
+            return;
+        }
+        paused_ = paused;
+        if (paused && state_ == kOggStreamPlaying) {
+            // A packet being pushed carries the decoder generation, the reset below cancels it
+            state_ = kOggStreamBuffering;
+            flush = true;
+        }
+        cv_.notify_all();
+    }
+    if (flush) {
+        ESP_LOGI(TAG, "Paused");
+        audio_service_.ResetDecoder();
+    }
+}
+
+bool OggStreamPlayer::IsActive() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return state_ != kOggStreamStopped;
+}
+
+void OggStreamPlayer::DownloadTask() {
+    while (true) {
+        std::string url;
+        uint32_t generation;
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            cv_.wait(lock, [this]() { return download_pending_; });
+            download_pending_ = false;
+            url = url_;
+            generation = generation_;
+        }
+        Download(generation, url);
+    }
+}
+
+void OggStreamPlayer::Download(uint32_t generation, const std::string& url) {
+    auto network = Board::GetInstance().GetNetwork();
+    OggOpusDemuxer demuxer;
+    char buffer[OGG_STREAM_READ_CHUNK_SIZE];
+    size_t offset = 0;
+    int retries = 0;
+
+    auto handler = [this, generation](std::unique_ptr<AudioStreamPacket> packet) {
+        return Enqueue(generation, std::move(packet));
+    };
+
+    while (true) {
+        auto http = network->CreateHttp(OGG_STREAM_HTTP_CONNECT_ID);
+        if (offset > 0) {
+            http->SetHeader("Range", "bytes=" + std::to_string(offset) + "-");
+        }
+        if (!http->Open("GET", url)) {
+            ESP_LOGE(TAG, "Failed to open HTTP connection");
+        } else if (http->GetStatusCode() != 200 && http->GetStatusCode() != 206) {
+            ESP_LOGE(TAG, "Failed to get stream, status code: %d", http->GetStatusCode());
+        } else {
+            size_t skip = 0;
+            if (offset > 0 && http->GetStatusCode() == 200) {
+                if (http->GetBodyLength() > offset) {
+                    // The server ignored the range, skip what has been played already
+                    skip = offset;
+                } else {
+                    // A live stream goes on from now, the demuxer picks up the next page
+                    demuxer.Resync();
+                    offset = 0;
+                }
+            }
+
+            while (true) {
+                if (!WaitForSpace(generation)) {
+                    http->Close();
+                    return;
+                }
+                int ret = http->Read(buffer, sizeof(buffer));
+                if (ret < 0) {
+                    ESP_LOGW(TAG, "Failed to read HTTP data at offset %u", offset);
+                    break;
+                }
+                if (ret == 0) {
+                    http->Close();
+                    FinishDownload(generation);
+                    return;
+                }
+                retries = 0;
+                size_t size = ret;
+                size_t skipped = std::min(skip, size);
+                skip -= skipped;
+                offset += size - skipped;
+                if (!demuxer.Feed((const uint8_t*)buffer + skipped, size - skipped, handler)) {
+                    http->Close();
+                    return;
+                }
+
+                std::lock_guard<std::mutex> lock(mutex_);
+                bytes_received_ += size;
+                lost_syncs_ = demuxer.lost_syncs();
+            }
+        }
+        http->Close();
+
+        if (++retries > OGG_STREAM_MAX_RECONNECTS) {
+            ESP_LOGE(TAG, "Giving up the stream after %d reconnects", OGG_STREAM_MAX_RECONNECTS);
+            FinishDownload(generation);
+            return;
+        }
+        vTaskDelay(pdMS_TO_TICKS(OGG_STREAM_RECONNECT_DELAY_MS));
+
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (generation != generation_) {
+            return;
+        }
+        reconnects_++;
+        ESP_LOGI(TAG, "Reconnecting at offset %u", offset);
+    }
+}
+
+bool OggStreamPlayer::WaitForSpace(uint32_t generation) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    if (queued_bytes_ >= OGG_STREAM_MAX_BUFFER_BYTES) {
+        cv_.wait(lock, [this, generation]() {
+            return generation != generation_ || queued_us_ <= OGG_STREAM_LOW_WATER_MS * 1000;
+        });
+    }
+    return generation == generation_;
+}
+
+bool OggStreamPlayer::Enqueue(uint32_t generation, std::unique_ptr<AudioStreamPacket> packet) {
+    int duration_us = OggOpusDemuxer::GetPacketDurationUs(packet->payload.data(), packet->payload.size());
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (generation != generation_) {
+        return false;
+    }
+    if (duration_us <= 0) {
+        return true;
+    }
+    queued_bytes_ += sizeof(AudioStreamPacket) + packet->payload.size();
+    queued_us_ += duration_us;
+    queue_.push_back(std::move(packet));
+    cv_.notify_all();
+    return true;
+}
+
+void OggStreamPlayer::FinishDownload(uint32_t generation) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (generation == generation_) {
+        eof_ = true;
+        cv_.notify_all();
+    }
+}
+
+void OggStreamPlayer::FeederTask() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (true) {
+        cv_.wait(lock, [this]() {
+            if (paused_ || state_ == kOggStreamStopped) {
+                return false;
+            }
+            if (state_ == kOggStreamBuffering) {
+                return eof_ || queued_us_ >= OGG_STREAM_PREBUFFER_MS * 1000;
+            }
+            return true;
+        });
+
+        if (state_ == kOggStreamBuffering) {
+            ESP_LOGI(TAG, "Playing with %lld ms buffered", queued_us_ / 1000);
+            state_ = kOggStreamPlaying;
+        }
+        if (queue_.empty()) {
+            if (eof_) {
+                ESP_LOGI(TAG, "Stream finished after %lld ms", position_us_ / 1000);
+                state_ = kOggStreamStopped;
+            } else {
+                stalls_++;
+                ESP_LOGW(TAG, "Stream stalled at %lld ms, rebuffering", position_us_ / 1000);
+                state_ = kOggStreamBuffering;
+            }
+            continue;
+        }
+
+        auto packet = std::move(queue_.front());
+        queue_.pop_front();
+        int duration_us = OggOpusDemuxer::GetPacketDurationUs(packet->payload.data(), packet->payload.size());
+        queued_bytes_ -= sizeof(AudioStreamPacket) + packet->payload.size();
+        queued_us_ -= duration_us;
+        // Taken under mutex_, so a pause or stop after this point resets the decoder after it and drops the push
+        uint32_t generation = audio_service_.GetDownlinkGeneration();
+        // The download task may be waiting for the queue to drain
+        cv_.notify_all();
+
+        lock.unlock();
+        bool pushed = audio_service_.PushPacketToDecodeQueue(std::move(packet), true, generation);
+        lock.lock();
+
+        if (pushed) {
+            position_us_ += duration_us;
+        }
+    }
+}
+
+cJSON* OggStreamPlayer::GetStatusJson() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto root = cJSON_CreateObject();
+    cJSON_AddStringToObject(root, "state", STATE_STRINGS[state_]);
+    cJSON_AddBoolToObject(root, "paused", paused_);
+    if (state_ != kOggStreamStopped) {
+        cJSON_AddStringToObject(root, "url", url_.c_str());
+    }
+    cJSON_AddNumberToObject(root, "position_ms", position_us_ / 1000);
+    cJSON_AddNumberToObject(root, "buffered_ms", queued_us_ / 1000);
+    cJSON_AddNumberToObject(root, "buffered_bytes", queued_bytes_);
+    cJSON_AddNumberToObject(root, "bytes_received", bytes_received_);
+    cJSON_AddNumberToObject(root, "stalls", stalls_);
+    cJSON_AddNumberToObject(root, "reconnects", reconnects_);
+    cJSON_AddNumberToObject(root, "lost_syncs", lost_syncs_);
+    return root;
+}
@@ -0,0 +1,83 @@
+#ifndef OGG_STREAM_PLAYER_H
+#define OGG_STREAM_PLAYER_H
+
+#include <string>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+
+#include <cJSON.h>
+
+#include "protocol.h"
+
+/*
+ * Plays a long Ogg/Opus file or live stream from an HTTP URL through the decode queue.
+ * (Server) -> [Download Task] -> [Ogg Demuxer] -> {Stream Queue} -> [Feeder Task] -> {Decode Queue}
+ *
+ * The stream queue is bounded in bytes. Playback starts once OGG_STREAM_PREBUFFER_MS are buffered,
+ * a stall drains the queue and rebuffers the same amount. The download pauses when the queue is full
+ * and goes on below OGG_STREAM_LOW_WATER_MS. A broken connection resumes from the byte it stopped at
+ * with a Range request, a live stream without Range support resyncs on the next page.
+ */
+#define OGG_STREAM_HTTP_CONNECT_ID 4
+#define OGG_STREAM_READ_CHUNK_SIZE 1024
+#define OGG_STREAM_MAX_BUFFER_BYTES (48 * 1024)
+#define OGG_STREAM_PREBUFFER_MS 2000
+#define OGG_STREAM_LOW_WATER_MS 1000
+#define OGG_STREAM_MAX_RECONNECTS 5
+#define OGG_STREAM_RECONNECT_DELAY_MS 1000
+
+class AudioService;
+
+enum OggStreamState {
+    kOggStreamStopped,
+    kOggStreamBuffering,
+    kOggStreamPlaying,
+};
+
+class OggStreamPlayer {
+public:
+    OggStreamPlayer(AudioService& audio_service);
+
+    // Neither call blocks, the download of a replaced stream ends at its next read
+    void Play(const std::string& url);
+    void Stop();
+    // Paused while the device is not idle, the part of the stream already in the decode queue is dropped
+    void SetPaused(bool paused);
+    bool IsActive();
+    cJSON* GetStatusJson();
+
+private:
+    AudioService& audio_service_;
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    bool tasks_started_ = false;
+    uint32_t generation_ = 0;
+    bool download_pending_ = false;
+    std::string url_;
+    OggStreamState state_ = kOggStreamStopped;
+    bool paused_ = true;
+    bool eof_ = false;
+
+    std::deque<std::unique_ptr<AudioStreamPacket>> queue_;
+    size_t queued_bytes_ = 0;
+    int64_t queued_us_ = 0;
+
+    int64_t position_us_ = 0;
+    size_t bytes_received_ = 0;
+    uint32_t stalls_ = 0;
+    uint32_t reconnects_ = 0;
+    uint32_t lost_syncs_ = 0;
+
+    void StartTasks();
+    bool ClearStream();
+    void DownloadTask();
+    void Download(uint32_t generation, const std::string& url);
+    bool WaitForSpace(uint32_t generation);
+    bool Enqueue(uint32_t generation, std::unique_ptr<AudioStreamPacket> packet);
+    void FinishDownload(uint32_t generation);
+    void FeederTask();
+};
+
+#endif
@@ -1,5 +1,8 @@
 #include "afe_audio_processor.h"
 #include <esp_log.h>
+#if CONFIG_USE_SHARED_AFE
+#include "afe_service.h"
+#endif
 
 #define PROCESSOR_RUNNING 0x01
 
@@ -17,6 +20,18 @@ void AfeAudioProcessor::Initialize(AudioCodec* codec, int frame_duration_ms, srm
     // Pre-allocate output buffer capacity
     output_buffer_.reserve(frame_samples_);
 
+#if CONFIG_USE_SHARED_AFE
+    auto& afe = AfeService::GetInstance();
+    if (!afe.Initialize(codec_, models_list)) {
+        return;
+    }
+    afe_iface_ = afe.iface();
+    afe_data_ = afe.data();
+    ns_available_ = afe.ns_available();
+    afe.SetHandler(kAfeModeCommunication, [this](afe_fetch_result_t* res) {
+        ProcessResult(res);
+    });
+#else
     int ref_num = codec_->input_reference() ? 1 : 0;
 
     std::string input_format;
@@ -40,7 +55,7 @@ void AfeAudioProcessor::Initialize(AudioCodec* codec, int frame_duration_ms, srm
     afe_config_t* afe_config = afe_config_init(input_format.c_str(), NULL, AFE_TYPE_VC, AFE_MODE_HIGH_PERF);
     afe_config->aec_mode = AEC_MODE_VOIP_HIGH_PERF;
     afe_config->vad_mode = VAD_MODE_0;
-    afe_config->vad_min_noise_ms = 100;
+    afe_config->vad_min_noise_ms = AFE_VAD_MIN_NOISE_MS;
     if (vad_model_name != nullptr) {
         afe_config->vad_model_name = vad_model_name;
     }
@@ -49,11 +64,17 @@ void AfeAudioProcessor::Initialize(AudioCodec* codec, int frame_duration_ms, srm
         afe_config->ns_init = true;
         afe_config->ns_model_name = ns_model_name;
         afe_config->afe_ns_mode = AFE_NS_MODE_NET;
+        ns_available_ = true;
     } else {
         afe_config->ns_init = false;
     }
 
+#if CONFIG_USE_AUDIO_COMPUTE_GOVERNOR
+    // AGC is allocated up front and switched on only in the high compute tier
+    afe_config->agc_init = true;
+#else
     afe_config->agc_init = false;
+#endif
     afe_config->memory_alloc_mode = AFE_MEMORY_ALLOC_MORE_PSRAM;
 
 #ifdef CONFIG_USE_DEVICE_AEC
@@ -66,18 +87,22 @@ void AfeAudioProcessor::Initialize(AudioCodec* codec, int frame_duration_ms, srm
 
     afe_iface_ = esp_afe_handle_from_config(afe_config);
     afe_data_ = afe_iface_->create_from_config(afe_config);
+    ApplyComputeTier();
     
     xTaskCreate([](void* arg) {
         auto this_ = (AfeAudioProcessor*)arg;
         this_->AudioProcessorTask();
         vTaskDelete(NULL);
     }, "audio_communication", 4096, this, 3, NULL);
+#endif
 }
 
 AfeAudioProcessor::~AfeAudioProcessor() {
+#if !CONFIG_USE_SHARED_AFE
     if (afe_data_ != nullptr) {
         afe_iface_->destroy(afe_data_);
     }
+#endif
     vEventGroupDelete(event_group_);
 }
 
@@ -92,22 +117,42 @@ void AfeAudioProcessor::Feed(std::vector<int16_t>&& data) {
     if (afe_data_ == nullptr) {
         return;
     }
+#if CONFIG_USE_SHARED_AFE
+    AfeService::GetInstance().Feed(kAfeModeCommunication, data.data());
+#else
     afe_iface_->feed(afe_data_, data.data());
+#endif
 }
 
 void AfeAudioProcessor::Start() {
+#if CONFIG_USE_SHARED_AFE
+    // Leaving the communication mode switched NS and AGC off, bring back those of the current tier
+    AfeService::GetInstance().EnableMode(kAfeModeCommunication, true);
+    if (afe_data_ != nullptr) {
+        ApplyComputeTier();
+    }
+#else
     xEventGroupSetBits(event_group_, PROCESSOR_RUNNING);
+#endif
 }
 
 void AfeAudioProcessor::Stop() {
+#if CONFIG_USE_SHARED_AFE
+    AfeService::GetInstance().EnableMode(kAfeModeCommunication, false);
+#else
     xEventGroupClearBits(event_group_, PROCESSOR_RUNNING);
     if (afe_data_ != nullptr) {
         afe_iface_->reset_buffer(afe_data_);
     }
+#endif
 }
 
 bool AfeAudioProcessor::IsRunning() {
+#if CONFIG_USE_SHARED_AFE
+    return AfeService::GetInstance().IsModeEnabled(kAfeModeCommunication);
+#else
     return xEventGroupGetBits(event_group_) & PROCESSOR_RUNNING;
+#endif
 }
 
 void AfeAudioProcessor::OnOutput(std::function<void(std::vector<int16_t>&& data)> callback) {
@@ -137,36 +182,39 @@ void AfeAudioProcessor::AudioProcessorTask() {
             }
             continue;
         }
+        ProcessResult(res);
+    }
+}
 
-        // VAD state change
-        if (vad_state_change_callback_) {
-            if (res->vad_state == VAD_SPEECH && !is_speaking_) {
-                is_speaking_ = true;
-                vad_state_change_callback_(true);
-            } else if (res->vad_state == VAD_SILENCE && is_speaking_) {
-                is_speaking_ = false;
-                vad_state_change_callback_(false);
-            }
+void AfeAudioProcessor::ProcessResult(afe_fetch_result_t* res) {
+    // VAD state change
+    if (vad_state_change_callback_) {
+        if (res->vad_state == VAD_SPEECH && !is_speaking_) {
+            is_speaking_ = true;
+            vad_state_change_callback_(true);
+        } else if (res->vad_state == VAD_SILENCE && is_speaking_) {
+            is_speaking_ = false;
+            vad_state_change_callback_(false);
         }
+    }
 
-        if (output_callback_) {
-            size_t samples = res->data_size / sizeof(int16_t);
-            
-            // Add data to buffer
-            output_buffer_.insert(output_buffer_.end(), res->data, res->data + samples);
-            
-            // Output complete frames when buffer has enough data
-            while (output_buffer_.size() >= frame_samples_) {
-                if (output_buffer_.size() == frame_samples_) {
-                    // If buffer size equals frame size, move the entire buffer
-                    output_callback_(std::move(output_buffer_));
-                    output_buffer_.clear();
-                    output_buffer_.reserve(frame_samples_);
-                } else {
-                    // If buffer size exceeds frame size, copy one frame and remove it
-                    output_callback_(std::vector<int16_t>(output_buffer_.begin(), output_buffer_.begin() + frame_samples_));
-                    output_buffer_.erase(output_buffer_.begin(), output_buffer_.begin() + frame_samples_);
-                }
+    if (output_callback_) {
+        size_t samples = res->data_size / sizeof(int16_t);
+        
+        // Add data to buffer
+        output_buffer_.insert(output_buffer_.end(), res->data, res->data + samples);
+        
+        // Output complete frames when buffer has enough data
+        while (output_buffer_.size() >= frame_samples_) {
+            if (output_buffer_.size() == frame_samples_) {
+                // If buffer size equals frame size, move the entire buffer
+                output_callback_(std::move(output_buffer_));
+                output_buffer_.clear();
+                output_buffer_.reserve(frame_samples_);
+            } else {
+                // If buffer size exceeds frame size, copy one frame and remove it
+                output_callback_(std::vector<int16_t>(output_buffer_.begin(), output_buffer_.begin() + frame_samples_));
+                output_buffer_.erase(output_buffer_.begin(), output_buffer_.begin() + frame_samples_);
             }
         }
     }
@@ -181,7 +229,48 @@ void AfeAudioProcessor::EnableDeviceAec(bool enable) {
         ESP_LOGE(TAG, "Device AEC is not supported");
 #endif
     } else {
+#if CONFIG_USE_SHARED_AFE
+        // The wake word keeps using the AEC of the shared instance
+        if (!codec_->input_reference()) {
+            afe_iface_->disable_aec(afe_data_);
+        }
+#else
         afe_iface_->disable_aec(afe_data_);
+#endif
         afe_iface_->enable_vad(afe_data_);
     }
 }
+
+void AfeAudioProcessor::SetComputeTier(AudioComputeTier tier) {
+    if (compute_tier_ == tier) {
+        return;
+    }
+    compute_tier_ = tier;
+    if (afe_data_ != nullptr) {
+        ApplyComputeTier();
+    }
+}
+
+void AfeAudioProcessor::ApplyComputeTier() {
+#if CONFIG_USE_SHARED_AFE
+    // The shared instance keeps NS and AGC off outside the communication mode
+    if (!IsRunning()) {
+        return;
+    }
+#endif
+    if (ns_available_) {
+        if (compute_tier_ == kAudioComputeTierLow) {
+            afe_iface_->disable_ns(afe_data_);
+        } else {
+            afe_iface_->enable_ns(afe_data_);
+        }
+    }
+#if CONFIG_USE_AUDIO_COMPUTE_GOVERNOR
+    if (compute_tier_ == kAudioComputeTierHigh) {
+        afe_iface_->enable_agc(afe_data_);
+    } else {
+        afe_iface_->disable_agc(afe_data_);
+    }
+#endif
+    ESP_LOGI(TAG, "Compute tier %d applied", (int)compute_tier_.load());
+}
@@ -9,10 +9,13 @@
 #include <string>
 #include <vector>
 #include <functional>
+#include <atomic>
 
 #include "audio_processor.h"
 #include "audio_codec.h"
 
+#define AFE_VAD_MIN_NOISE_MS 100
+
 class AfeAudioProcessor : public AudioProcessor {
 public:
     AfeAudioProcessor();
@@ -27,6 +30,8 @@ public:
     void OnVadStateChange(std::function<void(bool speaking)> callback) override;
     size_t GetFeedSize() override;
     void EnableDeviceAec(bool enable) override;
+    void SetComputeTier(AudioComputeTier tier) override;
+    int GetVadHangoverMs() override { return AFE_VAD_MIN_NOISE_MS; }
 
 private:
     EventGroupHandle_t event_group_ = nullptr;
@@ -37,9 +42,13 @@ private:
     AudioCodec* codec_ = nullptr;
     int frame_samples_ = 0;
     bool is_speaking_ = false;
+    bool ns_available_ = false;
+    std::atomic<AudioComputeTier> compute_tier_ = kAudioComputeTierMedium;
     std::vector<int16_t> output_buffer_;
 
     void AudioProcessorTask();
+    void ProcessResult(afe_fetch_result_t* res);
+    void ApplyComputeTier();
 };
 
 #endif 
\ No newline at end of file
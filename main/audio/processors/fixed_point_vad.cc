@@ -0,0 +1,149 @@
+#include "fixed_point_vad.h"
+
+#include <cstring>
+
+// 256 * 10 / log2(10) / 10, converts dB to Q8 log2
+#define DB_TO_Q8(db) ((db) * 85)
+// Mean sample energy below 30^2 is treated as silence whatever the noise floor is
+#define VAD_ABSOLUTE_FLOOR_Q8 2512
+// The noise floor rises about 3 dB per second, and follows drops much faster
+#define VAD_NOISE_RISE_Q8 5
+// While speech is detected the floor rises 16 times slower, so a long phrase does not lift it into
+// the speech, and a noise that was taken for speech is still absorbed in the end
+#define VAD_NOISE_RISE_SPEECH_WINDOWS 16
+
+FixedPointVad::FixedPointVad() {
+    Configure(FixedPointVadConfig());
+}
+
+void FixedPointVad::Configure(const FixedPointVadConfig& config) {
+    config_ = config;
+    energy_threshold_q8_ = DB_TO_Q8(config.energy_threshold_db);
+    onset_windows_ = config.onset_ms / 20;
+    if (onset_windows_ < 1) {
+        onset_windows_ = 1;
+    }
+    hangover_windows_ = config.hangover_ms / 20;
+    if (hangover_windows_ < 1) {
+        hangover_windows_ = 1;
+    }
+}
+
+void FixedPointVad::Reset() {
+    window_fill_ = 0;
+    speaking_ = false;
+    speech_run_ = 0;
+    silence_run_ = 0;
+    // Keep the noise floor, the room does not change between two turns
+}
+
+int FixedPointVad::Log2Q8(uint64_t value) {
+    if (value == 0) {
+        return 0;
+    }
+    int msb = 63 - __builtin_clzll(value);
+    // The 8 bits below the leading one are a linear approximation of the fraction
+    int fraction = msb >= 8 ? (int)((value >> (msb - 8)) & 0xFF) : (int)((value << (8 - msb)) & 0xFF);
+    return msb * 256 + fraction;
+}
+
+bool FixedPointVad::ProcessWindow() {
+    // Window energy, as mean energy per sample
+    uint64_t energy = 0;
+    for (int i = 0; i < VAD_WINDOW_SAMPLES; i++) {
+        int32_t sample = window_[i];
+        bands_[i] = sample;
+        energy += (uint64_t)(sample * sample);
+    }
+    int energy_q8 = Log2Q8(energy / VAD_WINDOW_SAMPLES);
+
+    // Haar wavelet packet, 3 levels give 8 bands of 40 coefficients
+    int32_t* in = bands_;
+    int32_t* out = scratch_;
+    for (int length = VAD_WINDOW_SAMPLES; length > VAD_WINDOW_SAMPLES / VAD_BANDS; length /= 2) {
+        for (int offset = 0; offset < VAD_WINDOW_SAMPLES; offset += length) {
+            int half = length / 2;
+            for (int i = 0; i < half; i++) {
+                int32_t a = in[offset + 2 * i];
+                int32_t b = in[offset + 2 * i + 1];
+                out[offset + i] = a + b;
+                out[offset + half + i] = a - b;
+            }
+        }
+        int32_t* swap = in;
+        in = out;
+        out = swap;
+    }
+
+    // Spectral flatness in the log domain: log2(arithmetic mean) - mean(log2), 0 when perfectly flat
+    const int band_length = VAD_WINDOW_SAMPLES / VAD_BANDS;
+    uint64_t band_sum = 0;
+    int log_sum = 0;
+    for (int band = 0; band < VAD_BANDS; band++) {
+        uint64_t band_energy = 0;
+        for (int i = 0; i < band_length; i++) {
+            int64_t value = in[band * band_length + i];
+            band_energy += (uint64_t)(value * value);
+        }
+        band_energy = band_energy / band_length + 1;
+        band_sum += band_energy;
+        log_sum += Log2Q8(band_energy);
+    }
+    int tonality_q8 = Log2Q8(band_sum / VAD_BANDS) - log_sum / VAD_BANDS;
+
+    // Decide against the floor of the previous windows, then track the noise floor
+    int above_noise_q8 = energy_q8 - noise_q8_;
+    bool speech = noise_initialized_ && energy_q8 > VAD_ABSOLUTE_FLOOR_Q8 &&
+        ((above_noise_q8 > energy_threshold_q8_ && tonality_q8 > config_.tonality_threshold_q8) ||
+        above_noise_q8 > 2 * energy_threshold_q8_);
+
+    if (!noise_initialized_) {
+        noise_q8_ = energy_q8;
+        noise_initialized_ = true;
+    } else if (energy_q8 < noise_q8_) {
+        noise_q8_ = (noise_q8_ * 3 + energy_q8) / 4;
+    } else if (!speech && !speaking_) {
+        noise_q8_ += VAD_NOISE_RISE_Q8;
+    } else if (++speech_rise_windows_ >= VAD_NOISE_RISE_SPEECH_WINDOWS) {
+        speech_rise_windows_ = 0;
+        noise_q8_ += VAD_NOISE_RISE_Q8;
+    }
+
+    if (speech) {
+        speech_run_++;
+        silence_run_ = 0;
+    } else {
+        silence_run_++;
+        speech_run_ = 0;
+    }
+
+    if (!speaking_ && speech_run_ >= onset_windows_) {
+        speaking_ = true;
+        return true;
+    }
+    if (speaking_ && silence_run_ >= hangover_windows_) {
+        speaking_ = false;
+        return true;
+    }
+    return false;
+}
+
+bool FixedPointVad::Process(const int16_t* pcm, size_t samples) {
+    bool changed = false;
+    while (samples > 0) {
+        size_t count = VAD_WINDOW_SAMPLES - window_fill_;
+        if (count > samples) {
+            count = samples;
+        }
+        memcpy(window_ + window_fill_, pcm, count * sizeof(int16_t));
+        window_fill_ += count;
+        pcm += count;
+        samples -= count;
+
+        if (window_fill_ == VAD_WINDOW_SAMPLES) {
+            window_fill_ = 0;
+            changed = ProcessWindow() || changed;
+        }
+    }
+    return changed;
+}
@@ -0,0 +1,61 @@
+#ifndef FIXED_POINT_VAD_H
+#define FIXED_POINT_VAD_H
+
+#include <cstddef>
+#include <cstdint>
+
+/*
+ * A small integer-only VAD for boards without the AFE.
+ * Every 20 ms window of 16 kHz audio is split into 8 bands with a Haar wavelet packet (adds and subtracts only).
+ * A window is speech when its energy is well above the tracked noise floor and its band energies
+ * are not flat, speech needs a short onset to start and ends after a hangover of silence.
+ * All levels are log2 values in Q8, 1.0 (256) is about 3 dB.
+ */
+#define VAD_WINDOW_SAMPLES 320   // 20 ms at 16 kHz
+#define VAD_BANDS 8
+
+struct FixedPointVadConfig {
+    // Window energy above the noise floor to count as speech
+    int energy_threshold_db = 9;
+    // Minimum spread between arithmetic and geometric mean of the band energies, in Q8 log2
+    int tonality_threshold_q8 = 96;
+    // Consecutive speech needed before reporting speech
+    int onset_ms = 40;
+    // Silence needed before reporting the end of speech
+    int hangover_ms = 300;
+};
+
+class FixedPointVad {
+public:
+    FixedPointVad();
+
+    void Configure(const FixedPointVadConfig& config);
+    void Reset();
+    // Feed mono samples of any length, returns true when the speaking state changed
+    bool Process(const int16_t* pcm, size_t samples);
+    bool speaking() const { return speaking_; }
+    int noise_floor_q8() const { return noise_q8_; }
+
+private:
+    FixedPointVadConfig config_;
+    int energy_threshold_q8_ = 0;
+    int onset_windows_ = 0;
+    int hangover_windows_ = 0;
+
+    int16_t window_[VAD_WINDOW_SAMPLES];
+    int window_fill_ = 0;
+    int32_t bands_[VAD_WINDOW_SAMPLES];
+    int32_t scratch_[VAD_WINDOW_SAMPLES];
+
+    bool speaking_ = false;
+    bool noise_initialized_ = false;
+    int noise_q8_ = 0;
+    int speech_rise_windows_ = 0;
+    int speech_run_ = 0;
+    int silence_run_ = 0;
+
+    bool ProcessWindow();
+    static int Log2Q8(uint64_t value);
+};
+
+#endif
@@ -1,11 +1,19 @@
 #include "no_audio_processor.h"
 #include <esp_log.h>
+#include <esp_cpu.h>
 
 #define TAG "NoAudioProcessor"
 
 void NoAudioProcessor::Initialize(AudioCodec* codec, int frame_duration_ms, srmodel_list_t* models_list) {
     codec_ = codec;
     frame_samples_ = frame_duration_ms * 16000 / 1000;
+
+#if CONFIG_USE_NO_AUDIO_PROCESSOR_VAD
+    FixedPointVadConfig config;
+    config.energy_threshold_db = CONFIG_NO_AUDIO_PROCESSOR_VAD_THRESHOLD_DB;
+    config.hangover_ms = CONFIG_NO_AUDIO_PROCESSOR_VAD_HANGOVER_MS;
+    vad_.Configure(config);
+#endif
 }
 
 void NoAudioProcessor::Feed(std::vector<int16_t>&& data) {
@@ -19,18 +27,36 @@ void NoAudioProcessor::Feed(std::vector<int16_t>&& data) {
         for (size_t i = 0, j = 0; i < mono_data.size(); ++i, j += 2) {
             mono_data[i] = data[j];
         }
-        output_callback_(std::move(mono_data));
-    } else {
-        output_callback_(std::move(data));
+        data = std::move(mono_data);
+    }
+
+#if CONFIG_USE_NO_AUDIO_PROCESSOR_VAD
+    // Report speech edges the same way the AFE does
+    auto start_cycles = esp_cpu_get_cycle_count();
+    bool changed = vad_.Process(data.data(), data.size());
+    vad_cycles_ += esp_cpu_get_cycle_count() - start_cycles;
+    vad_frames_++;
+    if (changed && vad_state_change_callback_) {
+        vad_state_change_callback_(vad_.speaking());
     }
+#endif
+
+    output_callback_(std::move(data));
 }
 
 void NoAudioProcessor::Start() {
+    vad_.Reset();
     is_running_ = true;
 }
 
 void NoAudioProcessor::Stop() {
     is_running_ = false;
+    if (vad_frames_ > 0) {
+        ESP_LOGD(TAG, "VAD costs %lu cycles per frame, noise floor %d", (unsigned long)(vad_cycles_ / vad_frames_),
+            vad_.noise_floor_q8());
+        vad_cycles_ = 0;
+        vad_frames_ = 0;
+    }
 }
 
 bool NoAudioProcessor::IsRunning() {
@@ -57,3 +83,15 @@ void NoAudioProcessor::EnableDeviceAec(bool enable) {
         ESP_LOGE(TAG, "Device AEC is not supported");
     }
 }
+
+void NoAudioProcessor::SetComputeTier(AudioComputeTier tier) {
+    // Nothing to scale, the processor only forwards the microphone data
+}
+
+int NoAudioProcessor::GetVadHangoverMs() {
+#if CONFIG_USE_NO_AUDIO_PROCESSOR_VAD
+    return CONFIG_NO_AUDIO_PROCESSOR_VAD_HANGOVER_MS;
+#else
+    return 0;
+#endif
+}
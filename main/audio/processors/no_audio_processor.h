@@ -6,6 +6,7 @@
 
 #include "audio_processor.h"
 #include "audio_codec.h"
+#include "fixed_point_vad.h"
 
 class NoAudioProcessor : public AudioProcessor {
 public:
@@ -21,6 +22,8 @@ public:
     void OnVadStateChange(std::function<void(bool speaking)> callback) override;
     size_t GetFeedSize() override;
     void EnableDeviceAec(bool enable) override;
+    void SetComputeTier(AudioComputeTier tier) override;
+    int GetVadHangoverMs() override;
 
 private:
     AudioCodec* codec_ = nullptr;
@@ -28,6 +31,9 @@ private:
     std::function<void(std::vector<int16_t>&& data)> output_callback_;
     std::function<void(bool speaking)> vad_state_change_callback_;
     bool is_running_ = false;
+    FixedPointVad vad_;
+    uint64_t vad_cycles_ = 0;
+    uint32_t vad_frames_ = 0;
 };
 
 #endif 
\ No newline at end of file
@@ -0,0 +1,34 @@
+#include "utterance_endpointer.h"
+
+void UtteranceEndpointer::Configure(int min_speech_ms, int trailing_silence_ms, int vad_hangover_ms) {
+    min_speech_us_ = (int64_t)min_speech_ms * 1000;
+    trailing_silence_ms_ = trailing_silence_ms;
+    vad_hangover_us_ = (int64_t)vad_hangover_ms * 1000;
+    Reset();
+}
+
+void UtteranceEndpointer::Reset() {
+    speaking_ = false;
+    speech_start_us_ = 0;
+    speech_us_ = 0;
+}
+
+UtteranceEndpointer::Action UtteranceEndpointer::OnVadChange(bool speaking, int64_t now_us) {
+    if (speaking) {
+        if (!speaking_) {
+            speaking_ = true;
+            speech_start_us_ = now_us;
+        }
+        return kActionCancelTimer;
+    }
+
+    if (!speaking_) {
+        return kActionNone;
+    }
+    speaking_ = false;
+    int64_t run_us = now_us - speech_start_us_ - vad_hangover_us_;
+    if (run_us > 0) {
+        speech_us_ += run_us;
+    }
+    return speech_us_ >= min_speech_us_ ? kActionArmTimer : kActionNone;
+}
@@ -0,0 +1,38 @@
+#ifndef UTTERANCE_ENDPOINTER_H
+#define UTTERANCE_ENDPOINTER_H
+
+#include <cstdint>
+
+/*
+ * The end of utterance rule on the VAD edges, kept free of timers so it also runs on a host.
+ * Speech is the time from each speech edge to the following silence edge, less the VAD hangover
+ * that every run ends with, summed over the turn. A pause between words or a short noise burst
+ * does not count towards the minimum. Once the sum reaches the minimum, every silence edge arms
+ * the trailing silence timer and every speech edge cancels it.
+ */
+class UtteranceEndpointer {
+public:
+    enum Action {
+        kActionNone,
+        kActionCancelTimer,
+        kActionArmTimer,
+    };
+
+    void Configure(int min_speech_ms, int trailing_silence_ms, int vad_hangover_ms);
+    // Called at the start of each listening turn
+    void Reset();
+    Action OnVadChange(bool speaking, int64_t now_us);
+
+    int trailing_silence_ms() const { return trailing_silence_ms_; }
+    int64_t speech_us() const { return speech_us_; }
+
+private:
+    int64_t min_speech_us_ = 0;
+    int trailing_silence_ms_ = 0;
+    int64_t vad_hangover_us_ = 0;
+    bool speaking_ = false;
+    int64_t speech_start_us_ = 0;
+    int64_t speech_us_ = 0;
+};
+
+#endif
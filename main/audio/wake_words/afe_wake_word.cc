@@ -1,5 +1,8 @@
 #include "afe_wake_word.h"
 #include "audio_service.h"
+#if CONFIG_USE_SHARED_AFE
+#include "afe_service.h"
+#endif
 
 #include <esp_log.h>
 #include <sstream>
@@ -17,9 +20,11 @@ AfeWakeWord::AfeWakeWord()
 }
 
 AfeWakeWord::~AfeWakeWord() {
+#if !CONFIG_USE_SHARED_AFE
     if (afe_data_ != nullptr) {
         afe_iface_->destroy(afe_data_);
     }
+#endif
 
     if (wake_word_encode_task_stack_ != nullptr) {
         heap_caps_free(wake_word_encode_task_stack_);
@@ -38,7 +43,6 @@ AfeWakeWord::~AfeWakeWord() {
 
 bool AfeWakeWord::Initialize(AudioCodec* codec, srmodel_list_t* models_list) {
     codec_ = codec;
-    int ref_num = codec_->input_reference() ? 1 : 0;
 
     if (models_list == nullptr) {
         models_ = esp_srmodel_init("model");
@@ -64,6 +68,19 @@ bool AfeWakeWord::Initialize(AudioCodec* codec, srmodel_list_t* models_list) {
         }
     }
 
+#if CONFIG_USE_SHARED_AFE
+    auto& afe = AfeService::GetInstance();
+    if (!afe.Initialize(codec_, models_)) {
+        return false;
+    }
+    afe_iface_ = afe.iface();
+    afe_data_ = afe.data();
+    afe.SetHandler(kAfeModeWakeWord, [this](afe_fetch_result_t* res) {
+        ProcessResult(res);
+    });
+    return true;
+#else
+    int ref_num = codec_->input_reference() ? 1 : 0;
     std::string input_format;
     for (int i = 0; i < codec_->input_channels() - ref_num; i++) {
         input_format.push_back('M');
@@ -88,6 +105,7 @@ bool AfeWakeWord::Initialize(AudioCodec* codec, srmodel_list_t* models_list) {
     }, "audio_detection", 4096, this, 3, nullptr);
 
     return true;
+#endif
 }
 
 void AfeWakeWord::OnWakeWordDetected(std::function<void(const std::string& wake_word)> callback) {
@@ -95,21 +113,33 @@ void AfeWakeWord::OnWakeWordDetected(std::function<void(const std::string& wake_
 }
 
 void AfeWakeWord::Start() {
+#if CONFIG_USE_SHARED_AFE
+    AfeService::GetInstance().EnableMode(kAfeModeWakeWord, true);
+#else
     xEventGroupSetBits(event_group_, DETECTION_RUNNING_EVENT);
+#endif
 }
 
 void AfeWakeWord::Stop() {
+#if CONFIG_USE_SHARED_AFE
+    AfeService::GetInstance().EnableMode(kAfeModeWakeWord, false);
+#else
     xEventGroupClearBits(event_group_, DETECTION_RUNNING_EVENT);
     if (afe_data_ != nullptr) {
         afe_iface_->reset_buffer(afe_data_);
     }
+#endif
 }
 
 void AfeWakeWord::Feed(const std::vector<int16_t>& data) {
     if (afe_data_ == nullptr) {
         return;
     }
+#if CONFIG_USE_SHARED_AFE
+    AfeService::GetInstance().Feed(kAfeModeWakeWord, data.data());
+#else
     afe_iface_->feed(afe_data_, data.data());
+#endif
 }
 
 size_t AfeWakeWord::GetFeedSize() {
@@ -132,17 +162,20 @@ void AfeWakeWord::AudioDetectionTask() {
         if (res == nullptr || res->ret_value == ESP_FAIL) {
             continue;;
         }
+        ProcessResult(res);
+    }
+}
 
-        // Store the wake word data for voice recognition, like who is speaking
-        StoreWakeWordData(res->data, res->data_size / sizeof(int16_t));
+void AfeWakeWord::ProcessResult(afe_fetch_result_t* res) {
+    // Store the wake word data for voice recognition, like who is speaking
+    StoreWakeWordData(res->data, res->data_size / sizeof(int16_t));
 
-        if (res->wakeup_state == WAKENET_DETECTED) {
-            Stop();
-            last_detected_wake_word_ = wake_words_[res->wakenet_model_index - 1];
+    if (res->wakeup_state == WAKENET_DETECTED) {
+        Stop();
+        last_detected_wake_word_ = wake_words_[res->wakenet_model_index - 1];
 
-            if (wake_word_detected_callback_) {
-                wake_word_detected_callback_(last_detected_wake_word_);
-            }
+        if (wake_word_detected_callback_) {
+            wake_word_detected_callback_(last_detected_wake_word_);
         }
     }
 }
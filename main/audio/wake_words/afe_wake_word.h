@@ -55,6 +55,7 @@ private:
 
     void StoreWakeWordData(const int16_t* data, size_t size);
     void AudioDetectionTask();
+    void ProcessResult(afe_fetch_result_t* res);
 };
 
 #endif
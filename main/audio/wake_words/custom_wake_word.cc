@@ -73,7 +73,25 @@ void CustomWakeWord::ParseWakenetModelConfig() {
                     cJSON* text = cJSON_GetObjectItem(command, "text");
                     cJSON* action = cJSON_GetObjectItem(command, "action");
                     if (cJSON_IsString(command_name) && cJSON_IsString(text) && cJSON_IsString(action)) {
-                        commands_.push_back({command_name->valuestring, text->valuestring, action->valuestring});
+                        Command item = {command_name->valuestring, text->valuestring, action->valuestring};
+                        // Local commands map a phrase directly to an MCP tool call, e.g.
+                        // {"command": "tiao da yin liang", "text": "调大音量", "action": "mcp",
+                        //  "tool": "self.audio_speaker.set_volume", "arguments": {"volume": 80}}
+                        if (item.action == "mcp") {
+                            cJSON* tool = cJSON_GetObjectItem(command, "tool");
+                            cJSON* arguments = cJSON_GetObjectItem(command, "arguments");
+                            if (!cJSON_IsString(tool)) {
+                                ESP_LOGW(TAG, "Command %s has no tool, ignored", command_name->valuestring);
+                                continue;
+                            }
+                            item.tool = tool->valuestring;
+                            if (cJSON_IsObject(arguments)) {
+                                auto arguments_str = cJSON_PrintUnformatted(arguments);
+                                item.arguments = arguments_str;
+                                cJSON_free(arguments_str);
+                            }
+                        }
+                        commands_.push_back(std::move(item));
                         ESP_LOGI(TAG, "Command: %s, Text: %s, Action: %s", command_name->valuestring, text->valuestring, action->valuestring);
                     }
                 }
@@ -93,7 +111,7 @@ bool CustomWakeWord::Initialize(AudioCodec* codec, srmodel_list_t* models_list)
         models_ = esp_srmodel_init("model");
 #ifdef CONFIG_CUSTOM_WAKE_WORD
         threshold_ = CONFIG_CUSTOM_WAKE_WORD_THRESHOLD / 100.0f;
-        commands_.push_back({CONFIG_CUSTOM_WAKE_WORD, CONFIG_CUSTOM_WAKE_WORD_DISPLAY, "wake"});
+        commands_.push_back({CONFIG_CUSTOM_WAKE_WORD, CONFIG_CUSTOM_WAKE_WORD_DISPLAY, "wake", "", ""});
 #endif
     } else {
         models_ = models_list;
@@ -130,6 +148,10 @@ void CustomWakeWord::OnWakeWordDetected(std::function<void(const std::string& wa
     wake_word_detected_callback_ = callback;
 }
 
+void CustomWakeWord::OnLocalCommand(std::function<void(const std::string& tool, const std::string& arguments)> callback) {
+    local_command_callback_ = callback;
+}
+
 void CustomWakeWord::Start() {
     running_ = true;
 }
@@ -173,6 +195,12 @@ void CustomWakeWord::Feed(const std::vector<int16_t>& data) {
                 if (wake_word_detected_callback_) {
                     wake_word_detected_callback_(last_detected_wake_word_);
                 }
+            } else if (command.action == "mcp") {
+                // Keep listening for commands, only the tool call leaves this task
+                if (local_command_callback_) {
+                    local_command_callback_(command.tool, command.arguments);
+                }
+                break;
             }
         }
         multinet_->clean(multinet_model_data_);
@@ -31,12 +31,16 @@ public:
     void EncodeWakeWordData();
     bool GetWakeWordOpus(std::vector<uint8_t>& opus);
     const std::string& GetLastDetectedWakeWord() const { return last_detected_wake_word_; }
+    // Commands with the "mcp" action are handled on the device, without opening an audio channel
+    void OnLocalCommand(std::function<void(const std::string& tool, const std::string& arguments)> callback);
 
 private:
     struct Command {
         std::string command;
         std::string text;
         std::string action;
+        std::string tool;
+        std::string arguments;
     };
 
     // multinet 相关成员变量
@@ -50,6 +54,7 @@ private:
     std::deque<Command> commands_;
  
     std::function<void(const std::string& wake_word)> wake_word_detected_callback_;
+    std::function<void(const std::string& tool, const std::string& arguments)> local_command_callback_;
     AudioCodec* codec_ = nullptr;
     std::string last_detected_wake_word_;
     std::atomic<bool> running_ = false;
@@ -1,5 +1,9 @@
 #include "esp_wake_word.h"
+#include "audio_service.h"
+
 #include <esp_log.h>
+#include <esp_cpu.h>
+#include <esp_timer.h>
 
 
 #define TAG "EspWakeWord"
@@ -8,6 +12,12 @@ EspWakeWord::EspWakeWord() {
 }
 
 EspWakeWord::~EspWakeWord() {
+    {
+        std::unique_lock<std::mutex> lock(wake_word_mutex_);
+        wake_word_cv_.wait(lock, [this]() {
+            return !wake_word_encoding_;
+        });
+    }
     if (wakenet_data_ != nullptr) {
         wakenet_iface_->destroy(wakenet_data_);
         esp_srmodel_deinit(wakenet_model_);
@@ -62,9 +72,14 @@ void EspWakeWord::Feed(const std::vector<int16_t>& data) {
     }
 
     int res = wakenet_iface_->detect(wakenet_data_, (int16_t *)data.data());
+    StoreWakeWordData(data);
     if (res > 0) {
         last_detected_wake_word_ = wakenet_iface_->get_word_name(wakenet_data_, res);
         running_ = false;
+        if (adpcm_samples_ > 0) {
+            ESP_LOGI(TAG, "Pre-roll ADPCM costs %lu cycles per second of audio",
+                (unsigned long)((uint64_t)adpcm_cycles_ * 16000 / adpcm_samples_));
+        }
 
         if (wake_word_detected_callback_) {
             wake_word_detected_callback_(last_detected_wake_word_);
@@ -79,9 +94,106 @@ size_t EspWakeWord::GetFeedSize() {
     return wakenet_iface_->get_samp_chunksize(wakenet_data_);
 }
 
+void EspWakeWord::StoreWakeWordData(const std::vector<int16_t>& data) {
+    auto start_cycles = esp_cpu_get_cycle_count();
+    // Only the mic channel is kept when the codec also captures the reference
+    size_t channels = codec_->input_channels();
+    size_t samples = data.size() / channels;
+    const int16_t* pcm = data.data();
+    std::vector<int16_t> mono;
+    if (channels > 1) {
+        mono.resize(samples);
+        for (size_t i = 0; i < samples; i++) {
+            mono[i] = data[i * channels];
+        }
+        pcm = mono.data();
+    }
+
+    std::lock_guard<std::mutex> lock(wake_word_mutex_);
+    WakeWordAdpcmBlock block;
+    block.state = adpcm_state_;
+    block.samples = samples;
+    block.data.resize(ImaAdpcm::EncodedSize(samples));
+    ImaAdpcm::Encode(adpcm_state_, pcm, samples, block.data.data());
+    wake_word_adpcm_.push_back(std::move(block));
+    // keep about 2 seconds of data
+    while (wake_word_adpcm_.size() > 1 && wake_word_adpcm_.size() * samples > WAKE_WORD_PREROLL_MS * 16) {
+        wake_word_adpcm_.pop_front();
+    }
+
+    // Counters are halved before they overflow, the ratio is what matters
+    adpcm_cycles_ += esp_cpu_get_cycle_count() - start_cycles;
+    adpcm_samples_ += samples;
+    if (adpcm_samples_ > 16000 * 60) {
+        adpcm_cycles_ /= 2;
+        adpcm_samples_ /= 2;
+    }
+}
+
 void EspWakeWord::EncodeWakeWordData() {
+    {
+        // Join the previous transcoding before its packets are dropped, only one task and encoder exist at a time
+        std::unique_lock<std::mutex> lock(wake_word_mutex_);
+        wake_word_cv_.wait(lock, [this]() {
+            return !wake_word_encoding_;
+        });
+        wake_word_encoding_ = true;
+        wake_word_opus_.clear();
+    }
+
+    // Wakenet is stopped after detection, so the transcoding does not compete with it for the CPU
+    BaseType_t created = xTaskCreate([](void* arg) {
+        auto this_ = (EspWakeWord*)arg;
+        {
+            auto start_time = esp_timer_get_time();
+            std::deque<WakeWordAdpcmBlock> blocks;
+            {
+                std::lock_guard<std::mutex> lock(this_->wake_word_mutex_);
+                blocks.swap(this_->wake_word_adpcm_);
+            }
+
+            auto encoder = std::make_unique<OpusEncoderWrapper>(16000, 1, OPUS_FRAME_DURATION_MS);
+            encoder->SetComplexity(0); // 0 is the fastest
+
+            int packets = 0;
+            std::vector<int16_t> pcm;
+            for (auto& block : blocks) {
+                pcm.resize(block.samples);
+                ImaAdpcm::Decode(block.state, block.data.data(), block.samples, pcm.data());
+                encoder->Encode(std::move(pcm), [this_, &packets](std::vector<uint8_t>&& opus) {
+                    std::lock_guard<std::mutex> lock(this_->wake_word_mutex_);
+                    this_->wake_word_opus_.emplace_back(std::move(opus));
+                    this_->wake_word_cv_.notify_all();
+                    packets++;
+                });
+            }
+
+            auto end_time = esp_timer_get_time();
+            ESP_LOGI(TAG, "Encode wake word opus %d packets in %ld ms", packets, (long)((end_time - start_time) / 1000));
+
+            encoder.reset();
+            std::lock_guard<std::mutex> lock(this_->wake_word_mutex_);
+            this_->wake_word_opus_.push_back(std::vector<uint8_t>());
+            this_->wake_word_encoding_ = false;
+            this_->wake_word_cv_.notify_all();
+        }
+        vTaskDelete(NULL);
+    }, "encode_wake_word", 4096 * 6, this, 2, &wake_word_encode_task_);
+    if (created != pdPASS) {
+        ESP_LOGE(TAG, "Failed to create the wake word encode task");
+        std::lock_guard<std::mutex> lock(wake_word_mutex_);
+        wake_word_opus_.push_back(std::vector<uint8_t>());
+        wake_word_encoding_ = false;
+        wake_word_cv_.notify_all();
+    }
 }
 
 bool EspWakeWord::GetWakeWordOpus(std::vector<uint8_t>& opus) {
-    return false;
+    std::unique_lock<std::mutex> lock(wake_word_mutex_);
+    wake_word_cv_.wait(lock, [this]() {
+        return !wake_word_opus_.empty();
+    });
+    opus.swap(wake_word_opus_.front());
+    wake_word_opus_.pop_front();
+    return !opus.empty();
 }
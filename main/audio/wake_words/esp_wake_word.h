@@ -1,17 +1,32 @@
 #ifndef ESP_WAKE_WORD_H
 #define ESP_WAKE_WORD_H
 
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
 #include <esp_wn_iface.h>
 #include <esp_wn_models.h>
 #include <model_path.h>
 
 #include <string>
 #include <vector>
+#include <deque>
 #include <functional>
 #include <atomic>
+#include <mutex>
+#include <condition_variable>
 
 #include "audio_codec.h"
 #include "wake_word.h"
+#include "ima_adpcm.h"
+
+// Pre-roll kept for the server, the same 2 seconds the AFE wake word keeps
+#define WAKE_WORD_PREROLL_MS 2000
+
+struct WakeWordAdpcmBlock {
+    ImaAdpcmState state;
+    uint16_t samples;
+    std::vector<uint8_t> data;
+};
 
 class EspWakeWord : public WakeWord {
 public:
@@ -37,6 +52,19 @@ private:
 
     std::function<void(const std::string& wake_word)> wake_word_detected_callback_;
     std::string last_detected_wake_word_;
+
+    // The pre-roll is compressed with IMA-ADPCM while listening and only turned into Opus after detection
+    ImaAdpcmState adpcm_state_;
+    std::deque<WakeWordAdpcmBlock> wake_word_adpcm_;
+    uint32_t adpcm_cycles_ = 0;
+    uint32_t adpcm_samples_ = 0;
+    TaskHandle_t wake_word_encode_task_ = nullptr;
+    bool wake_word_encoding_ = false;
+    std::deque<std::vector<uint8_t>> wake_word_opus_;
+    std::mutex wake_word_mutex_;
+    std::condition_variable wake_word_cv_;
+
+    void StoreWakeWordData(const std::vector<int16_t>& data);
 };
 
 #endif
@@ -14,8 +14,7 @@ namespace audio_wifi_config
 
     void ReceiveWifiCredentialsFromAudio(Application *app,
                                         WifiConfigurationAp *wifi_ap,
-                                        Display *display,
-                                        size_t input_channels
+                                        Display *display
                                     )
     {
         const int kInputSampleRate = 16000;                                    // Input sampling rate
@@ -23,29 +22,28 @@ namespace audio_wifi_config
         std::vector<int16_t> audio_data;
         AudioSignalProcessor signal_processor(kAudioSampleRate, kMarkFrequency, kSpaceFrequency, kBitRate, kWindowSize);
         AudioDataBuffer data_buffer;
+        auto& audio_service = app->GetAudioService();
+        int consumer_id = 0;
 
         while (true)
         {
             // 检查Application状态，只有在WiFi配置模式下才处理音频
             if (app->GetDeviceState() != kDeviceStateWifiConfiguring) {
-                // 不在WiFi配置状态，休眠100ms后再检查
+                // 不在WiFi配置状态，释放麦克风，休眠100ms后再检查
+                if (consumer_id != 0) {
+                    audio_service.RemoveInputConsumer(consumer_id);
+                    consumer_id = 0;
+                }
                 vTaskDelay(pdMS_TO_TICKS(100));
                 continue;
             }
-            
-            if (!app->GetAudioService().ReadAudioData(audio_data, 16000, 480)) { // 16kHz, 480 samples corresponds to 30ms data
-                // 读取音频失败，短暂延迟后重试
-                ESP_LOGI(kLogTag, "Failed to read audio data, retrying.");
-                vTaskDelay(pdMS_TO_TICKS(10));
-                continue;
-            }
 
-            if (input_channels == 2) { // 如果是双声道输入，转换为单声道
-                auto mono_data = std::vector<int16_t>(audio_data.size() / 2);
-                for (size_t i = 0, j = 0; i < mono_data.size(); ++i, j += 2) {
-                    mono_data[i] = audio_data[j];
-                }
-                audio_data = std::move(mono_data);
+            // 通过音频服务的分发获取单声道数据，可与音频测试等功能同时运行
+            if (consumer_id == 0) {
+                consumer_id = audio_service.AddInputConsumer("afsk", {kInputSampleRate, false, 480}, 8); // 480 samples corresponds to 30ms data
+            }
+            if (!audio_service.ReadInputFrame(consumer_id, audio_data, 100)) {
+                continue;
             }
             
             // Downsample the audio data
@@ -99,7 +97,6 @@ namespace audio_wifi_config
                     data_buffer.decoded_text.reset();  // Clear processed data
                 }
             }
-            vTaskDelay(pdMS_TO_TICKS(1));  // 1ms delay
         }
     }
 
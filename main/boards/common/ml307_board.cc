@@ -119,6 +119,15 @@ std::string Ml307Board::GetDeviceStatusJson() {
      *     "audio_speaker": {
      *         "volume": 70
      *     },
+     *     "audio_stream": {
+     *         "state": "playing",
+     *         "url": "https://example.com/radio.ogg"
+     *     },
+     *     "audio_link": {
+     *         "quality": "good",
+     *         "rtt_ms": 120,
+     *         "jitter_ms": 8
+     *     },
      *     "screen": {
      *         "brightness": 100,
      *         "theme": "light"
@@ -145,6 +154,11 @@ std::string Ml307Board::GetDeviceStatusJson() {
     }
     cJSON_AddItemToObject(root, "audio_speaker", audio_speaker);
 
+#if CONFIG_USE_URL_AUDIO_PLAYER
+    cJSON_AddItemToObject(root, "audio_stream", Application::GetInstance().GetUrlPlayer().GetStatusJson());
+#endif
+    cJSON_AddItemToObject(root, "audio_link", Application::GetInstance().GetLinkStatusJson());
+
     // Screen brightness
     auto backlight = board.GetBacklight();
     auto screen = cJSON_CreateObject();
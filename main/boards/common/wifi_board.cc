@@ -56,13 +56,8 @@ void WifiBoard::EnterWifiConfigMode() {
 
     #if CONFIG_USE_ACOUSTIC_WIFI_PROVISIONING
     auto display = Board::GetInstance().GetDisplay();
-    auto codec = Board::GetInstance().GetAudioCodec();
-    int channel = 1;
-    if (codec) {
-        channel = codec->input_channels();
-    }
-    ESP_LOGI(TAG, "Start receiving WiFi credentials from audio, input channels: %d", channel);
-    audio_wifi_config::ReceiveWifiCredentialsFromAudio(&application, &wifi_ap, display, channel);
+    ESP_LOGI(TAG, "Start receiving WiFi credentials from audio");
+    audio_wifi_config::ReceiveWifiCredentialsFromAudio(&application, &wifi_ap, display);
     #endif
     
     // Wait forever until reset after configuration
@@ -182,6 +177,15 @@ std::string WifiBoard::GetDeviceStatusJson() {
      *     "audio_speaker": {
      *         "volume": 70
      *     },
+     *     "audio_stream": {
+     *         "state": "playing",
+     *         "url": "https://example.com/radio.ogg"
+     *     },
+     *     "audio_link": {
+     *         "quality": "good",
+     *         "rtt_ms": 120,
+     *         "jitter_ms": 8
+     *     },
      *     "screen": {
      *         "brightness": 100,
      *         "theme": "light"
@@ -211,6 +215,11 @@ std::string WifiBoard::GetDeviceStatusJson() {
     }
     cJSON_AddItemToObject(root, "audio_speaker", audio_speaker);
 
+#if CONFIG_USE_URL_AUDIO_PLAYER
+    cJSON_AddItemToObject(root, "audio_stream", Application::GetInstance().GetUrlPlayer().GetStatusJson());
+#endif
+    cJSON_AddItemToObject(root, "audio_link", Application::GetInstance().GetLinkStatusJson());
+
     // Screen brightness
     auto backlight = board.GetBacklight();
     auto screen = cJSON_CreateObject();
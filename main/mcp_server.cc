@@ -63,6 +63,32 @@ void McpServer::AddCommonTools() {
             return true;
         });
     
+#if CONFIG_USE_URL_AUDIO_PLAYER
+    AddTool("self.audio.play_url",
+        "Play an Ogg/Opus audio file or live stream from an HTTP(S) URL, e.g. music, a podcast or a radio station. "
+        "Playback starts once the conversation is over and pauses while the user talks to the device. "
+        "Any stream that is already playing is replaced.",
+        PropertyList({
+            Property("url", kPropertyTypeString)
+        }),
+        [](const PropertyList& properties) -> ReturnValue {
+            auto url = properties["url"].value<std::string>();
+            if (url.rfind("http://", 0) != 0 && url.rfind("https://", 0) != 0) {
+                throw std::runtime_error("Only HTTP(S) URLs are supported");
+            }
+            Application::GetInstance().GetUrlPlayer().Play(url);
+            return true;
+        });
+
+    AddTool("self.audio.stop",
+        "Stop the audio stream started by `self.audio.play_url`.",
+        PropertyList(),
+        [](const PropertyList& properties) -> ReturnValue {
+            Application::GetInstance().GetUrlPlayer().Stop();
+            return true;
+        });
+#endif
+
     auto backlight = board.GetBacklight();
     if (backlight) {
         AddTool("self.screen.set_brightness",
@@ -148,6 +174,47 @@ void McpServer::AddUserOnlyTools() {
             return true;
         });
 
+    AddUserOnlyTool("self.audio.get_performance",
+        "Get the per-frame cost and real-time factor of the audio DSP kernels (Opus encode / decode, resamplers), "
+        "and the state of the audio pipeline (compute tier, Opus settings, CPU load, formats, buffers). "
+        "Set `reset` to true to clear the counters after reading them.",
+        PropertyList({
+            Property("reset", kPropertyTypeBoolean, false)
+        }),
+        [](const PropertyList& properties) -> ReturnValue {
+            auto& audio_service = Application::GetInstance().GetAudioService();
+            auto json = audio_service.GetPerformanceJson();
+            if (properties["reset"].value<bool>()) {
+                audio_service.ResetPerformanceStatistics();
+            }
+            return json;
+        });
+
+#if CONFIG_USE_AUDIO_FLIGHT_RECORDER
+    AddUserOnlyTool("self.audio.get_flight_record",
+        "Get the audio flight recorder snapshot: the latest pipeline events (queue depths, drops, underruns, "
+        "VAD edges, device state changes) and optionally the newest recorded Opus packets (up to 4 KB). The recorder freezes after "
+        "a glitch; set `rearm` to true to clear it and start recording again after reading.",
+        PropertyList({
+            Property("max_events", kPropertyTypeInteger, FLIGHT_RECORDER_SNAPSHOT_MAX_EVENTS, 1, FLIGHT_RECORDER_SNAPSHOT_MAX_EVENTS),
+            Property("include_audio", kPropertyTypeBoolean, false),
+            Property("freeze", kPropertyTypeBoolean, false),
+            Property("rearm", kPropertyTypeBoolean, false)
+        }),
+        [](const PropertyList& properties) -> ReturnValue {
+            auto& recorder = Application::GetInstance().GetAudioService().GetFlightRecorder();
+            if (properties["freeze"].value<bool>()) {
+                recorder.Trigger(kFlightTriggerManual);
+            }
+            auto json = recorder.GetSnapshotJson(properties["max_events"].value<int>(),
+                properties["include_audio"].value<bool>());
+            if (properties["rearm"].value<bool>()) {
+                recorder.Rearm();
+            }
+            return json;
+        });
+#endif
+
     // Firmware upgrade
     AddUserOnlyTool("self.upgrade_firmware", "Upgrade firmware from a specific URL. This will download and install the firmware, then reboot the device.",
         PropertyList({
@@ -510,42 +577,53 @@ void McpServer::GetToolsList(int id, const std::string& cursor, bool list_user_o
     ReplyResult(id, json);
 }
 
-void McpServer::DoToolCall(int id, const std::string& tool_name, const cJSON* tool_arguments) {
+McpTool* McpServer::FindTool(const std::string& tool_name) {
     auto tool_iter = std::find_if(tools_.begin(), tools_.end(), 
                                  [&tool_name](const McpTool* tool) { 
                                      return tool->name() == tool_name; 
                                  });
-    
     if (tool_iter == tools_.end()) {
+        return nullptr;
+    }
+    return *tool_iter;
+}
+
+PropertyList McpServer::ParseToolArguments(const McpTool* tool, const cJSON* tool_arguments) {
+    PropertyList arguments = tool->properties();
+    for (auto& argument : arguments) {
+        bool found = false;
+        if (cJSON_IsObject(tool_arguments)) {
+            auto value = cJSON_GetObjectItem(tool_arguments, argument.name().c_str());
+            if (argument.type() == kPropertyTypeBoolean && cJSON_IsBool(value)) {
+                argument.set_value<bool>(value->valueint == 1);
+                found = true;
+            } else if (argument.type() == kPropertyTypeInteger && cJSON_IsNumber(value)) {
+                argument.set_value<int>(value->valueint);
+                found = true;
+            } else if (argument.type() == kPropertyTypeString && cJSON_IsString(value)) {
+                argument.set_value<std::string>(value->valuestring);
+                found = true;
+            }
+        }
+
+        if (!argument.has_default_value() && !found) {
+            throw std::runtime_error("Missing valid argument: " + argument.name());
+        }
+    }
+    return arguments;
+}
+
+void McpServer::DoToolCall(int id, const std::string& tool_name, const cJSON* tool_arguments) {
+    auto tool = FindTool(tool_name);
+    if (tool == nullptr) {
         ESP_LOGE(TAG, "tools/call: Unknown tool: %s", tool_name.c_str());
         ReplyError(id, "Unknown tool: " + tool_name);
         return;
     }
 
-    PropertyList arguments = (*tool_iter)->properties();
+    PropertyList arguments;
     try {
-        for (auto& argument : arguments) {
-            bool found = false;
-            if (cJSON_IsObject(tool_arguments)) {
-                auto value = cJSON_GetObjectItem(tool_arguments, argument.name().c_str());
-                if (argument.type() == kPropertyTypeBoolean && cJSON_IsBool(value)) {
-                    argument.set_value<bool>(value->valueint == 1);
-                    found = true;
-                } else if (argument.type() == kPropertyTypeInteger && cJSON_IsNumber(value)) {
-                    argument.set_value<int>(value->valueint);
-                    found = true;
-                } else if (argument.type() == kPropertyTypeString && cJSON_IsString(value)) {
-                    argument.set_value<std::string>(value->valuestring);
-                    found = true;
-                }
-            }
-
-            if (!argument.has_default_value() && !found) {
-                ESP_LOGE(TAG, "tools/call: Missing valid argument: %s", argument.name().c_str());
-                ReplyError(id, "Missing valid argument: " + argument.name());
-                return;
-            }
-        }
+        arguments = ParseToolArguments(tool, tool_arguments);
     } catch (const std::exception& e) {
         ESP_LOGE(TAG, "tools/call: %s", e.what());
         ReplyError(id, e.what());
@@ -554,12 +632,32 @@ void McpServer::DoToolCall(int id, const std::string& tool_name, const cJSON* to
 
     // Use main thread to call the tool
     auto& app = Application::GetInstance();
-    app.Schedule([this, id, tool_iter, arguments = std::move(arguments)]() {
+    app.Schedule([this, id, tool, arguments = std::move(arguments)]() {
         try {
-            ReplyResult(id, (*tool_iter)->Call(arguments));
+            ReplyResult(id, tool->Call(arguments));
         } catch (const std::exception& e) {
             ESP_LOGE(TAG, "tools/call: %s", e.what());
             ReplyError(id, e.what());
         }
     });
 }
+
+bool McpServer::CallToolLocally(const std::string& tool_name, const std::string& arguments) {
+    auto tool = FindTool(tool_name);
+    if (tool == nullptr) {
+        ESP_LOGE(TAG, "Local call: Unknown tool: %s", tool_name.c_str());
+        return false;
+    }
+
+    cJSON* json = arguments.empty() ? nullptr : cJSON_Parse(arguments.c_str());
+    try {
+        auto result = tool->Call(ParseToolArguments(tool, json));
+        ESP_LOGI(TAG, "Local call %s: %s", tool_name.c_str(), result.c_str());
+    } catch (const std::exception& e) {
+        ESP_LOGE(TAG, "Local call %s: %s", tool_name.c_str(), e.what());
+        cJSON_Delete(json);
+        return false;
+    }
+    cJSON_Delete(json);
+    return true;
+}
@@ -325,6 +325,8 @@ public:
     void AddUserOnlyTool(const std::string& name, const std::string& description, const PropertyList& properties, std::function<ReturnValue(const PropertyList&)> callback);
     void ParseMessage(const cJSON* json);
     void ParseMessage(const std::string& message);
+    // Call a tool on the device itself, without a server round trip. Must run in the main thread.
+    bool CallToolLocally(const std::string& tool_name, const std::string& arguments);
 
 private:
     McpServer();
@@ -337,6 +339,8 @@ private:
 
     void GetToolsList(int id, const std::string& cursor, bool list_user_only_tools);
     void DoToolCall(int id, const std::string& tool_name, const cJSON* tool_arguments);
+    McpTool* FindTool(const std::string& tool_name);
+    PropertyList ParseToolArguments(const McpTool* tool, const cJSON* tool_arguments);
 
     std::vector<McpTool*> tools_;
 };
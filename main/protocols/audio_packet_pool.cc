@@ -0,0 +1,68 @@
+#include "audio_packet_pool.h"
+
+#include <algorithm>
+
+AudioPacketPool::AudioPacketPool() {
+    free_packets_.reserve(AUDIO_PACKET_POOL_MAX_PACKETS);
+}
+
+std::unique_ptr<AudioStreamPacket> AudioPacketPool::Acquire(size_t size) {
+    std::unique_ptr<AudioStreamPacket> packet;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        acquired_++;
+        if (!free_packets_.empty()) {
+            packet = std::move(free_packets_.back());
+            free_packets_.pop_back();
+            reused_++;
+        }
+    }
+
+    if (packet) {
+        packet->sample_rate = 0;
+        packet->frame_duration = 0;
+        packet->timestamp = 0;
+        packet->format = kAudioFormatOpus;
+        packet->headroom = 0;
+        packet->sound = 0;
+        packet->payload.clear();
+    } else {
+        packet = std::make_unique<AudioStreamPacket>();
+    }
+    if (packet->payload.capacity() < size) {
+        packet->payload.reserve(std::max<size_t>(size, AUDIO_PACKET_POOL_MIN_CAPACITY));
+        std::lock_guard<std::mutex> lock(mutex_);
+        grown_++;
+    }
+    return packet;
+}
+
+void AudioPacketPool::Release(std::unique_ptr<AudioStreamPacket> packet) {
+    if (!packet) {
+        return;
+    }
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (free_packets_.size() < AUDIO_PACKET_POOL_MAX_PACKETS) {
+        free_packets_.push_back(std::move(packet));
+    }
+}
+
+void AudioPacketPool::Clear() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    free_packets_.clear();
+}
+
+cJSON* AudioPacketPool::GetStatusJson() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    size_t free_bytes = 0;
+    for (auto& packet : free_packets_) {
+        free_bytes += packet->payload.capacity();
+    }
+    auto root = cJSON_CreateObject();
+    cJSON_AddNumberToObject(root, "free_packets", free_packets_.size());
+    cJSON_AddNumberToObject(root, "free_bytes", free_bytes);
+    cJSON_AddNumberToObject(root, "acquired", acquired_);
+    cJSON_AddNumberToObject(root, "reused", reused_);
+    cJSON_AddNumberToObject(root, "allocations", grown_);
+    return root;
+}
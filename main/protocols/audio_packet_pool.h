@@ -0,0 +1,46 @@
+#ifndef AUDIO_PACKET_POOL_H
+#define AUDIO_PACKET_POOL_H
+
+#include <memory>
+#include <mutex>
+#include <vector>
+#include <cJSON.h>
+
+#include "protocol.h"
+
+/*
+ * Recycled downlink packets. A packet keeps its payload capacity when it comes back to the pool, so the
+ * receive callbacks fill it without touching the heap once the pool has warmed up. Packets are returned
+ * by whoever is done with them (the decoder, the burst buffer, a dropped or reset decode queue); a packet
+ * that is simply destroyed is not a leak, the pool allocates a new one when it runs dry.
+ */
+#define AUDIO_PACKET_POOL_MAX_PACKETS 48
+#define AUDIO_PACKET_POOL_MIN_CAPACITY 256
+
+class AudioPacketPool {
+public:
+    static AudioPacketPool& GetInstance() {
+        static AudioPacketPool instance;
+        return instance;
+    }
+    AudioPacketPool(const AudioPacketPool&) = delete;
+    AudioPacketPool& operator=(const AudioPacketPool&) = delete;
+
+    // A packet with default fields and an empty payload that can take `size` bytes without allocating
+    std::unique_ptr<AudioStreamPacket> Acquire(size_t size);
+    void Release(std::unique_ptr<AudioStreamPacket> packet);
+    // Frees the idle packets, used when the audio channel closes
+    void Clear();
+    cJSON* GetStatusJson();
+
+private:
+    AudioPacketPool();
+
+    std::mutex mutex_;
+    std::vector<std::unique_ptr<AudioStreamPacket>> free_packets_;
+    uint32_t acquired_ = 0;
+    uint32_t reused_ = 0;
+    uint32_t grown_ = 0;
+};
+
+#endif
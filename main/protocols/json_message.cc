@@ -0,0 +1,366 @@
+#include "json_message.h"
+
+#include <cstring>
+
+const char* JsonMessage::SkipWhitespace(const char* p, const char* end) {
+    while (p < end && (*p == ' ' || *p == '\t' || *p == '\n' || *p == '\r')) {
+        p++;
+    }
+    return p;
+}
+
+static int ParseHex4(const char* p) {
+    int code = 0;
+    for (int i = 0; i < 4; i++) {
+        char c = p[i];
+        code <<= 4;
+        if (c >= '0' && c <= '9') {
+            code |= c - '0';
+        } else if (c >= 'a' && c <= 'f') {
+            code |= c - 'a' + 10;
+        } else if (c >= 'A' && c <= 'F') {
+            code |= c - 'A' + 10;
+        } else {
+            return -1;
+        }
+    }
+    return code;
+}
+
+// p is after a backslash, returns the first character after the escape or nullptr. Like cJSON a \u
+// escape of a surrogate must be a high one followed by a low one
+static const char* ScanEscape(const char* p, const char* end) {
+    if (p >= end) {
+        return nullptr;
+    }
+    char c = *p++;
+    if (c != 'u') {
+        return c != '\0' && strchr("\"\\/bfnrt", c) != nullptr ? p : nullptr;
+    }
+    if (end - p < 4) {
+        return nullptr;
+    }
+    int code = ParseHex4(p);
+    p += 4;
+    if (code < 0 || (code >= 0xDC00 && code <= 0xDFFF)) {
+        return nullptr;
+    }
+    if (code >= 0xD800 && code <= 0xDBFF) {
+        if (end - p < 6 || p[0] != '\\' || p[1] != 'u') {
+            return nullptr;
+        }
+        int low = ParseHex4(p + 2);
+        if (low < 0xDC00 || low > 0xDFFF) {
+            return nullptr;
+        }
+        p += 6;
+    }
+    return p;
+}
+
+static const char* ScanDigits(const char* p, const char* end) {
+    while (p < end && *p >= '0' && *p <= '9') {
+        p++;
+    }
+    return p;
+}
+
+// p is after the opening quote, returns the closing quote or nullptr
+const char* JsonMessage::ScanString(const char* p, const char* end) {
+    while (p < end) {
+        char c = *p;
+        if (c == '"') {
+            return p;
+        }
+        if ((uint8_t)c < 0x20) {
+            return nullptr;
+        }
+        if (c != '\\') {
+            p++;
+        } else if ((p = ScanEscape(p + 1, end)) == nullptr) {
+            return nullptr;
+        }
+    }
+    return nullptr;
+}
+
+// -?(0|[1-9][0-9]*)(.[0-9]+)?([eE][+-]?[0-9]+)?, returns the first character after it or nullptr
+const char* JsonMessage::ScanNumber(const char* p, const char* end) {
+    if (p < end && *p == '-') {
+        p++;
+    }
+    if (p >= end || *p < '0' || *p > '9') {
+        return nullptr;
+    }
+    p = *p == '0' ? p + 1 : ScanDigits(p, end);
+    if (p < end && *p == '.') {
+        auto digits = p + 1;
+        p = ScanDigits(digits, end);
+        if (p == digits) {
+            return nullptr;
+        }
+    }
+    if (p < end && (*p == 'e' || *p == 'E')) {
+        p++;
+        if (p < end && (*p == '+' || *p == '-')) {
+            p++;
+        }
+        auto digits = p;
+        p = ScanDigits(digits, end);
+        if (p == digits) {
+            return nullptr;
+        }
+    }
+    return p;
+}
+
+// p is at the opening bracket, returns the matching closing bracket or nullptr. The members are
+// checked like top-level values, depth counts the objects and arrays around this one
+const char* JsonMessage::ScanContainer(const char* p, const char* end, int depth) {
+    if (depth == JSON_MESSAGE_MAX_DEPTH) {
+        return nullptr;
+    }
+    bool object = *p == '{';
+    char close = object ? '}' : ']';
+    p = SkipWhitespace(p + 1, end);
+    if (p < end && *p == close) {
+        return p;
+    }
+    while (true) {
+        if (object) {
+            if (p >= end || *p != '"') {
+                return nullptr;
+            }
+            p = ScanString(p + 1, end);
+            if (p == nullptr) {
+                return nullptr;
+            }
+            p = SkipWhitespace(p + 1, end);
+            if (p >= end || *p != ':') {
+                return nullptr;
+            }
+            p = SkipWhitespace(p + 1, end);
+        }
+        JsonSpan value;
+        p = ScanValue(p, end, value, depth + 1);
+        if (p == nullptr) {
+            return nullptr;
+        }
+        p = SkipWhitespace(p, end);
+        if (p >= end) {
+            return nullptr;
+        }
+        if (*p == close) {
+            return p;
+        }
+        if (*p != ',') {
+            return nullptr;
+        }
+        p = SkipWhitespace(p + 1, end);
+    }
+}
+
+// Returns the first character after the value or nullptr
+const char* JsonMessage::ScanValue(const char* p, const char* end, JsonSpan& value, int depth) {
+    if (p >= end) {
+        return nullptr;
+    }
+    const char* start = p;
+    char c = *p;
+    if (c == '"') {
+        auto close = ScanString(p + 1, end);
+        if (close == nullptr) {
+            return nullptr;
+        }
+        value = {start + 1, (size_t)(close - start - 1), kJsonString};
+        return close + 1;
+    }
+    if (c == '{' || c == '[') {
+        auto close = ScanContainer(p, end, depth);
+        if (close == nullptr) {
+            return nullptr;
+        }
+        value = {start, (size_t)(close - start + 1), c == '{' ? kJsonObject : kJsonArray};
+        return close + 1;
+    }
+
+    static const struct {
+        const char* text;
+        size_t size;
+        JsonValueType type;
+    } literals[] = {
+        {"true", 4, kJsonTrue},
+        {"false", 5, kJsonFalse},
+        {"null", 4, kJsonNull},
+    };
+    for (auto& literal : literals) {
+        if ((size_t)(end - p) >= literal.size && memcmp(p, literal.text, literal.size) == 0) {
+            value = {start, literal.size, literal.type};
+            return p + literal.size;
+        }
+    }
+
+    // A handler that needs a number converts the span
+    p = ScanNumber(p, end);
+    if (p == nullptr) {
+        return nullptr;
+    }
+    value = {start, (size_t)(p - start), kJsonNumber};
+    return p;
+}
+
+bool JsonMessage::Parse(const char* data, size_t size) {
+    field_count_ = 0;
+    const char* end = data + size;
+    const char* p = SkipWhitespace(data, end);
+    if (p >= end || *p != '{') {
+        return false;
+    }
+    p = SkipWhitespace(p + 1, end);
+    if (p < end && *p == '}') {
+        return SkipWhitespace(p + 1, end) == end;
+    }
+
+    while (true) {
+        if (p >= end || *p != '"') {
+            return false;
+        }
+        auto key_end = ScanString(p + 1, end);
+        if (key_end == nullptr) {
+            return false;
+        }
+        const char* key = p + 1;
+        p = SkipWhitespace(key_end + 1, end);
+        if (p >= end || *p != ':') {
+            return false;
+        }
+        JsonSpan value;
+        p = ScanValue(SkipWhitespace(p + 1, end), end, value, 0);
+        if (p == nullptr) {
+            return false;
+        }
+        if (field_count_ < JSON_MESSAGE_MAX_FIELDS) {
+            fields_[field_count_++] = {key, (size_t)(key_end - key), value, true};
+        }
+
+        p = SkipWhitespace(p, end);
+        if (p >= end) {
+            return false;
+        }
+        if (*p == '}') {
+            return SkipWhitespace(p + 1, end) == end;
+        }
+        if (*p != ',') {
+            return false;
+        }
+        p = SkipWhitespace(p + 1, end);
+    }
+}
+
+void JsonMessage::Add(const char* key, const char* data, size_t size, JsonValueType type) {
+    if (field_count_ < JSON_MESSAGE_MAX_FIELDS) {
+        fields_[field_count_++] = {key, strlen(key), {data, size, type}, false};
+    }
+}
+
+const JsonMessage::Field* JsonMessage::Find(const char* key) const {
+    size_t key_size = strlen(key);
+    for (size_t i = 0; i < field_count_; i++) {
+        auto& field = fields_[i];
+        if (field.key_size == key_size && memcmp(field.key, key, key_size) == 0) {
+            return &field;
+        }
+    }
+    return nullptr;
+}
+
+JsonSpan JsonMessage::Get(const char* key) const {
+    auto field = Find(key);
+    return field != nullptr ? field->value : JsonSpan();
+}
+
+bool JsonMessage::Equals(const char* key, const char* value) const {
+    auto span = Get(key);
+    return span.type == kJsonString && span.size == strlen(value) && memcmp(span.data, value, span.size) == 0;
+}
+
+static void AppendUtf8(std::string& out, uint32_t code) {
+    if (code < 0x80) {
+        out.push_back(code);
+    } else if (code < 0x800) {
+        out.push_back(0xC0 | (code >> 6));
+        out.push_back(0x80 | (code & 0x3F));
+    } else if (code < 0x10000) {
+        out.push_back(0xE0 | (code >> 12));
+        out.push_back(0x80 | ((code >> 6) & 0x3F));
+        out.push_back(0x80 | (code & 0x3F));
+    } else {
+        out.push_back(0xF0 | (code >> 18));
+        out.push_back(0x80 | ((code >> 12) & 0x3F));
+        out.push_back(0x80 | ((code >> 6) & 0x3F));
+        out.push_back(0x80 | (code & 0x3F));
+    }
+}
+
+bool JsonMessage::GetString(const char* key, std::string& value) const {
+    auto field = Find(key);
+    if (field == nullptr || field->value.type != kJsonString) {
+        return false;
+    }
+    auto& span = field->value;
+    if (!field->escaped) {
+        value.assign(span.data, span.size);
+        return true;
+    }
+    value.clear();
+    value.reserve(span.size);
+    const char* p = span.data;
+    const char* end = span.data + span.size;
+    while (p < end) {
+        // Copy the run up to the next escape at once
+        auto escape = (const char*)memchr(p, '\\', end - p);
+        if (escape == nullptr) {
+            value.append(p, end - p);
+            break;
+        }
+        value.append(p, escape - p);
+        p = escape + 1;
+        if (p >= end) {
+            return false;
+        }
+        char c = *p++;
+        switch (c) {
+        case '"': value.push_back('"'); break;
+        case '\\': value.push_back('\\'); break;
+        case '/': value.push_back('/'); break;
+        case 'b': value.push_back('\b'); break;
+        case 'f': value.push_back('\f'); break;
+        case 'n': value.push_back('\n'); break;
+        case 'r': value.push_back('\r'); break;
+        case 't': value.push_back('\t'); break;
+        case 'u': {
+            if (end - p < 4) {
+                return false;
+            }
+            int code = ParseHex4(p);
+            if (code < 0) {
+                return false;
+            }
+            p += 4;
+            // Characters outside the BMP come as a surrogate pair
+            if (code >= 0xD800 && code <= 0xDBFF && end - p >= 6 && p[0] == '\\' && p[1] == 'u') {
+                int low = ParseHex4(p + 2);
+                if (low >= 0xDC00 && low <= 0xDFFF) {
+                    code = 0x10000 + ((code - 0xD800) << 10) + (low - 0xDC00);
+                    p += 6;
+                }
+            }
+            AppendUtf8(value, code);
+            break;
+        }
+        default:
+            return false;
+        }
+    }
+    return true;
+}
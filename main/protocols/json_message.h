@@ -0,0 +1,84 @@
+#ifndef JSON_MESSAGE_H
+#define JSON_MESSAGE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+/*
+ * In-situ view of a JSON control message. Parse walks the text once, checks every token down to the
+ * nested objects and arrays, and records where each top-level value starts and ends. Only the top-level
+ * fields are indexed. Nothing is copied and nothing is allocated, the text must outlive the message. Strings are handed out raw and only unescaped when
+ * a handler copies one. Messages that need a DOM (mcp, custom) parse just their payload with cJSON.
+ */
+#define JSON_MESSAGE_MAX_FIELDS 16
+#define JSON_MESSAGE_MAX_DEPTH 32
+
+enum JsonValueType {
+    kJsonNone,
+    kJsonString,
+    kJsonNumber,
+    kJsonTrue,
+    kJsonFalse,
+    kJsonNull,
+    kJsonObject,
+    kJsonArray,
+};
+
+// A string span excludes the quotes and is still escaped, an object or array span includes its brackets
+struct JsonSpan {
+    const char* data = nullptr;
+    size_t size = 0;
+    JsonValueType type = kJsonNone;
+};
+
+class JsonMessage {
+public:
+    // Returns false unless the text is a single well-formed object, fields past the first
+    // JSON_MESSAGE_MAX_FIELDS are checked but not indexed
+    bool Parse(const char* data, size_t size);
+
+    JsonSpan Get(const char* key) const;
+    bool IsString(const char* key) const { return Get(key).type == kJsonString; }
+    // Compares the raw string, meant for enumerations like "type" and "state"
+    bool Equals(const char* key, const char* value) const;
+    // Unescapes the string into value, false if the field is missing or not a string
+    bool GetString(const char* key, std::string& value) const;
+    // Indexes a value that was not parsed from JSON text (a binary control message), its strings are not escaped
+    void Add(const char* key, const char* data, size_t size, JsonValueType type);
+
+    // FNV-1a, used to dispatch on "type" through tables built at compile time
+    static constexpr uint32_t Hash(const char* data, size_t size) {
+        uint32_t hash = 2166136261u;
+        for (size_t i = 0; i < size; i++) {
+            hash = (hash ^ (uint8_t)data[i]) * 16777619u;
+        }
+        return hash;
+    }
+    static constexpr uint32_t Hash(const char* text) {
+        size_t size = 0;
+        while (text[size] != '\0') {
+            size++;
+        }
+        return Hash(text, size);
+    }
+
+private:
+    struct Field {
+        const char* key;
+        size_t key_size;
+        JsonSpan value;
+        bool escaped;
+    };
+    Field fields_[JSON_MESSAGE_MAX_FIELDS];
+    size_t field_count_ = 0;
+
+    const Field* Find(const char* key) const;
+    static const char* SkipWhitespace(const char* p, const char* end);
+    static const char* ScanString(const char* p, const char* end);
+    static const char* ScanNumber(const char* p, const char* end);
+    static const char* ScanContainer(const char* p, const char* end, int depth);
+    static const char* ScanValue(const char* p, const char* end, JsonSpan& value, int depth);
+};
+
+#endif
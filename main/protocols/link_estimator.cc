@@ -0,0 +1,172 @@
+#include "link_estimator.h"
+
+#include <esp_log.h>
+#include <esp_timer.h>
+#include <algorithm>
+
+#define TAG "LinkEstimator"
+
+struct LinkQualityProfile {
+    const char* name;
+    int opus_bitrate;
+    int min_fec_loss_percent;
+};
+
+// Indexed by LinkQuality, FEC is only worth its bits once packets are being lost
+static const LinkQualityProfile LINK_QUALITY_PROFILES[] = {
+    {"poor", 12000, 10},
+    {"fair", 16000, 5},
+    {"good", 24000, 0},
+};
+
+LinkEstimator::LinkEstimator() {
+}
+
+void LinkEstimator::Reset(int rtt_ms) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    quality_ = kLinkQualityGood;
+    worse_samples_ = 0;
+    better_samples_ = 0;
+    rtt_ms_ = rtt_ms;
+    jitter_x16_ = 0;
+    peak_jitter_x16_ = 0;
+    last_arrival_ms_ = 0;
+    last_timestamp_ = 0;
+    received_ = 0;
+    lost_ = 0;
+    loss_percent_ = 0;
+    backlog_ = 0;
+    max_backlog_ = 0;
+    dropped_ = false;
+    total_lost_ = 0;
+    total_dropped_ = 0;
+}
+
+void LinkEstimator::RecordIncomingAudio(uint32_t timestamp) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    received_++;
+    // Versions without a timestamp send 0, they only count towards the loss
+    if (timestamp == 0) {
+        return;
+    }
+    int64_t arrival_ms = esp_timer_get_time() / 1000;
+    if (last_arrival_ms_ != 0 && timestamp > last_timestamp_) {
+        int64_t transit_change = (arrival_ms - last_arrival_ms_) - (int64_t)(timestamp - last_timestamp_);
+        // Only late packets count, a server that sends faster than real time (burst buffer) is not jitter
+        uint32_t d = std::clamp<int64_t>(transit_change, 0, 10000);
+        // J += (|D| - J) / 16, kept scaled by 16 to stay in integers
+        jitter_x16_ += d - ((jitter_x16_ + 8) >> 4);
+        peak_jitter_x16_ = std::max(peak_jitter_x16_, jitter_x16_);
+    }
+    last_arrival_ms_ = arrival_ms;
+    last_timestamp_ = timestamp;
+}
+
+void LinkEstimator::RecordLostAudio(uint32_t packets) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    lost_ += packets;
+    total_lost_ += packets;
+}
+
+void LinkEstimator::RecordSendBacklog(size_t packets, bool dropped) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    backlog_ = std::max(backlog_, packets);
+    if (dropped) {
+        dropped_ = true;
+        total_dropped_++;
+    }
+}
+
+// Called with mutex_ held, the quality of the last second alone
+LinkQuality LinkEstimator::Measure() {
+    if (received_ + lost_ > 0) {
+        int sample = lost_ * 100 / (received_ + lost_);
+        // Smoothed over a few seconds, a single burst should not look like a lossy link
+        loss_percent_ = (loss_percent_ * 7 + sample * 3 + 5) / 10;
+    }
+    // Over the websocket audio arrives in order, the packets held up behind a stall come at once and
+    // the smoothed jitter falls back within a second, so the second is judged by its peak
+    int jitter_ms = peak_jitter_x16_ >> 4;
+    if (loss_percent_ >= LINK_ESTIMATOR_LOSS_POOR_PERCENT || jitter_ms >= LINK_ESTIMATOR_JITTER_POOR_MS ||
+        rtt_ms_ >= LINK_ESTIMATOR_RTT_POOR_MS || backlog_ >= LINK_ESTIMATOR_BACKLOG_POOR_PACKETS || dropped_) {
+        return kLinkQualityPoor;
+    }
+    if (loss_percent_ >= LINK_ESTIMATOR_LOSS_FAIR_PERCENT || jitter_ms >= LINK_ESTIMATOR_JITTER_FAIR_MS ||
+        rtt_ms_ >= LINK_ESTIMATOR_RTT_FAIR_MS || backlog_ >= LINK_ESTIMATOR_BACKLOG_FAIR_PACKETS) {
+        return kLinkQualityFair;
+    }
+    return kLinkQualityGood;
+}
+
+bool LinkEstimator::Update() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto measured = Measure();
+    max_backlog_ = std::max(max_backlog_, backlog_);
+    received_ = 0;
+    lost_ = 0;
+    backlog_ = 0;
+    dropped_ = false;
+    peak_jitter_x16_ = jitter_x16_;
+
+    auto previous = quality_;
+    if (measured < quality_) {
+        better_samples_ = 0;
+        if (++worse_samples_ >= LINK_ESTIMATOR_STEP_DOWN_SAMPLES) {
+            // A bad link is followed right away, not one level at a time
+            quality_ = measured;
+            worse_samples_ = 0;
+        }
+    } else if (measured > quality_) {
+        worse_samples_ = 0;
+        if (++better_samples_ >= LINK_ESTIMATOR_STEP_UP_SAMPLES) {
+            quality_ = (LinkQuality)(quality_ + 1);
+            better_samples_ = 0;
+        }
+    } else {
+        worse_samples_ = 0;
+        better_samples_ = 0;
+    }
+
+    if (quality_ == previous) {
+        return false;
+    }
+    ESP_LOGI(TAG, "Link %s (rtt %d ms, jitter %lu ms, loss %d%%)", quality_name(), rtt_ms_,
+        jitter_x16_ >> 4, loss_percent_);
+    return true;
+}
+
+LinkQuality LinkEstimator::quality() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return quality_;
+}
+
+int LinkEstimator::opus_bitrate() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return LINK_QUALITY_PROFILES[quality_].opus_bitrate;
+}
+
+int LinkEstimator::fec_loss_percent() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    int min_loss = LINK_QUALITY_PROFILES[quality_].min_fec_loss_percent;
+    if (min_loss == 0) {
+        return 0;
+    }
+    return std::clamp(loss_percent_, min_loss, 30);
+}
+
+const char* LinkEstimator::quality_name() const {
+    return LINK_QUALITY_PROFILES[quality_].name;
+}
+
+cJSON* LinkEstimator::GetStatusJson() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto root = cJSON_CreateObject();
+    cJSON_AddStringToObject(root, "quality", quality_name());
+    cJSON_AddNumberToObject(root, "rtt_ms", rtt_ms_);
+    cJSON_AddNumberToObject(root, "jitter_ms", jitter_x16_ >> 4);
+    cJSON_AddNumberToObject(root, "loss_percent", loss_percent_);
+    cJSON_AddNumberToObject(root, "lost_packets", total_lost_);
+    cJSON_AddNumberToObject(root, "max_send_backlog", max_backlog_);
+    cJSON_AddNumberToObject(root, "send_drops", total_dropped_);
+    return root;
+}
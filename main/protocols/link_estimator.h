@@ -0,0 +1,80 @@
+#ifndef LINK_ESTIMATOR_H
+#define LINK_ESTIMATOR_H
+
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <cJSON.h>
+
+/*
+ * Estimates the quality of the link to the server from what the protocols already see: the hello round
+ * trip, the late-arrival jitter of timestamped downlink audio (after RFC 3550), UDP sequence gaps and
+ * the uplink backlog in the main loop. Sampled about once per second by the Application, it steps the
+ * quality down quickly and up slowly, like the audio governor, and each level maps to an Opus bitrate
+ * and FEC setting. The device cannot see uplink loss, the downlink loss stands in for it.
+ */
+#define LINK_ESTIMATOR_STEP_DOWN_SAMPLES 2
+#define LINK_ESTIMATOR_STEP_UP_SAMPLES 8
+#define LINK_ESTIMATOR_LOSS_FAIR_PERCENT 3
+#define LINK_ESTIMATOR_LOSS_POOR_PERCENT 10
+#define LINK_ESTIMATOR_JITTER_FAIR_MS 60
+#define LINK_ESTIMATOR_JITTER_POOR_MS 150
+#define LINK_ESTIMATOR_RTT_FAIR_MS 400
+#define LINK_ESTIMATOR_RTT_POOR_MS 1000
+#define LINK_ESTIMATOR_BACKLOG_FAIR_PACKETS 2
+#define LINK_ESTIMATOR_BACKLOG_POOR_PACKETS 4
+
+enum LinkQuality {
+    kLinkQualityPoor,
+    kLinkQualityFair,
+    kLinkQualityGood,
+};
+
+class LinkEstimator {
+public:
+    LinkEstimator();
+
+    // Starts over for a new audio channel, with the round trip of its hello
+    void Reset(int rtt_ms);
+    void RecordIncomingAudio(uint32_t timestamp);
+    void RecordLostAudio(uint32_t packets);
+    // Packets the main loop found in the send queue at once, and whether one of them could not be sent
+    void RecordSendBacklog(size_t packets, bool dropped);
+
+    // Returns true when the quality level changed
+    bool Update();
+
+    LinkQuality quality();
+    int opus_bitrate();
+    // 0 turns in-band FEC off, otherwise the packet loss the encoder should expect
+    int fec_loss_percent();
+    cJSON* GetStatusJson();
+
+private:
+    std::mutex mutex_;
+    LinkQuality quality_ = kLinkQualityGood;
+    int worse_samples_ = 0;
+    int better_samples_ = 0;
+
+    int rtt_ms_ = 0;
+    // RFC 3550 interarrival jitter, in milliseconds scaled by 16
+    uint32_t jitter_x16_ = 0;
+    // The highest jitter since the last sample, a stall has mostly decayed again by the time of the sample
+    uint32_t peak_jitter_x16_ = 0;
+    int64_t last_arrival_ms_ = 0;
+    uint32_t last_timestamp_ = 0;
+
+    uint32_t received_ = 0;
+    uint32_t lost_ = 0;
+    int loss_percent_ = 0;
+    size_t backlog_ = 0;
+    size_t max_backlog_ = 0;
+    bool dropped_ = false;
+    uint32_t total_lost_ = 0;
+    uint32_t total_dropped_ = 0;
+
+    LinkQuality Measure();
+    const char* quality_name() const;
+};
+
+#endif
@@ -2,6 +2,7 @@
 #include "board.h"
 #include "application.h"
 #include "settings.h"
+#include "audio_packet_pool.h"
 
 #include <esp_log.h>
 #include <cstring>
@@ -28,6 +29,18 @@ MqttProtocol::MqttProtocol() {
         .arg = this,
     };
     esp_timer_create(&reconnect_timer_args, &reconnect_timer_);
+
+    esp_timer_create_args_t reorder_timer_args = {
+        .callback = [](void* arg) {
+            MqttProtocol* protocol = (MqttProtocol*)arg;
+            protocol->FlushReorderSlots();
+        },
+        .arg = this,
+        .dispatch_method = ESP_TIMER_TASK,
+        .name = "udp_reorder",
+        .skip_unhandled_events = true
+    };
+    esp_timer_create(&reorder_timer_args, &reorder_timer_);
 }
 
 MqttProtocol::~MqttProtocol() {
@@ -36,6 +49,10 @@ MqttProtocol::~MqttProtocol() {
         esp_timer_stop(reconnect_timer_);
         esp_timer_delete(reconnect_timer_);
     }
+    if (reorder_timer_ != nullptr) {
+        esp_timer_stop(reorder_timer_);
+        esp_timer_delete(reorder_timer_);
+    }
 
     udp_.reset();
     mqtt_.reset();
@@ -91,33 +108,35 @@ bool MqttProtocol::StartMqttClient(bool report_error) {
     });
 
     mqtt_->OnMessage([this](const std::string& topic, const std::string& payload) {
-        cJSON* root = cJSON_Parse(payload.c_str());
-        if (root == nullptr) {
+        JsonMessage message;
+        if (!message.Parse(payload.data(), payload.size())) {
             ESP_LOGE(TAG, "Failed to parse json message %s", payload.c_str());
             return;
         }
-        cJSON* type = cJSON_GetObjectItem(root, "type");
-        if (!cJSON_IsString(type)) {
+        if (!message.IsString("type")) {
             ESP_LOGE(TAG, "Message type is invalid");
-            cJSON_Delete(root);
             return;
         }
 
-        if (strcmp(type->valuestring, "hello") == 0) {
+        if (message.Equals("type", "hello")) {
+            // Only the hello needs a DOM
+            auto root = cJSON_ParseWithLength(payload.data(), payload.size());
             ParseServerHello(root);
-        } else if (strcmp(type->valuestring, "goodbye") == 0) {
-            auto session_id = cJSON_GetObjectItem(root, "session_id");
-            ESP_LOGI(TAG, "Received goodbye message, session_id: %s", session_id ? session_id->valuestring : "null");
-            if (session_id == nullptr || session_id_ == session_id->valuestring) {
+            cJSON_Delete(root);
+        } else if (message.Equals("type", "goodbye")) {
+            std::string session_id;
+            bool has_session_id = message.GetString("session_id", session_id);
+            ESP_LOGI(TAG, "Received goodbye message, session_id: %s", has_session_id ? session_id.c_str() : "null");
+            if (!has_session_id || session_id_ == session_id) {
                 Application::GetInstance().Schedule([this]() {
                     CloseAudioChannel();
                 });
             }
         } else if (on_incoming_json_ != nullptr) {
-            on_incoming_json_(root);
+            on_incoming_json_(message);
         }
-        cJSON_Delete(root);
         last_incoming_time_ = std::chrono::steady_clock::now();
+        MarkLinkActivity();
     });
 
     ESP_LOGI(TAG, "Connecting to endpoint %s", endpoint.c_str());
@@ -144,6 +163,7 @@ bool MqttProtocol::SendText(const std::string& text) {
     if (publish_topic_.empty()) {
         return false;
     }
+    MarkLinkActivity();
     if (!mqtt_->Publish(publish_topic_, text)) {
         ESP_LOGE(TAG, "Failed to publish message: %s", text.c_str());
         SetError(Lang::Strings::SERVER_ERROR);
@@ -157,25 +177,29 @@ bool MqttProtocol::SendAudio(std::unique_ptr<AudioStreamPacket> packet) {
     if (udp_ == nullptr) {
         return false;
     }
-
-    std::string nonce(aes_nonce_);
-    *(uint16_t*)&nonce[2] = htons(packet->payload.size());
-    *(uint32_t*)&nonce[8] = htonl(packet->timestamp);
-    *(uint32_t*)&nonce[12] = htonl(++local_sequence_);
-
-    std::string encrypted;
-    encrypted.resize(aes_nonce_.size() + packet->payload.size());
-    memcpy(encrypted.data(), nonce.data(), nonce.size());
-
+    MarkLinkActivity();
+
+    // Udp::Send takes a std::string, the nonce and the ciphertext are written straight into a datagram
+    // buffer that keeps its capacity, so a packet costs no allocation and no copy besides the encryption
+    size_t size = packet->size();
+    udp_send_buffer_.resize(MQTT_UDP_NONCE_SIZE + size);
+    auto header = (uint8_t*)&udp_send_buffer_[0];
+    memcpy(header, aes_nonce_.data(), MQTT_UDP_NONCE_SIZE);
+    *(uint16_t*)&header[2] = htons(size);
+    *(uint32_t*)&header[8] = htonl(packet->timestamp);
+    *(uint32_t*)&header[12] = htonl(++local_sequence_);
+
+    // mbedtls advances the counter block, the header keeps the initial one
+    uint8_t counter[MQTT_UDP_NONCE_SIZE];
+    memcpy(counter, header, MQTT_UDP_NONCE_SIZE);
     size_t nc_off = 0;
     uint8_t stream_block[16] = {0};
-    if (mbedtls_aes_crypt_ctr(&aes_ctx_, packet->payload.size(), &nc_off, (uint8_t*)nonce.c_str(), stream_block,
-        (uint8_t*)packet->payload.data(), (uint8_t*)&encrypted[nonce.size()]) != 0) {
+    if (mbedtls_aes_crypt_ctr(&aes_ctx_, size, &nc_off, counter, stream_block, packet->data(), header + MQTT_UDP_NONCE_SIZE) != 0) {
         ESP_LOGE(TAG, "Failed to encrypt audio data");
         return false;
     }
 
-    return udp_->Send(encrypted) > 0;
+    return udp_->Send(udp_send_buffer_) > 0;
 }
 
 void MqttProtocol::CloseAudioChannel() {
@@ -183,6 +207,7 @@ void MqttProtocol::CloseAudioChannel() {
         std::lock_guard<std::mutex> lock(channel_mutex_);
         udp_.reset();
     }
+    ResetReorderSlots();
 
     std::string message = "{";
     message += "\"session_id\":\"" + session_id_ + "\",";
@@ -208,6 +233,7 @@ bool MqttProtocol::OpenAudioChannel() {
     xEventGroupClearBits(event_group_handle_, MQTT_PROTOCOL_SERVER_HELLO_EVENT);
 
     auto message = GetHelloMessage();
+    hello_sent_us_ = esp_timer_get_time();
     if (!SendText(message)) {
         return false;
     }
@@ -229,7 +255,7 @@ bool MqttProtocol::OpenAudioChannel() {
          * |type 1u|flags 1u|payload_len 2u|ssrc 4u|timestamp 4u|sequence 4u|
          * |payload payload_len|
          */
-        if (data.size() < sizeof(aes_nonce_)) {
+        if (data.size() < MQTT_UDP_NONCE_SIZE) {
             ESP_LOGE(TAG, "Invalid audio packet size: %u", data.size());
             return;
         }
@@ -239,34 +265,35 @@ bool MqttProtocol::OpenAudioChannel() {
         }
         uint32_t timestamp = ntohl(*(uint32_t*)&data[8]);
         uint32_t sequence = ntohl(*(uint32_t*)&data[12]);
-        if (sequence < remote_sequence_) {
-            ESP_LOGW(TAG, "Received audio packet with old sequence: %lu, expected: %lu", sequence, remote_sequence_);
+        if (!CheckReplayWindow(sequence)) {
+            ESP_LOGW(TAG, "Dropped duplicate or stale audio packet: %lu, latest: %lu", sequence, remote_sequence_);
             return;
         }
-        if (sequence != remote_sequence_ + 1) {
-            ESP_LOGW(TAG, "Received audio packet with wrong sequence: %lu, expected: %lu", sequence, remote_sequence_ + 1);
-        }
 
-        size_t decrypted_size = data.size() - aes_nonce_.size();
-        size_t nc_off = 0;
-        uint8_t stream_block[16] = {0};
-        auto nonce = (uint8_t*)data.data();
-        auto encrypted = (uint8_t*)data.data() + aes_nonce_.size();
-        auto packet = std::make_unique<AudioStreamPacket>();
+        // Decrypted straight from the datagram into a recycled packet
+        size_t payload_size = data.size() - MQTT_UDP_NONCE_SIZE;
+        auto packet = AudioPacketPool::GetInstance().Acquire(payload_size);
         packet->sample_rate = server_sample_rate_;
         packet->frame_duration = server_frame_duration_;
         packet->timestamp = timestamp;
-        packet->payload.resize(decrypted_size);
-        int ret = mbedtls_aes_crypt_ctr(&aes_ctx_, decrypted_size, &nc_off, nonce, stream_block, encrypted, (uint8_t*)packet->payload.data());
+        packet->format = downlink_format_;
+        packet->payload.resize(payload_size);
+        // The datagram belongs to the Udp, mbedtls advances a copy of its counter block
+        uint8_t counter[MQTT_UDP_NONCE_SIZE];
+        memcpy(counter, data.data(), MQTT_UDP_NONCE_SIZE);
+        size_t nc_off = 0;
+        uint8_t stream_block[16] = {0};
+        int ret = mbedtls_aes_crypt_ctr(&aes_ctx_, payload_size, &nc_off, counter, stream_block,
+            (const uint8_t*)data.data() + MQTT_UDP_NONCE_SIZE, packet->payload.data());
         if (ret != 0) {
             ESP_LOGE(TAG, "Failed to decrypt audio data, ret: %d", ret);
+            AudioPacketPool::GetInstance().Release(std::move(packet));
             return;
         }
-        if (on_incoming_audio_ != nullptr) {
-            on_incoming_audio_(std::move(packet));
-        }
-        remote_sequence_ = sequence;
+        link_estimator_.RecordIncomingAudio(timestamp);
+        DeliverInOrder(sequence, std::move(packet));
         last_incoming_time_ = std::chrono::steady_clock::now();
+        MarkLinkActivity();
     });
 
     udp_->Connect(udp_server_, udp_port_);
@@ -274,6 +301,9 @@ bool MqttProtocol::OpenAudioChannel() {
     if (on_audio_channel_opened_ != nullptr) {
         on_audio_channel_opened_();
     }
+    if (on_audio_params_negotiated_ != nullptr) {
+        on_audio_params_negotiated_();
+    }
     return true;
 }
 
@@ -290,10 +320,13 @@ std::string MqttProtocol::GetHelloMessage() {
     cJSON_AddBoolToObject(features, "mcp", true);
     cJSON_AddItemToObject(root, "features", features);
     cJSON* audio_params = cJSON_CreateObject();
-    cJSON_AddStringToObject(audio_params, "format", "opus");
+    // A 60 ms frame of raw PCM is 1920 bytes, it does not fit in one UDP datagram under the MTU
+    AddAudioFormats(audio_params, AUDIO_FORMATS_ALL & ~AUDIO_FORMAT_BIT(kAudioFormatPcm));
     cJSON_AddNumberToObject(audio_params, "sample_rate", 16000);
     cJSON_AddNumberToObject(audio_params, "channels", 1);
     cJSON_AddNumberToObject(audio_params, "frame_duration", OPUS_FRAME_DURATION_MS);
+    // Opus decodes natively at the codec output rate, so the server may encode at that rate too
+    cJSON_AddNumberToObject(audio_params, "output_sample_rate", Board::GetInstance().GetAudioCodec()->output_sample_rate());
     cJSON_AddItemToObject(root, "audio_params", audio_params);
     auto json_str = cJSON_PrintUnformatted(root);
     std::string message(json_str);
@@ -304,10 +337,12 @@ std::string MqttProtocol::GetHelloMessage() {
 
 void MqttProtocol::ParseServerHello(const cJSON* root) {
     auto transport = cJSON_GetObjectItem(root, "transport");
-    if (transport == nullptr || strcmp(transport->valuestring, "udp") != 0) {
-        ESP_LOGE(TAG, "Unsupported transport: %s", transport->valuestring);
+    // The root is null when the hello did not parse, the log must not dereference a missing transport
+    if (!cJSON_IsString(transport) || strcmp(transport->valuestring, "udp") != 0) {
+        ESP_LOGE(TAG, "Unsupported transport: %s", cJSON_IsString(transport) ? transport->valuestring : "none");
         return;
     }
+    MeasureHelloRoundTrip();
 
     auto session_id = cJSON_GetObjectItem(root, "session_id");
     if (cJSON_IsString(session_id)) {
@@ -317,6 +352,7 @@ void MqttProtocol::ParseServerHello(const cJSON* root) {
 
     // Get sample rate from hello message
     auto audio_params = cJSON_GetObjectItem(root, "audio_params");
+    ParseAudioFormats(audio_params);
     if (cJSON_IsObject(audio_params)) {
         auto sample_rate = cJSON_GetObjectItem(audio_params, "sample_rate");
         if (cJSON_IsNumber(sample_rate)) {
@@ -341,13 +377,152 @@ void MqttProtocol::ParseServerHello(const cJSON* root) {
     // auto encryption = cJSON_GetObjectItem(udp, "encryption")->valuestring;
     // ESP_LOGI(TAG, "UDP server: %s, port: %d, encryption: %s", udp_server_.c_str(), udp_port_, encryption);
     aes_nonce_ = DecodeHexString(nonce);
+    if (aes_nonce_.size() != MQTT_UDP_NONCE_SIZE) {
+        ESP_LOGE(TAG, "Invalid UDP nonce size: %u", aes_nonce_.size());
+        return;
+    }
     mbedtls_aes_init(&aes_ctx_);
     mbedtls_aes_setkey_enc(&aes_ctx_, (const unsigned char*)DecodeHexString(key).c_str(), 128);
     local_sequence_ = 0;
     remote_sequence_ = 0;
+    replay_window_ = 0;
+    ResetReorderSlots();
     xEventGroupSetBits(event_group_handle_, MQTT_PROTOCOL_SERVER_HELLO_EVENT);
 }
 
+bool MqttProtocol::CheckReplayWindow(uint32_t sequence) {
+    if (sequence > remote_sequence_) {
+        uint32_t shift = sequence - remote_sequence_;
+        replay_window_ = shift >= MQTT_UDP_REPLAY_WINDOW ? 0 : replay_window_ << shift;
+        replay_window_ |= 1;
+        remote_sequence_ = sequence;
+        return true;
+    }
+    uint32_t offset = remote_sequence_ - sequence;
+    if (offset >= MQTT_UDP_REPLAY_WINDOW) {
+        return false;
+    }
+    uint64_t bit = 1ULL << offset;
+    if (replay_window_ & bit) {
+        return false;
+    }
+    replay_window_ |= bit;
+    return true;
+}
+
+void MqttProtocol::DeliverInOrder(uint32_t sequence, std::unique_ptr<AudioStreamPacket> packet) {
+    std::lock_guard<std::mutex> lock(reorder_mutex_);
+    if (next_sequence_ == 0) {
+        next_sequence_ = sequence;
+    }
+    if (sequence < next_sequence_) {
+        // Its gap was given up already, playing it now would only repeat old audio
+        ESP_LOGW(TAG, "Dropped late audio packet: %lu, expected: %lu", sequence, next_sequence_);
+        AudioPacketPool::GetInstance().Release(std::move(packet));
+        return;
+    }
+    if (sequence != next_sequence_) {
+        reordered_packets_++;
+    }
+
+    if (sequence - next_sequence_ >= 2 * MQTT_UDP_REORDER_DEPTH) {
+        // A long jump gives up the whole gap at once, the held packets go first and the rest is lost
+        uint32_t end = sequence - MQTT_UDP_REORDER_DEPTH + 1;
+        uint32_t lost = end - next_sequence_;
+        for (uint32_t held = next_sequence_; held < next_sequence_ + MQTT_UDP_REORDER_DEPTH; held++) {
+            auto& slot = reorder_slots_[held % MQTT_UDP_REORDER_DEPTH];
+            if (slot == nullptr) {
+                continue;
+            }
+            lost--;
+            if (on_incoming_audio_ != nullptr) {
+                on_incoming_audio_(std::move(slot));
+            }
+            slot.reset();
+        }
+        lost_packets_ += lost;
+        link_estimator_.RecordLostAudio(lost);
+        ESP_LOGW(TAG, "Gave up audio packets %lu to %lu, %lu of them lost, lost %lu so far", next_sequence_, end - 1,
+            lost, lost_packets_);
+        next_sequence_ = end;
+    }
+    // The slot of `sequence` must be free, older packets still waiting for a gap go first
+    while (sequence >= next_sequence_ + MQTT_UDP_REORDER_DEPTH) {
+        auto& slot = reorder_slots_[next_sequence_ % MQTT_UDP_REORDER_DEPTH];
+        if (slot != nullptr) {
+            if (on_incoming_audio_ != nullptr) {
+                on_incoming_audio_(std::move(slot));
+            }
+            slot.reset();
+        } else {
+            lost_packets_++;
+            link_estimator_.RecordLostAudio(1);
+            ESP_LOGW(TAG, "Lost audio packet: %lu, lost %lu so far", next_sequence_, lost_packets_);
+        }
+        next_sequence_++;
+    }
+    reorder_slots_[sequence % MQTT_UDP_REORDER_DEPTH] = std::move(packet);
+
+    while (true) {
+        auto& slot = reorder_slots_[next_sequence_ % MQTT_UDP_REORDER_DEPTH];
+        if (slot == nullptr) {
+            break;
+        }
+        if (on_incoming_audio_ != nullptr) {
+            on_incoming_audio_(std::move(slot));
+        }
+        slot.reset();
+        next_sequence_++;
+    }
+
+    // Something is still waiting for a gap, do not let the end of a reply hang there
+    bool holding = false;
+    for (auto& slot : reorder_slots_) {
+        holding |= slot != nullptr;
+    }
+    esp_timer_stop(reorder_timer_);
+    if (holding) {
+        esp_timer_start_once(reorder_timer_, MQTT_UDP_REORDER_DEPTH * server_frame_duration_ * 1000);
+    }
+}
+
+void MqttProtocol::FlushReorderSlots() {
+    std::lock_guard<std::mutex> lock(reorder_mutex_);
+    // Gaps up to the newest held packet are given up, empty slots after it were never sent
+    uint32_t end = next_sequence_;
+    for (uint32_t sequence = next_sequence_; sequence < next_sequence_ + MQTT_UDP_REORDER_DEPTH; sequence++) {
+        if (reorder_slots_[sequence % MQTT_UDP_REORDER_DEPTH] != nullptr) {
+            end = sequence + 1;
+        }
+    }
+    for (; next_sequence_ < end; next_sequence_++) {
+        auto& slot = reorder_slots_[next_sequence_ % MQTT_UDP_REORDER_DEPTH];
+        if (slot == nullptr) {
+            lost_packets_++;
+            link_estimator_.RecordLostAudio(1);
+            continue;
+        }
+        if (on_incoming_audio_ != nullptr) {
+            on_incoming_audio_(std::move(slot));
+        }
+        slot.reset();
+    }
+}
+
+void MqttProtocol::ResetReorderSlots() {
+    std::lock_guard<std::mutex> lock(reorder_mutex_);
+    esp_timer_stop(reorder_timer_);
+    for (auto& slot : reorder_slots_) {
+        slot.reset();
+    }
+    next_sequence_ = 0;
+    if (reordered_packets_ > 0 || lost_packets_ > 0) {
+        ESP_LOGI(TAG, "UDP audio: %lu reordered, %lu lost", reordered_packets_, lost_packets_);
+    }
+    reordered_packets_ = 0;
+    lost_packets_ = 0;
+}
+
 static const char hex_chars[] = "0123456789ABCDEF";
 // 辅助函数，将单个十六进制字符转换为对应的数值
 static inline uint8_t CharToHex(char c) {
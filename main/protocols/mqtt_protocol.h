@@ -21,6 +21,16 @@
 
 #define MQTT_PROTOCOL_SERVER_HELLO_EVENT (1 << 0)
 
+/*
+ * UDP audio arrives in any order. A sliding bitmap over the last MQTT_UDP_REPLAY_WINDOW sequences drops
+ * duplicates and replays, and up to MQTT_UDP_REORDER_DEPTH packets wait for a missing one before the gap
+ * is given up, so the decoder sees the packets in sequence. Held packets are flushed after the same number
+ * of frame durations when no later packet arrives.
+ */
+#define MQTT_UDP_NONCE_SIZE 16
+#define MQTT_UDP_REPLAY_WINDOW 64
+#define MQTT_UDP_REORDER_DEPTH 4
+
 class MqttProtocol : public Protocol {
 public:
     MqttProtocol();
@@ -40,17 +50,32 @@ private:
     std::mutex channel_mutex_;
     std::unique_ptr<Mqtt> mqtt_;
     std::unique_ptr<Udp> udp_;
+    // The outgoing datagram, reused for every packet under channel_mutex_
+    std::string udp_send_buffer_;
     mbedtls_aes_context aes_ctx_;
     std::string aes_nonce_;
     std::string udp_server_;
     int udp_port_;
     uint32_t local_sequence_;
+    // Highest sequence accepted, bit i of replay_window_ is set once remote_sequence_ - i has arrived
     uint32_t remote_sequence_;
+    uint64_t replay_window_ = 0;
     esp_timer_handle_t reconnect_timer_;
 
+    std::mutex reorder_mutex_;
+    std::unique_ptr<AudioStreamPacket> reorder_slots_[MQTT_UDP_REORDER_DEPTH];
+    uint32_t next_sequence_ = 0;
+    uint32_t reordered_packets_ = 0;
+    uint32_t lost_packets_ = 0;
+    esp_timer_handle_t reorder_timer_ = nullptr;
+
     bool StartMqttClient(bool report_error=false);
     void ParseServerHello(const cJSON* root);
     std::string DecodeHexString(const std::string& hex_string);
+    bool CheckReplayWindow(uint32_t sequence);
+    void DeliverInOrder(uint32_t sequence, std::unique_ptr<AudioStreamPacket> packet);
+    void FlushReorderSlots();
+    void ResetReorderSlots();
 
     bool SendText(const std::string& text) override;
     std::string GetHelloMessage();
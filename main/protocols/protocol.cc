@@ -1,10 +1,19 @@
 #include "protocol.h"
 
 #include <esp_log.h>
+#include <esp_timer.h>
+#include <algorithm>
+#include <cstring>
 
 #define TAG "Protocol"
 
-void Protocol::OnIncomingJson(std::function<void(const cJSON* root)> callback) {
+static const char* const AUDIO_FORMAT_NAMES[] = {
+    "opus",
+    "pcm",
+    "adpcm",
+};
+
+void Protocol::OnIncomingJson(std::function<void(const JsonMessage& message)> callback) {
     on_incoming_json_ = callback;
 }
 
@@ -16,6 +25,10 @@ void Protocol::OnAudioChannelOpened(std::function<void()> callback) {
     on_audio_channel_opened_ = callback;
 }
 
+void Protocol::OnAudioParamsNegotiated(std::function<void()> callback) {
+    on_audio_params_negotiated_ = callback;
+}
+
 void Protocol::OnAudioChannelClosed(std::function<void()> callback) {
     on_audio_channel_closed_ = callback;
 }
@@ -40,6 +53,9 @@ void Protocol::SetError(const std::string& message) {
 }
 
 void Protocol::SendAbortSpeaking(AbortReason reason) {
+    if (SendControl(kBinaryControlAbort, reason, "")) {
+        return;
+    }
     std::string message = "{\"session_id\":\"" + session_id_ + "\",\"type\":\"abort\"";
     if (reason == kAbortReasonWakeWordDetected) {
         message += ",\"reason\":\"wake_word_detected\"";
@@ -49,12 +65,18 @@ void Protocol::SendAbortSpeaking(AbortReason reason) {
 }
 
 void Protocol::SendWakeWordDetected(const std::string& wake_word) {
+    if (SendControl(kBinaryControlListenDetect, 0, wake_word)) {
+        return;
+    }
     std::string json = "{\"session_id\":\"" + session_id_ + 
                       "\",\"type\":\"listen\",\"state\":\"detect\",\"text\":\"" + wake_word + "\"}";
     SendText(json);
 }
 
 void Protocol::SendStartListening(ListeningMode mode) {
+    if (SendControl(kBinaryControlListenStart, mode, "")) {
+        return;
+    }
     std::string message = "{\"session_id\":\"" + session_id_ + "\"";
     message += ",\"type\":\"listen\",\"state\":\"start\"";
     if (mode == kListeningModeRealtime) {
@@ -69,6 +91,9 @@ void Protocol::SendStartListening(ListeningMode mode) {
 }
 
 void Protocol::SendStopListening() {
+    if (SendControl(kBinaryControlListenStop, 0, "")) {
+        return;
+    }
     std::string message = "{\"session_id\":\"" + session_id_ + "\",\"type\":\"listen\",\"state\":\"stop\"}";
     SendText(message);
 }
@@ -78,6 +103,62 @@ void Protocol::SendMcpMessage(const std::string& payload) {
     SendText(message);
 }
 
+bool Protocol::SendBinaryControl(BinaryControlType control, uint8_t argument, const std::string& text) {
+    // Only transports that negotiate binary control messages implement them
+    return false;
+}
+
+bool Protocol::SendControl(BinaryControlType control, uint8_t argument, const std::string& text) {
+    if (!binary_control_) {
+        return false;
+    }
+    if (SendBinaryControl(control, argument, text)) {
+        return true;
+    }
+    // A message the encoder refused goes out as JSON, a failed send is not repeated
+    return error_occurred_;
+}
+
+bool Protocol::ParseBinaryControl(const uint8_t* data, size_t size, JsonMessage& message) {
+    if (size < sizeof(BinaryControlMessage) || data[0] != BINARY_CONTROL_MESSAGE_TYPE) {
+        return false;
+    }
+    auto control = (const BinaryControlMessage*)data;
+    // The strings point into the message, handlers see the same fields as with JSON
+    auto text = (const char*)control->text;
+    size_t text_size = size - sizeof(BinaryControlMessage);
+    auto add_string = [&message](const char* key, const char* value) {
+        message.Add(key, value, strlen(value), kJsonString);
+    };
+    switch (control->control) {
+    case kBinaryControlTtsStart:
+        add_string("type", "tts");
+        add_string("state", "start");
+        break;
+    case kBinaryControlTtsStop:
+        add_string("type", "tts");
+        add_string("state", "stop");
+        break;
+    case kBinaryControlTtsSentence:
+        add_string("type", "tts");
+        add_string("state", "sentence_start");
+        message.Add("text", text, text_size, kJsonString);
+        break;
+    case kBinaryControlStt:
+        add_string("type", "stt");
+        message.Add("text", text, text_size, kJsonString);
+        break;
+    case kBinaryControlLlmEmotion:
+        add_string("type", "llm");
+        message.Add("emotion", text, text_size, kJsonString);
+        break;
+    default:
+        ESP_LOGW(TAG, "Unknown binary control message: 0x%02x", control->control);
+        return false;
+    }
+    return true;
+}
+
 bool Protocol::IsTimeout() const {
     const int kTimeoutSeconds = 120;
     auto now = std::chrono::steady_clock::now();
@@ -88,3 +169,108 @@ bool Protocol::IsTimeout() const {
     }
     return timeout;
 }
+
+void Protocol::ResetLinkActivity() {
+    std::lock_guard<std::mutex> lock(link_activity_mutex_);
+    link_session_start_us_ = esp_timer_get_time();
+    link_active_us_ = 0;
+    last_link_activity_us_ = 0;
+}
+
+void Protocol::MarkLinkActivity() {
+    std::lock_guard<std::mutex> lock(link_activity_mutex_);
+    auto now = esp_timer_get_time();
+    // Packets closer than the tail keep the radio active in between, otherwise only the tail counts
+    if (last_link_activity_us_ > 0) {
+        link_active_us_ += std::min<int64_t>(now - last_link_activity_us_, LINK_ACTIVITY_TAIL_MS * 1000);
+    }
+    last_link_activity_us_ = now;
+}
+
+void Protocol::MeasureHelloRoundTrip() {
+    if (hello_sent_us_ > 0) {
+        link_rtt_ms_ = (esp_timer_get_time() - hello_sent_us_) / 1000;
+        hello_sent_us_ = 0;
+        ESP_LOGI(TAG, "Hello round trip: %d ms", link_rtt_ms_);
+    }
+    link_estimator_.Reset(link_rtt_ms_);
+}
+
+uint8_t* Protocol::PrepareAudioHeader(AudioStreamPacket& packet, size_t size) {
+    if (packet.headroom < size) {
+        // Only packets built without headroom, like the wake word audio, have their payload moved
+        packet.payload.insert(packet.payload.begin(), size - packet.headroom, 0);
+        packet.headroom = size;
+    }
+    return packet.data() - size;
+}
+
+int64_t Protocol::link_active_ms() {
+    std::lock_guard<std::mutex> lock(link_activity_mutex_);
+    int64_t active_us = link_active_us_;
+    if (last_link_activity_us_ > 0) {
+        active_us += std::min<int64_t>(esp_timer_get_time() - last_link_activity_us_, LINK_ACTIVITY_TAIL_MS * 1000);
+    }
+    return active_us / 1000;
+}
+
+int64_t Protocol::link_session_ms() {
+    std::lock_guard<std::mutex> lock(link_activity_mutex_);
+    return link_session_start_us_ > 0 ? (esp_timer_get_time() - link_session_start_us_) / 1000 : 0;
+}
+
+const char* Protocol::GetAudioFormatName(AudioFormat format) {
+    return AUDIO_FORMAT_NAMES[format];
+}
+
+static bool ParseAudioFormat(const cJSON* item, AudioFormat& format) {
+    if (!cJSON_IsString(item)) {
+        return false;
+    }
+    for (size_t i = 0; i < sizeof(AUDIO_FORMAT_NAMES) / sizeof(AUDIO_FORMAT_NAMES[0]); i++) {
+        if (strcmp(item->valuestring, AUDIO_FORMAT_NAMES[i]) == 0) {
+            format = (AudioFormat)i;
+            return true;
+        }
+    }
+    ESP_LOGW(TAG, "Unsupported audio format: %s", item->valuestring);
+    return false;
+}
+
+void Protocol::AddAudioFormats(cJSON* audio_params, uint32_t formats) {
+    // "format" stays opus for servers that do not negotiate, "formats" lists what the device can also handle
+    cJSON_AddStringToObject(audio_params, "format", GetAudioFormatName(kAudioFormatOpus));
+    offered_formats_ = AUDIO_FORMAT_BIT(kAudioFormatOpus);
+#if CONFIG_OFFER_UNCOMPRESSED_AUDIO_FORMATS
+    offered_formats_ |= formats & AUDIO_FORMATS_ALL;
+    auto names = cJSON_CreateArray();
+    for (size_t i = 0; i < sizeof(AUDIO_FORMAT_NAMES) / sizeof(AUDIO_FORMAT_NAMES[0]); i++) {
+        if (offered_formats_ & AUDIO_FORMAT_BIT(i)) {
+            cJSON_AddItemToArray(names, cJSON_CreateString(AUDIO_FORMAT_NAMES[i]));
+        }
+    }
+    cJSON_AddItemToObject(audio_params, "formats", names);
+#endif
+#if CONFIG_USE_DOWNLINK_BURST_BUFFER
+    // The server may send faster than real time as long as it stays within this many bytes ahead of playback
+    cJSON_AddNumberToObject(audio_params, "downlink_buffer_bytes", CONFIG_DOWNLINK_BURST_BUFFER_KB * 1024);
+#endif
+}
+
+void Protocol::ParseAudioFormats(const cJSON* audio_params) {
+    uplink_format_ = kAudioFormatOpus;
+    downlink_format_ = kAudioFormatOpus;
+    if (!cJSON_IsObject(audio_params)) {
+        return;
+    }
+    // The server format describes what it sends, uplink_format what it wants to receive
+    ParseAudioFormat(cJSON_GetObjectItem(audio_params, "format"), downlink_format_);
+    ParseAudioFormat(cJSON_GetObjectItem(audio_params, "uplink_format"), uplink_format_);
+    for (auto format : {&downlink_format_, &uplink_format_}) {
+        if (!(offered_formats_ & AUDIO_FORMAT_BIT(*format))) {
+            ESP_LOGW(TAG, "Audio format %s was not offered, using opus", GetAudioFormatName(*format));
+            *format = kAudioFormatOpus;
+        }
+    }
+    ESP_LOGI(TAG, "Audio format: uplink %s, downlink %s", GetAudioFormatName(uplink_format_), GetAudioFormatName(downlink_format_));
+}
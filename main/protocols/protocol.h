@@ -4,14 +4,44 @@
 #include <cJSON.h>
 #include <string>
 #include <functional>
+#include <memory>
 #include <chrono>
 #include <vector>
+#include <mutex>
+
+#include "link_estimator.h"
+#include "json_message.h"
+
+// The radio stays in its high power state for a while after the last packet, this is a lower bound,
+// cellular networks usually keep the modem connected for several seconds
+#define LINK_ACTIVITY_TAIL_MS 2000
+
+// Audio formats that can be negotiated in the hello exchange
+enum AudioFormat {
+    kAudioFormatOpus,
+    kAudioFormatPcm,    // 16-bit little-endian mono
+    kAudioFormatAdpcm,  // IMA-ADPCM, 4-byte state header then two samples per byte
+};
+#define AUDIO_FORMAT_BIT(format) (1u << (format))
+#define AUDIO_FORMATS_ALL (AUDIO_FORMAT_BIT(kAudioFormatOpus) | AUDIO_FORMAT_BIT(kAudioFormatPcm) | AUDIO_FORMAT_BIT(kAudioFormatAdpcm))
+
+// Room left in front of uplink audio for the largest websocket header (BinaryProtocol2)
+#define AUDIO_PACKET_HEADROOM 16
 
 struct AudioStreamPacket {
     int sample_rate = 0;
     int frame_duration = 0;
     uint32_t timestamp = 0;
     std::vector<uint8_t> payload;
+    AudioFormat format = kAudioFormatOpus;
+    // The first `headroom` bytes of payload are free for the transport header, the audio follows them
+    size_t headroom = 0;
+    // Local sounds carry the handle that queued them, audio from the server leaves it 0
+    uint32_t sound = 0;
+
+    uint8_t* data() { return payload.data() + headroom; }
+    const uint8_t* data() const { return payload.data() + headroom; }
+    size_t size() const { return payload.size() - headroom; }
 };
 
 struct BinaryProtocol2 {
@@ -30,6 +60,46 @@ struct BinaryProtocol3 {
     uint8_t payload[];
 } __attribute__((packed));
 
+// Several audio frames in one message, each frame is a BinaryProtocol4Frame
+struct BinaryProtocol4 {
+    uint8_t type;           // Message type (0: audio frames)
+    uint8_t frame_count;
+    uint8_t frames[];
+} __attribute__((packed));
+
+struct BinaryProtocol4Frame {
+    uint32_t timestamp;     // Timestamp in milliseconds (used for server-side AEC)
+    uint16_t payload_size;
+    uint8_t payload[];
+} __attribute__((packed));
+
+// Fixed-schema control messages negotiated in hello, carried in binary protocols 3 and 4 with this
+// message type, MCP and anything else stays JSON. The websocket connection stands for the session id.
+#define BINARY_CONTROL_MESSAGE_TYPE 2
+// Longer texts from the device are sent in the JSON form instead
+#define BINARY_CONTROL_MAX_TEXT_SIZE 64
+
+enum BinaryControlType {
+    // Device to server
+    kBinaryControlListenStart = 0x01,   // argument: ListeningMode
+    kBinaryControlListenStop = 0x02,
+    kBinaryControlListenDetect = 0x03,  // text: wake word
+    kBinaryControlAbort = 0x04,         // argument: AbortReason
+    // Server to device
+    kBinaryControlTtsStart = 0x10,
+    kBinaryControlTtsStop = 0x11,
+    kBinaryControlTtsSentence = 0x12,   // text: sentence
+    kBinaryControlStt = 0x13,           // text: recognized speech
+    kBinaryControlLlmEmotion = 0x14,    // text: emotion
+};
+
+struct BinaryControlMessage {
+    uint8_t type;           // BINARY_CONTROL_MESSAGE_TYPE, where audio messages have 0
+    uint8_t control;        // BinaryControlType
+    uint8_t argument;
+    uint8_t text[];         // UTF-8 without terminator, up to the end of the message
+} __attribute__((packed));
+
 enum AbortReason {
     kAbortReasonNone,
     kAbortReasonWakeWordDetected
@@ -54,10 +124,28 @@ public:
     inline const std::string& session_id() const {
         return session_id_;
     }
+    inline AudioFormat uplink_format() const {
+        return uplink_format_;
+    }
+    inline AudioFormat downlink_format() const {
+        return downlink_format_;
+    }
+    static const char* GetAudioFormatName(AudioFormat format);
+    // Traffic based estimate of the time the radio was active since the last reset
+    void ResetLinkActivity();
+    int64_t link_active_ms();
+    int64_t link_session_ms();
+    // Round trip of the last hello exchange, 0 before the first one
+    int link_rtt_ms() const { return link_rtt_ms_; }
+    // Reset with every hello exchange, fed by the protocol and the send loop
+    LinkEstimator& link_estimator() { return link_estimator_; }
 
     void OnIncomingAudio(std::function<void(std::unique_ptr<AudioStreamPacket> packet)> callback);
-    void OnIncomingJson(std::function<void(const cJSON* root)> callback);
+    // Control messages other than hello arrive as an in-situ view, valid only during the call
+    void OnIncomingJson(std::function<void(const JsonMessage& message)> callback);
     void OnAudioChannelOpened(std::function<void()> callback);
+    // Right after the channel opened, and again when a pipelined channel gets the server hello
+    void OnAudioParamsNegotiated(std::function<void()> callback);
     void OnAudioChannelClosed(std::function<void()> callback);
     void OnNetworkError(std::function<void(const std::string& message)> callback);
     void OnConnected(std::function<void()> callback);
@@ -75,9 +163,10 @@ public:
     virtual void SendMcpMessage(const std::string& message);
 
 protected:
-    std::function<void(const cJSON* root)> on_incoming_json_;
+    std::function<void(const JsonMessage& message)> on_incoming_json_;
     std::function<void(std::unique_ptr<AudioStreamPacket> packet)> on_incoming_audio_;
     std::function<void()> on_audio_channel_opened_;
+    std::function<void()> on_audio_params_negotiated_;
     std::function<void()> on_audio_channel_closed_;
     std::function<void(const std::string& message)> on_network_error_;
     std::function<void()> on_connected_;
@@ -85,13 +174,39 @@ protected:
 
     int server_sample_rate_ = 24000;
     int server_frame_duration_ = 60;
+    AudioFormat uplink_format_ = kAudioFormatOpus;
+    AudioFormat downlink_format_ = kAudioFormatOpus;
+    // What the last hello offered, a server answer outside of it falls back to Opus
+    uint32_t offered_formats_ = AUDIO_FORMAT_BIT(kAudioFormatOpus);
     bool error_occurred_ = false;
     std::string session_id_;
     std::chrono::time_point<std::chrono::steady_clock> last_incoming_time_;
+    std::mutex link_activity_mutex_;
+    int64_t link_session_start_us_ = 0;
+    int64_t link_active_us_ = 0;
+    int64_t last_link_activity_us_ = 0;
+    int64_t hello_sent_us_ = 0;
+    int link_rtt_ms_ = 0;
+    LinkEstimator link_estimator_;
+    // The server accepted binary control messages in its hello
+    bool binary_control_ = false;
 
     virtual bool SendText(const std::string& text) = 0;
+    // False when the message was not sent, error_occurred_ tells a failed send from one the encoder refused
+    virtual bool SendBinaryControl(BinaryControlType control, uint8_t argument, const std::string& text);
+    // True when the message went out in binary or the send failed, false leaves it to the JSON form
+    bool SendControl(BinaryControlType control, uint8_t argument, const std::string& text);
+    // Indexes a binary control message from the server under the keys of its JSON form, false if it has none
+    static bool ParseBinaryControl(const uint8_t* data, size_t size, JsonMessage& message);
     virtual void SetError(const std::string& message);
     virtual bool IsTimeout() const;
+    void MarkLinkActivity();
+    void MeasureHelloRoundTrip();
+    // Where a header of `size` bytes goes, right in front of the audio, the headroom grows if it is too small
+    static uint8_t* PrepareAudioHeader(AudioStreamPacket& packet, size_t size);
+    // Offers the formats of `formats` that are enabled, Opus is always offered
+    void AddAudioFormats(cJSON* audio_params, uint32_t formats = AUDIO_FORMATS_ALL);
+    void ParseAudioFormats(const cJSON* audio_params);
 };
 
 #endif // PROTOCOL_H
@@ -3,8 +3,10 @@
 #include "system_info.h"
 #include "application.h"
 #include "settings.h"
+#include "audio_packet_pool.h"
 
 #include <cstring>
+#include <algorithm>
 #include <cJSON.h>
 #include <esp_log.h>
 #include <arpa/inet.h>
@@ -14,9 +16,66 @@
 
 WebsocketProtocol::WebsocketProtocol() {
     event_group_handle_ = xEventGroupCreate();
+
+    esp_timer_create_args_t batch_timer_args = {
+        .callback = [](void* arg) {
+            auto protocol = (WebsocketProtocol*)arg;
+            std::lock_guard<std::mutex> lock(protocol->batch_mutex_);
+            protocol->FlushAudioBatch();
+        },
+        .arg = this,
+        .dispatch_method = ESP_TIMER_TASK,
+        .name = "audio_batch",
+        .skip_unhandled_events = true
+    };
+    esp_timer_create(&batch_timer_args, &batch_timer_);
+
+    esp_timer_create_args_t hello_timer_args = {
+        .callback = [](void* arg) {
+            auto protocol = (WebsocketProtocol*)arg;
+            if (protocol->hello_pending_) {
+                protocol->hello_pending_ = false;
+                ESP_LOGE(TAG, "Failed to receive server hello");
+                protocol->SetError(Lang::Strings::SERVER_TIMEOUT);
+            }
+        },
+        .arg = this,
+        .dispatch_method = ESP_TIMER_TASK,
+        .name = "ws_hello",
+        .skip_unhandled_events = true
+    };
+    esp_timer_create(&hello_timer_args, &hello_timer_);
+
+#if CONFIG_USE_PERSISTENT_WEBSOCKET
+    esp_timer_create_args_t keepalive_timer_args = {
+        .callback = [](void* arg) {
+            auto protocol = (WebsocketProtocol*)arg;
+            Application::GetInstance().Schedule([protocol]() {
+                protocol->KeepAlive();
+            });
+        },
+        .arg = this,
+        .dispatch_method = ESP_TIMER_TASK,
+        .name = "ws_keepalive",
+        .skip_unhandled_events = true
+    };
+    esp_timer_create(&keepalive_timer_args, &keepalive_timer_);
+#endif
 }
 
 WebsocketProtocol::~WebsocketProtocol() {
+    if (batch_timer_ != nullptr) {
+        esp_timer_stop(batch_timer_);
+        esp_timer_delete(batch_timer_);
+    }
+    if (hello_timer_ != nullptr) {
+        esp_timer_stop(hello_timer_);
+        esp_timer_delete(hello_timer_);
+    }
+    if (keepalive_timer_ != nullptr) {
+        esp_timer_stop(keepalive_timer_);
+        esp_timer_delete(keepalive_timer_);
+    }
     vEventGroupDelete(event_group_handle_);
 }
 
@@ -30,37 +89,111 @@ bool WebsocketProtocol::SendAudio(std::unique_ptr<AudioStreamPacket> packet) {
         return false;
     }
 
-    if (version_ == 2) {
-        std::string serialized;
-        serialized.resize(sizeof(BinaryProtocol2) + packet->payload.size());
-        auto bp2 = (BinaryProtocol2*)serialized.data();
-        bp2->version = htons(version_);
+    if (first_audio_pending_) {
+        first_audio_pending_ = false;
+        ESP_LOGI(TAG, "First audio sent %lld ms after opening the channel", (esp_timer_get_time() - channel_open_us_) / 1000);
+    }
+
+    if (binary_version_ == AUDIO_BATCH_VERSION) {
+        std::lock_guard<std::mutex> lock(batch_mutex_);
+        batch_.push_back(std::move(packet));
+        if (batch_.size() >= batch_frames_) {
+            esp_timer_stop(batch_timer_);
+            return FlushAudioBatch();
+        }
+        if (batch_.size() == 1) {
+            // When the capture stops the frames left behind still go out within one window
+            esp_timer_start_once(batch_timer_, batch_frames_ * OPUS_FRAME_DURATION_MS * 1000);
+        }
+        return true;
+    }
+    MarkLinkActivity();
+
+    // The header is written into the headroom, header and audio go out as one buffer without a copy
+    size_t payload_size = packet->size();
+    if (binary_version_ == 2) {
+        auto bp2 = (BinaryProtocol2*)PrepareAudioHeader(*packet, sizeof(BinaryProtocol2));
+        bp2->version = htons(binary_version_);
         bp2->type = 0;
         bp2->reserved = 0;
         bp2->timestamp = htonl(packet->timestamp);
-        bp2->payload_size = htonl(packet->payload.size());
-        memcpy(bp2->payload, packet->payload.data(), packet->payload.size());
-
-        return websocket_->Send(serialized.data(), serialized.size(), true);
-    } else if (version_ == 3) {
-        std::string serialized;
-        serialized.resize(sizeof(BinaryProtocol3) + packet->payload.size());
-        auto bp3 = (BinaryProtocol3*)serialized.data();
+        bp2->payload_size = htonl(payload_size);
+
+        return websocket_->Send(bp2, sizeof(BinaryProtocol2) + payload_size, true);
+    } else if (binary_version_ == 3) {
+        auto bp3 = (BinaryProtocol3*)PrepareAudioHeader(*packet, sizeof(BinaryProtocol3));
         bp3->type = 0;
         bp3->reserved = 0;
-        bp3->payload_size = htons(packet->payload.size());
-        memcpy(bp3->payload, packet->payload.data(), packet->payload.size());
+        bp3->payload_size = htons(payload_size);
 
-        return websocket_->Send(serialized.data(), serialized.size(), true);
+        return websocket_->Send(bp3, sizeof(BinaryProtocol3) + payload_size, true);
     } else {
-        return websocket_->Send(packet->payload.data(), packet->payload.size(), true);
+        return websocket_->Send(packet->data(), payload_size, true);
     }
 }
 
+// Called with batch_mutex_ held
+bool WebsocketProtocol::FlushAudioBatch() {
+    if (batch_.empty()) {
+        return true;
+    }
+    if (websocket_ == nullptr || !websocket_->IsConnected()) {
+        batch_.clear();
+        return false;
+    }
+    MarkLinkActivity();
+
+    bool sent;
+    if (batch_.size() == 1) {
+        // A lone frame gets its headers in place, like versions 2 and 3
+        auto& packet = *batch_.front();
+        size_t payload_size = packet.size();
+        size_t header_size = sizeof(BinaryProtocol4) + sizeof(BinaryProtocol4Frame);
+        auto bp4 = (BinaryProtocol4*)PrepareAudioHeader(packet, header_size);
+        bp4->type = 0;
+        bp4->frame_count = 1;
+        auto frame = (BinaryProtocol4Frame*)bp4->frames;
+        frame->timestamp = htonl(packet.timestamp);
+        frame->payload_size = htons(payload_size);
+        sent = websocket_->Send(bp4, header_size + payload_size, true);
+    } else {
+        size_t size = sizeof(BinaryProtocol4);
+        for (auto& packet : batch_) {
+            size += sizeof(BinaryProtocol4Frame) + packet->size();
+        }
+        batch_buffer_.resize(size);
+        auto bp4 = (BinaryProtocol4*)batch_buffer_.data();
+        bp4->type = 0;
+        bp4->frame_count = batch_.size();
+        auto position = bp4->frames;
+        for (auto& packet : batch_) {
+            auto frame = (BinaryProtocol4Frame*)position;
+            frame->timestamp = htonl(packet->timestamp);
+            frame->payload_size = htons(packet->size());
+            memcpy(frame->payload, packet->data(), packet->size());
+            position = frame->payload + packet->size();
+        }
+        sent = websocket_->Send(batch_buffer_.data(), size, true);
+    }
+    batch_.clear();
+    return sent;
+}
+
+void WebsocketProtocol::FlushBeforeMessage() {
+    if (binary_version_ == AUDIO_BATCH_VERSION) {
+        // Audio captured before a message (e.g. stop listening) must reach the server first
+        std::lock_guard<std::mutex> lock(batch_mutex_);
+        esp_timer_stop(batch_timer_);
+        FlushAudioBatch();
+    }
+    MarkLinkActivity();
+}
+
 bool WebsocketProtocol::SendText(const std::string& text) {
     if (websocket_ == nullptr || !websocket_->IsConnected()) {
         return false;
     }
+    FlushBeforeMessage();
 
     if (!websocket_->Send(text)) {
         ESP_LOGE(TAG, "Failed to send text: %s", text.c_str());
@@ -71,15 +204,161 @@ bool WebsocketProtocol::SendText(const std::string& text) {
     return true;
 }
 
+bool WebsocketProtocol::SendBinaryControl(BinaryControlType control, uint8_t argument, const std::string& text) {
+    if (websocket_ == nullptr || !websocket_->IsConnected()) {
+        return false;
+    }
+    // The only text sent is a wake word, a longer one is left to the JSON form
+    if (text.size() > BINARY_CONTROL_MAX_TEXT_SIZE) {
+        return false;
+    }
+    FlushBeforeMessage();
+
+    size_t size = sizeof(BinaryControlMessage) + text.size();
+    uint8_t buffer[sizeof(BinaryControlMessage) + BINARY_CONTROL_MAX_TEXT_SIZE];
+    auto message = (BinaryControlMessage*)buffer;
+    message->type = BINARY_CONTROL_MESSAGE_TYPE;
+    message->control = control;
+    message->argument = argument;
+    memcpy(message->text, text.data(), text.size());
+
+    if (!websocket_->Send(message, size, true)) {
+        ESP_LOGE(TAG, "Failed to send binary control message 0x%02x", control);
+        SetError(Lang::Strings::SERVER_ERROR);
+        return false;
+    }
+    return true;
+}
+
 bool WebsocketProtocol::IsAudioChannelOpened() const {
-    return websocket_ != nullptr && websocket_->IsConnected() && !error_occurred_ && !IsTimeout();
+    return websocket_ != nullptr && websocket_->IsConnected() && !parked_ && !error_occurred_ && !IsTimeout();
 }
 
 void WebsocketProtocol::CloseAudioChannel() {
+    hello_pending_ = false;
+    esp_timer_stop(hello_timer_);
+    {
+        std::lock_guard<std::mutex> lock(batch_mutex_);
+        esp_timer_stop(batch_timer_);
+        batch_.clear();
+    }
+
+#if CONFIG_USE_PERSISTENT_WEBSOCKET
+    if (!parked_ && websocket_ != nullptr && websocket_->IsConnected() && !error_occurred_ && !IsTimeout()) {
+        // End the conversation with a goodbye and keep the connection, the next one only exchanges hellos
+        std::string message = "{";
+        message += "\"session_id\":\"" + session_id_ + "\",";
+        message += "\"type\":\"goodbye\"";
+        message += "}";
+        if (SendText(message)) {
+            parked_ = true;
+            parked_since_us_ = esp_timer_get_time();
+            esp_timer_start_periodic(keepalive_timer_, WEBSOCKET_KEEPALIVE_INTERVAL_SECONDS * 1000000LL);
+            ESP_LOGI(TAG, "Websocket session parked");
+            if (on_audio_channel_closed_ != nullptr) {
+                on_audio_channel_closed_();
+            }
+            return;
+        }
+    }
+    esp_timer_stop(keepalive_timer_);
+#endif
+    websocket_.reset();
+    parked_ = false;
+}
+
+#if CONFIG_USE_PERSISTENT_WEBSOCKET
+// Runs on the main thread
+void WebsocketProtocol::KeepAlive() {
+    if (!parked_) {
+        return;
+    }
+    if (websocket_ == nullptr || !websocket_->IsConnected()) {
+        ESP_LOGI(TAG, "Parked websocket session lost");
+    } else if (esp_timer_get_time() - parked_since_us_ >= CONFIG_WEBSOCKET_SESSION_IDLE_SECONDS * 1000000LL) {
+        ESP_LOGI(TAG, "Closing websocket session idle for %d s", CONFIG_WEBSOCKET_SESSION_IDLE_SECONDS);
+    } else {
+        websocket_->Ping();
+        return;
+    }
+    esp_timer_stop(keepalive_timer_);
     websocket_.reset();
+    parked_ = false;
 }
+#endif
 
 bool WebsocketProtocol::OpenAudioChannel() {
+    int64_t start_time = esp_timer_get_time();
+    // A parked session skips DNS, TCP and the TLS handshake
+    bool warm = parked_ && websocket_ != nullptr && websocket_->IsConnected();
+    if (keepalive_timer_ != nullptr) {
+        esp_timer_stop(keepalive_timer_);
+    }
+    parked_ = false;
+    error_occurred_ = false;
+    // A parked session heard nothing but pongs, its silence must not time the new channel out
+    last_incoming_time_ = std::chrono::steady_clock::now();
+    if (!warm && !Connect()) {
+        return false;
+    }
+    binary_version_ = version_;
+    binary_control_ = false;
+    channel_open_us_ = start_time;
+    first_audio_pending_ = true;
+    xEventGroupClearBits(event_group_handle_, WEBSOCKET_PROTOCOL_SERVER_HELLO_EVENT);
+
+#if CONFIG_USE_HELLO_PIPELINING
+    // A server that said it takes messages before its hello gets the listen request and audio right away,
+    // in Opus and without a session id until its hello arrives
+    Settings settings("websocket", false);
+    if (settings.GetBool("pipelined_hello")) {
+        hello_pending_ = true;
+        session_id_.clear();
+        ParseAudioFormats(nullptr);
+    }
+#endif
+
+    // Send hello message to describe the client
+    auto message = GetHelloMessage();
+    hello_sent_us_ = esp_timer_get_time();
+    if (!SendText(message)) {
+        hello_pending_ = false;
+        return false;
+    }
+
+    if (hello_pending_) {
+        esp_timer_start_once(hello_timer_, WEBSOCKET_SERVER_HELLO_TIMEOUT_MS * 1000);
+        ESP_LOGI(TAG, "Audio channel pipelined in %lld ms (%s)", (esp_timer_get_time() - start_time) / 1000, warm ? "warm" : "cold");
+        if (on_audio_channel_opened_ != nullptr) {
+            on_audio_channel_opened_();
+        }
+        // Opus both ways until the server hello tells otherwise
+        if (on_audio_params_negotiated_ != nullptr) {
+            on_audio_params_negotiated_();
+        }
+        return true;
+    }
+
+    // Wait for server hello
+    EventBits_t bits = xEventGroupWaitBits(event_group_handle_, WEBSOCKET_PROTOCOL_SERVER_HELLO_EVENT, pdTRUE, pdFALSE, pdMS_TO_TICKS(WEBSOCKET_SERVER_HELLO_TIMEOUT_MS));
+    if (!(bits & WEBSOCKET_PROTOCOL_SERVER_HELLO_EVENT)) {
+        ESP_LOGE(TAG, "Failed to receive server hello");
+        SetError(Lang::Strings::SERVER_TIMEOUT);
+        return false;
+    }
+    ESP_LOGI(TAG, "Audio channel ready in %lld ms (%s)", (esp_timer_get_time() - start_time) / 1000, warm ? "warm" : "cold");
+
+    if (on_audio_channel_opened_ != nullptr) {
+        on_audio_channel_opened_();
+    }
+    if (on_audio_params_negotiated_ != nullptr) {
+        on_audio_params_negotiated_();
+    }
+
+    return true;
+}
+
+bool WebsocketProtocol::Connect() {
     Settings settings("websocket", false);
     std::string url = settings.GetString("url");
     std::string token = settings.GetString("token");
@@ -88,8 +367,6 @@ bool WebsocketProtocol::OpenAudioChannel() {
         version_ = version;
     }
 
-    error_occurred_ = false;
-
     auto network = Board::GetInstance().GetNetwork();
     websocket_ = network->CreateWebSocket(1);
     if (websocket_ == nullptr) {
@@ -109,64 +386,61 @@ bool WebsocketProtocol::OpenAudioChannel() {
     websocket_->SetHeader("Client-Id", Board::GetInstance().GetUuid().c_str());
 
     websocket_->OnData([this](const char* data, size_t len, bool binary) {
-        if (binary) {
+        if (parked_) {
+            // Nothing belongs to a conversation until the next hello
+            return;
+        }
+        if (binary && binary_control_ && len > 0 && data[0] == BINARY_CONTROL_MESSAGE_TYPE) {
+            JsonMessage message;
+            if (ParseBinaryControl((const uint8_t*)data, len, message) && on_incoming_json_ != nullptr) {
+                on_incoming_json_(message);
+            }
+        } else if (binary) {
             if (on_incoming_audio_ != nullptr) {
-                if (version_ == 2) {
-                    BinaryProtocol2* bp2 = (BinaryProtocol2*)data;
-                    bp2->version = ntohs(bp2->version);
-                    bp2->type = ntohs(bp2->type);
-                    bp2->timestamp = ntohl(bp2->timestamp);
-                    bp2->payload_size = ntohl(bp2->payload_size);
-                    auto payload = (uint8_t*)bp2->payload;
-                    on_incoming_audio_(std::make_unique<AudioStreamPacket>(AudioStreamPacket{
-                        .sample_rate = server_sample_rate_,
-                        .frame_duration = server_frame_duration_,
-                        .timestamp = bp2->timestamp,
-                        .payload = std::vector<uint8_t>(payload, payload + bp2->payload_size)
-                    }));
-                } else if (version_ == 3) {
-                    BinaryProtocol3* bp3 = (BinaryProtocol3*)data;
-                    bp3->type = bp3->type;
-                    bp3->payload_size = ntohs(bp3->payload_size);
-                    auto payload = (uint8_t*)bp3->payload;
-                    on_incoming_audio_(std::make_unique<AudioStreamPacket>(AudioStreamPacket{
-                        .sample_rate = server_sample_rate_,
-                        .frame_duration = server_frame_duration_,
-                        .timestamp = 0,
-                        .payload = std::vector<uint8_t>(payload, payload + bp3->payload_size)
-                    }));
+                if (binary_version_ == AUDIO_BATCH_VERSION) {
+                    ParseAudioBatch((const uint8_t*)data, len);
                 } else {
-                    on_incoming_audio_(std::make_unique<AudioStreamPacket>(AudioStreamPacket{
-                        .sample_rate = server_sample_rate_,
-                        .frame_duration = server_frame_duration_,
-                        .timestamp = 0,
-                        .payload = std::vector<uint8_t>((uint8_t*)data, (uint8_t*)data + len)
-                    }));
+                    size_t header_size = binary_version_ == 2 ? sizeof(BinaryProtocol2) : binary_version_ == 3 ? sizeof(BinaryProtocol3) : 0;
+                    size_t payload_size = len - std::min(len, header_size);
+                    uint32_t timestamp = 0;
+                    if (binary_version_ == 2 && len >= header_size) {
+                        auto bp2 = (const BinaryProtocol2*)data;
+                        payload_size = ntohl(bp2->payload_size);
+                        timestamp = ntohl(bp2->timestamp);
+                    } else if (binary_version_ == 3 && len >= header_size) {
+                        auto bp3 = (const BinaryProtocol3*)data;
+                        payload_size = ntohs(bp3->payload_size);
+                    }
+                    if (len < header_size || payload_size > len - header_size) {
+                        ESP_LOGE(TAG, "Invalid audio frame of %u bytes", len);
+                    } else {
+                        EmitIncomingAudio((const uint8_t*)data + header_size, payload_size, timestamp);
+                    }
                 }
             }
         } else {
-            // Parse JSON data
-            auto root = cJSON_Parse(data);
-            auto type = cJSON_GetObjectItem(root, "type");
-            if (cJSON_IsString(type)) {
-                if (strcmp(type->valuestring, "hello") == 0) {
-                    ParseServerHello(root);
-                } else {
-                    if (on_incoming_json_ != nullptr) {
-                        on_incoming_json_(root);
-                    }
-                }
-            } else {
-                ESP_LOGE(TAG, "Missing message type, data: %s", data);
+            // Only the hello needs a DOM, the other messages are dispatched from the frame buffer
+            JsonMessage message;
+            if (!message.Parse(data, len)) {
+                ESP_LOGE(TAG, "Invalid JSON message: %.*s", (int)len, data);
+            } else if (!message.IsString("type")) {
+                ESP_LOGE(TAG, "Missing message type, data: %.*s", (int)len, data);
+            } else if (message.Equals("type", "hello")) {
+                auto root = cJSON_ParseWithLength(data, len);
+                ParseServerHello(root);
+                cJSON_Delete(root);
+            } else if (on_incoming_json_ != nullptr) {
+                on_incoming_json_(message);
             }
-            cJSON_Delete(root);
         }
         last_incoming_time_ = std::chrono::steady_clock::now();
+        MarkLinkActivity();
     });
 
     websocket_->OnDisconnected([this]() {
         ESP_LOGI(TAG, "Websocket disconnected");
-        if (on_audio_channel_closed_ != nullptr) {
+        // The conversation of a parked session has been closed already
+        if (!parked_ && on_audio_channel_closed_ != nullptr) {
             on_audio_channel_closed_();
         }
     });
@@ -177,26 +451,43 @@ bool WebsocketProtocol::OpenAudioChannel() {
         SetError(Lang::Strings::SERVER_NOT_CONNECTED);
         return false;
     }
+    return true;
+}
 
-    // Send hello message to describe the client
-    auto message = GetHelloMessage();
-    if (!SendText(message)) {
-        return false;
-    }
+void WebsocketProtocol::EmitIncomingAudio(const uint8_t* payload, size_t size, uint32_t timestamp) {
+    // The frame buffer belongs to the websocket, the payload is copied once into a recycled packet
+    auto packet = AudioPacketPool::GetInstance().Acquire(size);
+    packet->sample_rate = server_sample_rate_;
+    packet->frame_duration = server_frame_duration_;
+    packet->timestamp = timestamp;
+    packet->format = downlink_format_;
+    packet->payload.assign(payload, payload + size);
+    link_estimator_.RecordIncomingAudio(timestamp);
+    on_incoming_audio_(std::move(packet));
+}
 
-    // Wait for server hello
-    EventBits_t bits = xEventGroupWaitBits(event_group_handle_, WEBSOCKET_PROTOCOL_SERVER_HELLO_EVENT, pdTRUE, pdFALSE, pdMS_TO_TICKS(10000));
-    if (!(bits & WEBSOCKET_PROTOCOL_SERVER_HELLO_EVENT)) {
-        ESP_LOGE(TAG, "Failed to receive server hello");
-        SetError(Lang::Strings::SERVER_TIMEOUT);
-        return false;
+void WebsocketProtocol::ParseAudioBatch(const uint8_t* data, size_t len) {
+    if (len < sizeof(BinaryProtocol4) || data[0] != 0) {
+        ESP_LOGE(TAG, "Invalid audio batch of %u bytes", len);
+        return;
     }
-
-    if (on_audio_channel_opened_ != nullptr) {
-        on_audio_channel_opened_();
+    auto bp4 = (const BinaryProtocol4*)data;
+    auto position = bp4->frames;
+    auto end = data + len;
+    for (int i = 0; i < bp4->frame_count; i++) {
+        if ((size_t)(end - position) < sizeof(BinaryProtocol4Frame)) {
+            ESP_LOGE(TAG, "Audio batch truncated at frame %d of %d", i, bp4->frame_count);
+            return;
+        }
+        auto frame = (const BinaryProtocol4Frame*)position;
+        size_t payload_size = ntohs(frame->payload_size);
+        if ((size_t)(end - frame->payload) < payload_size) {
+            ESP_LOGE(TAG, "Audio batch truncated at frame %d of %d", i, bp4->frame_count);
+            return;
+        }
+        EmitIncomingAudio(frame->payload, payload_size, ntohl(frame->timestamp));
+        position = frame->payload + payload_size;
     }
-
-    return true;
 }
 
 std::string WebsocketProtocol::GetHelloMessage() {
@@ -209,13 +500,24 @@ std::string WebsocketProtocol::GetHelloMessage() {
     cJSON_AddBoolToObject(features, "aec", true);
 #endif
     cJSON_AddBoolToObject(features, "mcp", true);
+#if CONFIG_USE_AUDIO_BATCHING
+    cJSON_AddBoolToObject(features, "audio_batch", true);
+#endif
+#if CONFIG_USE_HELLO_PIPELINING
+    cJSON_AddBoolToObject(features, "hello_pipelining", true);
+#endif
+#if CONFIG_USE_BINARY_CONTROL_MESSAGES
+    cJSON_AddBoolToObject(features, "binary_control", true);
+#endif
     cJSON_AddItemToObject(root, "features", features);
     cJSON_AddStringToObject(root, "transport", "websocket");
     cJSON* audio_params = cJSON_CreateObject();
-    cJSON_AddStringToObject(audio_params, "format", "opus");
+    AddAudioFormats(audio_params);
     cJSON_AddNumberToObject(audio_params, "sample_rate", 16000);
     cJSON_AddNumberToObject(audio_params, "channels", 1);
     cJSON_AddNumberToObject(audio_params, "frame_duration", OPUS_FRAME_DURATION_MS);
+    // Opus decodes natively at the codec output rate, so the server may encode at that rate too
+    cJSON_AddNumberToObject(audio_params, "output_sample_rate", Board::GetInstance().GetAudioCodec()->output_sample_rate());
     cJSON_AddItemToObject(root, "audio_params", audio_params);
     auto json_str = cJSON_PrintUnformatted(root);
     std::string message(json_str);
@@ -226,10 +528,24 @@ std::string WebsocketProtocol::GetHelloMessage() {
 
 void WebsocketProtocol::ParseServerHello(const cJSON* root) {
     auto transport = cJSON_GetObjectItem(root, "transport");
-    if (transport == nullptr || strcmp(transport->valuestring, "websocket") != 0) {
-        ESP_LOGE(TAG, "Unsupported transport: %s", transport->valuestring);
+    // The root is null when the hello did not parse, the log must not dereference a missing transport
+    if (!cJSON_IsString(transport) || strcmp(transport->valuestring, "websocket") != 0) {
+        ESP_LOGE(TAG, "Unsupported transport: %s", cJSON_IsString(transport) ? transport->valuestring : "none");
         return;
     }
+    MeasureHelloRoundTrip();
+
+#if CONFIG_USE_AUDIO_BATCHING
+    // The server opts in to batching by answering with version 4, otherwise the configured version stays
+    auto version = cJSON_GetObjectItem(root, "version");
+    if (cJSON_IsNumber(version) && version->valueint == AUDIO_BATCH_VERSION) {
+        // Batching delays a frame by at most half the round trip, a LAN keeps one frame per message
+        int frames = link_rtt_ms_ / 2 / OPUS_FRAME_DURATION_MS;
+        batch_frames_ = std::clamp(frames, 1, AUDIO_BATCH_MAX_FRAMES);
+        binary_version_ = AUDIO_BATCH_VERSION;
+        ESP_LOGI(TAG, "Binary protocol %d, up to %u frames per message", binary_version_, batch_frames_);
+    }
+#endif
 
     auto session_id = cJSON_GetObjectItem(root, "session_id");
     if (cJSON_IsString(session_id)) {
@@ -237,7 +553,19 @@ void WebsocketProtocol::ParseServerHello(const cJSON* root) {
         ESP_LOGI(TAG, "Session ID: %s", session_id_.c_str());
     }
 
+#if CONFIG_USE_BINARY_CONTROL_MESSAGES
+    // Binary control messages need a message type in front, versions 1 and 2 keep sending JSON
+    auto binary_control = cJSON_GetObjectItem(cJSON_GetObjectItem(root, "features"), "binary_control");
+    if (cJSON_IsTrue(binary_control)) {
+        binary_control_ = binary_version_ == 3 || binary_version_ == AUDIO_BATCH_VERSION;
+        if (!binary_control_) {
+            ESP_LOGW(TAG, "Binary control messages need binary protocol 3 or 4, not %d", binary_version_);
+        }
+    }
+#endif
+
     auto audio_params = cJSON_GetObjectItem(root, "audio_params");
+    ParseAudioFormats(audio_params);
     if (cJSON_IsObject(audio_params)) {
         auto sample_rate = cJSON_GetObjectItem(audio_params, "sample_rate");
         if (cJSON_IsNumber(sample_rate)) {
@@ -249,5 +577,29 @@ void WebsocketProtocol::ParseServerHello(const cJSON* root) {
         }
     }
 
+#if CONFIG_USE_HELLO_PIPELINING
+    // Remembered for the next channel, the first one always waits for the server
+    auto features = cJSON_GetObjectItem(root, "features");
+    bool pipelining = cJSON_IsObject(features) && cJSON_IsTrue(cJSON_GetObjectItem(features, "hello_pipelining"));
+    Settings settings("websocket", true);
+    if (settings.GetBool("pipelined_hello") != pipelining) {
+        settings.SetBool("pipelined_hello", pipelining);
+    }
+    if (hello_pending_) {
+        hello_pending_ = false;
+        esp_timer_stop(hello_timer_);
+        if (!pipelining) {
+            ESP_LOGW(TAG, "Server no longer takes pipelined messages, the next channel waits for its hello");
+        }
+        // Apply what the server negotiated (formats, batching) to the audio already flowing, the channel
+        // itself has been opened already
+        Application::GetInstance().Schedule([this]() {
+            if (on_audio_params_negotiated_ != nullptr) {
+                on_audio_params_negotiated_();
+            }
+        });
+    }
+#endif
+
     xEventGroupSetBits(event_group_handle_, WEBSOCKET_PROTOCOL_SERVER_HELLO_EVENT);
 }
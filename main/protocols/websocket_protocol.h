@@ -7,8 +7,20 @@
 #include <web_socket.h>
 #include <freertos/FreeRTOS.h>
 #include <freertos/event_groups.h>
+#include <esp_timer.h>
+
+#include <deque>
+#include <mutex>
 
 #define WEBSOCKET_PROTOCOL_SERVER_HELLO_EVENT (1 << 0)
+#define WEBSOCKET_SERVER_HELLO_TIMEOUT_MS 10000
+
+// Binary protocol version 4 batches audio frames, the window grows with the hello round trip
+#define AUDIO_BATCH_VERSION 4
+#define AUDIO_BATCH_MAX_FRAMES 4
+
+// A parked session is pinged at this interval and closed after CONFIG_WEBSOCKET_SESSION_IDLE_SECONDS
+#define WEBSOCKET_KEEPALIVE_INTERVAL_SECONDS 30
 
 class WebsocketProtocol : public Protocol {
 public:
@@ -25,9 +37,35 @@ private:
     EventGroupHandle_t event_group_handle_;
     std::unique_ptr<WebSocket> websocket_;
     int version_ = 1;
+    // The binary protocol in use, version_ unless the server accepted batching in its hello
+    int binary_version_ = 1;
+
+    std::mutex batch_mutex_;
+    std::deque<std::unique_ptr<AudioStreamPacket>> batch_;
+    std::vector<uint8_t> batch_buffer_;
+    size_t batch_frames_ = 1;
+    esp_timer_handle_t batch_timer_ = nullptr;
+
+    // The conversation ended but the connection is kept for the next one
+    bool parked_ = false;
+    int64_t parked_since_us_ = 0;
+    esp_timer_handle_t keepalive_timer_ = nullptr;
+
+    // The hello went out and the channel is in use before the server answered
+    bool hello_pending_ = false;
+    esp_timer_handle_t hello_timer_ = nullptr;
+    int64_t channel_open_us_ = 0;
+    bool first_audio_pending_ = false;
 
+    bool Connect();
+    void KeepAlive();
     void ParseServerHello(const cJSON* root);
+    void ParseAudioBatch(const uint8_t* data, size_t len);
+    void EmitIncomingAudio(const uint8_t* payload, size_t size, uint32_t timestamp);
+    bool FlushAudioBatch();
+    void FlushBeforeMessage();
     bool SendText(const std::string& text) override;
+    bool SendBinaryControl(BinaryControlType control, uint8_t argument, const std::string& text) override;
     std::string GetHelloMessage();
 };
 
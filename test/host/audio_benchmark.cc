@@ -0,0 +1,497 @@
+/*
+ * Host benchmark of the audio kernels that run per frame on the device: the I2S sample
+ * conversions, IMA-ADPCM and the wake word pre-roll ring built on it, the AFSK demodulator of
+ * acoustic provisioning and, when libopus is installed, the Opus encoder and decoder. Every kernel runs over a fixed generated corpus and
+ * its output is checked before it is timed, so a change that breaks a kernel fails here instead
+ * of reporting a fast number. OpusDecoderWrapper and OpusResampler come from the managed Opus
+ * component, which is not in the tree, so the decoder and the resamplers are timed through host
+ * classes making the same libopus calls. The resamplers need the static libopus, whose silk
+ * resampler they wrap.
+ *
+ * One JSON object per kernel is printed to stdout:
+ *   {"kernel":"ima_adpcm_encode","corpus":"speech_16k","frames":1000,"frame_ms":60,
+ *    "ns_per_frame":1234.5,"max_ns":4567,"rtf":0.00002}
+ * rtf is the time spent per second of audio, host figures only rank changes against each other,
+ * they are not device cycles.
+ *
+ *   audio_benchmark [--quick] [--kernel <name>]
+ */
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "host_corpus.h"
+#include "ima_adpcm.h"
+#include "sample_conversion.h"
+#include "afsk_demod.h"
+#ifdef HOST_HAVE_OPUS
+#include <opus.h>
+#include "adaptive_opus_encoder.h"
+#endif
+
+#ifdef HOST_HAVE_SILK_RESAMPLER
+// Internal to libopus, declared in silk/SigProc_FIX.h
+extern "C" {
+int silk_resampler_init(void* state, int32_t input_rate, int32_t output_rate, int for_encoder);
+int silk_resampler(void* state, int16_t* output, const int16_t* input, int32_t input_samples);
+}
+#endif
+
+namespace {
+
+struct Options {
+    bool quick = false;
+    std::string kernel;
+};
+
+int failures = 0;
+
+void Check(bool condition, const char* kernel, const char* what) {
+    if (!condition) {
+        fprintf(stderr, "%s: %s\n", kernel, what);
+        failures++;
+    }
+}
+
+// Runs frame(i) for every frame of the corpus, repeated until at least min_frames were timed, and
+// returns the time per frame, 0 when the kernel is not selected
+double Measure(const Options& options, const char* kernel, const char* corpus, int frames_in_corpus,
+             int frame_ms, const std::function<void(int)>& frame) {
+    if (!options.kernel.empty() && options.kernel != kernel) {
+        return 0;
+    }
+    int min_frames = options.quick ? frames_in_corpus : std::max(frames_in_corpus, 5000);
+    int64_t total_ns = 0;
+    int64_t max_ns = 0;
+    int frames = 0;
+    while (frames < min_frames) {
+        for (int i = 0; i < frames_in_corpus; i++) {
+            auto start = std::chrono::steady_clock::now();
+            frame(i);
+            auto end = std::chrono::steady_clock::now();
+            int64_t ns = std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
+            total_ns += ns;
+            max_ns = std::max(max_ns, ns);
+            frames++;
+        }
+    }
+    double ns_per_frame = (double)total_ns / frames;
+    printf("{\"kernel\":\"%s\",\"corpus\":\"%s\",\"frames\":%d,\"frame_ms\":%d,"
+           "\"ns_per_frame\":%.1f,\"max_ns\":%lld,\"rtf\":%.6f}\n",
+        kernel, corpus, frames, frame_ms, ns_per_frame, (long long)max_ns,
+        ns_per_frame / (frame_ms * 1e6));
+    return ns_per_frame;
+}
+
+double SnrDb(const std::vector<int16_t>& reference, const std::vector<int16_t>& decoded) {
+    double signal = 0, noise = 0;
+    for (size_t i = 0; i < reference.size(); i++) {
+        double diff = (double)reference[i] - decoded[i];
+        signal += (double)reference[i] * reference[i];
+        noise += diff * diff;
+    }
+    return 10 * std::log10(signal / std::max(noise, 1.0));
+}
+
+void BenchmarkSampleConversion(const Options& options) {
+    // 60 ms frames at 16 kHz, the frame the input task reads
+    const int kFrameSamples = 960;
+    auto pcm = GenerateSpeechLike(16000, 60000, 1);
+    auto words = GenerateI2sWords(pcm, 2);
+    int frames = (int)pcm.size() / kFrameSamples;
+
+    std::vector<int16_t> converted(kFrameSamples);
+    ConvertI2s32ToPcm16(words.data(), converted.data(), kFrameSamples);
+    Check(std::equal(converted.begin(), converted.end(), pcm.begin()), "i2s32_to_pcm16", "samples do not round-trip");
+    Measure(options, "i2s32_to_pcm16", "speech_16k", frames, 60, [&](int i) {
+        ConvertI2s32ToPcm16(words.data() + i * kFrameSamples, converted.data(), kFrameSamples);
+    });
+
+    std::vector<int32_t> scaled(kFrameSamples);
+    ScalePcm16ToI2s32(pcm.data(), scaled.data(), kFrameSamples, 65536);
+    Check(scaled[100] == (int32_t)pcm[100] << 16, "pcm16_to_i2s32", "full volume is not a 16 bit shift");
+    Measure(options, "pcm16_to_i2s32", "speech_16k", frames, 60, [&](int i) {
+        ScalePcm16ToI2s32(pcm.data() + i * kFrameSamples, scaled.data(), kFrameSamples, 40000);
+    });
+
+    std::vector<int16_t> gained(pcm.begin(), pcm.begin() + kFrameSamples);
+    ApplyPcm16Gain(gained.data(), kFrameSamples, 1000);
+    Check(std::all_of(gained.begin(), gained.end(), [](int16_t v) { return v >= -INT16_MAX; }), "pcm16_gain",
+        "gain does not saturate");
+    Measure(options, "pcm16_gain", "speech_16k", frames, 60, [&](int i) {
+        std::copy_n(pcm.data() + i * kFrameSamples, kFrameSamples, gained.data());
+        ApplyPcm16Gain(gained.data(), kFrameSamples, 4);
+    });
+}
+
+void BenchmarkImaAdpcm(const Options& options) {
+    const int kFrameSamples = 960;
+    auto pcm = GenerateSpeechLike(16000, 60000, 3);
+    int frames = (int)pcm.size() / kFrameSamples;
+    size_t frame_bytes = ImaAdpcm::EncodedSize(kFrameSamples);
+    std::vector<uint8_t> adpcm(frames * frame_bytes);
+
+    ImaAdpcmState encoder;
+    for (int i = 0; i < frames; i++) {
+        ImaAdpcm::Encode(encoder, pcm.data() + i * kFrameSamples, kFrameSamples, adpcm.data() + i * frame_bytes);
+    }
+    std::vector<int16_t> decoded(frames * kFrameSamples);
+    ImaAdpcmState decoder;
+    for (int i = 0; i < frames; i++) {
+        ImaAdpcm::Decode(decoder, adpcm.data() + i * frame_bytes, kFrameSamples, decoded.data() + i * kFrameSamples);
+    }
+    std::vector<int16_t> reference(pcm.begin(), pcm.begin() + decoded.size());
+    Check(SnrDb(reference, decoded) > 20, "ima_adpcm", "round trip SNR below 20 dB");
+
+    std::vector<uint8_t> out(frame_bytes);
+    encoder = ImaAdpcmState();
+    Measure(options, "ima_adpcm_encode", "speech_16k", frames, 60, [&](int i) {
+        ImaAdpcm::Encode(encoder, pcm.data() + i * kFrameSamples, kFrameSamples, out.data());
+    });
+    std::vector<int16_t> samples(kFrameSamples);
+    decoder = ImaAdpcmState();
+    Measure(options, "ima_adpcm_decode", "speech_16k", frames, 60, [&](int i) {
+        ImaAdpcm::Decode(decoder, adpcm.data() + i * frame_bytes, kFrameSamples, samples.data());
+    });
+}
+
+// EspWakeWord::StoreWakeWordData per wakenet chunk: one ADPCM block appended to a 2 second ring
+void BenchmarkWakeWordPreroll(const Options& options) {
+    const int kChunkSamples = 512;
+    const size_t kRingChunks = 2000 * 16 / kChunkSamples;
+    auto pcm = GenerateSpeechLike(16000, 60000, 5);
+    int chunks = (int)pcm.size() / kChunkSamples;
+
+    struct Block {
+        ImaAdpcmState state;
+        std::vector<uint8_t> data;
+    };
+    std::deque<Block> ring;
+    ImaAdpcmState encoder;
+    auto store = [&](int i) {
+        Block block;
+        block.state = encoder;
+        block.data.resize(ImaAdpcm::EncodedSize(kChunkSamples));
+        ImaAdpcm::Encode(encoder, pcm.data() + i * kChunkSamples, kChunkSamples, block.data.data());
+        ring.push_back(std::move(block));
+        while (ring.size() > kRingChunks) {
+            ring.pop_front();
+        }
+    };
+    for (int i = 0; i < chunks; i++) {
+        store(i);
+    }
+    size_t ring_bytes = 0;
+    for (auto& block : ring) {
+        ring_bytes += sizeof(Block) + block.data.size();
+    }
+    Check(ring_bytes * 3 < kRingChunks * kChunkSamples * sizeof(int16_t), "wake_word_preroll",
+        "ring is not smaller than a third of raw PCM");
+
+    // Each block decodes from its own state to what a decoder running over the whole ring produces
+    std::vector<int16_t> decoded(kChunkSamples);
+    std::vector<int16_t> continuous(kChunkSamples);
+    ImaAdpcmState decoder = ring.front().state;
+    bool matches = true;
+    for (size_t i = 0; i < ring.size(); i++) {
+        ImaAdpcm::Decode(decoder, ring[i].data.data(), kChunkSamples, continuous.data());
+        auto state = ring[i].state;
+        ImaAdpcm::Decode(state, ring[i].data.data(), kChunkSamples, decoded.data());
+        matches = matches && decoded == continuous;
+    }
+    Check(matches, "wake_word_preroll", "a block does not decode from its own state");
+
+    ring.clear();
+    encoder = ImaAdpcmState();
+    Measure(options, "wake_word_preroll", "speech_16k", chunks, kChunkSamples / 16, store);
+}
+
+// The provisioning frame: a preamble, \x01\x02, the text, its checksum, \x03\x04, sent MSB first
+std::vector<float> GenerateAfsk(const std::string& text, uint32_t seed) {
+    std::vector<uint8_t> bytes = {0x55, 0x55, 0x01, 0x02};
+    bytes.insert(bytes.end(), text.begin(), text.end());
+    bytes.push_back(audio_wifi_config::AudioDataBuffer::CalculateChecksum(text));
+    bytes.push_back(0x03);
+    bytes.push_back(0x04);
+    bytes.push_back(0x55);
+
+    HostRandom random(seed);
+    const int samples_per_bit = kAudioSampleRate / kBitRate;
+    std::vector<float> samples;
+    double phase = 0;
+    for (uint8_t byte : bytes) {
+        for (int bit = 7; bit >= 0; bit--) {
+            double frequency = ((byte >> bit) & 1) ? kMarkFrequency : kSpaceFrequency;
+            for (int i = 0; i < samples_per_bit; i++) {
+                phase += 2 * M_PI * frequency / kAudioSampleRate;
+                samples.push_back((float)(8000 * std::sin(phase) + 800 * random.Uniform()));
+            }
+        }
+    }
+    return samples;
+}
+
+void BenchmarkAfskDemod(const Options& options) {
+    using namespace audio_wifi_config;
+    const std::string kText = "xiaozhi-test\npassword1234";
+    auto samples = GenerateAfsk(kText, 4);
+    // The provisioning loop reads 30 ms frames, 192 samples after the downsampling to 6.4 kHz
+    const size_t kFrameSamples = kAudioSampleRate * 30 / 1000;
+    int frames = (int)(samples.size() / kFrameSamples);
+
+    {
+        AudioSignalProcessor processor(kAudioSampleRate, kMarkFrequency, kSpaceFrequency, kBitRate, kWindowSize);
+        AudioDataBuffer buffer;
+        bool decoded = false;
+        for (int i = 0; i < frames; i++) {
+            std::vector<float> frame(samples.begin() + i * kFrameSamples, samples.begin() + (i + 1) * kFrameSamples);
+            decoded |= buffer.ProcessProbabilityData(processor.ProcessAudioSamples(frame), 0.5f);
+        }
+        Check(decoded && buffer.decoded_text == kText, "afsk_demod", "the generated frame does not decode");
+    }
+
+    AudioSignalProcessor processor(kAudioSampleRate, kMarkFrequency, kSpaceFrequency, kBitRate, kWindowSize);
+    AudioDataBuffer buffer;
+    std::vector<float> frame(kFrameSamples);
+    Measure(options, "afsk_demod", "afsk_6k4", frames, 30, [&](int i) {
+        std::copy_n(samples.begin() + i * kFrameSamples, kFrameSamples, frame.begin());
+        buffer.ProcessProbabilityData(processor.ProcessAudioSamples(frame), 0.5f);
+    });
+}
+
+#ifdef HOST_HAVE_OPUS
+// The libopus calls of OpusDecoderWrapper for one frame: the PCM sized for a whole frame, decoded
+// into and cut to the samples opus_decode returned
+class HostOpusDecoder {
+public:
+    HostOpusDecoder(int sample_rate, int duration_ms) : frame_size_(sample_rate / 1000 * duration_ms) {
+        int error = 0;
+        decoder_ = opus_decoder_create(sample_rate, 1, &error);
+    }
+    ~HostOpusDecoder() {
+        if (decoder_ != nullptr) {
+            opus_decoder_destroy(decoder_);
+        }
+    }
+
+    bool valid() const { return decoder_ != nullptr; }
+
+    bool Decode(const std::vector<uint8_t>& opus, std::vector<int16_t>& pcm) {
+        pcm.resize(frame_size_);
+        int samples = opus_decode(decoder_, opus.data(), opus.size(), pcm.data(), pcm.size(), 0);
+        if (samples < 0) {
+            return false;
+        }
+        pcm.resize(samples);
+        return true;
+    }
+
+private:
+    OpusDecoder* decoder_ = nullptr;
+    int frame_size_;
+};
+#endif
+
+#ifdef HOST_HAVE_SILK_RESAMPLER
+// OpusResampler over the silk resampler, which is set up for the encoder when it goes down in rate.
+// Its state is a struct internal to libopus, the buffer is larger than it.
+class HostOpusResampler {
+public:
+    bool Configure(int input_sample_rate, int output_sample_rate) {
+        input_sample_rate_ = input_sample_rate;
+        output_sample_rate_ = output_sample_rate;
+        return silk_resampler_init(state_, input_sample_rate, output_sample_rate, input_sample_rate > output_sample_rate) == 0;
+    }
+
+    int GetOutputSamples(int input_samples) const {
+        return input_samples * output_sample_rate_ / input_sample_rate_;
+    }
+
+    void Process(const int16_t* input, int input_samples, int16_t* output) {
+        silk_resampler(state_, output, input, input_samples);
+    }
+
+private:
+    alignas(8) uint8_t state_[1024] = {};
+    int input_sample_rate_ = 0;
+    int output_sample_rate_ = 0;
+};
+
+double RmsOf(const int16_t* samples, size_t count) {
+    double sum = 0;
+    for (size_t i = 0; i < count; i++) {
+        sum += (double)samples[i] * samples[i];
+    }
+    return std::sqrt(sum / std::max<size_t>(count, 1));
+}
+
+// A 1 kHz tone keeps its level through a resampler, the first frame holds the filter delay
+void CheckResampler(int input_rate, int output_rate, const char* kernel) {
+    HostOpusResampler resampler;
+    Check(resampler.Configure(input_rate, output_rate), kernel, "the resampler does not take these rates");
+    int input_samples = input_rate * 60 / 1000;
+    std::vector<int16_t> tone(input_samples * 2);
+    for (size_t i = 0; i < tone.size(); i++) {
+        tone[i] = (int16_t)(8000 * std::sin(2 * M_PI * 1000 * i / input_rate));
+    }
+    std::vector<int16_t> output(resampler.GetOutputSamples(input_samples));
+    resampler.Process(tone.data(), input_samples, output.data());
+    resampler.Process(tone.data() + input_samples, input_samples, output.data());
+    double ratio = RmsOf(output.data(), output.size()) / RmsOf(tone.data(), input_samples);
+    Check(ratio > 0.89 && ratio < 1.12, kernel, "a 1 kHz tone does not keep its level");
+}
+
+void BenchmarkResampler(const Options& options, const char* kernel, const char* corpus, int input_rate, int output_rate) {
+    CheckResampler(input_rate, output_rate, kernel);
+    const int kFrameSamples = input_rate * 60 / 1000;
+    auto pcm = GenerateSpeechLike(input_rate, 60000, 7);
+    int frames = (int)pcm.size() / kFrameSamples;
+    HostOpusResampler resampler;
+    resampler.Configure(input_rate, output_rate);
+    Measure(options, kernel, corpus, frames, 60, [&](int i) {
+        // AudioService allocates the output per frame
+        auto resampled = std::vector<int16_t>(resampler.GetOutputSamples(kFrameSamples));
+        resampler.Process(pcm.data() + i * kFrameSamples, kFrameSamples, resampled.data());
+    });
+}
+#endif
+
+#ifdef HOST_HAVE_OPUS
+void BenchmarkOpus(const Options& options) {
+    const int kFrameSamples = 960;
+    auto pcm = GenerateSpeechLike(16000, 60000, 5);
+    int frames = (int)pcm.size() / kFrameSamples;
+
+    // Same settings as the uplink encoder in AudioService
+    AdaptiveOpusEncoder encoder(16000, 1, 60);
+    encoder.SetComplexity(0);
+    std::vector<std::vector<uint8_t>> packets(frames);
+    for (int i = 0; i < frames; i++) {
+        std::vector<int16_t> frame(pcm.begin() + i * kFrameSamples, pcm.begin() + (i + 1) * kFrameSamples);
+        Check(encoder.Encode(std::move(frame), packets[i]), "opus_encode", "encoder returned no packet");
+    }
+
+    encoder.ResetState();
+    std::vector<uint8_t> packet;
+    Measure(options, "opus_encode_c0", "speech_16k", frames, 60, [&](int i) {
+        std::vector<int16_t> frame(pcm.begin() + i * kFrameSamples, pcm.begin() + (i + 1) * kFrameSamples);
+        encoder.Encode(std::move(frame), packet);
+    });
+
+    HostOpusDecoder decoder(16000, 60);
+    Check(decoder.valid(), "opus_decode", "decoder creation failed");
+    std::vector<int16_t> out;
+    Measure(options, "opus_decode", "speech_16k", frames, 60, [&](int i) {
+        if (!decoder.Decode(packets[i], out) || out.size() != (size_t)kFrameSamples) {
+            failures++;
+        }
+    });
+
+#ifdef HOST_HAVE_SILK_RESAMPLER
+    // A 24 kHz codec to the 16 kHz of the AFE, and 16 kHz audio out to a 24 kHz codec
+    BenchmarkResampler(options, "input_resample", "speech_24k_to_16k", 24000, 16000);
+    BenchmarkResampler(options, "output_resample", "speech_16k_to_24k", 16000, 24000);
+#endif
+}
+#endif
+
+#ifdef HOST_HAVE_SILK_RESAMPLER
+// The 24 kHz TTS stream on a 16 kHz codec: decoded at 24 kHz and resampled like before the decoder
+// ran at the codec rate, against decoded at 16 kHz. One more line gives the CPU time per second of
+// playback of both and what decoding at the codec rate saves.
+void BenchmarkDecodeRate(const Options& options) {
+    const int kStreamRate = 24000;
+    const int kCodecRate = 16000;
+    const int kFrameSamples = kStreamRate * 60 / 1000;
+    const int kCodecFrameSamples = kCodecRate * 60 / 1000;
+    auto pcm = GenerateSpeechLike(kStreamRate, 60000, 9);
+    int frames = (int)pcm.size() / kFrameSamples;
+
+    AdaptiveOpusEncoder encoder(kStreamRate, 1, 60);
+    std::vector<std::vector<uint8_t>> packets(frames);
+    for (int i = 0; i < frames; i++) {
+        std::vector<int16_t> frame(pcm.begin() + i * kFrameSamples, pcm.begin() + (i + 1) * kFrameSamples);
+        Check(encoder.Encode(std::move(frame), packets[i]), "decode_rate", "encoder returned no packet");
+    }
+
+    HostOpusDecoder stream_decoder(kStreamRate, 60);
+    HostOpusDecoder codec_decoder(kCodecRate, 60);
+    HostOpusResampler resampler;
+    resampler.Configure(kStreamRate, kCodecRate);
+    std::vector<int16_t> decoded;
+    std::vector<int16_t> resampled;
+    std::vector<int16_t> native;
+    auto decode_and_resample = [&](int i) {
+        if (!stream_decoder.Decode(packets[i], decoded)) {
+            failures++;
+            return;
+        }
+        resampled = std::vector<int16_t>(resampler.GetOutputSamples(decoded.size()));
+        resampler.Process(decoded.data(), decoded.size(), resampled.data());
+    };
+    auto decode_native = [&](int i) {
+        if (!codec_decoder.Decode(packets[i], native)) {
+            failures++;
+        }
+    };
+
+    // Both give the codec a full frame at its rate and the same level
+    double resampled_energy = 0, native_energy = 0;
+    for (int i = 0; i < frames; i++) {
+        decode_and_resample(i);
+        decode_native(i);
+        Check(resampled.size() == (size_t)kCodecFrameSamples && native.size() == (size_t)kCodecFrameSamples,
+            "decode_rate", "a frame is not 60 ms at the codec rate");
+        resampled_energy += std::pow(RmsOf(resampled.data(), resampled.size()), 2);
+        native_energy += std::pow(RmsOf(native.data(), native.size()), 2);
+    }
+    double level_db = 10 * std::log10(std::max(resampled_energy, 1.0) / std::max(native_energy, 1.0));
+    Check(std::fabs(level_db) < 1, "decode_rate", "the two paths do not play at the same level");
+
+    double resampled_ns = Measure(options, "opus_decode_24k_resample_16k", "speech_24k", frames, 60, decode_and_resample);
+    double native_ns = Measure(options, "opus_decode_16k", "speech_24k", frames, 60, decode_native);
+    if (resampled_ns > 0 && native_ns > 0) {
+        // 60 ms frames, so 1000 / 60 of them per second of playback
+        double resampled_us = resampled_ns * 1000 / 60 / 1000;
+        double native_us = native_ns * 1000 / 60 / 1000;
+        printf("{\"comparison\":\"decode_at_codec_rate\",\"stream_rate\":%d,\"codec_rate\":%d,"
+               "\"resampled_us_per_s\":%.1f,\"native_us_per_s\":%.1f,\"saved_us_per_s\":%.1f,\"saved_percent\":%.1f}\n",
+            kStreamRate, kCodecRate, resampled_us, native_us, resampled_us - native_us,
+            100 * (resampled_us - native_us) / resampled_us);
+    }
+}
+#endif
+
+} // namespace
+
+int main(int argc, char** argv) {
+    Options options;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--quick") == 0) {
+            options.quick = true;
+        } else if (strcmp(argv[i], "--kernel") == 0 && i + 1 < argc) {
+            options.kernel = argv[++i];
+        } else {
+            fprintf(stderr, "usage: %s [--quick] [--kernel <name>]\n", argv[0]);
+            return 2;
+        }
+    }
+
+    BenchmarkSampleConversion(options);
+    BenchmarkImaAdpcm(options);
+    BenchmarkWakeWordPreroll(options);
+    BenchmarkAfskDemod(options);
+#ifdef HOST_HAVE_OPUS
+    BenchmarkOpus(options);
+#endif
+#ifdef HOST_HAVE_SILK_RESAMPLER
+    BenchmarkDecodeRate(options);
+#endif
+    return failures == 0 ? 0 : 1;
+}
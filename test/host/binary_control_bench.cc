@@ -0,0 +1,312 @@
+/*
+ * Bytes and CPU per control message, JSON against the binary control messages of binary protocol 3.
+ * Both directions go through WebsocketProtocol on the stand-in WebSocket of protocol/web_socket.h
+ * without link delay, so each frame is handed over inside Send. Two protocols are opened, one on a
+ * server that leaves binary_control out of its hello and one on a server that accepts it.
+ *
+ *   send      the device messages: SendStartListening, SendStopListening, SendWakeWordDetected and
+ *             SendAbortSpeaking, timed up to the frame reaching the server
+ *   receive   the messages of ServerMessageTrace (host_corpus.h) that have a binary form, sent by the
+ *             server as they are and as binary frames, timed from the server sending the frame until
+ *             a handler like the one of Application has read its fields
+ *
+ * Every message is checked once in both forms before it is timed: the server decodes a binary frame
+ * from the device to the fields of the JSON one, and the handler reads the same fields from both
+ * forms of a server message. One JSON object per direction, message and form is printed to stdout.
+ * A wake word longer than BINARY_CONTROL_MAX_TEXT_SIZE must be sent as JSON on the binary protocol.
+ * The exit status is non-zero when the forms disagree or binary control was not negotiated.
+ */
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "websocket_protocol.h"
+#include "json_message.h"
+#include "settings.h"
+#include "web_socket.h"
+#include "host_corpus.h"
+
+namespace {
+
+const char kSessionId[] = "4f9c2a7e-1b3d-4c8e-9a61-0d5e7f3b2c18";
+
+int failures = 0;
+
+void Check(bool condition, const char* test, const char* what) {
+    if (!condition) {
+        fprintf(stderr, "%s: %s\n", test, what);
+        failures++;
+    }
+}
+
+int64_t NowNs() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+typedef std::map<std::string, std::string> Fields;
+
+// The fields a server reads from a device message
+Fields FieldsOfJson(const char* data, size_t size) {
+    Fields fields;
+    JsonMessage message;
+    if (!message.Parse(data, size)) {
+        return fields;
+    }
+    for (auto key : {"session_id", "type", "state", "mode", "text", "reason"}) {
+        std::string value;
+        if (message.GetString(key, value)) {
+            fields[key] = value;
+        }
+    }
+    return fields;
+}
+
+// The same fields from a binary control message, the connection stands for the session id
+Fields FieldsOfBinary(const uint8_t* data, size_t size) {
+    Fields fields;
+    if (size < sizeof(BinaryControlMessage) || data[0] != BINARY_CONTROL_MESSAGE_TYPE) {
+        return fields;
+    }
+    auto message = (const BinaryControlMessage*)data;
+    std::string text((const char*)message->text, size - sizeof(BinaryControlMessage));
+    fields["session_id"] = kSessionId;
+    switch (message->control) {
+    case kBinaryControlListenStart:
+        fields["type"] = "listen";
+        fields["state"] = "start";
+        fields["mode"] = message->argument == kListeningModeRealtime ? "realtime" :
+            message->argument == kListeningModeAutoStop ? "auto" : "manual";
+        break;
+    case kBinaryControlListenStop:
+        fields["type"] = "listen";
+        fields["state"] = "stop";
+        break;
+    case kBinaryControlListenDetect:
+        fields["type"] = "listen";
+        fields["state"] = "detect";
+        fields["text"] = text;
+        break;
+    case kBinaryControlAbort:
+        fields["type"] = "abort";
+        if (message->argument == kAbortReasonWakeWordDetected) {
+            fields["reason"] = "wake_word_detected";
+        }
+        break;
+    }
+    return fields;
+}
+
+// Answers the hello, with binary_control when accepted, and keeps the session to send from
+class ControlServer : public HostWebSocketServer {
+public:
+    bool binary_control = false;
+    std::shared_ptr<HostWebSocketSession> session;
+    size_t frame_bytes = 0;
+    bool frame_binary = false;
+    // Set outside the timing, the frame is decoded
+    bool capture = false;
+    Fields fields;
+
+    void OnFrame(std::shared_ptr<HostWebSocketSession> from, const char* data, size_t len, bool binary) override {
+        if (!binary && strstr(data, "\"hello\"") != nullptr) {
+            session = from;
+            std::string features = binary_control ? "\"features\":{\"binary_control\":true}," : "";
+            from->Send(std::string("{\"type\":\"hello\",\"transport\":\"websocket\",\"session_id\":\"") + kSessionId +
+                "\"," + features + "\"audio_params\":{\"format\":\"opus\",\"sample_rate\":24000,\"frame_duration\":60}}", false);
+            return;
+        }
+        frame_bytes = len;
+        frame_binary = binary;
+        if (capture) {
+            fields = binary ? FieldsOfBinary((const uint8_t*)data, len) : FieldsOfJson(data, len);
+        }
+    }
+};
+
+// What the handlers of Application read from a server message, strings are copied like there
+struct Received {
+    int messages = 0;
+    std::string type;
+    std::string state;
+    std::string text;
+
+    void Handle(const JsonMessage& message) {
+        messages++;
+        message.GetString("type", type);
+        if (message.Equals("type", "tts")) {
+            message.GetString("state", state);
+            if (message.Equals("state", "sentence_start")) {
+                message.GetString("text", text);
+            }
+        } else if (message.Equals("type", "stt")) {
+            message.GetString("text", text);
+        } else if (message.Equals("type", "llm")) {
+            message.GetString("emotion", text);
+        }
+    }
+};
+
+struct Outgoing {
+    const char* name;
+    std::function<void(Protocol& protocol)> send;
+};
+
+struct Incoming {
+    std::string name;
+    std::string json;
+    std::string binary;
+};
+
+std::string BinaryFrame(BinaryControlType control, const std::string& text) {
+    std::string frame(sizeof(BinaryControlMessage), '\0');
+    auto message = (BinaryControlMessage*)frame.data();
+    message->type = BINARY_CONTROL_MESSAGE_TYPE;
+    message->control = control;
+    message->argument = 0;
+    return frame + text;
+}
+
+// The trace messages a server would send in binary, with their binary frames
+std::vector<Incoming> IncomingMessages() {
+    std::vector<Incoming> messages;
+    for (auto& json : ServerMessageTrace()) {
+        JsonMessage message;
+        message.Parse(json.data(), json.size());
+        std::string text, emotion;
+        message.GetString("text", text);
+        message.GetString("emotion", emotion);
+        if (message.Equals("type", "tts") && message.Equals("state", "start")) {
+            messages.push_back({"tts start", json, BinaryFrame(kBinaryControlTtsStart, "")});
+        } else if (message.Equals("type", "tts") && message.Equals("state", "stop")) {
+            messages.push_back({"tts stop", json, BinaryFrame(kBinaryControlTtsStop, "")});
+        } else if (message.Equals("type", "tts") && message.Equals("state", "sentence_start")) {
+            messages.push_back({"tts sentence_start", json, BinaryFrame(kBinaryControlTtsSentence, text)});
+        } else if (message.Equals("type", "stt")) {
+            messages.push_back({"stt", json, BinaryFrame(kBinaryControlStt, text)});
+        } else if (message.Equals("type", "llm")) {
+            messages.push_back({"llm emotion", json, BinaryFrame(kBinaryControlLlmEmotion, emotion)});
+        }
+    }
+    return messages;
+}
+
+void Print(const char* direction, const std::string& name, bool binary, size_t messages, size_t bytes, double ns) {
+    printf("{\"direction\":\"%s\",\"message\":\"%s\",\"form\":\"%s\",\"messages\":%zu,\"bytes_per_message\":%zu,"
+        "\"ns_per_message\":%.1f}\n", direction, name.c_str(), binary ? "binary" : "json", messages, bytes / messages, ns);
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    bool quick = argc > 1 && strcmp(argv[1], "--quick") == 0;
+    const int kRounds = quick ? 200 : 50000;
+
+    Settings settings("websocket", true);
+    settings.SetString("url", "ws://host/control");
+    settings.SetInt("version", 3);
+
+    ControlServer servers[2];
+    std::unique_ptr<WebsocketProtocol> protocols[2];
+    Received received[2];
+    for (int binary = 0; binary < 2; binary++) {
+        servers[binary].binary_control = binary;
+        GetHostWebSocketLink().server = &servers[binary];
+        protocols[binary] = std::make_unique<WebsocketProtocol>();
+        protocols[binary]->OnIncomingJson([&received, binary](const JsonMessage& message) {
+            received[binary].Handle(message);
+        });
+        if (!protocols[binary]->OpenAudioChannel()) {
+            fprintf(stderr, "cannot open the channel\n");
+            return 1;
+        }
+    }
+
+    const Outgoing outgoing[] = {
+        {"listen start", [](Protocol& protocol) { protocol.SendStartListening(kListeningModeAutoStop); }},
+        {"listen stop", [](Protocol& protocol) { protocol.SendStopListening(); }},
+        {"listen detect", [](Protocol& protocol) { protocol.SendWakeWordDetected("你好小智"); }},
+        {"abort", [](Protocol& protocol) { protocol.SendAbortSpeaking(kAbortReasonWakeWordDetected); }},
+    };
+    for (auto& message : outgoing) {
+        Fields fields[2];
+        for (int binary = 0; binary < 2; binary++) {
+            auto& server = servers[binary];
+            GetHostWebSocketLink().server = &server;
+            server.capture = true;
+            message.send(*protocols[binary]);
+            server.capture = false;
+            fields[binary] = server.fields;
+            Check(server.frame_binary == (bool)binary, message.name, "the control message was not sent in the negotiated form");
+
+            int64_t start = NowNs();
+            for (int round = 0; round < kRounds; round++) {
+                message.send(*protocols[binary]);
+            }
+            Print("send", message.name, binary, 1, server.frame_bytes, (double)(NowNs() - start) / kRounds);
+        }
+        Check(!fields[0].empty() && fields[0] == fields[1], message.name, "the binary message decodes to other fields");
+    }
+
+    // A wake word longer than the binary form takes goes out as JSON on the binary protocol too
+    std::string long_wake_word;
+    while (long_wake_word.size() <= BINARY_CONTROL_MAX_TEXT_SIZE) {
+        long_wake_word += "你好小智";
+    }
+    auto& server = servers[1];
+    GetHostWebSocketLink().server = &server;
+    server.capture = true;
+    protocols[1]->SendWakeWordDetected(long_wake_word);
+    server.capture = false;
+    Check(!server.frame_binary, "long detect", "an over-long text was not sent as JSON");
+    Check(server.fields["text"] == long_wake_word && server.fields["state"] == "detect", "long detect",
+        "the JSON fallback carries other fields");
+
+    // Grouped by name, in the order of the trace
+    std::vector<std::string> names;
+    std::map<std::string, std::vector<Incoming>> by_name;
+    for (auto& message : IncomingMessages()) {
+        if (by_name[message.name].empty()) {
+            names.push_back(message.name);
+        }
+        by_name[message.name].push_back(message);
+    }
+    for (auto& name : names) {
+        auto& messages = by_name[name];
+        for (auto& message : messages) {
+            Received got[2];
+            for (int binary = 0; binary < 2; binary++) {
+                received[binary] = Received();
+                servers[binary].session->Send(binary ? message.binary : message.json, binary);
+                got[binary] = received[binary];
+            }
+            Check(got[0].messages == 1 && got[1].messages == 1, name.c_str(), "a message did not reach the handler");
+            Check(got[0].type == got[1].type && got[0].state == got[1].state && got[0].text == got[1].text,
+                name.c_str(), "the handler read other fields from the binary message");
+        }
+        for (int binary = 0; binary < 2; binary++) {
+            size_t bytes = 0;
+            for (auto& message : messages) {
+                bytes += binary ? message.binary.size() : message.json.size();
+            }
+            auto& session = *servers[binary].session;
+            int64_t start = NowNs();
+            for (int round = 0; round < kRounds; round++) {
+                for (auto& message : messages) {
+                    session.Send(binary ? message.binary : message.json, binary);
+                }
+            }
+            Print("receive", name, binary, messages.size(), bytes, (double)(NowNs() - start) / kRounds / messages.size());
+        }
+    }
+
+    for (auto& protocol : protocols) {
+        protocol->CloseAudioChannel();
+    }
+    return failures == 0 ? 0 : 1;
+}
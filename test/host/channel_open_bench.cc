@@ -0,0 +1,254 @@
+/*
+ * How long WebsocketProtocol takes to open an audio channel on a simulated link, built with
+ * USE_PERSISTENT_WEBSOCKET and USE_HELLO_PIPELINING. The stand-in WebSocket of protocol/web_socket.h
+ * delays every frame by half the round trip and takes three round trips to connect: DNS, TCP and a
+ * TLS 1.3 handshake.
+ *
+ *   cold   a new protocol for every channel, so each one connects
+ *   warm   one protocol, each channel is opened on the session the previous one parked
+ *
+ * Both against a server that waits for its hello to be answered and one that takes pipelined
+ * messages. A first channel that is not measured lets the protocol learn which one it talks to.
+ *
+ * Per round trip and case, the medians over the rounds of the time OpenAudioChannel takes and of
+ * the time until the server has the first audio packet, sent as soon as the channel is open. One
+ * JSON object per case is printed to stdout. The exit status is non-zero when a cold channel did not
+ * connect or a warm one did, or when a channel was reported opened more than once.
+ *
+ * A last check parks a session, moves its last incoming message back past the channel timeout and
+ * opens a pipelined channel on it, which must report opened before the server hello arrives.
+ */
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "websocket_protocol.h"
+#include "application.h"
+#include "settings.h"
+#include "web_socket.h"
+
+namespace {
+
+int failures = 0;
+
+void Check(bool condition, const char* test, const char* what) {
+    if (!condition) {
+        fprintf(stderr, "%s: %s\n", test, what);
+        failures++;
+    }
+}
+
+// Answers every hello and notes when the first audio of a channel arrives
+class HelloServer : public HostWebSocketServer {
+public:
+    std::atomic<bool> pipelining = false;
+
+    void OnFrame(std::shared_ptr<HostWebSocketSession> session, const char* data, size_t len, bool binary) override {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (binary) {
+            if (first_audio_us_ == 0) {
+                first_audio_us_ = esp_timer_get_time();
+            }
+            return;
+        }
+        std::string message(data, len);
+        if (message.find("\"type\":\"hello\"") != std::string::npos) {
+            hellos_on_same_session_ += session == last_session_;
+            last_session_ = session;
+            std::string features = pipelining ? "\"features\":{\"hello_pipelining\":true}," : "";
+            session->Send("{\"type\":\"hello\",\"transport\":\"websocket\",\"session_id\":\"bench\"," + features +
+                "\"audio_params\":{\"format\":\"opus\",\"sample_rate\":24000,\"frame_duration\":60}}", false);
+        }
+    }
+
+    void NewChannel() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        first_audio_us_ = 0;
+    }
+
+    // Waits until the first audio of the channel has arrived, 0 when it did not within a second
+    int64_t WaitForFirstAudio() {
+        for (int waited = 0; waited < 1000; waited++) {
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                if (first_audio_us_ != 0) {
+                    return first_audio_us_;
+                }
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        return 0;
+    }
+
+    int hellos_on_same_session() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return hellos_on_same_session_;
+    }
+
+private:
+    std::mutex mutex_;
+    int64_t first_audio_us_ = 0;
+    std::shared_ptr<HostWebSocketSession> last_session_;
+    int hellos_on_same_session_ = 0;
+};
+
+// What the Application is told about one channel
+struct Callbacks {
+    std::atomic<int> opened = 0;
+    std::atomic<int> negotiated = 0;
+
+    void Attach(WebsocketProtocol& protocol) {
+        protocol.OnAudioChannelOpened([this]() { opened++; });
+        protocol.OnAudioParamsNegotiated([this]() { negotiated++; });
+    }
+};
+
+struct Timing {
+    std::vector<double> open_ms;
+    std::vector<double> first_audio_ms;
+    int channels = 0;
+    int opened_twice = 0;
+    int negotiated_wrong = 0;
+};
+
+double Median(std::vector<double> values) {
+    std::sort(values.begin(), values.end());
+    return values[values.size() / 2];
+}
+
+// Opens a channel, sends one packet like the first captured frame and records both times. The
+// channel is closed once the server hello has been applied.
+bool OpenSendAndClose(WebsocketProtocol& protocol, HelloServer& server, bool pipelined, Timing& timing) {
+    Callbacks callbacks;
+    callbacks.Attach(protocol);
+    server.NewChannel();
+    int64_t start = esp_timer_get_time();
+    if (!protocol.OpenAudioChannel()) {
+        return false;
+    }
+    int64_t opened = esp_timer_get_time();
+    auto packet = std::make_unique<AudioStreamPacket>();
+    packet->headroom = AUDIO_PACKET_HEADROOM;
+    packet->payload.resize(AUDIO_PACKET_HEADROOM + 120);
+    protocol.SendAudio(std::move(packet));
+    int64_t first_audio = server.WaitForFirstAudio();
+    if (first_audio == 0) {
+        return false;
+    }
+    // A pipelined channel applies the server hello once it arrives, on the main loop
+    int expected_negotiated = pipelined ? 2 : 1;
+    for (int waited = 0; callbacks.negotiated < expected_negotiated && waited < 1000; waited++) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    Application::GetInstance().WaitForScheduled();
+    protocol.CloseAudioChannel();
+
+    timing.open_ms.push_back((opened - start) / 1000.0);
+    timing.first_audio_ms.push_back((first_audio - start) / 1000.0);
+    timing.channels++;
+    timing.opened_twice += callbacks.opened != 1;
+    timing.negotiated_wrong += callbacks.negotiated != expected_negotiated;
+    return true;
+}
+
+void Print(const char* name, bool pipelined, int rtt_ms, const Timing& timing, int connects) {
+    printf("{\"case\":\"%s\",\"pipelined\":%s,\"rtt_ms\":%d,\"rounds\":%zu,\"open_ms\":%.1f,\"first_audio_ms\":%.1f,"
+        "\"connects\":%d}\n", name, pipelined ? "true" : "false", rtt_ms, timing.open_ms.size(),
+        Median(timing.open_ms), Median(timing.first_audio_ms), connects);
+}
+
+// Lets the check age the last incoming message like a session parked for minutes
+class AgedProtocol : public WebsocketProtocol {
+public:
+    void AgeIncoming(int seconds) {
+        last_incoming_time_ -= std::chrono::seconds(seconds);
+    }
+};
+
+void CheckLongParked(HelloServer& server, Settings& settings) {
+    const char* name = "long_parked";
+    server.pipelining = true;
+    settings.EraseKey("pipelined_hello");
+    AgedProtocol protocol;
+    Timing first;
+    Check(OpenSendAndClose(protocol, server, false, first), name, "the first channel did not open");
+    Check(OpenSendAndClose(protocol, server, true, first), name, "the channel to park did not open");
+    protocol.AgeIncoming(121);
+    server.NewChannel();
+    Check(protocol.OpenAudioChannel(), name, "the channel did not open");
+    Check(protocol.IsAudioChannelOpened(), name, "the reused session timed out at once");
+    auto packet = std::make_unique<AudioStreamPacket>();
+    packet->headroom = AUDIO_PACKET_HEADROOM;
+    packet->payload.resize(AUDIO_PACKET_HEADROOM + 120);
+    protocol.SendAudio(std::move(packet));
+    Check(server.WaitForFirstAudio() != 0, name, "the audio did not reach the server");
+    Application::GetInstance().WaitForScheduled();
+    protocol.CloseAudioChannel();
+}
+
+void CheckCallbacks(const char* name, const Timing& timing) {
+    Check(timing.opened_twice == 0, name, "a channel was not reported opened exactly once");
+    Check(timing.negotiated_wrong == 0, name, "the negotiated parameters were not applied as expected");
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    bool quick = argc > 1 && strcmp(argv[1], "--quick") == 0;
+    const int kRounds = quick ? 2 : 10;
+
+    HelloServer server;
+    auto& link = GetHostWebSocketLink();
+    link.server = &server;
+    Settings settings("websocket", true);
+    settings.SetString("url", "wss://host/channel");
+
+    for (int rtt_ms : {20, 100, 250}) {
+        link.one_way_us = rtt_ms * 1000 / 2;
+        link.connect_us = 3 * rtt_ms * 1000;
+
+        for (bool pipelined : {false, true}) {
+            server.pipelining = pipelined;
+            settings.EraseKey("pipelined_hello");
+            Timing learning;
+            {
+                WebsocketProtocol protocol;
+                Check(OpenSendAndClose(protocol, server, false, learning), "learning", "the channel did not open");
+            }
+
+            Timing cold;
+            link.connects = 0;
+            for (int round = 0; round < kRounds; round++) {
+                WebsocketProtocol protocol;
+                Check(OpenSendAndClose(protocol, server, pipelined, cold), "cold", "the channel did not open");
+            }
+            Check(link.connects == kRounds, "cold", "a channel did not connect");
+            CheckCallbacks("cold", cold);
+            Print("cold", pipelined, rtt_ms, cold, link.connects);
+
+            Timing warm;
+            WebsocketProtocol protocol;
+            Timing first;
+            Check(OpenSendAndClose(protocol, server, pipelined, first), "warm", "the first channel did not open");
+            link.connects = 0;
+            int reused = server.hellos_on_same_session();
+            for (int round = 0; round < kRounds; round++) {
+                Check(OpenSendAndClose(protocol, server, pipelined, warm), "warm", "the channel did not open");
+            }
+            Check(link.connects == 0, "warm", "a parked session was not reused");
+            Check(server.hellos_on_same_session() - reused == kRounds, "warm", "a hello came on a new session");
+            CheckCallbacks("warm", warm);
+            Print("warm", pipelined, rtt_ms, warm, link.connects);
+        }
+    }
+    CheckLongParked(server, settings);
+    fflush(stdout);
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,177 @@
+/*
+ * Client endpointing on a generated utterance corpus. Each utterance runs through the fixed-point
+ * VAD of NoAudioProcessor and the UtteranceEndpointer with the Kconfig defaults, and the one-shot
+ * timer of AudioService is simulated on the sample clock.
+ *
+ * Three kinds of utterances, each with a known end of speech:
+ *   plain        words of 200-600 ms with pauses of 80-300 ms
+ *   hesitant     the same with one 450-600 ms pause in the middle
+ *   false_start  an 80 ms burst, 1.2-1.8 s of silence, then a plain utterance
+ * A stop before the end of speech cuts the user off (premature), otherwise the latency is the time
+ * from the end of speech to the stop. The rule the endpointer replaced, minimum speech counted
+ * from the first speech edge, runs alongside for comparison.
+ *
+ * One JSON object per rule and kind is printed to stdout. The exit status is non-zero when the
+ * endpointer cuts off a plain or false_start utterance, or misses one.
+ */
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "host_corpus.h"
+#include "fixed_point_vad.h"
+#include "utterance_endpointer.h"
+
+namespace {
+
+const int kMinSpeechMs = 300;       // CONFIG_ENDPOINT_MIN_SPEECH_MS
+const int kTrailingSilenceMs = 700; // CONFIG_ENDPOINT_TRAILING_SILENCE_MS
+const int kHangoverMs = 300;        // CONFIG_NO_AUDIO_PROCESSOR_VAD_HANGOVER_MS
+const int kUtterancesPerKind = 100;
+
+struct Utterance {
+    std::vector<int16_t> pcm;
+    int64_t speech_end_us;
+};
+
+enum Rule {
+    kRuleAccumulated,
+    kRuleFirstOnset,
+};
+
+std::vector<CorpusSegment> PlainWords(HostRandom& random, int max_gap_ms) {
+    std::vector<CorpusSegment> segments;
+    int words = 2 + random.Next() % 5;
+    for (int i = 0; i < words; i++) {
+        if (i > 0) {
+            segments.push_back({false, 80 + (int)(random.Next() % (max_gap_ms - 80))});
+        }
+        segments.push_back({true, 200 + (int)(random.Next() % 400)});
+    }
+    return segments;
+}
+
+Utterance MakeUtterance(const std::string& kind, uint32_t seed) {
+    HostRandom random(seed);
+    std::vector<CorpusSegment> segments = {{false, 500}};
+    if (kind == "false_start") {
+        segments.push_back({true, 80});
+        segments.push_back({false, 1200 + (int)(random.Next() % 600)});
+    }
+    auto words = PlainWords(random, 300);
+    if (kind == "hesitant" && words.size() > 2) {
+        words[words.size() / 2 | 1].ms = 450 + random.Next() % 150;
+    }
+    segments.insert(segments.end(), words.begin(), words.end());
+
+    int speech_end_ms = 0;
+    for (auto& segment : segments) {
+        speech_end_ms += segment.ms;
+    }
+    segments.push_back({false, 3000});
+
+    Utterance utterance;
+    utterance.pcm = RenderCorpus(segments, seed * 7919, 0.3f, 0.01f);
+    utterance.speech_end_us = (int64_t)speech_end_ms * 1000;
+    return utterance;
+}
+
+// Returns the time of the stop, or -1 when the timer never fired
+int64_t RunEndpointing(const Utterance& utterance, Rule rule) {
+    FixedPointVad vad;
+    FixedPointVadConfig config;
+    config.hangover_ms = kHangoverMs;
+    vad.Configure(config);
+
+    UtteranceEndpointer endpointer;
+    endpointer.Configure(kMinSpeechMs, kTrailingSilenceMs, rule == kRuleAccumulated ? kHangoverMs : 0);
+    bool started = false;
+    int64_t first_onset_us = 0;
+
+    const size_t kChunkSamples = 320;
+    int64_t deadline_us = -1;
+    for (size_t offset = 0; offset + kChunkSamples <= utterance.pcm.size(); offset += kChunkSamples) {
+        int64_t now_us = (int64_t)(offset + kChunkSamples) * 1000000 / 16000;
+        if (deadline_us >= 0 && now_us >= deadline_us) {
+            return deadline_us;
+        }
+        if (!vad.Process(utterance.pcm.data() + offset, kChunkSamples)) {
+            continue;
+        }
+
+        bool speaking = vad.speaking();
+        if (rule == kRuleAccumulated) {
+            auto action = endpointer.OnVadChange(speaking, now_us);
+            if (action == UtteranceEndpointer::kActionCancelTimer) {
+                deadline_us = -1;
+            } else if (action == UtteranceEndpointer::kActionArmTimer) {
+                deadline_us = now_us + kTrailingSilenceMs * 1000;
+            }
+        } else if (speaking) {
+            deadline_us = -1;
+            if (!started) {
+                started = true;
+                first_onset_us = now_us;
+            }
+        } else if (started && now_us - first_onset_us >= kMinSpeechMs * 1000) {
+            deadline_us = now_us + kTrailingSilenceMs * 1000;
+        }
+    }
+    return -1;
+}
+
+struct KindResult {
+    int utterances = 0;
+    int premature = 0;
+    int missed = 0;
+    std::vector<int64_t> latencies_ms;
+};
+
+KindResult Evaluate(const std::string& kind, Rule rule) {
+    KindResult result;
+    for (int i = 0; i < kUtterancesPerKind; i++) {
+        auto utterance = MakeUtterance(kind, 1000 + i);
+        int64_t stop_us = RunEndpointing(utterance, rule);
+        result.utterances++;
+        if (stop_us < 0) {
+            result.missed++;
+        } else if (stop_us < utterance.speech_end_us) {
+            result.premature++;
+        } else {
+            result.latencies_ms.push_back((stop_us - utterance.speech_end_us) / 1000);
+        }
+    }
+    std::sort(result.latencies_ms.begin(), result.latencies_ms.end());
+    return result;
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    int failures = 0;
+    for (Rule rule : {kRuleAccumulated, kRuleFirstOnset}) {
+        for (const char* kind : {"plain", "hesitant", "false_start"}) {
+            auto result = Evaluate(kind, rule);
+            double mean = 0;
+            for (auto latency : result.latencies_ms) {
+                mean += latency;
+            }
+            size_t count = result.latencies_ms.size();
+            mean = count > 0 ? mean / count : 0;
+            int64_t p90 = count > 0 ? result.latencies_ms[count * 9 / 10] : 0;
+            printf("{\"rule\":\"%s\",\"kind\":\"%s\",\"utterances\":%d,\"premature\":%d,\"missed\":%d,"
+                   "\"latency_mean_ms\":%.0f,\"latency_p90_ms\":%lld}\n",
+                rule == kRuleAccumulated ? "accumulated" : "first_onset", kind, result.utterances,
+                result.premature, result.missed, mean, (long long)p90);
+
+            if (rule == kRuleAccumulated && strcmp(kind, "hesitant") != 0 &&
+                (result.premature > 0 || result.missed > 0)) {
+                fprintf(stderr, "endpointer cut off or missed %s utterances\n", kind);
+                failures++;
+            }
+        }
+    }
+    return failures == 0 ? 0 : 1;
+}
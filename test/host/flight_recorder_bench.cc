@@ -0,0 +1,131 @@
+/*
+ * Cost of the audio flight recorder on a host: one Record and one RecordAudio call, a full
+ * snapshot at the MCP caps, and how long a recording task waited while snapshots were taken on
+ * another thread. The snapshot copies the ring under the lock and builds the JSON after it,
+ * so that wait stays at the copy and not at the JSON.
+ *
+ * One JSON object is printed to stdout. The exit status is non-zero when a snapshot exceeds the
+ * caps in audio_flight_recorder.h.
+ */
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <thread>
+#include <vector>
+
+#include "audio_flight_recorder.h"
+
+namespace {
+
+int64_t NowNs() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// Events and 120 byte Opus packets at the rate of a conversation: queue depths every 60 ms frame
+// in both directions, playback every frame, plus the packets themselves
+void Fill(AudioFlightRecorder& recorder, int frames) {
+    uint8_t packet[120];
+    for (int i = 0; i < frames; i++) {
+        memset(packet, i, sizeof(packet));
+        recorder.Record(kFlightEventEncodeQueue, i % 4);
+        recorder.Record(kFlightEventSendQueue, i % 8, i * 60);
+        recorder.Record(kFlightEventDecodeQueue, i % 16, i * 60);
+        recorder.Record(kFlightEventPlayback, i % 4, i % 16);
+        recorder.RecordAudio(kFlightAudioUplink, packet, sizeof(packet));
+        recorder.RecordAudio(kFlightAudioDownlink, packet, sizeof(packet));
+    }
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    bool quick = argc > 1 && strcmp(argv[1], "--quick") == 0;
+    const int kCalls = quick ? 200000 : 2000000;
+
+    AudioFlightRecorder recorder;
+    // The Kconfig defaults: 4096 events and 64 KB of audio
+    if (!recorder.Initialize(4096, 64 * 1024)) {
+        return 1;
+    }
+
+    int64_t start = NowNs();
+    for (int i = 0; i < kCalls; i++) {
+        recorder.Record(kFlightEventDecodeQueue, i & 15, i);
+    }
+    double record_ns = (double)(NowNs() - start) / kCalls;
+
+    uint8_t packet[120] = {};
+    start = NowNs();
+    for (int i = 0; i < kCalls; i++) {
+        recorder.RecordAudio(kFlightAudioDownlink, packet, sizeof(packet));
+    }
+    double record_audio_ns = (double)(NowNs() - start) / kCalls;
+
+    Fill(recorder, 4096);
+    const int kSnapshots = quick ? 20 : 200;
+    size_t json_bytes = 0;
+    int events = 0;
+    int audio_packets = 0;
+    start = NowNs();
+    for (int i = 0; i < kSnapshots; i++) {
+        auto json = recorder.GetSnapshotJson(100000, true);
+        if (i == 0) {
+            char* text = cJSON_PrintUnformatted(json);
+            json_bytes = strlen(text);
+            cJSON_free(text);
+            events = cJSON_GetArraySize(cJSON_GetObjectItem(json, "events"));
+            audio_packets = cJSON_GetArraySize(cJSON_GetObjectItem(json, "audio"));
+        }
+        cJSON_Delete(json);
+    }
+    double snapshot_us = (double)(NowNs() - start) / kSnapshots / 1000;
+
+    // A recording thread at full speed while snapshots are taken, its slow calls waited for the lock
+    std::atomic<bool> done = false;
+    std::vector<int64_t> record_latencies;
+    record_latencies.reserve(1 << 22);
+    std::thread writer([&]() {
+        int i = 0;
+        while (!done && record_latencies.size() < record_latencies.capacity()) {
+            int64_t before = NowNs();
+            recorder.Record(kFlightEventPlayback, i & 3, i);
+            record_latencies.push_back(NowNs() - before);
+            i++;
+        }
+    });
+    for (int i = 0; i < kSnapshots; i++) {
+        cJSON_Delete(recorder.GetSnapshotJson(100000, true));
+    }
+    done = true;
+    writer.join();
+    // The maximum is dominated by the host scheduler, the high percentile shows the lock wait
+    std::sort(record_latencies.begin(), record_latencies.end());
+    int64_t p999_record_ns = record_latencies[record_latencies.size() * 999 / 1000];
+
+    // At the rate Fill() models, 4 events and 2 packets per 60 ms frame
+    double busy_per_second_us = (4 * record_ns + 2 * record_audio_ns) * (1000.0 / 60) / 1000;
+    printf("{\"record_ns\":%.1f,\"record_audio_ns\":%.1f,\"busy_us_per_second\":%.2f,"
+           "\"snapshot_us\":%.1f,\"snapshot_bytes\":%zu,\"snapshot_events\":%d,\"snapshot_audio_packets\":%d,"
+           "\"p999_record_ns_during_snapshots\":%lld}\n",
+        record_ns, record_audio_ns, busy_per_second_us, snapshot_us, json_bytes, events, audio_packets,
+        (long long)p999_record_ns);
+
+    int failures = 0;
+    if (events != FLIGHT_RECORDER_SNAPSHOT_MAX_EVENTS) {
+        fprintf(stderr, "snapshot has %d events, expected the cap of %d\n", events, FLIGHT_RECORDER_SNAPSHOT_MAX_EVENTS);
+        failures++;
+    }
+    if (audio_packets * 120 > FLIGHT_RECORDER_SNAPSHOT_AUDIO_BYTES) {
+        fprintf(stderr, "snapshot has %d audio packets, over the audio cap\n", audio_packets);
+        failures++;
+    }
+    if (json_bytes > 20 * 1024) {
+        fprintf(stderr, "snapshot is %zu bytes\n", json_bytes);
+        failures++;
+    }
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,137 @@
+#ifndef HOST_CORPUS_H
+#define HOST_CORPUS_H
+
+/*
+ * Fixed, generated corpora shared by the host tools. Every signal comes from a seeded generator,
+ * so two runs on two machines see the same samples and their figures can be compared.
+ */
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+class HostRandom {
+public:
+    explicit HostRandom(uint32_t seed) : state_(seed) {}
+
+    uint32_t Next() {
+        // xorshift32
+        state_ ^= state_ << 13;
+        state_ ^= state_ >> 17;
+        state_ ^= state_ << 5;
+        return state_;
+    }
+    // Uniform in [-1, 1)
+    float Uniform() { return (float)(Next() >> 8) / (float)(1 << 23) - 1.0f; }
+
+private:
+    uint32_t state_;
+};
+
+// Voiced segments: a gliding pitch with harmonics under a syllable envelope, separated by pauses
+inline std::vector<int16_t> GenerateSpeechLike(int sample_rate, int duration_ms, uint32_t seed, float noise_level = 0.01f) {
+    HostRandom random(seed);
+    size_t samples = (size_t)sample_rate * duration_ms / 1000;
+    std::vector<int16_t> pcm(samples);
+    double phase = 0;
+    for (size_t i = 0; i < samples; i++) {
+        double t = (double)i / sample_rate;
+        double syllable = std::fmod(t, 0.3) / 0.3;
+        bool pause = std::fmod(t, 1.5) > 1.2;
+        double envelope = pause ? 0 : std::sin(M_PI * syllable);
+        double pitch = 140 + 40 * std::sin(2 * M_PI * 0.7 * t);
+        phase += 2 * M_PI * pitch / sample_rate;
+        double voiced = 0;
+        for (int harmonic = 1; harmonic <= 8; harmonic++) {
+            voiced += std::sin(harmonic * phase) / harmonic;
+        }
+        double value = 0.35 * envelope * voiced + noise_level * random.Uniform();
+        pcm[i] = (int16_t)std::lround(std::max(-1.0, std::min(1.0, value)) * 32767);
+    }
+    return pcm;
+}
+
+// What a 32-bit I2S microphone delivers, 16-bit samples shifted into the upper bits with low bit noise
+inline std::vector<int32_t> GenerateI2sWords(const std::vector<int16_t>& pcm, uint32_t seed) {
+    HostRandom random(seed);
+    std::vector<int32_t> words(pcm.size());
+    for (size_t i = 0; i < pcm.size(); i++) {
+        words[i] = ((int32_t)pcm[i] << 12) | (int32_t)(random.Next() & 0xFFF);
+    }
+    return words;
+}
+
+// One labeled stretch of a generated recording
+struct CorpusSegment {
+    bool speech;
+    int ms;
+};
+
+// Appends a segment at 16 kHz over a noise floor: speech is a voiced sound with a gliding pitch and
+// a syllable envelope that never falls below a quarter, silence is the noise floor alone
+inline void AppendCorpusSegment(std::vector<int16_t>& pcm, const CorpusSegment& segment, HostRandom& random,
+                                float speech_level, float noise_level) {
+    const int kSampleRate = 16000;
+    size_t samples = (size_t)kSampleRate * segment.ms / 1000;
+    double phase = random.Uniform() * M_PI;
+    double pitch_base = 110 + 60 * (random.Uniform() + 1);
+    for (size_t i = 0; i < samples; i++) {
+        double t = (double)i / kSampleRate;
+        double value = noise_level * random.Uniform();
+        if (segment.speech) {
+            double envelope = 0.25 + 0.75 * std::fabs(std::sin(M_PI * t / 0.22));
+            double pitch = pitch_base + 25 * std::sin(2 * M_PI * 1.3 * t);
+            phase += 2 * M_PI * pitch / kSampleRate;
+            double voiced = 0;
+            for (int harmonic = 1; harmonic <= 8; harmonic++) {
+                voiced += std::sin(harmonic * phase) / harmonic;
+            }
+            value += speech_level * envelope * voiced;
+        }
+        pcm.push_back((int16_t)std::lround(std::max(-1.0, std::min(1.0, value)) * 32767));
+    }
+}
+
+inline std::vector<int16_t> RenderCorpus(const std::vector<CorpusSegment>& segments, uint32_t seed,
+                                         float speech_level, float noise_level) {
+    HostRandom random(seed);
+    std::vector<int16_t> pcm;
+    for (auto& segment : segments) {
+        AppendCorpusSegment(pcm, segment, random, speech_level, noise_level);
+    }
+    return pcm;
+}
+
+// The control messages of two turns of a conversation as a server sends them over the websocket: the
+// MCP handshake, recognized speech, emotions, TTS sentences and a tool call. One sentence is escaped
+// to ASCII the way Python's json.dumps writes it, one has quotes and a line break.
+inline std::vector<std::string> ServerMessageTrace() {
+    const std::string session = "\"session_id\":\"4f9c2a7e-1b3d-4c8e-9a61-0d5e7f3b2c18\"";
+    return {
+        "{" + session + ",\"type\":\"mcp\",\"payload\":{\"jsonrpc\":\"2.0\",\"method\":\"initialize\",\"params\":"
+            "{\"capabilities\":{\"vision\":{\"url\":\"https://api.example.com/vision/explain\",\"token\":"
+            "\"d41d8cd98f00b204e9800998ecf8427e\"}}},\"id\":1}}",
+        "{" + session + ",\"type\":\"mcp\",\"payload\":{\"jsonrpc\":\"2.0\",\"method\":\"tools/list\",\"params\":{\"cursor\":\"\"},\"id\":2}}",
+        "{\"type\":\"stt\",\"text\":\"今天天气怎么样\"," + session + "}",
+        "{\"type\":\"llm\",\"text\":\"😊\",\"emotion\":\"happy\"," + session + "}",
+        "{\"type\":\"tts\",\"state\":\"start\",\"sample_rate\":24000," + session + "}",
+        "{\"type\":\"tts\",\"state\":\"sentence_start\",\"text\":\"今天是晴天，最高气温二十六度。\"," + session + "}",
+        "{\"type\":\"tts\",\"state\":\"sentence_start\",\"text\":\"\\u4e0b\\u5348\\u53ef\\u80fd\\u4f1a\\u6709\\u9635\\u96e8\\uff0c"
+            "\\u51fa\\u95e8\\u8bb0\\u5f97\\u5e26\\u4f1e\\u3002\"," + session + "}",
+        "{\"type\":\"tts\",\"state\":\"sentence_start\",\"text\":\"The forecast says \\\"light showers\\\" after 3 pm.\\n"
+            "Take an umbrella.\"," + session + "}",
+        "{\"type\":\"tts\",\"state\":\"sentence_end\",\"text\":\"Take an umbrella.\"," + session + "}",
+        "{\"type\":\"tts\",\"state\":\"stop\"," + session + "}",
+        "{\"type\":\"stt\",\"text\":\"把音量调到六十\"," + session + "}",
+        "{\"type\":\"llm\",\"text\":\"👌\",\"emotion\":\"neutral\"," + session + "}",
+        "{" + session + ",\"type\":\"mcp\",\"payload\":{\"jsonrpc\":\"2.0\",\"method\":\"tools/call\",\"params\":"
+            "{\"name\":\"self.audio_speaker.set_volume\",\"arguments\":{\"volume\":60}},\"id\":3}}",
+        "{\"type\":\"tts\",\"state\":\"start\",\"sample_rate\":24000," + session + "}",
+        "{\"type\":\"tts\",\"state\":\"sentence_start\",\"text\":\"好的，音量已经调到百分之六十。\"," + session + "}",
+        "{\"type\":\"tts\",\"state\":\"stop\"," + session + "}",
+        "{\"type\":\"alert\",\"status\":\"提醒\",\"message\":\"电量低于百分之二十\",\"emotion\":\"sad\"," + session + "}",
+    };
+}
+
+#endif
@@ -0,0 +1,249 @@
+/*
+ * Cost of dispatching the server control messages of ServerMessageTrace (host_corpus.h), per
+ * message type, the way Application handles them:
+ *
+ *   cjson         the path before JsonMessage: cJSON_ParseWithLength of the frame, strcmp on "type",
+ *                 the handler reads its fields from the tree and copies its strings, cJSON_Delete
+ *   json_message  JsonMessage::Parse, the type hash looked up in a table, the handler copies its
+ *                 strings with GetString and an MCP payload alone is parsed with cJSON
+ *
+ * The cJSON here is the host parser of stubs/cJSON.cc, which allocates like cJSON: a node per value
+ * and a copy of every key and string. The parser allocations per message are counted from the trees
+ * in a pass of their own. Each handler copies the strings the Application copies on its path, an
+ * escaped string has to be copied out of the frame. One JSON object per path and type is printed to
+ * stdout.
+ */
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <map>
+#include <string>
+#include <vector>
+
+#include <cJSON.h>
+#include "json_message.h"
+#include "host_corpus.h"
+
+namespace {
+
+int64_t NowNs() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// What the handlers hand on, kept so the copies are not optimized away
+size_t sink = 0;
+// Set for one pass outside the timing, the trees are walked to count their blocks
+bool count_allocations = false;
+
+void Use(const std::string& value) {
+    sink += value.size();
+}
+
+void Use(const char* value) {
+    sink += strlen(value);
+}
+
+// Heap blocks of a parsed tree: the node, its key and its string
+int CountAllocations(const cJSON* item) {
+    if (!count_allocations) {
+        return 0;
+    }
+    int count = 1 + (item->string != nullptr) + (item->valuestring != nullptr);
+    for (auto child = item->child; child != nullptr; child = child->next) {
+        count += CountAllocations(child);
+    }
+    return count;
+}
+
+// What McpServer::ParseMessage reads first
+void UseMcpPayload(const cJSON* payload) {
+    auto method = cJSON_GetObjectItem(payload, "method");
+    if (cJSON_IsString(method)) {
+        Use(method->valuestring);
+    }
+    sink += cJSON_GetObjectItem(payload, "id") != nullptr;
+}
+
+int DispatchCjson(const char* data, size_t size) {
+    auto root = cJSON_ParseWithLength(data, size);
+    if (root == nullptr) {
+        return 0;
+    }
+    int allocations = CountAllocations(root);
+    auto type = cJSON_GetObjectItem(root, "type");
+    if (strcmp(type->valuestring, "tts") == 0) {
+        auto state = cJSON_GetObjectItem(root, "state");
+        if (strcmp(state->valuestring, "sentence_start") == 0) {
+            auto text = cJSON_GetObjectItem(root, "text");
+            if (cJSON_IsString(text)) {
+                Use(std::string(text->valuestring));
+            }
+        }
+    } else if (strcmp(type->valuestring, "stt") == 0) {
+        auto text = cJSON_GetObjectItem(root, "text");
+        if (cJSON_IsString(text)) {
+            Use(std::string(text->valuestring));
+        }
+    } else if (strcmp(type->valuestring, "llm") == 0) {
+        auto emotion = cJSON_GetObjectItem(root, "emotion");
+        if (cJSON_IsString(emotion)) {
+            Use(std::string(emotion->valuestring));
+        }
+    } else if (strcmp(type->valuestring, "mcp") == 0) {
+        auto payload = cJSON_GetObjectItem(root, "payload");
+        if (cJSON_IsObject(payload)) {
+            UseMcpPayload(payload);
+        }
+    } else if (strcmp(type->valuestring, "system") == 0) {
+        auto command = cJSON_GetObjectItem(root, "command");
+        if (cJSON_IsString(command)) {
+            Use(command->valuestring);
+        }
+    } else if (strcmp(type->valuestring, "alert") == 0) {
+        auto status = cJSON_GetObjectItem(root, "status");
+        auto message = cJSON_GetObjectItem(root, "message");
+        auto emotion = cJSON_GetObjectItem(root, "emotion");
+        if (cJSON_IsString(status) && cJSON_IsString(message) && cJSON_IsString(emotion)) {
+            Use(status->valuestring);
+            Use(message->valuestring);
+            Use(emotion->valuestring);
+        }
+    }
+    cJSON_Delete(root);
+    return allocations;
+}
+
+int HandleTts(const JsonMessage& message) {
+    std::string text;
+    if (message.Equals("state", "sentence_start") && message.GetString("text", text)) {
+        Use(text);
+    }
+    return 0;
+}
+
+int HandleStt(const JsonMessage& message) {
+    std::string text;
+    if (message.GetString("text", text)) {
+        Use(text);
+    }
+    return 0;
+}
+
+int HandleLlm(const JsonMessage& message) {
+    std::string emotion;
+    if (message.GetString("emotion", emotion)) {
+        Use(emotion);
+    }
+    return 0;
+}
+
+int HandleMcp(const JsonMessage& message) {
+    auto payload = message.Get("payload");
+    if (payload.type != kJsonObject) {
+        return 0;
+    }
+    auto root = cJSON_ParseWithLength(payload.data, payload.size);
+    if (root == nullptr) {
+        return 0;
+    }
+    int allocations = CountAllocations(root);
+    UseMcpPayload(root);
+    cJSON_Delete(root);
+    return allocations;
+}
+
+int HandleSystem(const JsonMessage& message) {
+    std::string command;
+    if (message.GetString("command", command)) {
+        Use(command);
+    }
+    return 0;
+}
+
+int HandleAlert(const JsonMessage& message) {
+    std::string status, text, emotion;
+    if (message.GetString("status", status) && message.GetString("message", text) && message.GetString("emotion", emotion)) {
+        Use(status);
+        Use(text);
+        Use(emotion);
+    }
+    return 0;
+}
+
+// Laid out like the table of Application::OnIncomingJson
+int DispatchJsonMessage(const char* data, size_t size) {
+    static const struct {
+        uint32_t hash;
+        const char* type;
+        int (*handle)(const JsonMessage& message);
+    } handlers[] = {
+        {JsonMessage::Hash("tts"), "tts", HandleTts},
+        {JsonMessage::Hash("stt"), "stt", HandleStt},
+        {JsonMessage::Hash("llm"), "llm", HandleLlm},
+        {JsonMessage::Hash("mcp"), "mcp", HandleMcp},
+        {JsonMessage::Hash("system"), "system", HandleSystem},
+        {JsonMessage::Hash("alert"), "alert", HandleAlert},
+    };
+    JsonMessage message;
+    if (!message.Parse(data, size) || !message.IsString("type")) {
+        return 0;
+    }
+    auto type = message.Get("type");
+    auto hash = JsonMessage::Hash(type.data, type.size);
+    for (auto& handler : handlers) {
+        if (handler.hash == hash && message.Equals("type", handler.type)) {
+            return handler.handle(message);
+        }
+    }
+    return 0;
+}
+
+std::string TypeOf(const std::string& message) {
+    JsonMessage parsed;
+    std::string type;
+    parsed.Parse(message.data(), message.size());
+    parsed.GetString("type", type);
+    return type;
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    bool quick = argc > 1 && strcmp(argv[1], "--quick") == 0;
+    const int kRounds = quick ? 200 : 20000;
+
+    // The trace grouped by type, in the order of the trace
+    std::map<std::string, std::vector<std::string>> by_type;
+    for (auto& message : ServerMessageTrace()) {
+        by_type[TypeOf(message)].push_back(message);
+    }
+
+    for (auto& [type, messages] : by_type) {
+        size_t bytes = 0;
+        for (auto& message : messages) {
+            bytes += message.size();
+        }
+        for (bool cjson : {true, false}) {
+            auto dispatch = cjson ? DispatchCjson : DispatchJsonMessage;
+            int allocations = 0;
+            count_allocations = true;
+            for (auto& message : messages) {
+                allocations += dispatch(message.data(), message.size());
+            }
+            count_allocations = false;
+            int64_t start = NowNs();
+            for (int round = 0; round < kRounds; round++) {
+                for (auto& message : messages) {
+                    dispatch(message.data(), message.size());
+                }
+            }
+            double ns_per_message = (double)(NowNs() - start) / kRounds / messages.size();
+            printf("{\"path\":\"%s\",\"type\":\"%s\",\"messages\":%zu,\"bytes_per_message\":%zu,"
+                "\"ns_per_message\":%.1f,\"parser_allocations_per_message\":%.1f}\n", cjson ? "cjson" : "json_message",
+                type.c_str(), messages.size(), bytes / messages.size(), ns_per_message,
+                (double)allocations / messages.size());
+        }
+    }
+    return sink == 0 ? 1 : 0;
+}
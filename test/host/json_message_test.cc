@@ -0,0 +1,332 @@
+/*
+ * Fuzzes JsonMessage with mutations of ServerMessageTrace (host_corpus.h) and a few hand-written
+ * edge cases. Every input sits in a heap buffer of exactly its size, so under the sanitizers of
+ * the build a read past the end is caught. For every input:
+ *
+ *   spans       an accepted message indexes only spans inside the input, and every string field can
+ *               be unescaped or is refused without a crash
+ *   strict      an accepted message is accepted by the cJSON parser too, so nested objects, arrays,
+ *               escapes and numbers are checked and not only delimited, and a list of messages
+ *               malformed below the top level is refused
+ *   agreement   when the cJSON parser accepts the input too, both see the same type for every
+ *               indexed field and the same text for every string both can decode
+ *   reprint     when cJSON accepts an object, JsonMessage accepts its unformatted print and agrees
+ *               with it field by field, so no well-formed message is refused
+ *
+ * One JSON object with the counts is printed to stdout. The exit status is non-zero on the first
+ * disagreement, the input is printed to stderr.
+ */
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <cJSON.h>
+#include "json_message.h"
+#include "host_corpus.h"
+
+namespace {
+
+struct Counts {
+    long inputs = 0;
+    long accepted = 0;
+    long both_accepted = 0;
+    long reprinted = 0;
+    long strings_compared = 0;
+};
+
+Counts counts;
+int failures = 0;
+
+void Fail(const std::string& input, const char* what) {
+    if (failures++ < 10) {
+        fprintf(stderr, "%s: %s\n", what, input.c_str());
+    }
+}
+
+JsonValueType TypeOf(const cJSON* item) {
+    switch (item->type) {
+    case cJSON_String: return kJsonString;
+    case cJSON_Number: return kJsonNumber;
+    case cJSON_True: return kJsonTrue;
+    case cJSON_False: return kJsonFalse;
+    case cJSON_NULL: return kJsonNull;
+    case cJSON_Object: return kJsonObject;
+    case cJSON_Array: return kJsonArray;
+    }
+    return kJsonNone;
+}
+
+int Depth(const cJSON* item) {
+    int depth = 0;
+    for (auto child = item->child; child != nullptr; child = child->next) {
+        depth = std::max(depth, Depth(child));
+    }
+    return depth + ((item->type & (cJSON_Object | cJSON_Array)) != 0);
+}
+
+bool HasNumberOutOfRange(const std::string& text) {
+    return text.find("inf") != std::string::npos || text.find("nan") != std::string::npos;
+}
+
+// The cJSON stand-in reads at most 63 characters of a number
+bool HasLongNumber(const std::string& text) {
+    size_t run = 0;
+    for (char c : text) {
+        run = strchr("0123456789+-eE.", c) != nullptr && c != '\0' ? run + 1 : 0;
+        if (run > 63) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Keys are compared raw by JsonMessage, only keys that print without an escape can be looked up
+bool IsPlainKey(const char* key) {
+    for (auto p = (const unsigned char*)key; *p != 0; p++) {
+        if (*p < 0x20 || *p == '"' || *p == '\\') {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Compares the indexed fields of message with the first JSON_MESSAGE_MAX_FIELDS members of root
+bool Agree(const JsonMessage& message, const cJSON* root, bool exact_strings) {
+    int index = 0;
+    for (auto child = root->child; child != nullptr && index < JSON_MESSAGE_MAX_FIELDS; child = child->next, index++) {
+        if (!IsPlainKey(child->string)) {
+            continue;
+        }
+        // Both look up the first member with a key
+        auto first = cJSON_GetObjectItem(root, child->string);
+        auto span = message.Get(child->string);
+        if (span.type == kJsonNone && !exact_strings) {
+            // The key may be escaped in the input, JsonMessage only finds it as written
+            continue;
+        }
+        if (span.type != TypeOf(first)) {
+            return false;
+        }
+        if (span.type != kJsonString) {
+            continue;
+        }
+        std::string value;
+        if (!message.GetString(child->string, value)) {
+            // A printed string is always valid, one from the input may hold an escape only cJSON refuses
+            if (exact_strings) {
+                return false;
+            }
+            continue;
+        }
+        // cJSON strings end at an escaped NUL
+        size_t nul = value.find('\0');
+        if (nul != std::string::npos) {
+            value.resize(nul);
+        }
+        if (value != first->valuestring) {
+            return false;
+        }
+        counts.strings_compared++;
+    }
+    return true;
+}
+
+void CheckInput(const std::string& input) {
+    counts.inputs++;
+    // The input ends where the buffer does, without a terminator behind it
+    std::unique_ptr<char[]> buffer(new char[input.size()]);
+    char* data = buffer.get();
+    memcpy(data, input.data(), input.size());
+
+    JsonMessage message;
+    bool accepted = message.Parse(data, input.size());
+    if (accepted) {
+        counts.accepted++;
+        for (auto key : {"type", "state", "text", "session_id", "payload", "emotion"}) {
+            auto span = message.Get(key);
+            if (span.type != kJsonNone && (span.data < data || span.data + span.size > data + input.size())) {
+                Fail(input, "a span is outside the input");
+            }
+            std::string value;
+            message.GetString(key, value);
+        }
+    }
+
+    auto root = cJSON_ParseWithLength(data, input.size());
+    if (root == nullptr) {
+        if (accepted && !HasLongNumber(input)) {
+            Fail(input, "JsonMessage accepted what cJSON refuses");
+        }
+        return;
+    }
+    if (accepted && cJSON_IsObject(root)) {
+        counts.both_accepted++;
+        if (!Agree(message, root, false)) {
+            Fail(input, "JsonMessage and cJSON disagree");
+        }
+    }
+    if (cJSON_IsObject(root) && Depth(root) <= JSON_MESSAGE_MAX_DEPTH) {
+        auto printed = cJSON_PrintUnformatted(root);
+        std::string text(printed);
+        cJSON_free(printed);
+        if (!HasNumberOutOfRange(text)) {
+            counts.reprinted++;
+            JsonMessage reprinted;
+            if (!reprinted.Parse(text.data(), text.size())) {
+                Fail(text, "a well-formed object was refused");
+            } else if (!Agree(reprinted, root, true)) {
+                Fail(text, "JsonMessage and cJSON disagree on a printed object");
+            }
+        }
+    }
+    cJSON_Delete(root);
+}
+
+std::vector<std::string> EdgeCases() {
+    std::string deep_objects, deep_arrays;
+    for (int i = 0; i < JSON_MESSAGE_MAX_DEPTH; i++) {
+        deep_objects += "{\"a\":";
+        deep_arrays += "[";
+    }
+    deep_objects += "1";
+    deep_arrays += "1";
+    for (int i = 0; i < JSON_MESSAGE_MAX_DEPTH; i++) {
+        deep_objects += "}";
+        deep_arrays += "]";
+    }
+    std::string many_fields = "{";
+    for (int i = 0; i < JSON_MESSAGE_MAX_FIELDS + 4; i++) {
+        many_fields += "\"f" + std::to_string(i) + "\":" + std::to_string(i) + ",";
+    }
+    many_fields += "\"type\":\"tts\"}";
+    return {
+        "{}",
+        " { } ",
+        "{\"type\":\"tts\"}",
+        "{\"a\":" + deep_objects + "}",
+        "{\"a\":" + deep_arrays + "}",
+        "{\"a\":{\"a\":" + deep_objects + "}}",
+        many_fields,
+        "{\"type\":\"tts\",\"type\":\"stt\"}",
+        "{\"text\":\"\\ud83d\\ude00 \\u00e9 \\\\ \\/ \\b\\f\\n\\r\\t\"}",
+        "{\"text\":\"\\ud83d\"}",
+        "{\"text\":\"\\u0000after\"}",
+        "{\"text\":\"\\u12\"}",
+        "{\"text\":\"trailing\\\\\"}",
+        "{\"a\":[1,-2.5e+3,true,false,null,\"]\",\"}\",{\"b\":[]}]}",
+        "{\"a\":-}",
+        "{\"a\":1}}",
+        "{\"a\":1} x",
+        "{\"a\" 1}",
+        "{\"a\":[}",
+        "{\"a\":{]}",
+        "{\"a\":\"\x01\"}",
+        "{\"a\":tru}",
+        // Cut off inside a value, the parser must not look past the end
+        "{\"a\":tru",
+        "{\"a\":fals",
+        "{\"a\":n",
+        "{\"a\":-1.5e",
+        "{\"a\":\"abc\\",
+        "{\"a\":\"\\u12",
+        "{\"a\":[true,false,null",
+        "{\"a\":{\"b\":\"",
+        "",
+        "[]",
+        "\"type\"",
+    };
+}
+
+// Malformed below the top level, each one must be refused
+std::vector<std::string> MalformedCases() {
+    return {
+        "{\"a\":{1:2}}",
+        "{\"a\":{\"b\"}}",
+        "{\"a\":{\"b\":1,}}",
+        "{\"a\":[1,,2]}",
+        "{\"a\":[1 2]}",
+        "{\"a\":[01]}",
+        "{\"a\":[1.]}",
+        "{\"a\":[-]}",
+        "{\"a\":[\"\\x\"]}",
+        "{\"a\":[\"\\ude00\"]}",
+        "{\"a\":{\"b\":\"\\ud83d\"}}",
+        "{\"a\":[tru]}",
+        "{\"a\":1.5.2}",
+    };
+}
+
+// Mostly characters that change the structure
+const char kAlphabet[] = "{}[]\":,\\ \n\ttfnrue0123456789-+.eEu\"\"{}";
+
+std::string Mutate(const std::string& seed, HostRandom& random) {
+    std::string text = seed;
+    int edits = 1 + random.Next() % 4;
+    for (int i = 0; i < edits; i++) {
+        size_t position = text.empty() ? 0 : random.Next() % (text.size() + 1);
+        char c = random.Next() % 8 == 0 ? (char)random.Next() : kAlphabet[random.Next() % (sizeof(kAlphabet) - 1)];
+        switch (random.Next() % 6) {
+        case 0:
+            if (position < text.size()) {
+                text[position] = c;
+            }
+            break;
+        case 1:
+            text.insert(position, 1, c);
+            break;
+        case 2:
+            if (position < text.size()) {
+                text.erase(position, 1 + random.Next() % 8);
+            }
+            break;
+        case 3:
+            text.resize(position);
+            break;
+        case 4: {
+            // A piece of the message repeated somewhere else, nests and duplicates fields
+            size_t from = random.Next() % (seed.size() + 1);
+            size_t size = random.Next() % 32;
+            text.insert(position, seed.substr(from, size));
+            break;
+        }
+        default:
+            if (position < text.size()) {
+                text[position] ^= 1 << (random.Next() % 8);
+            }
+            break;
+        }
+    }
+    return text;
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    bool quick = argc > 1 && strcmp(argv[1], "--quick") == 0;
+    const int kMutations = quick ? 20000 : 500000;
+
+    auto seeds = ServerMessageTrace();
+    for (auto& edge_case : EdgeCases()) {
+        seeds.push_back(edge_case);
+    }
+    for (auto& malformed : MalformedCases()) {
+        JsonMessage message;
+        if (message.Parse(malformed.data(), malformed.size())) {
+            Fail(malformed, "a malformed message was accepted");
+        }
+        seeds.push_back(malformed);
+    }
+    for (auto& seed : seeds) {
+        CheckInput(seed);
+    }
+    HostRandom random(20240611);
+    for (int i = 0; i < kMutations; i++) {
+        CheckInput(Mutate(seeds[random.Next() % seeds.size()], random));
+    }
+    printf("{\"inputs\":%ld,\"accepted\":%ld,\"both_accepted\":%ld,\"reprinted\":%ld,\"strings_compared\":%ld,"
+        "\"failures\":%d}\n", counts.inputs, counts.accepted, counts.both_accepted, counts.reprinted,
+        counts.strings_compared, failures);
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,19 @@
+#ifndef HOST_LINK_ESTIMATOR_ESP_TIMER_H
+#define HOST_LINK_ESTIMATOR_ESP_TIMER_H
+
+/*
+ * A simulated clock for LinkEstimator. The test sets the time of every event, so a minute of a
+ * lossy link runs in no time and the same seed always gives the same estimate.
+ */
+#include <cstdint>
+
+inline int64_t& HostSimulatedTimeUs() {
+    static int64_t now_us = 0;
+    return now_us;
+}
+
+inline int64_t esp_timer_get_time() {
+    return HostSimulatedTimeUs();
+}
+
+#endif
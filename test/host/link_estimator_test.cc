@@ -0,0 +1,225 @@
+/*
+ * LinkEstimator on a simulated link. Downlink audio is sent every 60 ms and arrives after a base
+ * delay plus a random extra delay, in order like over the websocket, so a late packet holds up the
+ * ones behind it. Some packets are lost, and the uplink backlog is reported once per second before
+ * Update, like the main loop does. The clock is the simulated one of
+ * link_estimator/esp_timer.h. Every case is 90 s, bad from second 10 to 40 unless it is clean.
+ *
+ *   clean       20 ms jitter at most and no loss, the quality never changes
+ *   lossy       15% loss, poor with FEC, then good again
+ *   jittery     one packet in five held up by 300 to 1000 ms, fair
+ *   congested   4 packets in the send queue and a dropped one each second, poor
+ *   flapping    20% loss for 2 s and none for 2 s in turn, degraded and changing far less often
+ *               than the link
+ *
+ * In every case the quality steps up at most once per LINK_ESTIMATOR_STEP_UP_SAMPLES seconds.
+ *
+ * One JSON object per case is printed to stdout. The exit status is non-zero when a case fails.
+ */
+#include <algorithm>
+#include <cstdio>
+#include <vector>
+
+#include "esp_timer.h"
+#include "link_estimator.h"
+#include "host_corpus.h"
+
+namespace {
+
+const int kSeconds = 90;
+const int kBadFrom = 10;
+const int kBadUntil = 40;
+const int kFrameMs = 60;
+const int kBaseDelayMs = 30;
+const int kRttMs = 80;
+
+int failures = 0;
+
+void Check(bool condition, const char* test, const char* what) {
+    if (!condition) {
+        fprintf(stderr, "%s: %s\n", test, what);
+        failures++;
+    }
+}
+
+struct Conditions {
+    int loss_percent = 0;
+    int max_extra_delay_ms = 20;
+    // Packets held up on top of that, like by retransmissions on a weak radio
+    int stall_percent = 0;
+    size_t backlog = 1;
+    bool dropped = false;
+};
+
+bool IsBad(int second) {
+    return second >= kBadFrom && second < kBadUntil;
+}
+
+Conditions Clean(int second) {
+    return {};
+}
+
+Conditions Lossy(int second) {
+    Conditions conditions;
+    conditions.loss_percent = IsBad(second) ? 15 : 0;
+    return conditions;
+}
+
+Conditions Jittery(int second) {
+    Conditions conditions;
+    conditions.stall_percent = IsBad(second) ? 20 : 0;
+    return conditions;
+}
+
+Conditions Congested(int second) {
+    Conditions conditions;
+    if (IsBad(second)) {
+        conditions.backlog = 4;
+        conditions.dropped = true;
+    }
+    return conditions;
+}
+
+Conditions Flapping(int second) {
+    Conditions conditions;
+    conditions.loss_percent = IsBad(second) && (second - kBadFrom) % 4 < 2 ? 20 : 0;
+    return conditions;
+}
+
+struct Scenario {
+    const char* name;
+    Conditions (*conditions)(int second);
+    LinkQuality lowest;
+    // Seconds after the link turns bad until the quality drops, and after it is clean again until it is good
+    int degrade_within_s;
+    int recover_within_s;
+    // The link stays as bad for the whole window, so the quality must not step up in it
+    bool steady;
+};
+
+struct Event {
+    int64_t time_us;
+    // 0 an arrival, 1 a loss found, 2 the once per second update
+    int kind;
+    uint32_t timestamp;
+};
+
+const char* QualityName(LinkQuality quality) {
+    return quality == kLinkQualityPoor ? "poor" : quality == kLinkQualityFair ? "fair" : "good";
+}
+
+void Run(const Scenario& scenario, uint32_t seed) {
+    HostRandom random(seed);
+    std::vector<Event> events;
+    uint32_t lost = 0;
+    int64_t last_arrival_ms = 0;
+    for (int64_t sent_ms = 0; sent_ms < kSeconds * 1000; sent_ms += kFrameMs) {
+        auto conditions = scenario.conditions(sent_ms / 1000);
+        uint32_t timestamp = 1000 + (uint32_t)sent_ms;
+        int64_t arrival_ms = sent_ms + kBaseDelayMs + random.Next() % (conditions.max_extra_delay_ms + 1);
+        if ((int)(random.Next() % 100) < conditions.stall_percent) {
+            arrival_ms += 300 + random.Next() % 701;
+        }
+        arrival_ms = std::max(arrival_ms, last_arrival_ms);
+        if ((int)(random.Next() % 100) < conditions.loss_percent) {
+            // The gap shows when the next packet arrives, about one frame later
+            events.push_back({(sent_ms + kBaseDelayMs + kFrameMs) * 1000, 1, timestamp});
+            lost++;
+        } else {
+            events.push_back({arrival_ms * 1000, 0, timestamp});
+            last_arrival_ms = arrival_ms;
+        }
+    }
+    for (int second = 1; second <= kSeconds; second++) {
+        events.push_back({second * 1000000LL, 2, 0});
+    }
+    std::stable_sort(events.begin(), events.end(), [](const Event& a, const Event& b) { return a.time_us < b.time_us; });
+
+    LinkEstimator estimator;
+    HostSimulatedTimeUs() = 0;
+    estimator.Reset(kRttMs);
+    int changes = 0;
+    int stepped_up_while_bad = 0;
+    int early_step_ups = 0;
+    int last_change = 0;
+    int degraded_at = -1;
+    int recovered_at = -1;
+    int max_fec = 0;
+    bool fec_off_while_degraded = false;
+    LinkQuality lowest = kLinkQualityGood;
+    for (auto& event : events) {
+        HostSimulatedTimeUs() = event.time_us;
+        if (event.kind == 0) {
+            estimator.RecordIncomingAudio(event.timestamp);
+            continue;
+        }
+        if (event.kind == 1) {
+            estimator.RecordLostAudio(1);
+            continue;
+        }
+        int second = event.time_us / 1000000;
+        // The backlog of the second that just ended
+        auto conditions = scenario.conditions(second - 1);
+        estimator.RecordSendBacklog(conditions.backlog, conditions.dropped);
+        auto previous = estimator.quality();
+        bool changed = estimator.Update();
+        auto quality = estimator.quality();
+        if (changed) {
+            changes++;
+            early_step_ups += quality > previous && second - last_change < LINK_ESTIMATOR_STEP_UP_SAMPLES;
+            stepped_up_while_bad += quality > previous && IsBad(second - 1);
+            last_change = second;
+        }
+        lowest = std::min(lowest, quality);
+        if (quality < kLinkQualityGood && degraded_at < 0) {
+            degraded_at = second;
+        }
+        if (quality == kLinkQualityGood && degraded_at >= 0 && recovered_at < 0 && second >= kBadUntil) {
+            recovered_at = second;
+        }
+        max_fec = std::max(max_fec, estimator.fec_loss_percent());
+        fec_off_while_degraded |= quality < kLinkQualityGood && estimator.fec_loss_percent() == 0;
+    }
+
+    auto status = estimator.GetStatusJson();
+    auto lost_packets = cJSON_GetObjectItem(status, "lost_packets");
+    Check(cJSON_IsNumber(lost_packets) && lost_packets->valueint == (int)lost, scenario.name,
+        "the status does not count every lost packet");
+    cJSON_Delete(status);
+
+    Check(lowest == scenario.lowest, scenario.name, "the link was not judged as expected");
+    Check(!fec_off_while_degraded, scenario.name, "FEC was off on a degraded link");
+    Check(early_step_ups == 0, scenario.name, "the quality stepped up too soon after a change");
+    Check(!scenario.steady || stepped_up_while_bad == 0, scenario.name, "the quality stepped up while the link was bad");
+    if (scenario.lowest == kLinkQualityGood) {
+        Check(changes == 0, scenario.name, "the quality changed on a clean link");
+    } else {
+        Check(degraded_at >= kBadFrom && degraded_at <= kBadFrom + scenario.degrade_within_s, scenario.name,
+            "the quality did not drop in time");
+        Check(recovered_at >= 0 && recovered_at <= kBadUntil + scenario.recover_within_s, scenario.name,
+            "the quality did not recover in time");
+    }
+    printf("{\"case\":\"%s\",\"seed\":%u,\"lost_packets\":%u,\"lowest\":\"%s\",\"changes\":%d,"
+        "\"degrade_s\":%d,\"recover_s\":%d,\"max_fec_loss_percent\":%d,\"final_bitrate\":%d}\n",
+        scenario.name, seed, lost, QualityName(lowest), changes,
+        degraded_at < 0 ? -1 : degraded_at - kBadFrom, recovered_at < 0 ? -1 : recovered_at - kBadUntil,
+        max_fec, estimator.opus_bitrate());
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    const Scenario scenarios[] = {
+        {"clean", Clean, kLinkQualityGood, 0, 0, true},
+        {"lossy", Lossy, kLinkQualityPoor, 5, 30, true},
+        {"jittery", Jittery, kLinkQualityFair, 10, 12, true},
+        {"congested", Congested, kLinkQualityPoor, 2, 20, true},
+        {"flapping", Flapping, kLinkQualityPoor, 6, 30, false},
+    };
+    for (auto& scenario : scenarios) {
+        for (uint32_t seed : {3u, 5u, 8u}) {
+            Run(scenario, seed);
+        }
+    }
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,209 @@
+/*
+ * Time from a press of the talk button until the server has the first audio of the turn, with
+ * WebsocketProtocol on the simulated link of protocol/web_socket.h: every frame is delayed by half
+ * the round trip and a connect takes three round trips. Built with USE_PERSISTENT_WEBSOCKET.
+ *
+ *   after_open   capture starts once the channel is open and the listen message is sent, like
+ *                before the Connecting state started it
+ *   ahead        capture starts at the press and its frames are held until the listen message is
+ *                sent, like PrepareVoiceProcessing(true) and ReleaseUplink
+ *
+ * A frame is ready 60 ms after its capture started, the codec input is taken as already powered
+ * (SetInputKeepWarm) and the AFE as adding no delay, so the numbers are the link and the framing
+ * only. Each case runs on a new connection (cold) and on a parked session (warm).
+ *
+ * Per round trip, case and capture, the medians of the time until the server has the first audio
+ * and of the speech from the press that the turn misses. One JSON object each is printed to stdout.
+ * The exit status is non-zero when audio reached the server before the listen message or when
+ * capturing ahead missed speech or was not faster.
+ */
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "websocket_protocol.h"
+#include "application.h"
+#include "settings.h"
+#include "web_socket.h"
+
+namespace {
+
+const int kFrameMs = 60;
+
+int failures = 0;
+
+void Check(bool condition, const char* test, const char* what) {
+    if (!condition) {
+        fprintf(stderr, "%s: %s\n", test, what);
+        failures++;
+    }
+}
+
+// Answers every hello and notes when the listen message and the first audio of a turn arrive
+class ListenServer : public HostWebSocketServer {
+public:
+    void OnFrame(std::shared_ptr<HostWebSocketSession> session, const char* data, size_t len, bool binary) override {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (binary) {
+            if (first_audio_us_ == 0) {
+                first_audio_us_ = esp_timer_get_time();
+                memcpy(&first_frame_, data, std::min(len, sizeof(first_frame_)));
+                audio_before_listen_ |= listen_us_ == 0;
+            }
+            return;
+        }
+        std::string message(data, len);
+        if (message.find("\"type\":\"hello\"") != std::string::npos) {
+            session->Send("{\"type\":\"hello\",\"transport\":\"websocket\",\"session_id\":\"bench\","
+                "\"audio_params\":{\"format\":\"opus\",\"sample_rate\":24000,\"frame_duration\":60}}", false);
+        } else if (message.find("\"state\":\"start\"") != std::string::npos && listen_us_ == 0) {
+            listen_us_ = esp_timer_get_time();
+        }
+    }
+
+    void NewTurn() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        listen_us_ = 0;
+        first_audio_us_ = 0;
+        first_frame_ = -1;
+    }
+
+    // Waits for the first audio of the turn, false when it did not come within a second
+    bool WaitForFirstAudio(int64_t& arrival_us, int& frame, bool& before_listen) {
+        for (int waited = 0; waited < 1000; waited++) {
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                if (first_audio_us_ != 0) {
+                    arrival_us = first_audio_us_;
+                    frame = first_frame_;
+                    before_listen = audio_before_listen_;
+                    return true;
+                }
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        return false;
+    }
+
+private:
+    std::mutex mutex_;
+    int64_t listen_us_ = 0;
+    int64_t first_audio_us_ = 0;
+    int first_frame_ = -1;
+    bool audio_before_listen_ = false;
+};
+
+struct Timing {
+    std::vector<double> first_uplink_ms;
+    std::vector<double> missed_ms;
+};
+
+double Median(std::vector<double> values) {
+    std::sort(values.begin(), values.end());
+    return values[values.size() / 2];
+}
+
+void SleepUntil(int64_t time_us) {
+    int64_t now = esp_timer_get_time();
+    if (time_us > now) {
+        std::this_thread::sleep_for(std::chrono::microseconds(time_us - now));
+    }
+}
+
+// The first frame of the capture, its payload is the number of frames captured since the press
+std::unique_ptr<AudioStreamPacket> MakeFrame(int frame) {
+    auto packet = std::make_unique<AudioStreamPacket>();
+    packet->headroom = AUDIO_PACKET_HEADROOM;
+    packet->payload.resize(AUDIO_PACKET_HEADROOM + 120);
+    memcpy(packet->data(), &frame, sizeof(frame));
+    return packet;
+}
+
+// One turn from the press, the channel is closed again once the first audio has arrived
+bool Turn(WebsocketProtocol& protocol, ListenServer& server, bool ahead, Timing& timing, const char* name) {
+    server.NewTurn();
+    int64_t press = esp_timer_get_time();
+    if (!protocol.IsAudioChannelOpened() && !protocol.OpenAudioChannel()) {
+        return false;
+    }
+    int64_t opened = esp_timer_get_time();
+    protocol.SendStartListening(kListeningModeAutoStop);
+    // Captured ahead, the first frame was ready 60 ms after the press and waited for the listen message
+    int64_t capture_start = ahead ? press : esp_timer_get_time();
+    SleepUntil(capture_start + kFrameMs * 1000);
+    int frame = ahead ? 0 : (int)((opened - press + kFrameMs * 1000 - 1) / (kFrameMs * 1000));
+    protocol.SendAudio(MakeFrame(frame));
+
+    int64_t arrival = 0;
+    int received_frame = -1;
+    bool before_listen = false;
+    if (!server.WaitForFirstAudio(arrival, received_frame, before_listen)) {
+        return false;
+    }
+    Application::GetInstance().WaitForScheduled();
+    protocol.CloseAudioChannel();
+    Check(!before_listen, name, "audio reached the server before the listen message");
+    Check(received_frame == frame, name, "the server did not get the first frame first");
+    timing.first_uplink_ms.push_back((arrival - press) / 1000.0);
+    // Speech from the press to where the first sent frame starts is not in the turn
+    timing.missed_ms.push_back(ahead ? 0 : (capture_start - press) / 1000.0);
+    return true;
+}
+
+void Print(const char* name, bool ahead, int rtt_ms, const Timing& timing) {
+    printf("{\"case\":\"%s\",\"capture\":\"%s\",\"rtt_ms\":%d,\"rounds\":%zu,\"first_uplink_ms\":%.1f,"
+        "\"missed_speech_ms\":%.1f}\n", name, ahead ? "ahead" : "after_open", rtt_ms, timing.first_uplink_ms.size(),
+        Median(timing.first_uplink_ms), Median(timing.missed_ms));
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    bool quick = argc > 1 && strcmp(argv[1], "--quick") == 0;
+    const int kRounds = quick ? 2 : 10;
+
+    ListenServer server;
+    auto& link = GetHostWebSocketLink();
+    link.server = &server;
+    Settings settings("websocket", true);
+    settings.SetString("url", "wss://host/listen");
+
+    for (int rtt_ms : {20, 100, 250}) {
+        link.one_way_us = rtt_ms * 1000 / 2;
+        link.connect_us = 3 * rtt_ms * 1000;
+
+        for (bool warm : {false, true}) {
+            const char* name = warm ? "warm" : "cold";
+            double medians[2] = {};
+            for (bool ahead : {false, true}) {
+                Timing timing;
+                std::unique_ptr<WebsocketProtocol> parked;
+                if (warm) {
+                    // The first channel connects and leaves its session parked for the measured ones
+                    parked = std::make_unique<WebsocketProtocol>();
+                    Timing first;
+                    Check(Turn(*parked, server, ahead, first, name), name, "the first channel did not open");
+                }
+                for (int round = 0; round < kRounds; round++) {
+                    auto fresh = warm ? nullptr : std::make_unique<WebsocketProtocol>();
+                    auto& protocol = warm ? *parked : *fresh;
+                    Check(Turn(protocol, server, ahead, timing, name), name, "the channel did not open");
+                }
+                Print(name, ahead, rtt_ms, timing);
+                medians[ahead] = Median(timing.first_uplink_ms);
+                if (ahead) {
+                    Check(Median(timing.missed_ms) == 0, name, "capturing ahead missed speech");
+                }
+            }
+            Check(medians[1] <= medians[0], name, "capturing ahead did not reach the server sooner");
+        }
+    }
+    fflush(stdout);
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,392 @@
+/*
+ * The UDP audio channel of MqttProtocol over the loopback of the host. The broker of protocol/mqtt.h
+ * answers the hello with the address of a socket of this test, which then plays the server: it
+ * learns the device address from the first uplink packet, checks that it decrypts, and sends
+ * encrypted downlink packets in the order a case asks for.
+ *
+ *   fixed      a hand-written order with swaps, a duplicate, a replay and two losses, the last one
+ *              at the end of the stream where only the flush timer gives it up
+ *   jump       the sequence jumps far ahead while a packet waits for a gap, the gap is given up at
+ *              once and the held packet still plays
+ *   shuffled   random orders: the packets of each block of MQTT_UDP_REORDER_DEPTH are shuffled,
+ *              some are dropped and some sent twice
+ *   crypto     the per-packet cost of MqttProtocol::SendAudio on the loopback, and of the encrypt and
+ *              decrypt passes against the copies they replaced
+ *
+ * In every order case the decoder must see each packet that was sent exactly once, in sequence,
+ * with its payload intact. One JSON object per case is printed to stdout. The exit status is
+ * non-zero when a case fails.
+ */
+#include <algorithm>
+#include <arpa/inet.h>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <mutex>
+#include <netinet/in.h>
+#include <string>
+#include <sys/socket.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+#include "mqtt_protocol.h"
+#include "audio_packet_pool.h"
+#include "settings.h"
+#include "mqtt.h"
+#include "host_corpus.h"
+
+namespace {
+
+const char* kKeyHex = "000102030405060708090a0b0c0d0e0f";
+const char* kNonceHex = "01000000a1b2c3d40000000000000000";
+const int kFrameMs = 60;
+
+int failures = 0;
+
+void Check(bool condition, const char* test, const char* what) {
+    if (!condition) {
+        fprintf(stderr, "%s: %s\n", test, what);
+        failures++;
+    }
+}
+
+int64_t NowNs() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+std::string DecodeHex(const char* hex) {
+    std::string bytes;
+    for (size_t i = 0; hex[i] != 0 && hex[i + 1] != 0; i += 2) {
+        bytes.push_back((char)std::stoi(std::string(hex + i, 2), nullptr, 16));
+    }
+    return bytes;
+}
+
+// The payload of a packet tells its sequence and is long enough to span several AES blocks
+std::vector<uint8_t> MakePayload(uint32_t sequence, size_t size) {
+    std::vector<uint8_t> payload(size);
+    for (size_t i = 0; i < size; i++) {
+        payload[i] = (uint8_t)(sequence * 31 + i);
+    }
+    return payload;
+}
+
+class UdpServer {
+public:
+    UdpServer() {
+        aes_nonce_ = DecodeHex(kNonceHex);
+        mbedtls_aes_init(&aes_);
+        mbedtls_aes_setkey_enc(&aes_, (const unsigned char*)DecodeHex(kKeyHex).data(), 128);
+        fd_ = socket(AF_INET, SOCK_DGRAM, 0);
+        sockaddr_in address = {};
+        address.sin_family = AF_INET;
+        address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        bind(fd_, (sockaddr*)&address, sizeof(address));
+        socklen_t length = sizeof(address);
+        getsockname(fd_, (sockaddr*)&address, &length);
+        port_ = ntohs(address.sin_port);
+        timeval timeout = {1, 0};
+        setsockopt(fd_, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    }
+    ~UdpServer() { close(fd_); }
+
+    int port() const { return port_; }
+
+    // The first uplink packet gives the device address, its payload is returned decrypted
+    bool ReceiveUplink(std::vector<uint8_t>& payload, uint32_t& timestamp) {
+        char buffer[1500];
+        socklen_t length = sizeof(device_);
+        ssize_t size = recvfrom(fd_, buffer, sizeof(buffer), 0, (sockaddr*)&device_, &length);
+        if (size < MQTT_UDP_NONCE_SIZE) {
+            return false;
+        }
+        timestamp = ntohl(*(uint32_t*)&buffer[8]);
+        payload.resize(size - MQTT_UDP_NONCE_SIZE);
+        Crypt((const uint8_t*)buffer, (const uint8_t*)buffer + MQTT_UDP_NONCE_SIZE, payload.size(), payload.data());
+        return ntohs(*(uint16_t*)&buffer[2]) == payload.size();
+    }
+
+    void SendDownlink(uint32_t sequence, size_t size) {
+        auto payload = MakePayload(sequence, size);
+        std::string datagram(MQTT_UDP_NONCE_SIZE + size, 0);
+        auto header = (uint8_t*)&datagram[0];
+        memcpy(header, aes_nonce_.data(), MQTT_UDP_NONCE_SIZE);
+        *(uint16_t*)&header[2] = htons(size);
+        *(uint32_t*)&header[8] = htonl(sequence * kFrameMs);
+        *(uint32_t*)&header[12] = htonl(sequence);
+        Crypt(header, payload.data(), size, header + MQTT_UDP_NONCE_SIZE);
+        sendto(fd_, datagram.data(), datagram.size(), 0, (sockaddr*)&device_, sizeof(device_));
+    }
+
+    // Empties the socket, the device may have sent more than the first packet
+    void Drain() {
+        char buffer[1500];
+        while (recv(fd_, buffer, sizeof(buffer), MSG_DONTWAIT) > 0) {
+        }
+    }
+
+private:
+    int fd_;
+    int port_;
+    sockaddr_in device_ = {};
+    std::string aes_nonce_;
+    mbedtls_aes_context aes_;
+
+    void Crypt(const uint8_t* header, const uint8_t* input, size_t size, uint8_t* output) {
+        uint8_t counter[MQTT_UDP_NONCE_SIZE];
+        memcpy(counter, header, MQTT_UDP_NONCE_SIZE);
+        size_t nc_off = 0;
+        uint8_t stream_block[16] = {0};
+        mbedtls_aes_crypt_ctr(&aes_, size, &nc_off, counter, stream_block, input, output);
+    }
+};
+
+struct Received {
+    std::mutex mutex;
+    std::vector<uint32_t> sequences;
+    int corrupted = 0;
+};
+
+// Opens the channel, checks one uplink packet and leaves the server ready to send downlink
+bool OpenChannel(MqttProtocol& protocol, UdpServer& server, const char* test) {
+    if (!protocol.OpenAudioChannel()) {
+        Check(false, test, "the audio channel did not open");
+        return false;
+    }
+    auto packet = std::make_unique<AudioStreamPacket>();
+    packet->timestamp = 4242;
+    packet->payload = MakePayload(7, 120);
+    protocol.SendAudio(std::move(packet));
+    std::vector<uint8_t> payload;
+    uint32_t timestamp = 0;
+    bool received = server.ReceiveUplink(payload, timestamp);
+    Check(received && timestamp == 4242 && payload == MakePayload(7, 120), test, "the uplink packet did not decrypt");
+    return received;
+}
+
+void RunOrder(MqttProtocol& protocol, UdpServer& server, Received& received, const char* name,
+              const std::vector<uint32_t>& order, std::vector<uint32_t> expected) {
+    {
+        std::lock_guard<std::mutex> lock(received.mutex);
+        received.sequences.clear();
+        received.corrupted = 0;
+    }
+    if (!OpenChannel(protocol, server, name)) {
+        return;
+    }
+    for (auto sequence : order) {
+        server.SendDownlink(sequence, 120 + sequence % 64);
+        std::this_thread::sleep_for(std::chrono::microseconds(200));
+    }
+    // Long enough for the flush timer to give up a gap at the end
+    std::this_thread::sleep_for(std::chrono::milliseconds(MQTT_UDP_REORDER_DEPTH * kFrameMs + 200));
+    protocol.CloseAudioChannel();
+
+    std::sort(expected.begin(), expected.end());
+    expected.erase(std::unique(expected.begin(), expected.end()), expected.end());
+    std::lock_guard<std::mutex> lock(received.mutex);
+    Check(received.sequences == expected, name, "the decoder did not get every packet once and in sequence");
+    Check(received.corrupted == 0, name, "a payload did not decrypt");
+    printf("{\"case\":\"%s\",\"sent\":%zu,\"expected\":%zu,\"delivered\":%zu,\"corrupted\":%d}\n",
+        name, order.size(), expected.size(), received.sequences.size(), received.corrupted);
+}
+
+void TestShuffled(MqttProtocol& protocol, UdpServer& server, Received& received, uint32_t seed) {
+    HostRandom random(seed);
+    std::vector<uint32_t> order;
+    std::vector<uint32_t> expected;
+    const uint32_t kPackets = 200;
+    for (uint32_t block = 1; block <= kPackets; block += MQTT_UDP_REORDER_DEPTH) {
+        std::vector<uint32_t> packets;
+        for (uint32_t sequence = block; sequence < block + MQTT_UDP_REORDER_DEPTH; sequence++) {
+            uint32_t roll = random.Next() % 100;
+            // The first packet always arrives, it starts the stream
+            if (roll < 3 && sequence > 1) {
+                continue;
+            }
+            packets.push_back(sequence);
+            expected.push_back(sequence);
+            if (roll >= 97) {
+                packets.push_back(sequence);
+            }
+        }
+        for (size_t i = packets.size(); i > 1; i--) {
+            std::swap(packets[i - 1], packets[random.Next() % i]);
+        }
+        // The first packet of the stream sets the next expected sequence, so it goes first
+        if (block == 1) {
+            std::iter_swap(packets.begin(), std::find(packets.begin(), packets.end(), 1u));
+        }
+        order.insert(order.end(), packets.begin(), packets.end());
+    }
+    char name[32];
+    snprintf(name, sizeof(name), "shuffled_%u", seed);
+    RunOrder(protocol, server, received, name, order, expected);
+}
+
+// The send path before the datagram buffer: a nonce string and an output string per packet
+bool EncryptCopy(mbedtls_aes_context& aes, const std::string& aes_nonce, uint32_t sequence, AudioStreamPacket& packet,
+                 std::string& datagram) {
+    std::string nonce(aes_nonce);
+    *(uint16_t*)&nonce[2] = htons(packet.size());
+    *(uint32_t*)&nonce[8] = htonl(packet.timestamp);
+    *(uint32_t*)&nonce[12] = htonl(sequence);
+    std::string encrypted;
+    encrypted.resize(aes_nonce.size() + packet.size());
+    memcpy(&encrypted[0], nonce.data(), nonce.size());
+    size_t nc_off = 0;
+    uint8_t stream_block[16] = {0};
+    int ret = mbedtls_aes_crypt_ctr(&aes, packet.size(), &nc_off, (uint8_t*)&nonce[0], stream_block, packet.data(),
+        (uint8_t*)&encrypted[nonce.size()]);
+    datagram = std::move(encrypted);
+    return ret == 0;
+}
+
+// The send path of MqttProtocol::SendAudio
+bool EncryptDirect(mbedtls_aes_context& aes, const std::string& aes_nonce, uint32_t sequence, AudioStreamPacket& packet,
+                   std::string& datagram) {
+    size_t size = packet.size();
+    datagram.resize(MQTT_UDP_NONCE_SIZE + size);
+    auto header = (uint8_t*)&datagram[0];
+    memcpy(header, aes_nonce.data(), MQTT_UDP_NONCE_SIZE);
+    *(uint16_t*)&header[2] = htons(size);
+    *(uint32_t*)&header[8] = htonl(packet.timestamp);
+    *(uint32_t*)&header[12] = htonl(sequence);
+    uint8_t counter[MQTT_UDP_NONCE_SIZE];
+    memcpy(counter, header, MQTT_UDP_NONCE_SIZE);
+    size_t nc_off = 0;
+    uint8_t stream_block[16] = {0};
+    return mbedtls_aes_crypt_ctr(&aes, size, &nc_off, counter, stream_block, packet.data(), header + MQTT_UDP_NONCE_SIZE) == 0;
+}
+
+// The receive path with a copy into the packet and decryption in place, or straight into the packet
+std::unique_ptr<AudioStreamPacket> Decrypt(mbedtls_aes_context& aes, const std::string& data, bool copy) {
+    size_t payload_size = data.size() - MQTT_UDP_NONCE_SIZE;
+    auto packet = AudioPacketPool::GetInstance().Acquire(payload_size);
+    const uint8_t* input;
+    if (copy) {
+        packet->payload.assign(data.begin() + MQTT_UDP_NONCE_SIZE, data.end());
+        input = packet->payload.data();
+    } else {
+        packet->payload.resize(payload_size);
+        input = (const uint8_t*)data.data() + MQTT_UDP_NONCE_SIZE;
+    }
+    uint8_t counter[MQTT_UDP_NONCE_SIZE];
+    memcpy(counter, data.data(), MQTT_UDP_NONCE_SIZE);
+    size_t nc_off = 0;
+    uint8_t stream_block[16] = {0};
+    mbedtls_aes_crypt_ctr(&aes, payload_size, &nc_off, counter, stream_block, input, packet->payload.data());
+    return packet;
+}
+
+void PrintCrypto(const char* path, size_t size, int64_t elapsed_ns, int packets) {
+    printf("{\"case\":\"crypto\",\"path\":\"%s\",\"payload_bytes\":%zu,\"ns_per_packet\":%.1f}\n",
+        path, size, (double)elapsed_ns / packets);
+}
+
+void BenchmarkCrypto(MqttProtocol& protocol, UdpServer& server, bool quick) {
+    const int kPackets = quick ? 2000 : 50000;
+    mbedtls_aes_context aes;
+    mbedtls_aes_init(&aes);
+    mbedtls_aes_setkey_enc(&aes, (const unsigned char*)DecodeHex(kKeyHex).data(), 128);
+    std::string aes_nonce = DecodeHex(kNonceHex);
+
+    // Opus at 60 ms, and the 60 ms ADPCM frame
+    for (size_t size : {120, 484}) {
+        if (!OpenChannel(protocol, server, "crypto")) {
+            return;
+        }
+        int64_t elapsed_ns = 0;
+        for (int i = 0; i < kPackets; i++) {
+            auto packet = std::make_unique<AudioStreamPacket>();
+            packet->headroom = AUDIO_PACKET_HEADROOM;
+            packet->payload.resize(AUDIO_PACKET_HEADROOM + size, (uint8_t)i);
+            int64_t start = NowNs();
+            protocol.SendAudio(std::move(packet));
+            elapsed_ns += NowNs() - start;
+            // The loopback drops what the server socket cannot hold, keep it empty
+            if (i % 64 == 63) {
+                server.Drain();
+            }
+        }
+        protocol.CloseAudioChannel();
+        server.Drain();
+        PrintCrypto("send_audio", size, elapsed_ns, kPackets);
+
+        AudioStreamPacket packet;
+        packet.headroom = AUDIO_PACKET_HEADROOM;
+        packet.payload.resize(AUDIO_PACKET_HEADROOM + size, 0x5a);
+        std::string datagram;
+        for (bool copy : {true, false}) {
+            int64_t start = NowNs();
+            for (int i = 0; i < kPackets; i++) {
+                copy ? EncryptCopy(aes, aes_nonce, i, packet, datagram) : EncryptDirect(aes, aes_nonce, i, packet, datagram);
+            }
+            PrintCrypto(copy ? "encrypt_copy" : "encrypt", size, NowNs() - start, kPackets);
+        }
+        EncryptDirect(aes, aes_nonce, 1, packet, datagram);
+        for (bool copy : {true, false}) {
+            int64_t start = NowNs();
+            for (int i = 0; i < kPackets; i++) {
+                AudioPacketPool::GetInstance().Release(Decrypt(aes, datagram, copy));
+            }
+            PrintCrypto(copy ? "decrypt_copy" : "decrypt", size, NowNs() - start, kPackets);
+        }
+        auto decrypted = Decrypt(aes, datagram, false);
+        Check(memcmp(decrypted->payload.data(), packet.data(), size) == 0, "crypto", "a payload did not decrypt");
+    }
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    bool quick = argc > 1 && strcmp(argv[1], "--quick") == 0;
+    UdpServer server;
+
+    Settings settings("mqtt", true);
+    settings.SetString("endpoint", "127.0.0.1:1883");
+    settings.SetString("publish_topic", "device-server");
+    auto& broker = GetHostMqttBroker();
+    broker.on_publish = [&server, &broker](const std::string& topic, const std::string& payload) {
+        if (payload.find("\"hello\"") == std::string::npos) {
+            return;
+        }
+        char hello[512];
+        snprintf(hello, sizeof(hello),
+            "{\"type\":\"hello\",\"transport\":\"udp\",\"session_id\":\"host\","
+            "\"audio_params\":{\"format\":\"opus\",\"sample_rate\":16000,\"frame_duration\":%d},"
+            "\"udp\":{\"server\":\"127.0.0.1\",\"port\":%d,\"key\":\"%s\",\"nonce\":\"%s\"}}",
+            kFrameMs, server.port(), kKeyHex, kNonceHex);
+        broker.Send("server-device", hello);
+    };
+
+    Received received;
+    MqttProtocol protocol;
+    protocol.OnIncomingAudio([&received](std::unique_ptr<AudioStreamPacket> packet) {
+        uint32_t sequence = packet->timestamp / kFrameMs;
+        std::lock_guard<std::mutex> lock(received.mutex);
+        received.sequences.push_back(sequence);
+        received.corrupted += packet->payload != MakePayload(sequence, 120 + sequence % 64);
+        AudioPacketPool::GetInstance().Release(std::move(packet));
+    });
+    if (!protocol.Start()) {
+        fprintf(stderr, "cannot connect to the broker\n");
+        return 1;
+    }
+
+    // 3 and 4 swapped, 5 twice, 6 and 7 swapped, 2 replayed, 9 lost, 15 and 16 swapped, 19 lost at the end
+    RunOrder(protocol, server, received, "fixed",
+        {1, 2, 4, 3, 5, 5, 7, 6, 8, 2, 10, 11, 12, 13, 14, 16, 15, 17, 18, 20},
+        {1, 2, 3, 4, 5, 6, 7, 8, 10, 11, 12, 13, 14, 15, 16, 17, 18, 20});
+    // 3 lost with 4 held when the sequence jumps by a million, then 1000001 and 1000002 swapped
+    RunOrder(protocol, server, received, "jump",
+        {1, 2, 4, 1000000, 1000002, 1000001, 1000003, 1000004},
+        {1, 2, 4, 1000000, 1000001, 1000002, 1000003, 1000004});
+    for (uint32_t seed : {3, 5, 8, 13}) {
+        TestShuffled(protocol, server, received, seed);
+    }
+    BenchmarkCrypto(protocol, server, quick);
+    return failures == 0 ? 0 : 1;
+}
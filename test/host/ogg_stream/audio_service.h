@@ -0,0 +1,118 @@
+#ifndef HOST_OGG_STREAM_AUDIO_SERVICE_H
+#define HOST_OGG_STREAM_AUDIO_SERVICE_H
+
+/*
+ * Stand-in for the decode queue side of AudioService that OggStreamPlayer talks to. The queue is
+ * bounded and drained by a playback thread faster than real time, the wait and the generation check
+ * of PushPacketToDecodeQueue follow main/audio/audio_service.cc. Every packet that lands is counted,
+ * also per generation, so a test can see packets that landed after a reset.
+ */
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+#include "protocol.h"
+#include "ogg_opus_demuxer.h"
+
+#define HOST_DECODE_QUEUE_PACKETS 4
+
+class AudioService {
+public:
+    explicit AudioService(int speedup) : speedup_(speedup) {
+        playback_thread_ = std::thread([this]() { PlaybackThread(); });
+    }
+    ~AudioService() {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stopped_ = true;
+            cv_.notify_all();
+        }
+        playback_thread_.join();
+    }
+
+    bool PushPacketToDecodeQueue(std::unique_ptr<AudioStreamPacket> packet, bool wait = false, uint32_t generation = 0) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        auto cancelled = [this, generation]() {
+            return (generation != 0 && generation != generation_) || stopped_;
+        };
+        if (wait) {
+            cv_.wait(lock, [this, &cancelled]() { return queue_.size() < HOST_DECODE_QUEUE_PACKETS || cancelled(); });
+        }
+        if (cancelled() || queue_.size() >= HOST_DECODE_QUEUE_PACKETS) {
+            cancelled_pushes_++;
+            return false;
+        }
+        queue_.push_back(std::move(packet));
+        accepted_++;
+        accepted_since_reset_++;
+        cv_.notify_all();
+        return true;
+    }
+
+    uint32_t GetDownlinkGeneration() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return generation_;
+    }
+
+    void ResetDecoder() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (++generation_ == 0) {
+            generation_ = 1;
+        }
+        queue_.clear();
+        accepted_since_reset_ = 0;
+        cv_.notify_all();
+    }
+
+    int accepted() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return accepted_;
+    }
+    int accepted_since_reset() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return accepted_since_reset_;
+    }
+    int cancelled_pushes() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return cancelled_pushes_;
+    }
+    void ResetCounters() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        accepted_ = 0;
+        accepted_since_reset_ = 0;
+        cancelled_pushes_ = 0;
+    }
+
+private:
+    const int speedup_;
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    std::deque<std::unique_ptr<AudioStreamPacket>> queue_;
+    uint32_t generation_ = 1;
+    bool stopped_ = false;
+    int accepted_ = 0;
+    int accepted_since_reset_ = 0;
+    int cancelled_pushes_ = 0;
+    std::thread playback_thread_;
+
+    void PlaybackThread() {
+        std::unique_lock<std::mutex> lock(mutex_);
+        while (true) {
+            cv_.wait(lock, [this]() { return stopped_ || !queue_.empty(); });
+            if (stopped_) {
+                return;
+            }
+            auto packet = std::move(queue_.front());
+            queue_.pop_front();
+            cv_.notify_all();
+            int duration_us = OggOpusDemuxer::GetPacketDurationUs(packet->payload.data(), packet->payload.size());
+            lock.unlock();
+            std::this_thread::sleep_for(std::chrono::microseconds(duration_us / speedup_));
+            lock.lock();
+        }
+    }
+};
+
+#endif
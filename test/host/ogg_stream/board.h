@@ -0,0 +1,84 @@
+#ifndef HOST_OGG_STREAM_BOARD_H
+#define HOST_OGG_STREAM_BOARD_H
+
+/*
+ * Stand-in for the board network of OggStreamPlayer: every Http serves the same body from memory,
+ * honours Range when asked to, and can break the connection once at a given offset.
+ */
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+struct HostHttpServer {
+    std::vector<char> body;
+    bool range_supported = true;
+    // The first read at or past this offset fails, -1 never
+    std::atomic<long> fail_at = -1;
+    // Time per read, the download is paced like a network
+    int read_delay_us = 100;
+    std::atomic<int> opens = 0;
+};
+
+inline HostHttpServer& GetHostHttpServer() {
+    static HostHttpServer server;
+    return server;
+}
+
+class Http {
+public:
+    void SetHeader(const std::string& key, const std::string& value) {
+        if (key == "Range" && GetHostHttpServer().range_supported) {
+            range_ = std::stoul(value.substr(strlen("bytes=")));
+        }
+    }
+    bool Open(const std::string& method, const std::string& url) {
+        GetHostHttpServer().opens++;
+        position_ = range_;
+        status_ = range_ > 0 ? 206 : 200;
+        return true;
+    }
+    int GetStatusCode() { return status_; }
+    size_t GetBodyLength() { return GetHostHttpServer().body.size() - position_; }
+    int Read(char* buffer, size_t size) {
+        auto& server = GetHostHttpServer();
+        std::this_thread::sleep_for(std::chrono::microseconds(server.read_delay_us));
+        long fail_at = server.fail_at;
+        if (fail_at >= 0 && (long)position_ >= fail_at && server.fail_at.compare_exchange_strong(fail_at, -1)) {
+            return -1;
+        }
+        size = std::min(size, server.body.size() - position_);
+        memcpy(buffer, server.body.data() + position_, size);
+        position_ += size;
+        return (int)size;
+    }
+    void Close() {}
+
+private:
+    size_t range_ = 0;
+    size_t position_ = 0;
+    int status_ = 0;
+};
+
+class NetworkInterface {
+public:
+    std::unique_ptr<Http> CreateHttp(int connect_id) { return std::make_unique<Http>(); }
+};
+
+class Board {
+public:
+    static Board& GetInstance() {
+        static Board board;
+        return board;
+    }
+    NetworkInterface* GetNetwork() { return &network_; }
+
+private:
+    NetworkInterface network_;
+};
+
+#endif
@@ -0,0 +1,197 @@
+/*
+ * OggStreamPlayer against a file-backed HTTP stand-in (ogg_stream/board.h) and a decode queue
+ * stand-in (ogg_stream/audio_service.h) that plays SPEEDUP times faster than real time. The body
+ * is the Ogg files given on the command line, chained into one stream.
+ *
+ *   full          the whole stream plays, with one broken connection resumed by a Range request
+ *   no_range      the same against a server that ignores Range, the played bytes are skipped
+ *   stop          Stop at random points, no packet of the stopped stream lands after the reset
+ *   pause         SetPaused(true) at random points, nothing lands while paused, then it plays on
+ *   resync        the demuxer alone on the stream with "Og" in front of every page after the first, fed
+ *                 whole and in 7 byte chunks, the next page is found within the bytes taken as header
+ *
+ * One JSON object per case is printed to stdout. The exit status is non-zero when a case fails.
+ */
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <thread>
+#include <unistd.h>
+
+#include "board.h"
+#include "audio_service.h"
+#include "ogg_opus_demuxer.h"
+#include "ogg_stream_player.h"
+#include "host_corpus.h"
+
+namespace {
+
+const int kSpeedup = 50;
+const int kRaceRounds = 20;
+
+int failures = 0;
+
+void Check(bool condition, const char* test, const char* what) {
+    if (!condition) {
+        fprintf(stderr, "%s: %s\n", test, what);
+        failures++;
+    }
+}
+
+void Sleep(int ms) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(ms));
+}
+
+// Packets the player queues, the demuxer output without the headers
+int CountAudioPackets(const std::vector<char>& body, size_t chunk = SIZE_MAX, uint32_t* lost_syncs = nullptr) {
+    int packets = 0;
+    OggOpusDemuxer demuxer;
+    for (size_t offset = 0; offset < body.size(); offset += chunk) {
+        size_t size = std::min(chunk, body.size() - offset);
+        demuxer.Feed((const uint8_t*)body.data() + offset, size, [&packets](std::unique_ptr<AudioStreamPacket> packet) {
+            packets += OggOpusDemuxer::GetPacketDurationUs(packet->payload.data(), packet->payload.size()) > 0;
+            return true;
+        });
+    }
+    if (lost_syncs != nullptr) {
+        *lost_syncs = demuxer.lost_syncs();
+    }
+    return packets;
+}
+
+// The body with a cut capture pattern in front of every page but the first, returns the pages changed
+int PrefixPages(const std::vector<char>& body, std::vector<char>& damaged) {
+    int pages = 0;
+    size_t offset = 0;
+    while (offset + OGG_PAGE_HEADER_SIZE <= body.size()) {
+        size_t segments = (uint8_t)body[offset + 26];
+        size_t length = OGG_PAGE_HEADER_SIZE + segments;
+        for (size_t i = 0; i < segments && offset + OGG_PAGE_HEADER_SIZE + i < body.size(); i++) {
+            length += (uint8_t)body[offset + OGG_PAGE_HEADER_SIZE + i];
+        }
+        if (offset > 0) {
+            damaged.push_back('O');
+            damaged.push_back('g');
+            pages++;
+        }
+        size_t end = std::min(offset + length, body.size());
+        damaged.insert(damaged.end(), body.begin() + offset, body.begin() + end);
+        offset = end;
+    }
+    return pages;
+}
+
+void TestResync(const std::vector<char>& body, int expected) {
+    const char* name = "resync";
+    std::vector<char> damaged;
+    int pages = PrefixPages(body, damaged);
+    for (size_t chunk : {SIZE_MAX, (size_t)7}) {
+        uint32_t lost_syncs = 0;
+        int packets = CountAudioPackets(damaged, chunk, &lost_syncs);
+        Check(packets == expected, name, "packets were lost with the page after a broken header");
+        Check(lost_syncs == (uint32_t)pages, name, "the sync was not lost once per broken header");
+        printf("{\"case\":\"%s\",\"chunk\":%d,\"broken_headers\":%d,\"expected_packets\":%d,\"packets\":%d,"
+            "\"lost_syncs\":%u}\n", name, chunk == SIZE_MAX ? 0 : (int)chunk, pages, expected, packets, lost_syncs);
+    }
+}
+
+bool WaitUntilStopped(OggStreamPlayer& player, int timeout_ms) {
+    for (int waited = 0; player.IsActive(); waited += 5) {
+        if (waited >= timeout_ms) {
+            return false;
+        }
+        Sleep(5);
+    }
+    return true;
+}
+
+void TestFullStream(OggStreamPlayer& player, AudioService& audio_service, const char* name, bool range_supported,
+                    int expected) {
+    auto& server = GetHostHttpServer();
+    server.range_supported = range_supported;
+    server.fail_at = (long)server.body.size() / 2;
+    server.opens = 0;
+    audio_service.ResetCounters();
+
+    player.Play("http://host/stream.ogg");
+    bool finished = WaitUntilStopped(player, 30000);
+    Check(finished, name, "the stream did not finish");
+    Check(audio_service.accepted() == expected, name, "not every packet was played exactly once");
+    Check(server.opens == 2, name, "the broken connection was not resumed once");
+    printf("{\"case\":\"%s\",\"expected_packets\":%d,\"played_packets\":%d,\"connections\":%d}\n",
+        name, expected, audio_service.accepted(), server.opens.load());
+    server.range_supported = true;
+}
+
+void TestStopAndPause(OggStreamPlayer& player, AudioService& audio_service, bool pause) {
+    const char* name = pause ? "pause" : "stop";
+    auto& server = GetHostHttpServer();
+    server.fail_at = -1;
+    HostRandom random(pause ? 17 : 11);
+    int late_packets = 0;
+    int cancelled = 0;
+    int resumed = 0;
+
+    for (int round = 0; round < kRaceRounds; round++) {
+        audio_service.ResetCounters();
+        player.Play("http://host/stream.ogg");
+        // Past the prebuffer, so the feeder is pushing and usually waits in the full decode queue
+        Sleep(OGG_STREAM_PREBUFFER_MS / kSpeedup + 20 + random.Next() % 40);
+        if (pause) {
+            player.SetPaused(true);
+        } else {
+            player.Stop();
+        }
+        // What still lands was pushed before the pause or stop, and is older than its reset
+        Sleep(50);
+        late_packets += audio_service.accepted_since_reset();
+        cancelled += audio_service.cancelled_pushes();
+        if (pause) {
+            player.SetPaused(false);
+            resumed += WaitUntilStopped(player, 30000);
+        } else {
+            Check(!player.IsActive(), name, "the player is still active after Stop");
+        }
+    }
+    Check(late_packets == 0, name, "packets landed after the decoder reset");
+    if (pause) {
+        Check(resumed == kRaceRounds, name, "the stream did not play on after the pause");
+    }
+    printf("{\"case\":\"%s\",\"rounds\":%d,\"late_packets\":%d,\"cancelled_pushes\":%d}\n",
+        name, kRaceRounds, late_packets, cancelled);
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    if (argc < 2) {
+        fprintf(stderr, "usage: %s <file.ogg>...\n", argv[0]);
+        return 2;
+    }
+    auto& server = GetHostHttpServer();
+    for (int i = 1; i < argc; i++) {
+        std::ifstream file(argv[i], std::ios::binary);
+        if (!file) {
+            fprintf(stderr, "cannot read %s\n", argv[i]);
+            return 2;
+        }
+        server.body.insert(server.body.end(), std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+    }
+    int expected = CountAudioPackets(server.body);
+
+    // Both live as long as the process, like on the device, the player tasks never exit
+    static AudioService audio_service(kSpeedup);
+    static OggStreamPlayer player(audio_service);
+    player.SetPaused(false);
+    TestFullStream(player, audio_service, "full", true, expected);
+    TestFullStream(player, audio_service, "no_range", false, expected);
+    TestStopAndPause(player, audio_service, false);
+    TestStopAndPause(player, audio_service, true);
+    TestResync(server.body, expected);
+    fflush(stdout);
+    _exit(failures == 0 ? 0 : 1);
+}
@@ -0,0 +1,71 @@
+#ifndef HOST_PROTOCOL_APPLICATION_H
+#define HOST_PROTOCOL_APPLICATION_H
+
+/*
+ * The parts of the Application the protocols use: the device state, always idle here, and the main
+ * loop. Schedule runs a callback on one thread, in order. The thread lives as long as the process
+ * and is never joined.
+ */
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+
+#include "device_state.h"
+
+// From audio_service.h, which the real header includes
+#define OPUS_FRAME_DURATION_MS 60
+
+class Application {
+public:
+    static Application& GetInstance() {
+        static Application* instance = new Application();
+        return *instance;
+    }
+
+    DeviceState GetDeviceState() const { return kDeviceStateIdle; }
+
+    void Schedule(std::function<void()> callback) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        tasks_.push_back(std::move(callback));
+        cv_.notify_all();
+    }
+
+    // Returns once every callback scheduled before the call has run
+    void WaitForScheduled() {
+        std::mutex done_mutex;
+        std::condition_variable done_cv;
+        bool done = false;
+        Schedule([&]() {
+            std::lock_guard<std::mutex> lock(done_mutex);
+            done = true;
+            done_cv.notify_all();
+        });
+        std::unique_lock<std::mutex> lock(done_mutex);
+        done_cv.wait(lock, [&done]() { return done; });
+    }
+
+private:
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    std::deque<std::function<void()>> tasks_;
+
+    Application() {
+        std::thread([this]() { MainLoop(); }).detach();
+    }
+
+    void MainLoop() {
+        std::unique_lock<std::mutex> lock(mutex_);
+        while (true) {
+            cv_.wait(lock, [this]() { return !tasks_.empty(); });
+            auto task = std::move(tasks_.front());
+            tasks_.pop_front();
+            lock.unlock();
+            task();
+            lock.lock();
+        }
+    }
+};
+
+#endif
@@ -0,0 +1,14 @@
+#ifndef HOST_PROTOCOL_LANG_CONFIG_H
+#define HOST_PROTOCOL_LANG_CONFIG_H
+
+// The generated header has every string of the locale, the protocols only show these
+namespace Lang {
+namespace Strings {
+constexpr const char* SERVER_ERROR = "SERVER_ERROR";
+constexpr const char* SERVER_NOT_CONNECTED = "SERVER_NOT_CONNECTED";
+constexpr const char* SERVER_NOT_FOUND = "SERVER_NOT_FOUND";
+constexpr const char* SERVER_TIMEOUT = "SERVER_TIMEOUT";
+} // namespace Strings
+} // namespace Lang
+
+#endif
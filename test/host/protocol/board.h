@@ -0,0 +1,42 @@
+#ifndef HOST_PROTOCOL_BOARD_H
+#define HOST_PROTOCOL_BOARD_H
+
+/*
+ * Stand-in for the board as the protocols see it: a network that creates the transports of
+ * web_socket.h, udp.h and mqtt.h, and an audio codec that only reports its output rate.
+ */
+#include <memory>
+#include <string>
+
+#include "mqtt.h"
+#include "udp.h"
+#include "web_socket.h"
+
+class AudioCodec {
+public:
+    int output_sample_rate() const { return 24000; }
+};
+
+class NetworkInterface {
+public:
+    std::unique_ptr<WebSocket> CreateWebSocket(int connect_id) { return std::make_unique<WebSocket>(); }
+    std::unique_ptr<Udp> CreateUdp(int connect_id) { return std::make_unique<Udp>(); }
+    std::unique_ptr<Mqtt> CreateMqtt(int connect_id) { return std::make_unique<Mqtt>(); }
+};
+
+class Board {
+public:
+    static Board& GetInstance() {
+        static Board board;
+        return board;
+    }
+    NetworkInterface* GetNetwork() { return &network_; }
+    AudioCodec* GetAudioCodec() { return &codec_; }
+    std::string GetUuid() { return "00000000-0000-4000-8000-000000000001"; }
+
+private:
+    NetworkInterface network_;
+    AudioCodec codec_;
+};
+
+#endif
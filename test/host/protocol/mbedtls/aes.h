@@ -0,0 +1,47 @@
+#ifndef HOST_PROTOCOL_MBEDTLS_AES_H
+#define HOST_PROTOCOL_MBEDTLS_AES_H
+
+/*
+ * The AES calls of mbedtls the protocols make, on the AES block cipher of OpenSSL. The CTR mode
+ * follows mbedtls_aes_crypt_ctr: the counter block is big-endian and advanced in place, nc_off and
+ * stream_block carry a partial block over to the next call.
+ */
+#define OPENSSL_SUPPRESS_DEPRECATED
+#include <openssl/aes.h>
+#include <cstddef>
+
+typedef struct {
+    AES_KEY key;
+} mbedtls_aes_context;
+
+inline void mbedtls_aes_init(mbedtls_aes_context* ctx) {}
+inline void mbedtls_aes_free(mbedtls_aes_context* ctx) {}
+
+inline int mbedtls_aes_setkey_enc(mbedtls_aes_context* ctx, const unsigned char* key, unsigned int keybits) {
+    return AES_set_encrypt_key(key, keybits, &ctx->key) == 0 ? 0 : -0x0020;
+}
+
+inline int mbedtls_aes_crypt_ctr(mbedtls_aes_context* ctx, size_t length, size_t* nc_off,
+                                 unsigned char nonce_counter[16], unsigned char stream_block[16],
+                                 const unsigned char* input, unsigned char* output) {
+    size_t n = *nc_off;
+    if (n > 0x0f) {
+        return -0x0021;
+    }
+    while (length--) {
+        if (n == 0) {
+            AES_encrypt(nonce_counter, stream_block, &ctx->key);
+            for (int i = 16; i > 0; i--) {
+                if (++nonce_counter[i - 1] != 0) {
+                    break;
+                }
+            }
+        }
+        *output++ = *input++ ^ stream_block[n];
+        n = (n + 1) & 0x0f;
+    }
+    *nc_off = n;
+    return 0;
+}
+
+#endif
@@ -0,0 +1,77 @@
+#ifndef HOST_PROTOCOL_MQTT_H
+#define HOST_PROTOCOL_MQTT_H
+
+/*
+ * Stand-in for the Mqtt client of the network component, connected to an in-process broker. What
+ * the device publishes goes to the broker's on_publish, the broker's Send reaches the OnMessage of
+ * the connected client. Both are called on the thread of the caller.
+ */
+#include <functional>
+#include <mutex>
+#include <string>
+
+class Mqtt;
+
+struct HostMqttBroker {
+    std::function<void(const std::string& topic, const std::string& payload)> on_publish;
+    Mqtt* client = nullptr;
+
+    void Send(const std::string& topic, const std::string& payload);
+};
+
+inline HostMqttBroker& GetHostMqttBroker() {
+    static HostMqttBroker broker;
+    return broker;
+}
+
+class Mqtt {
+public:
+    ~Mqtt() {
+        auto& broker = GetHostMqttBroker();
+        if (broker.client == this) {
+            broker.client = nullptr;
+        }
+    }
+
+    void SetKeepAlive(int seconds) {}
+    bool Connect(const std::string& broker_address, int broker_port, const std::string& client_id,
+                 const std::string& username, const std::string& password) {
+        GetHostMqttBroker().client = this;
+        connected_ = true;
+        if (on_connected_) {
+            on_connected_();
+        }
+        return true;
+    }
+    bool IsConnected() { return connected_; }
+    bool Publish(const std::string& topic, const std::string& payload, int qos = 0) {
+        auto& broker = GetHostMqttBroker();
+        if (!connected_ || !broker.on_publish) {
+            return false;
+        }
+        broker.on_publish(topic, payload);
+        return true;
+    }
+    bool Subscribe(const std::string& topic, int qos = 0) { return true; }
+
+    void OnConnected(std::function<void()> callback) { on_connected_ = callback; }
+    void OnDisconnected(std::function<void()> callback) { on_disconnected_ = callback; }
+    void OnMessage(std::function<void(const std::string& topic, const std::string& payload)> callback) {
+        on_message_ = callback;
+    }
+
+private:
+    friend struct HostMqttBroker;
+    bool connected_ = false;
+    std::function<void()> on_connected_;
+    std::function<void()> on_disconnected_;
+    std::function<void(const std::string& topic, const std::string& payload)> on_message_;
+};
+
+inline void HostMqttBroker::Send(const std::string& topic, const std::string& payload) {
+    if (client != nullptr && client->on_message_) {
+        client->on_message_(topic, payload);
+    }
+}
+
+#endif
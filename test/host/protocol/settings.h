@@ -0,0 +1,66 @@
+#ifndef HOST_PROTOCOL_SETTINGS_H
+#define HOST_PROTOCOL_SETTINGS_H
+
+/*
+ * Settings kept in memory for the process, every namespace starts empty. A test writes what the
+ * protocol reads (url, version, ...) before it opens a channel.
+ */
+#include <map>
+#include <mutex>
+#include <string>
+
+class Settings {
+public:
+    Settings(const std::string& ns, bool read_write = false) : ns_(ns) {}
+
+    std::string GetString(const std::string& key, const std::string& default_value = "") {
+        std::string value;
+        return Find(key, value) ? value : default_value;
+    }
+    void SetString(const std::string& key, const std::string& value) {
+        std::lock_guard<std::mutex> lock(Mutex());
+        Store()[ns_][key] = value;
+    }
+    int32_t GetInt(const std::string& key, int32_t default_value = 0) {
+        std::string value;
+        return Find(key, value) ? std::stoi(value) : default_value;
+    }
+    void SetInt(const std::string& key, int32_t value) { SetString(key, std::to_string(value)); }
+    bool GetBool(const std::string& key, bool default_value = false) {
+        std::string value;
+        return Find(key, value) ? value == "1" : default_value;
+    }
+    void SetBool(const std::string& key, bool value) { SetString(key, value ? "1" : "0"); }
+    void EraseKey(const std::string& key) {
+        std::lock_guard<std::mutex> lock(Mutex());
+        Store()[ns_].erase(key);
+    }
+    void EraseAll() {
+        std::lock_guard<std::mutex> lock(Mutex());
+        Store()[ns_].clear();
+    }
+
+private:
+    std::string ns_;
+
+    static std::map<std::string, std::map<std::string, std::string>>& Store() {
+        static std::map<std::string, std::map<std::string, std::string>> store;
+        return store;
+    }
+    static std::mutex& Mutex() {
+        static std::mutex mutex;
+        return mutex;
+    }
+    bool Find(const std::string& key, std::string& value) {
+        std::lock_guard<std::mutex> lock(Mutex());
+        auto& keys = Store()[ns_];
+        auto it = keys.find(key);
+        if (it == keys.end()) {
+            return false;
+        }
+        value = it->second;
+        return true;
+    }
+};
+
+#endif
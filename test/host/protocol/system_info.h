@@ -0,0 +1,11 @@
+#ifndef HOST_PROTOCOL_SYSTEM_INFO_H
+#define HOST_PROTOCOL_SYSTEM_INFO_H
+
+#include <string>
+
+class SystemInfo {
+public:
+    static std::string GetMacAddress() { return "02:00:00:00:00:01"; }
+};
+
+#endif
@@ -0,0 +1,90 @@
+#ifndef HOST_PROTOCOL_UDP_H
+#define HOST_PROTOCOL_UDP_H
+
+/*
+ * Stand-in for the Udp of the network component on a real socket, so the datagrams go through the
+ * loopback of the host. Received datagrams are handed to OnMessage on a thread of the Udp, like the
+ * receive task on the device.
+ */
+#include <arpa/inet.h>
+#include <atomic>
+#include <functional>
+#include <mutex>
+#include <netinet/in.h>
+#include <poll.h>
+#include <string>
+#include <sys/socket.h>
+#include <thread>
+#include <unistd.h>
+
+class Udp {
+public:
+    ~Udp() { Disconnect(); }
+
+    bool Connect(const std::string& host, int port) {
+        sockaddr_in address = {};
+        address.sin_family = AF_INET;
+        address.sin_port = htons(port);
+        if (inet_pton(AF_INET, host.c_str(), &address.sin_addr) != 1) {
+            return false;
+        }
+        fd_ = socket(AF_INET, SOCK_DGRAM, 0);
+        if (fd_ < 0 || connect(fd_, (sockaddr*)&address, sizeof(address)) != 0) {
+            return false;
+        }
+        running_ = true;
+        receive_thread_ = std::thread([this]() { ReceiveLoop(); });
+        return true;
+    }
+
+    void Disconnect() {
+        running_ = false;
+        if (receive_thread_.joinable()) {
+            receive_thread_.join();
+        }
+        if (fd_ >= 0) {
+            close(fd_);
+            fd_ = -1;
+        }
+    }
+
+    int Send(const std::string& data) {
+        return fd_ >= 0 ? (int)send(fd_, data.data(), data.size(), 0) : -1;
+    }
+
+    void OnMessage(std::function<void(const std::string& data)> callback) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        on_message_ = callback;
+    }
+
+private:
+    int fd_ = -1;
+    std::atomic<bool> running_ = false;
+    std::thread receive_thread_;
+    std::mutex mutex_;
+    std::function<void(const std::string& data)> on_message_;
+
+    void ReceiveLoop() {
+        char buffer[1500];
+        while (running_) {
+            pollfd fd = {fd_, POLLIN, 0};
+            if (poll(&fd, 1, 20) <= 0) {
+                continue;
+            }
+            ssize_t size = recv(fd_, buffer, sizeof(buffer), 0);
+            if (size < 0) {
+                continue;
+            }
+            std::function<void(const std::string& data)> on_message;
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                on_message = on_message_;
+            }
+            if (on_message) {
+                on_message(std::string(buffer, size));
+            }
+        }
+    }
+};
+
+#endif
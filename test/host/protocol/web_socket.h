@@ -0,0 +1,218 @@
+#ifndef HOST_PROTOCOL_WEB_SOCKET_H
+#define HOST_PROTOCOL_WEB_SOCKET_H
+
+/*
+ * In-process stand-in for the WebSocket of the network component. The other end is a
+ * HostWebSocketServer. Frames in both directions go through one delay line and arrive one_way_us
+ * after they were sent, in order. With no delay they are handed over inside Send. Connect takes
+ * connect_us, the time DNS, TCP and the TLS handshake would take.
+ */
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include <esp_timer.h>
+
+class HostWebSocketSession;
+
+class HostWebSocketServer {
+public:
+    virtual ~HostWebSocketServer() = default;
+    virtual void OnConnect(std::shared_ptr<HostWebSocketSession> session) {}
+    // A frame from the device, after the link delay
+    virtual void OnFrame(std::shared_ptr<HostWebSocketSession> session, const char* data, size_t len, bool binary) = 0;
+};
+
+struct HostWebSocketLink {
+    int64_t connect_us = 0;
+    int64_t one_way_us = 0;
+    HostWebSocketServer* server = nullptr;
+    std::atomic<int> connects = 0;
+};
+
+inline HostWebSocketLink& GetHostWebSocketLink() {
+    static HostWebSocketLink link;
+    return link;
+}
+
+// Runs each delivery at its time, in the order they were sent. The thread is never joined.
+class HostDelayLine {
+public:
+    static HostDelayLine& GetInstance() {
+        static HostDelayLine* instance = new HostDelayLine();
+        return *instance;
+    }
+
+    void Post(int64_t delay_us, std::function<void()> delivery) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        queue_.push_back({esp_timer_get_time() + delay_us, std::move(delivery)});
+        cv_.notify_all();
+    }
+
+private:
+    struct Delivery {
+        int64_t due_us;
+        std::function<void()> run;
+    };
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    std::deque<Delivery> queue_;
+
+    HostDelayLine() {
+        std::thread([this]() { Run(); }).detach();
+    }
+
+    void Run() {
+        std::unique_lock<std::mutex> lock(mutex_);
+        while (true) {
+            cv_.wait(lock, [this]() { return !queue_.empty(); });
+            int64_t wait_us = queue_.front().due_us - esp_timer_get_time();
+            if (wait_us > 0) {
+                cv_.wait_for(lock, std::chrono::microseconds(wait_us));
+                continue;
+            }
+            auto delivery = std::move(queue_.front().run);
+            queue_.pop_front();
+            lock.unlock();
+            delivery();
+            lock.lock();
+        }
+    }
+};
+
+inline void HostDeliver(std::function<void()> delivery) {
+    int64_t one_way_us = GetHostWebSocketLink().one_way_us;
+    if (one_way_us == 0) {
+        delivery();
+    } else {
+        HostDelayLine::GetInstance().Post(one_way_us, std::move(delivery));
+    }
+}
+
+// Both ends of one connection, it stays valid for deliveries in flight after the device closed it
+class HostWebSocketSession : public std::enable_shared_from_this<HostWebSocketSession> {
+public:
+    std::map<std::string, std::string> headers;
+
+    // Server to device
+    void Send(const std::string& data, bool binary) {
+        auto self = shared_from_this();
+        HostDeliver([self, data, binary]() {
+            std::function<void(const char*, size_t, bool)> on_data;
+            {
+                std::lock_guard<std::mutex> lock(self->mutex_);
+                if (!self->open_) {
+                    return;
+                }
+                on_data = self->on_data_;
+            }
+            if (on_data) {
+                on_data(data.data(), data.size(), binary);
+            }
+        });
+    }
+
+    // The server closes the connection
+    void Close() {
+        std::function<void()> on_disconnected;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (!open_) {
+                return;
+            }
+            open_ = false;
+            on_disconnected = on_disconnected_;
+        }
+        if (on_disconnected) {
+            on_disconnected();
+        }
+    }
+
+    bool open() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return open_;
+    }
+
+private:
+    friend class WebSocket;
+    std::mutex mutex_;
+    bool open_ = false;
+    std::function<void(const char*, size_t, bool)> on_data_;
+    std::function<void()> on_disconnected_;
+};
+
+class WebSocket {
+public:
+    WebSocket() : session_(std::make_shared<HostWebSocketSession>()) {}
+    ~WebSocket() {
+        std::lock_guard<std::mutex> lock(session_->mutex_);
+        session_->open_ = false;
+    }
+
+    void SetHeader(const char* key, const char* value) { session_->headers[key] = value; }
+    void SetReceiveBufferSize(size_t size) {}
+
+    bool IsConnected() const { return session_->open(); }
+
+    bool Connect(const char* uri) {
+        auto& link = GetHostWebSocketLink();
+        if (link.server == nullptr) {
+            return false;
+        }
+        std::this_thread::sleep_for(std::chrono::microseconds(link.connect_us));
+        {
+            std::lock_guard<std::mutex> lock(session_->mutex_);
+            session_->open_ = true;
+        }
+        link.connects++;
+        link.server->OnConnect(session_);
+        return true;
+    }
+
+    bool Send(const std::string& data) { return Send(data.data(), data.size(), false); }
+
+    // The frame is copied only when it waits in the delay line, like into a socket buffer
+    bool Send(const void* data, size_t len, bool binary = false, bool fin = true) {
+        if (!IsConnected()) {
+            return false;
+        }
+        auto server = GetHostWebSocketLink().server;
+        auto session = session_;
+        if (GetHostWebSocketLink().one_way_us == 0) {
+            server->OnFrame(session, (const char*)data, len, binary);
+        } else {
+            std::string frame((const char*)data, len);
+            HostDeliver([server, session, frame, binary]() {
+                server->OnFrame(session, frame.data(), frame.size(), binary);
+            });
+        }
+        return true;
+    }
+
+    void Ping() {}
+    void Close() { session_->Close(); }
+
+    void OnConnected(std::function<void()> callback) {}
+    void OnDisconnected(std::function<void()> callback) {
+        std::lock_guard<std::mutex> lock(session_->mutex_);
+        session_->on_disconnected_ = callback;
+    }
+    void OnData(std::function<void(const char*, size_t, bool)> callback) {
+        std::lock_guard<std::mutex> lock(session_->mutex_);
+        session_->on_data_ = callback;
+    }
+    void OnError(std::function<void(int)> callback) {}
+
+private:
+    std::shared_ptr<HostWebSocketSession> session_;
+};
+
+#endif
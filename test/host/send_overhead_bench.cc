@@ -0,0 +1,201 @@
+/*
+ * Per-packet cost of sending uplink audio in binary protocols 1, 2 and 3. Packets are built like the
+ * encoder builds them, with AUDIO_PACKET_HEADROOM in front of the audio, and every time covers
+ * freeing the packet. Two payload sizes: a 60 ms Opus frame and 60 ms of 16 kHz PCM.
+ *
+ *   send_audio  WebsocketProtocol::SendAudio on an open channel, the stand-in WebSocket of
+ *               protocol/web_socket.h hands each frame to a sink that checks its header
+ *   in_place    only the framing of versions 2 and 3: the header written into the headroom
+ *   copy        the framing before that, a std::string per packet with the header and a copy of
+ *               the audio, for comparison with in_place
+ *
+ * One JSON object per path, version and size is printed to stdout. The exit status is non-zero when
+ * the sink received a malformed frame.
+ */
+#include <arpa/inet.h>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "websocket_protocol.h"
+#include "settings.h"
+#include "web_socket.h"
+
+namespace {
+
+const int kPackets = 1000;
+
+int64_t NowNs() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// Answers the hello and checks every audio frame against the version in use
+class SinkServer : public HostWebSocketServer {
+public:
+    int version = 1;
+    size_t payload_size = 0;
+    long frames = 0;
+    long malformed = 0;
+
+    void OnFrame(std::shared_ptr<HostWebSocketSession> session, const char* data, size_t len, bool binary) override {
+        if (!binary) {
+            if (strstr(data, "\"hello\"") != nullptr) {
+                session->Send("{\"type\":\"hello\",\"transport\":\"websocket\",\"session_id\":\"bench\","
+                    "\"audio_params\":{\"format\":\"opus\",\"sample_rate\":24000,\"frame_duration\":60}}", false);
+            }
+            return;
+        }
+        frames++;
+        bool valid;
+        if (version == 2) {
+            auto bp2 = (const BinaryProtocol2*)data;
+            valid = len == sizeof(BinaryProtocol2) + payload_size && ntohs(bp2->version) == 2 &&
+                ntohl(bp2->payload_size) == payload_size && ntohl(bp2->timestamp) == (uint32_t)frames;
+        } else if (version == 3) {
+            auto bp3 = (const BinaryProtocol3*)data;
+            valid = len == sizeof(BinaryProtocol3) + payload_size && bp3->type == 0 && ntohs(bp3->payload_size) == payload_size;
+        } else {
+            valid = len == payload_size;
+        }
+        malformed += !valid;
+    }
+};
+
+std::vector<std::unique_ptr<AudioStreamPacket>> MakePackets(int count, size_t size, size_t headroom) {
+    std::vector<std::unique_ptr<AudioStreamPacket>> packets;
+    packets.reserve(count);
+    for (int i = 0; i < count; i++) {
+        auto packet = std::make_unique<AudioStreamPacket>();
+        packet->timestamp = i + 1;
+        packet->headroom = headroom;
+        packet->payload.resize(headroom + size);
+        memset(packet->data(), i, size);
+        packets.push_back(std::move(packet));
+    }
+    return packets;
+}
+
+// Where a transport would take the message, kept out of line so the framing is not optimized away
+uint32_t checksum = 0;
+__attribute__((noinline)) bool Transmit(const void* data, size_t size) {
+    checksum += ((const uint8_t*)data)[0] + ((const uint8_t*)data)[size - 1];
+    return true;
+}
+
+struct FramingAccess : Protocol {
+    using Protocol::PrepareAudioHeader;
+};
+
+// The framing of WebsocketProtocol::SendAudio
+bool SendInPlace(int version, std::unique_ptr<AudioStreamPacket> packet) {
+    size_t payload_size = packet->size();
+    if (version == 2) {
+        auto bp2 = (BinaryProtocol2*)FramingAccess::PrepareAudioHeader(*packet, sizeof(BinaryProtocol2));
+        bp2->version = htons(version);
+        bp2->type = 0;
+        bp2->reserved = 0;
+        bp2->timestamp = htonl(packet->timestamp);
+        bp2->payload_size = htonl(payload_size);
+        return Transmit(bp2, sizeof(BinaryProtocol2) + payload_size);
+    } else {
+        auto bp3 = (BinaryProtocol3*)FramingAccess::PrepareAudioHeader(*packet, sizeof(BinaryProtocol3));
+        bp3->type = 0;
+        bp3->reserved = 0;
+        bp3->payload_size = htons(payload_size);
+        return Transmit(bp3, sizeof(BinaryProtocol3) + payload_size);
+    }
+}
+
+// The framing before the header went into the headroom
+bool SendCopy(int version, std::unique_ptr<AudioStreamPacket> packet) {
+    if (version == 2) {
+        std::string serialized;
+        serialized.resize(sizeof(BinaryProtocol2) + packet->payload.size());
+        auto bp2 = (BinaryProtocol2*)serialized.data();
+        bp2->version = htons(version);
+        bp2->type = 0;
+        bp2->reserved = 0;
+        bp2->timestamp = htonl(packet->timestamp);
+        bp2->payload_size = htonl(packet->payload.size());
+        memcpy(bp2->payload, packet->payload.data(), packet->payload.size());
+        return Transmit(serialized.data(), serialized.size());
+    } else {
+        std::string serialized;
+        serialized.resize(sizeof(BinaryProtocol3) + packet->payload.size());
+        auto bp3 = (BinaryProtocol3*)serialized.data();
+        bp3->type = 0;
+        bp3->reserved = 0;
+        bp3->payload_size = htons(packet->payload.size());
+        memcpy(bp3->payload, packet->payload.data(), packet->payload.size());
+        return Transmit(serialized.data(), serialized.size());
+    }
+}
+
+void Print(const char* path, int version, size_t size, int64_t round_ns) {
+    size_t header = version == 2 ? sizeof(BinaryProtocol2) : version == 3 ? sizeof(BinaryProtocol3) : 0;
+    printf("{\"path\":\"%s\",\"version\":%d,\"payload_bytes\":%zu,\"message_bytes\":%zu,\"ns_per_packet\":%.1f}\n",
+        path, version, size, header + size, (double)round_ns / kPackets);
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    bool quick = argc > 1 && strcmp(argv[1], "--quick") == 0;
+    const int kRounds = quick ? 20 : 500;
+
+    SinkServer sink;
+    GetHostWebSocketLink().server = &sink;
+    Settings settings("websocket", true);
+    settings.SetString("url", "ws://host/bench");
+
+    for (size_t size : {120, 1920}) {
+        for (int version : {1, 2, 3}) {
+            settings.SetInt("version", version);
+            sink.version = version;
+            sink.payload_size = size;
+            WebsocketProtocol protocol;
+            if (!protocol.OpenAudioChannel()) {
+                fprintf(stderr, "cannot open the channel for version %d\n", version);
+                return 1;
+            }
+            int64_t elapsed_ns = 0;
+            for (int round = 0; round < kRounds; round++) {
+                sink.frames = 0;
+                auto packets = MakePackets(kPackets, size, AUDIO_PACKET_HEADROOM);
+                int64_t start = NowNs();
+                for (auto& packet : packets) {
+                    protocol.SendAudio(std::move(packet));
+                }
+                elapsed_ns += NowNs() - start;
+            }
+            Print("send_audio", version, size, elapsed_ns / kRounds);
+            protocol.CloseAudioChannel();
+        }
+    }
+
+    for (size_t size : {120, 1920}) {
+        for (int version : {2, 3}) {
+            for (bool copy : {false, true}) {
+                int64_t elapsed_ns = 0;
+                for (int round = 0; round < kRounds; round++) {
+                    auto packets = MakePackets(kPackets, size, copy ? 0 : AUDIO_PACKET_HEADROOM);
+                    int64_t start = NowNs();
+                    for (auto& packet : packets) {
+                        copy ? SendCopy(version, std::move(packet)) : SendInPlace(version, std::move(packet));
+                    }
+                    elapsed_ns += NowNs() - start;
+                }
+                Print(copy ? "copy" : "in_place", version, size, elapsed_ns / kRounds);
+            }
+        }
+    }
+    if (sink.malformed > 0) {
+        fprintf(stderr, "%ld malformed frames\n", sink.malformed);
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,42 @@
+#ifndef HOST_APPLICATION_H
+#define HOST_APPLICATION_H
+
+/*
+ * Only what the acoustic provisioning loop in afsk_demod.cc references (the real header reaches
+ * display.h through board.h). The host tools drive the demodulator classes directly and never
+ * call into the Application.
+ */
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include <freertos/FreeRTOS.h>
+
+#include "device_state.h"
+#include "display.h"
+
+struct AudioInputFormat {
+    int sample_rate = 16000;
+    bool with_reference = false;
+    int frame_samples = 0;
+};
+
+class AudioService {
+public:
+    int AddInputConsumer(const char* name, const AudioInputFormat& format, size_t max_frames) { return 1; }
+    void RemoveInputConsumer(int id) {}
+    bool ReadInputFrame(int id, std::vector<int16_t>& frame, int timeout_ms) { return false; }
+};
+
+class Application {
+public:
+    AudioService& GetAudioService() { return audio_service_; }
+    DeviceState GetDeviceState() const { return kDeviceStateIdle; }
+
+private:
+    AudioService audio_service_;
+};
+
+inline void esp_restart() {}
+
+#endif
@@ -0,0 +1,420 @@
+#include "cJSON.h"
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+static cJSON* NewItem(int type) {
+    auto item = (cJSON*)calloc(1, sizeof(cJSON));
+    item->type = type;
+    return item;
+}
+
+cJSON* cJSON_CreateObject() { return NewItem(cJSON_Object); }
+cJSON* cJSON_CreateArray() { return NewItem(cJSON_Array); }
+
+cJSON* cJSON_CreateString(const char* string) {
+    auto item = NewItem(cJSON_String);
+    item->valuestring = strdup(string);
+    return item;
+}
+
+cJSON* cJSON_CreateNumber(double number) {
+    auto item = NewItem(cJSON_Number);
+    item->valuedouble = number;
+    item->valueint = (int)number;
+    return item;
+}
+
+cJSON* cJSON_CreateBool(bool value) { return NewItem(value ? cJSON_True : cJSON_False); }
+
+void cJSON_AddItemToArray(cJSON* array, cJSON* item) {
+    if (array == nullptr || item == nullptr) {
+        return;
+    }
+    if (array->child == nullptr) {
+        array->child = item;
+        item->prev = item;
+        return;
+    }
+    auto last = array->child->prev;
+    last->next = item;
+    item->prev = last;
+    array->child->prev = item;
+}
+
+void cJSON_AddItemToObject(cJSON* object, const char* name, cJSON* item) {
+    if (item == nullptr) {
+        return;
+    }
+    free(item->string);
+    item->string = strdup(name);
+    cJSON_AddItemToArray(object, item);
+}
+
+cJSON* cJSON_AddStringToObject(cJSON* object, const char* name, const char* string) {
+    auto item = cJSON_CreateString(string);
+    cJSON_AddItemToObject(object, name, item);
+    return item;
+}
+
+cJSON* cJSON_AddNumberToObject(cJSON* object, const char* name, double number) {
+    auto item = cJSON_CreateNumber(number);
+    cJSON_AddItemToObject(object, name, item);
+    return item;
+}
+
+cJSON* cJSON_AddBoolToObject(cJSON* object, const char* name, bool value) {
+    auto item = cJSON_CreateBool(value);
+    cJSON_AddItemToObject(object, name, item);
+    return item;
+}
+
+cJSON* cJSON_GetObjectItem(const cJSON* object, const char* name) {
+    for (auto item = object != nullptr ? object->child : nullptr; item != nullptr; item = item->next) {
+        if (item->string != nullptr && strcmp(item->string, name) == 0) {
+            return item;
+        }
+    }
+    return nullptr;
+}
+
+int cJSON_GetArraySize(const cJSON* array) {
+    int size = 0;
+    for (auto item = array != nullptr ? array->child : nullptr; item != nullptr; item = item->next) {
+        size++;
+    }
+    return size;
+}
+
+bool cJSON_IsString(const cJSON* item) { return item != nullptr && item->type == cJSON_String; }
+bool cJSON_IsNumber(const cJSON* item) { return item != nullptr && item->type == cJSON_Number; }
+bool cJSON_IsBool(const cJSON* item) { return item != nullptr && (item->type == cJSON_True || item->type == cJSON_False); }
+bool cJSON_IsTrue(const cJSON* item) { return item != nullptr && item->type == cJSON_True; }
+bool cJSON_IsFalse(const cJSON* item) { return item != nullptr && item->type == cJSON_False; }
+bool cJSON_IsNull(const cJSON* item) { return item != nullptr && item->type == cJSON_NULL; }
+bool cJSON_IsObject(const cJSON* item) { return item != nullptr && item->type == cJSON_Object; }
+bool cJSON_IsArray(const cJSON* item) { return item != nullptr && item->type == cJSON_Array; }
+
+// Same nesting limit as CJSON_NESTING_LIMIT
+#define PARSE_NESTING_LIMIT 1000
+
+struct ParseBuffer {
+    const char* content;
+    size_t length;
+    size_t offset;
+    int depth;
+
+    bool Has(size_t count) const { return offset + count <= length; }
+    char Peek() const { return offset < length ? content[offset] : 0; }
+    void SkipWhitespace() {
+        while (offset < length && (unsigned char)content[offset] <= 32) {
+            offset++;
+        }
+    }
+};
+
+static bool ParseValue(cJSON* item, ParseBuffer& buffer);
+
+static int HexValue(char c) {
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
+
+static bool ParseHex4(ParseBuffer& buffer, unsigned& value) {
+    if (!buffer.Has(4)) {
+        return false;
+    }
+    value = 0;
+    for (int i = 0; i < 4; i++) {
+        int digit = HexValue(buffer.content[buffer.offset + i]);
+        if (digit < 0) {
+            return false;
+        }
+        value = (value << 4) | digit;
+    }
+    buffer.offset += 4;
+    return true;
+}
+
+static void AppendUtf8(unsigned code, std::string& out) {
+    if (code < 0x80) {
+        out += (char)code;
+    } else if (code < 0x800) {
+        out += (char)(0xc0 | (code >> 6));
+        out += (char)(0x80 | (code & 0x3f));
+    } else if (code < 0x10000) {
+        out += (char)(0xe0 | (code >> 12));
+        out += (char)(0x80 | ((code >> 6) & 0x3f));
+        out += (char)(0x80 | (code & 0x3f));
+    } else {
+        out += (char)(0xf0 | (code >> 18));
+        out += (char)(0x80 | ((code >> 12) & 0x3f));
+        out += (char)(0x80 | ((code >> 6) & 0x3f));
+        out += (char)(0x80 | (code & 0x3f));
+    }
+}
+
+// Returns a heap copy of the unescaped string, the buffer is past the closing quote
+static char* ParseString(ParseBuffer& buffer) {
+    if (buffer.Peek() != '"') {
+        return nullptr;
+    }
+    buffer.offset++;
+    std::string out;
+    while (true) {
+        if (!buffer.Has(1)) {
+            return nullptr;
+        }
+        char c = buffer.content[buffer.offset++];
+        if (c == '"') {
+            break;
+        }
+        if (c != '\\') {
+            out += c;
+            continue;
+        }
+        if (!buffer.Has(1)) {
+            return nullptr;
+        }
+        c = buffer.content[buffer.offset++];
+        switch (c) {
+        case 'b': out += '\b'; break;
+        case 'f': out += '\f'; break;
+        case 'n': out += '\n'; break;
+        case 'r': out += '\r'; break;
+        case 't': out += '\t'; break;
+        case '"': case '\\': case '/': out += c; break;
+        case 'u': {
+            unsigned code;
+            if (!ParseHex4(buffer, code) || (code >= 0xdc00 && code <= 0xdfff)) {
+                return nullptr;
+            }
+            if (code >= 0xd800 && code <= 0xdbff) {
+                unsigned low;
+                if (!buffer.Has(2) || buffer.content[buffer.offset] != '\\' || buffer.content[buffer.offset + 1] != 'u') {
+                    return nullptr;
+                }
+                buffer.offset += 2;
+                if (!ParseHex4(buffer, low) || low < 0xdc00 || low > 0xdfff) {
+                    return nullptr;
+                }
+                code = 0x10000 + (((code & 0x3ff) << 10) | (low & 0x3ff));
+            }
+            AppendUtf8(code, out);
+            break;
+        }
+        default:
+            return nullptr;
+        }
+    }
+    return strdup(out.c_str());
+}
+
+static bool ParseNumber(cJSON* item, ParseBuffer& buffer) {
+    char number[64];
+    size_t size = 0;
+    while (buffer.offset + size < buffer.length && size < sizeof(number) - 1 && buffer.content[buffer.offset + size] != 0 &&
+           strchr("0123456789+-eE.", buffer.content[buffer.offset + size]) != nullptr) {
+        number[size] = buffer.content[buffer.offset + size];
+        size++;
+    }
+    number[size] = 0;
+    char* end = nullptr;
+    double value = strtod(number, &end);
+    if (end == number) {
+        return false;
+    }
+    item->type = cJSON_Number;
+    item->valuedouble = value;
+    // Saturated like cJSON
+    item->valueint = value >= 2147483647.0 ? 2147483647 : value <= -2147483648.0 ? (int)-2147483648LL : (int)value;
+    buffer.offset += end - number;
+    return true;
+}
+
+static bool ParseChildren(cJSON* item, ParseBuffer& buffer, bool object) {
+    if (++buffer.depth > PARSE_NESTING_LIMIT) {
+        return false;
+    }
+    char close = object ? '}' : ']';
+    item->type = object ? cJSON_Object : cJSON_Array;
+    buffer.offset++;
+    buffer.SkipWhitespace();
+    if (buffer.Peek() == close) {
+        buffer.offset++;
+        buffer.depth--;
+        return true;
+    }
+    while (true) {
+        auto child = NewItem(0);
+        cJSON_AddItemToArray(item, child);
+        buffer.SkipWhitespace();
+        if (object) {
+            child->string = ParseString(buffer);
+            if (child->string == nullptr) {
+                return false;
+            }
+            buffer.SkipWhitespace();
+            if (buffer.Peek() != ':') {
+                return false;
+            }
+            buffer.offset++;
+        }
+        buffer.SkipWhitespace();
+        if (!ParseValue(child, buffer)) {
+            return false;
+        }
+        buffer.SkipWhitespace();
+        char c = buffer.Peek();
+        buffer.offset++;
+        if (c == close) {
+            break;
+        }
+        if (c != ',') {
+            return false;
+        }
+    }
+    buffer.depth--;
+    return true;
+}
+
+static bool ParseLiteral(ParseBuffer& buffer, const char* literal) {
+    size_t size = strlen(literal);
+    if (!buffer.Has(size) || strncmp(buffer.content + buffer.offset, literal, size) != 0) {
+        return false;
+    }
+    buffer.offset += size;
+    return true;
+}
+
+static bool ParseValue(cJSON* item, ParseBuffer& buffer) {
+    char c = buffer.Peek();
+    if (c == '"') {
+        item->type = cJSON_String;
+        item->valuestring = ParseString(buffer);
+        return item->valuestring != nullptr;
+    }
+    if (c == '{' || c == '[') {
+        return ParseChildren(item, buffer, c == '{');
+    }
+    if (c == '-' || (c >= '0' && c <= '9')) {
+        return ParseNumber(item, buffer);
+    }
+    if (ParseLiteral(buffer, "null")) {
+        item->type = cJSON_NULL;
+        return true;
+    }
+    if (ParseLiteral(buffer, "true")) {
+        item->type = cJSON_True;
+        item->valueint = 1;
+        return true;
+    }
+    if (ParseLiteral(buffer, "false")) {
+        item->type = cJSON_False;
+        return true;
+    }
+    return false;
+}
+
+// Like cJSON_ParseWithLengthOpts without require_null_terminated: data after the value is ignored
+cJSON* cJSON_ParseWithLength(const char* value, size_t length) {
+    if (value == nullptr || length == 0) {
+        return nullptr;
+    }
+    ParseBuffer buffer = {value, length, 0, 0};
+    buffer.SkipWhitespace();
+    auto item = NewItem(0);
+    if (!ParseValue(item, buffer)) {
+        cJSON_Delete(item);
+        return nullptr;
+    }
+    return item;
+}
+
+cJSON* cJSON_Parse(const char* value) {
+    return value != nullptr ? cJSON_ParseWithLength(value, strlen(value)) : nullptr;
+}
+
+static void PrintString(const char* string, std::string& out) {
+    out += '"';
+    for (auto p = (const unsigned char*)string; *p != 0; p++) {
+        switch (*p) {
+        case '"': out += "\\\""; break;
+        case '\\': out += "\\\\"; break;
+        case '\n': out += "\\n"; break;
+        case '\r': out += "\\r"; break;
+        case '\t': out += "\\t"; break;
+        default:
+            if (*p < 0x20) {
+                char escaped[8];
+                snprintf(escaped, sizeof(escaped), "\\u%04x", *p);
+                out += escaped;
+            } else {
+                out += (char)*p;
+            }
+        }
+    }
+    out += '"';
+}
+
+static void PrintItem(const cJSON* item, std::string& out) {
+    switch (item->type) {
+    case cJSON_False: out += "false"; break;
+    case cJSON_True: out += "true"; break;
+    case cJSON_NULL: out += "null"; break;
+    case cJSON_String: PrintString(item->valuestring, out); break;
+    case cJSON_Number: {
+        // Same choice as cJSON: integers print without a fraction, the rest with up to 15 digits
+        char number[32];
+        double value = item->valuedouble;
+        if (std::floor(value) == value && std::fabs(value) < 1e15) {
+            snprintf(number, sizeof(number), "%.0f", value);
+        } else {
+            snprintf(number, sizeof(number), "%.15g", value);
+        }
+        out += number;
+        break;
+    }
+    case cJSON_Array:
+    case cJSON_Object: {
+        bool object = item->type == cJSON_Object;
+        out += object ? '{' : '[';
+        for (auto child = item->child; child != nullptr; child = child->next) {
+            if (child != item->child) {
+                out += ',';
+            }
+            if (object) {
+                PrintString(child->string, out);
+                out += ':';
+            }
+            PrintItem(child, out);
+        }
+        out += object ? '}' : ']';
+        break;
+    }
+    }
+}
+
+char* cJSON_PrintUnformatted(const cJSON* item) {
+    std::string out;
+    PrintItem(item, out);
+    return strdup(out.c_str());
+}
+
+void cJSON_free(void* pointer) { free(pointer); }
+
+void cJSON_Delete(cJSON* item) {
+    while (item != nullptr) {
+        auto next = item->next;
+        cJSON_Delete(item->child);
+        free(item->valuestring);
+        free(item->string);
+        free(item);
+        item = next;
+    }
+}
@@ -0,0 +1,56 @@
+#ifndef HOST_CJSON_H
+#define HOST_CJSON_H
+
+#include <cstddef>
+
+/*
+ * The part of the cJSON API the host tools reach through main/, enough to build, print and parse
+ * documents. It keeps the real field and function names so the sources compile unchanged. The parser
+ * allocates like cJSON, one node per value and a heap copy of every key and string.
+ */
+#define cJSON_False  (1 << 0)
+#define cJSON_True   (1 << 1)
+#define cJSON_NULL   (1 << 2)
+#define cJSON_Number (1 << 3)
+#define cJSON_String (1 << 4)
+#define cJSON_Array  (1 << 5)
+#define cJSON_Object (1 << 6)
+
+struct cJSON {
+    cJSON* next;
+    cJSON* prev;
+    cJSON* child;
+    int type;
+    char* valuestring;
+    int valueint;
+    double valuedouble;
+    char* string;
+};
+
+cJSON* cJSON_CreateObject();
+cJSON* cJSON_CreateArray();
+cJSON* cJSON_CreateString(const char* string);
+cJSON* cJSON_CreateNumber(double number);
+cJSON* cJSON_CreateBool(bool value);
+void cJSON_AddItemToArray(cJSON* array, cJSON* item);
+void cJSON_AddItemToObject(cJSON* object, const char* name, cJSON* item);
+cJSON* cJSON_AddStringToObject(cJSON* object, const char* name, const char* string);
+cJSON* cJSON_AddNumberToObject(cJSON* object, const char* name, double number);
+cJSON* cJSON_AddBoolToObject(cJSON* object, const char* name, bool value);
+cJSON* cJSON_Parse(const char* value);
+cJSON* cJSON_ParseWithLength(const char* value, size_t length);
+cJSON* cJSON_GetObjectItem(const cJSON* object, const char* name);
+int cJSON_GetArraySize(const cJSON* array);
+bool cJSON_IsString(const cJSON* item);
+bool cJSON_IsNumber(const cJSON* item);
+bool cJSON_IsBool(const cJSON* item);
+bool cJSON_IsTrue(const cJSON* item);
+bool cJSON_IsFalse(const cJSON* item);
+bool cJSON_IsNull(const cJSON* item);
+bool cJSON_IsObject(const cJSON* item);
+bool cJSON_IsArray(const cJSON* item);
+char* cJSON_PrintUnformatted(const cJSON* item);
+void cJSON_free(void* pointer);
+void cJSON_Delete(cJSON* item);
+
+#endif
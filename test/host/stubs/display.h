@@ -0,0 +1,10 @@
+#ifndef HOST_DISPLAY_H
+#define HOST_DISPLAY_H
+
+class Display {
+public:
+    virtual ~Display() = default;
+    virtual void SetChatMessage(const char* role, const char* content) {}
+};
+
+#endif
@@ -0,0 +1,154 @@
+#ifndef HOST_ESP_TIMER_H
+#define HOST_ESP_TIMER_H
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+inline int64_t esp_timer_get_time() {
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+#ifndef ESP_OK
+typedef int esp_err_t;
+#define ESP_OK 0
+#define ESP_FAIL -1
+#endif
+
+typedef void (*esp_timer_cb_t)(void* arg);
+
+typedef enum {
+    ESP_TIMER_TASK,
+    ESP_TIMER_ISR,
+} esp_timer_dispatch_t;
+
+typedef struct {
+    esp_timer_cb_t callback;
+    void* arg;
+    esp_timer_dispatch_t dispatch_method;
+    const char* name;
+    bool skip_unhandled_events;
+} esp_timer_create_args_t;
+
+struct esp_timer {
+    esp_timer_create_args_t args;
+    int64_t due_us = -1; // -1 while stopped
+    int64_t period_us = 0;
+};
+typedef esp_timer* esp_timer_handle_t;
+
+/*
+ * All timers fire on one thread, like the esp_timer task. The thread lives as long as the process
+ * and is never joined.
+ */
+class HostTimerService {
+public:
+    static HostTimerService& GetInstance() {
+        static HostTimerService* instance = new HostTimerService();
+        return *instance;
+    }
+
+    void Add(esp_timer_handle_t timer) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        timers_.push_back(timer);
+    }
+
+    // Waits for a callback of the timer that is running on another thread
+    void Remove(esp_timer_handle_t timer) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        timers_.erase(std::remove(timers_.begin(), timers_.end(), timer), timers_.end());
+        if (std::this_thread::get_id() != thread_id_) {
+            cv_.wait(lock, [this, timer]() { return running_ != timer; });
+        }
+    }
+
+    void Start(esp_timer_handle_t timer, uint64_t timeout_us, bool periodic) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        timer->due_us = esp_timer_get_time() + timeout_us;
+        timer->period_us = periodic ? timeout_us : 0;
+        cv_.notify_all();
+    }
+
+    bool Stop(esp_timer_handle_t timer) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        bool running = timer->due_us >= 0;
+        timer->due_us = -1;
+        return running;
+    }
+
+private:
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    std::vector<esp_timer_handle_t> timers_;
+    esp_timer_handle_t running_ = nullptr;
+    std::thread::id thread_id_;
+
+    HostTimerService() {
+        std::thread thread([this]() { Run(); });
+        thread_id_ = thread.get_id();
+        thread.detach();
+    }
+
+    void Run() {
+        std::unique_lock<std::mutex> lock(mutex_);
+        while (true) {
+            esp_timer_handle_t next = nullptr;
+            for (auto timer : timers_) {
+                if (timer->due_us >= 0 && (next == nullptr || timer->due_us < next->due_us)) {
+                    next = timer;
+                }
+            }
+            if (next == nullptr) {
+                cv_.wait(lock);
+                continue;
+            }
+            int64_t wait_us = next->due_us - esp_timer_get_time();
+            if (wait_us > 0) {
+                cv_.wait_for(lock, std::chrono::microseconds(wait_us));
+                continue;
+            }
+            next->due_us = next->period_us > 0 ? next->due_us + next->period_us : -1;
+            running_ = next;
+            lock.unlock();
+            next->args.callback(next->args.arg);
+            lock.lock();
+            running_ = nullptr;
+            cv_.notify_all();
+        }
+    }
+};
+
+inline esp_err_t esp_timer_create(const esp_timer_create_args_t* args, esp_timer_handle_t* handle) {
+    auto timer = new esp_timer();
+    timer->args = *args;
+    HostTimerService::GetInstance().Add(timer);
+    *handle = timer;
+    return ESP_OK;
+}
+
+inline esp_err_t esp_timer_start_once(esp_timer_handle_t timer, uint64_t timeout_us) {
+    HostTimerService::GetInstance().Start(timer, timeout_us, false);
+    return ESP_OK;
+}
+
+inline esp_err_t esp_timer_start_periodic(esp_timer_handle_t timer, uint64_t period_us) {
+    HostTimerService::GetInstance().Start(timer, period_us, true);
+    return ESP_OK;
+}
+
+inline esp_err_t esp_timer_stop(esp_timer_handle_t timer) {
+    return HostTimerService::GetInstance().Stop(timer) ? ESP_OK : ESP_FAIL;
+}
+
+inline esp_err_t esp_timer_delete(esp_timer_handle_t timer) {
+    HostTimerService::GetInstance().Remove(timer);
+    delete timer;
+    return ESP_OK;
+}
+
+#endif
@@ -0,0 +1,22 @@
+#ifndef HOST_FREERTOS_TASK_H
+#define HOST_FREERTOS_TASK_H
+
+#include "FreeRTOS.h"
+
+typedef void (*TaskFunction_t)(void*);
+typedef void* TaskHandle_t;
+
+// Every task is a detached thread, its function ends with vTaskDelete(NULL) and returns
+inline BaseType_t xTaskCreate(TaskFunction_t function, const char* name, uint32_t stack_size, void* arg,
+                              int priority, TaskHandle_t* handle) {
+    std::thread([function, arg]() { function(arg); }).detach();
+    if (handle != nullptr) {
+        *handle = nullptr;
+    }
+    return pdPASS;
+}
+
+inline void vTaskDelete(TaskHandle_t task) {
+}
+
+#endif
@@ -0,0 +1,31 @@
+#ifndef HOST_MBEDTLS_BASE64_H
+#define HOST_MBEDTLS_BASE64_H
+
+#include <cstddef>
+
+#define MBEDTLS_ERR_BASE64_BUFFER_TOO_SMALL -0x002A
+
+// Same contract as mbedTLS: with a short buffer only olen is set, to the size needed with the NUL
+inline int mbedtls_base64_encode(unsigned char* dst, size_t dlen, size_t* olen, const unsigned char* src, size_t slen) {
+    static const char kAlphabet[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+    size_t needed = (slen + 2) / 3 * 4;
+    if (dst == nullptr || dlen < needed + 1) {
+        *olen = needed + 1;
+        return MBEDTLS_ERR_BASE64_BUFFER_TOO_SMALL;
+    }
+    size_t out = 0;
+    for (size_t i = 0; i < slen; i += 3) {
+        unsigned int value = src[i] << 16;
+        if (i + 1 < slen) value |= src[i + 1] << 8;
+        if (i + 2 < slen) value |= src[i + 2];
+        dst[out++] = kAlphabet[(value >> 18) & 0x3F];
+        dst[out++] = kAlphabet[(value >> 12) & 0x3F];
+        dst[out++] = i + 1 < slen ? kAlphabet[(value >> 6) & 0x3F] : '=';
+        dst[out++] = i + 2 < slen ? kAlphabet[value & 0x3F] : '=';
+    }
+    dst[out] = 0;
+    *olen = out;
+    return 0;
+}
+
+#endif
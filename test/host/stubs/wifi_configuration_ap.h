@@ -0,0 +1,12 @@
+#ifndef HOST_WIFI_CONFIGURATION_AP_H
+#define HOST_WIFI_CONFIGURATION_AP_H
+
+#include <string>
+
+class WifiConfigurationAp {
+public:
+    bool ConnectToWifi(const std::string& ssid, const std::string& password) { return false; }
+    void Save(const std::string& ssid, const std::string& password) {}
+};
+
+#endif
@@ -0,0 +1,161 @@
+/*
+ * Precision and recall of the fixed-point VAD of NoAudioProcessor on a labeled corpus. Every
+ * recording is generated from known segments, so each 20 ms window has a label, and the VAD state
+ * after the window is compared with it.
+ *
+ * Two kinds of recordings, at three speech levels over two noise floors:
+ *   turns      2-6 words of 200-600 ms with pauses of 80-300 ms, between 1-2 s of silence
+ *   monologue  8-20 s of connected speech, phrases of 1.5-4 s with pauses of 150-400 ms between
+ *              them, the case where a noise floor that keeps rising during speech eats into the margin
+ * The onset and the hangover are part of the VAD design, so the first onset_ms of every speech
+ * segment and the hangover_ms after it are not scored.
+ *
+ * One JSON object per kind and level is printed to stdout. The exit status is non-zero when the
+ * recall or precision of a condition above the noise floor falls below 0.9.
+ */
+#include <cstdio>
+#include <vector>
+
+#include "host_corpus.h"
+#include "fixed_point_vad.h"
+
+namespace {
+
+const int kRecordingsPerCondition = 20;
+
+enum Label {
+    kLabelSilence,
+    kLabelSpeech,
+    kLabelIgnored,
+};
+
+struct Recording {
+    std::vector<int16_t> pcm;
+    std::vector<Label> labels; // one per VAD window
+};
+
+std::vector<CorpusSegment> MakeSegments(bool monologue, HostRandom& random) {
+    std::vector<CorpusSegment> segments = {{false, 1000 + (int)(random.Next() % 1000)}};
+    if (monologue) {
+        // Connected speech: phrases voiced without a break, the pauses only between them
+        int target_ms = 8000 + random.Next() % 12000;
+        for (int speech_ms = 0; speech_ms < target_ms;) {
+            if (speech_ms > 0) {
+                segments.push_back({false, 150 + (int)(random.Next() % 250)});
+            }
+            int phrase_ms = 1500 + (int)(random.Next() % 2500);
+            segments.push_back({true, phrase_ms});
+            speech_ms += phrase_ms;
+        }
+    } else {
+        int words = 2 + random.Next() % 5;
+        for (int i = 0; i < words; i++) {
+            if (i > 0) {
+                segments.push_back({false, 80 + (int)(random.Next() % 220)});
+            }
+            segments.push_back({true, 200 + (int)(random.Next() % 400)});
+        }
+    }
+    segments.push_back({false, 1000 + (int)(random.Next() % 1000)});
+    return segments;
+}
+
+Recording MakeRecording(bool monologue, uint32_t seed, float speech_level, float noise_level,
+                        const FixedPointVadConfig& config) {
+    HostRandom random(seed);
+    auto segments = MakeSegments(monologue, random);
+
+    Recording recording;
+    recording.pcm = RenderCorpus(segments, seed * 7919, speech_level, noise_level);
+    std::vector<Label> samples;
+    samples.reserve(recording.pcm.size());
+    for (size_t i = 0; i < segments.size(); i++) {
+        size_t count = (size_t)segments[i].ms * 16;
+        size_t start = samples.size();
+        samples.insert(samples.end(), count, segments[i].speech ? kLabelSpeech : kLabelSilence);
+        if (segments[i].speech) {
+            size_t onset = std::min(count, (size_t)config.onset_ms * 16);
+            std::fill(samples.begin() + start, samples.begin() + start + onset, kLabelIgnored);
+        } else if (i > 0 && segments[i - 1].speech) {
+            // A pause shorter than the hangover stays speech for the VAD, and so does not count
+            size_t hangover = std::min(count, (size_t)config.hangover_ms * 16);
+            std::fill(samples.begin() + start, samples.begin() + start + hangover, kLabelIgnored);
+        }
+    }
+    for (size_t offset = 0; offset + VAD_WINDOW_SAMPLES <= samples.size(); offset += VAD_WINDOW_SAMPLES) {
+        int speech = 0;
+        int ignored = 0;
+        for (size_t i = offset; i < offset + VAD_WINDOW_SAMPLES; i++) {
+            speech += samples[i] == kLabelSpeech;
+            ignored += samples[i] == kLabelIgnored;
+        }
+        if (ignored > 0) {
+            recording.labels.push_back(kLabelIgnored);
+        } else {
+            recording.labels.push_back(speech * 2 > VAD_WINDOW_SAMPLES ? kLabelSpeech : kLabelSilence);
+        }
+    }
+    return recording;
+}
+
+struct Counts {
+    int true_positive = 0;
+    int false_positive = 0;
+    int false_negative = 0;
+    int true_negative = 0;
+};
+
+void Score(const Recording& recording, const FixedPointVadConfig& config, Counts& counts) {
+    FixedPointVad vad;
+    vad.Configure(config);
+    for (size_t window = 0; window < recording.labels.size(); window++) {
+        vad.Process(recording.pcm.data() + window * VAD_WINDOW_SAMPLES, VAD_WINDOW_SAMPLES);
+        bool speaking = vad.speaking();
+        switch (recording.labels[window]) {
+        case kLabelSpeech:
+            speaking ? counts.true_positive++ : counts.false_negative++;
+            break;
+        case kLabelSilence:
+            speaking ? counts.false_positive++ : counts.true_negative++;
+            break;
+        default:
+            break;
+        }
+    }
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    FixedPointVadConfig config;
+    config.hangover_ms = 300; // CONFIG_NO_AUDIO_PROCESSOR_VAD_HANGOVER_MS
+
+    int failures = 0;
+    for (bool monologue : {false, true}) {
+        for (float noise_level : {0.003f, 0.01f}) {
+            for (float speech_level : {0.3f, 0.1f, 0.03f}) {
+                Counts counts;
+                for (int i = 0; i < kRecordingsPerCondition; i++) {
+                    uint32_t seed = 2000 + i * 31 + (monologue ? 7 : 0);
+                    Score(MakeRecording(monologue, seed, speech_level, noise_level, config), config, counts);
+                }
+                double recall = (double)counts.true_positive / std::max(1, counts.true_positive + counts.false_negative);
+                double precision = (double)counts.true_positive / std::max(1, counts.true_positive + counts.false_positive);
+                // The speech level over the noise, both uniform white noise is 4.8 dB below its peak
+                double snr_db = 20 * std::log10(speech_level / noise_level);
+                printf("{\"kind\":\"%s\",\"speech_level\":%.2f,\"noise_level\":%.3f,\"snr_db\":%.0f,"
+                       "\"speech_windows\":%d,\"silence_windows\":%d,\"recall\":%.3f,\"precision\":%.3f}\n",
+                    monologue ? "monologue" : "turns", speech_level, noise_level, snr_db,
+                    counts.true_positive + counts.false_negative, counts.false_positive + counts.true_negative,
+                    recall, precision);
+
+                if (recall < 0.9 || precision < 0.9) {
+                    fprintf(stderr, "%s at %.0f dB: recall %.3f, precision %.3f\n",
+                        monologue ? "monologue" : "turns", snr_db, recall, precision);
+                    failures++;
+                }
+            }
+        }
+    }
+    return failures == 0 ? 0 : 1;
+}